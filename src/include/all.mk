@@ -20,6 +20,7 @@ HEADERS	= \
 	conf.h \
 	conffile.h \
 	detail.h \
+	epoch.h \
 	event.h \
 	hash.h \
 	heap.h \
@@ -39,6 +40,7 @@ HEADERS	= \
 	token.h \
 	udpfromto.h \
 	base64.h \
+	escape.h \
 	map.h \
 	udp.h \
 	tcp.h \
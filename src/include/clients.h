@@ -41,6 +41,8 @@ typedef struct radclient {
 	char const		*shortname;		//!< Client nickname.
 
 	char const		*secret;		//!< Secret PSK.
+	fr_hmac_md5_key_t	*secret_hmac;		//!< Precomputed HMAC-MD5 key for secret, used to
+							//!< sign and verify Message-Authenticator.
 
 	bool			message_authenticator;	//!< Require RADIUS message authenticator in requests.
 
@@ -34,6 +34,7 @@ extern "C" {
 #endif
 
 typedef struct fr_connection_pool_t fr_connection_pool_t;
+typedef struct fr_connection_thread_cache fr_connection_thread_cache_t;
 
 typedef struct fr_connection_pool_state {
 	uint32_t	pending;		//!< Number of pending open connections.
@@ -63,6 +64,9 @@ typedef struct fr_connection_pool_state {
 	uint32_t       	num;			//!< Number of connections in the pool.
 	uint32_t	active;	 		//!< Number of currently reserved connections.
 
+	uint64_t	cache_hits;		//!< Reservations satisfied from a thread's local cache.
+	uint64_t	cache_misses;		//!< Reservations which had to go to the pool.
+
 	bool		reconnecting;		//!< We are currently reconnecting the pool.
 } fr_connection_pool_state_t;
 
@@ -157,6 +161,13 @@ int	fr_connection_pool_reconnect(fr_connection_pool_t *pool, REQUEST *request);
 
 void	fr_connection_pool_free(fr_connection_pool_t *pool);
 
+/*
+ *	Per-thread caches of idle connections
+ */
+fr_connection_thread_cache_t *fr_connection_pool_thread_instantiate(fr_connection_pool_t *pool);
+
+void	fr_connection_pool_thread_detach(fr_connection_thread_cache_t *cache);
+
 /*
  *	Connection lifecycle
  */
@@ -0,0 +1,89 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_CRYPTO_OFFLOAD_H
+#define _FR_CRYPTO_OFFLOAD_H
+/**
+ * $Id$
+ *
+ * @file include/crypto_offload.h
+ * @brief Run expensive password hashing in a dedicated thread pool.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(crypto_offload_h, "$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_crypto_offload fr_crypto_offload_t;
+typedef struct fr_crypto_offload_thread fr_crypto_offload_thread_t;
+typedef struct fr_crypto_offload_job fr_crypto_offload_job_t;
+
+/** Hashing function run by one of the crypto threads
+ *
+ * Must not allocate memory from, or modify, any talloc ctx other than uctx,
+ * as it runs concurrently with the worker that submitted it.
+ *
+ * @param[in] uctx	Data for the job, allocated in the job's ctx.
+ * @return a result, retrieved by the worker with #fr_crypto_offload_job_result.
+ */
+typedef int (*fr_crypto_offload_func_t)(void *uctx);
+
+/** Crypto thread pool configuration
+ *
+ */
+typedef struct {
+	uint32_t	threads;		//!< Number of crypto threads.  0 disables offloading.
+	uint32_t	max_queued;		//!< Maximum number of jobs waiting for a thread.
+} fr_crypto_offload_config_t;
+
+/** Counters and gauges for a crypto thread pool
+ *
+ */
+typedef struct {
+	uint32_t	queued;			//!< Jobs currently waiting for a thread.
+	uint32_t	queued_max;		//!< Most jobs ever waiting at once.
+	uint32_t	running;		//!< Jobs currently being run.
+	uint64_t	submitted;		//!< Jobs accepted by the pool.
+	uint64_t	completed;		//!< Jobs which have finished.
+	uint64_t	rejected;		//!< Jobs refused because the queue was full.
+	uint64_t	wait_usec;		//!< Total time completed jobs spent queued.
+	uint64_t	run_usec;		//!< Total time spent running jobs.
+} fr_crypto_offload_stats_t;
+
+fr_crypto_offload_t		*fr_crypto_offload_create(TALLOC_CTX *ctx, char const *name,
+							  fr_crypto_offload_config_t const *config);
+
+void				fr_crypto_offload_stats(fr_crypto_offload_t *co, fr_crypto_offload_stats_t *stats);
+
+fr_crypto_offload_thread_t	*fr_crypto_offload_thread_create(TALLOC_CTX *ctx, fr_crypto_offload_t *co,
+								 fr_event_list_t *el);
+
+fr_crypto_offload_job_t		*fr_crypto_offload_job_alloc(fr_crypto_offload_thread_t *cot,
+							     fr_crypto_offload_func_t func);
+
+int				fr_crypto_offload_job_submit(fr_crypto_offload_job_t *job, REQUEST *request,
+							     void *uctx);
+
+int				fr_crypto_offload_job_result(fr_crypto_offload_job_t const *job);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_CRYPTO_OFFLOAD_H */
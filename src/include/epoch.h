@@ -0,0 +1,47 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_EPOCH_H
+#define _FR_EPOCH_H
+/**
+ * $Id$
+ *
+ * @file include/epoch.h
+ * @brief Grace periods for data which is read without locks, and replaced by a single writer.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(epoch_h, "$Id$")
+
+#include <talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_epoch fr_epoch_t;
+
+fr_epoch_t	*fr_epoch_alloc(TALLOC_CTX *ctx);
+
+unsigned int	fr_epoch_enter(fr_epoch_t *e);
+
+void		fr_epoch_exit(fr_epoch_t *e, unsigned int ref);
+
+void		fr_epoch_synchronize(fr_epoch_t *e);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_EPOCH_H */
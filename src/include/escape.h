@@ -0,0 +1,90 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_ESCAPE_H
+#define _FR_ESCAPE_H
+/**
+ * $Id$
+ *
+ * @file include/escape.h
+ * @brief Table driven escaping of strings for SQL, LDAP, URIs etc.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(escape_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @name Actions for each byte of the input
+ *
+ * Any other value is written out after a backslash, e.g. an action
+ * of 'n' for 0x0a produces "\n".
+ *
+ * @{
+ */
+#define FR_ESCAPE_COPY		(0)	//!< Copy the byte verbatim.
+#define FR_ESCAPE_HEX		(1)	//!< Write the prefix, then the byte as two hex digits.
+#define FR_ESCAPE_UTF8		(2)	//!< Copy a multi-byte UTF-8 character verbatim,
+					//!< otherwise as #FR_ESCAPE_HEX.
+/* @} **/
+
+/** @name Flags for #fr_escape_init
+ *
+ * @{
+ */
+#define FR_ESCAPE_FLAG_SPECIALS	(1 << 0)	//!< chars lists the bytes to escape, rather than
+						//!< the bytes to copy.
+#define FR_ESCAPE_FLAG_UTF8	(1 << 1)	//!< Copy multi-byte UTF-8 characters verbatim.
+#define FR_ESCAPE_FLAG_LOWER	(1 << 2)	//!< Use lower case hex digits.
+/* @} **/
+
+/** How to escape each possible byte of a string
+ *
+ * Built once, usually when a module is instantiated, then used for every
+ * string the module escapes.
+ *
+ * May also be initialised statically, with just the action table.  Such
+ * tables don't get the vector classification masks, so are only worth
+ * using for short strings.
+ */
+typedef struct fr_escape_t {
+	uint8_t		action[256];	//!< What to do with each byte.
+	char		prefix;		//!< Written before #FR_ESCAPE_HEX sequences.
+	char const	*hextab;	//!< Upper or lower case hex digits.
+
+	bool		classify;	//!< Whether the masks below are valid.
+	uint8_t		mask[16];	//!< Bit n of mask[i] is set if byte (n << 4) | i
+					//!< is copied.  Bytes >= 0x80 are never marked as
+					//!< copied here, even if they are in action.
+} fr_escape_t;
+
+void		fr_escape_init(fr_escape_t *esc, char const *chars, char prefix, unsigned int flags);
+
+fr_escape_t	*fr_escape_alloc(TALLOC_CTX *ctx, char const *chars, char prefix, unsigned int flags);
+
+void		fr_escape_set(fr_escape_t *esc, uint8_t c, uint8_t action);
+
+size_t		fr_escape(fr_escape_t const *esc, char *out, size_t outlen, char const *in, ssize_t inlen);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_ESCAPE_H */
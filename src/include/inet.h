@@ -109,6 +109,8 @@ int	fr_inet_pton_port(fr_ipaddr_t *out, uint16_t *port_out, char const *value,
 
 char	*fr_inet_ntop(char out[FR_IPADDR_STRLEN], size_t outlen, fr_ipaddr_t const *addr);
 
+size_t	fr_inet_ntop4(char out[INET_ADDRSTRLEN], struct in_addr const *addr);
+
 char	*fr_inet_ntop_prefix(char out[FR_IPADDR_PREFIX_STRLEN], size_t outlen, fr_ipaddr_t const *addr);
 
 char	*fr_inet_ifid_ntop(char *out, size_t outlen, uint8_t const *ifid);
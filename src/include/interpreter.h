@@ -131,8 +131,26 @@ typedef struct {
 	vp_map_t		*map;		//!< #UNLANG_TYPE_UPDATE, #UNLANG_TYPE_MAP.
 	vp_tmpl_t		*vpt;		//!< #UNLANG_TYPE_SWITCH, #UNLANG_TYPE_MAP.
 	fr_cond_t		*cond;		//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.
+	unlang_t		*chain_end;	//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.  The last "elsif" or
+						//!< "else" of the chain, resolved by the compiler.  Once a
+						//!< branch is taken, the interpreter continues after it.
+#if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+	regex_t			*regex_set;	//!< #UNLANG_TYPE_IF.  The patterns of the leading "if" and
+						//!< "elsif" statements which match against the same
+						//!< attribute, combined into one expression.  If it
+						//!< doesn't match, none of them can.
+	unlang_t		*regex_set_end;	//!< #UNLANG_TYPE_IF.  The last statement covered by regex_set.
+#endif
+
+	unlang_t		**cases;	//!< #UNLANG_TYPE_SWITCH.  The 'case' statements sorted by
+						//!< value, followed by the default 'case' (or NULL).  Only
+						//!< set when every 'case' is a literal of the attribute's type.
+	int			num_cases;	//!< #UNLANG_TYPE_SWITCH, number of sorted 'case' statements.
 
 	map_proc_inst_t		*proc_inst;	//!< Instantiation data for #UNLANG_TYPE_MAP.
+	uint32_t		quorum;		//!< #UNLANG_TYPE_PARALLEL, number of children which must
+						//!< succeed.  0 means wait for all the children.
+	uint32_t		latency_id;	//!< Histogram for a compiled section.  0 for other groups.
 	bool			done_pass2;
 } unlang_group_t;
 
@@ -143,6 +161,7 @@ typedef struct {
 	unlang_t		self;
 	module_instance_t	*module_instance;	//!< Instance of the module we're calling.
 	module_method_t		method;
+	uint32_t		latency_id;		//!< Histogram for this module and component.
 } unlang_module_call_t;
 
 /** Pushed onto the interpreter stack by a yielding module, indicates the resumption point
@@ -170,6 +189,8 @@ typedef struct {
 						//!< be called when the request is poked via an action
 	void const		*ctx;		//!< Context data for the callback.  Usually represents
 						//!< the module's internal state at the time of yielding.
+	uint64_t		running;	//!< Time spent in the module so far, not counting
+						//!< the time spent waiting to be resumed.
 } unlang_resumption_t;
 
 /** A naked xlat
@@ -207,6 +228,16 @@ typedef struct {
 	unlang_t		*found;
 } unlang_stack_entry_redundant_t;
 
+typedef struct unlang_parallel unlang_parallel_t;
+typedef struct unlang_parallel_child unlang_parallel_child_t;
+
+/** State of a parallel section
+ *
+ */
+typedef struct {
+	unlang_parallel_t	*state;		//!< Children, and the result so far.
+} unlang_stack_entry_parallel_t;
+
 /** Our interpreter stack, as distinct from the C stack
  *
  * We don't call the modules recursively.  Instead we iterate over a list of unlang_t and
@@ -230,10 +261,15 @@ typedef struct {
 	bool			top_frame;
 	unlang_t		*instruction;
 
+	uint32_t		latency_id;	//!< Histogram of the section started by a top frame.
+	uint64_t		latency_running;	//!< Time spent running the section so far, not
+						//!< counting the time spent yielded.
+
 	union {
 		unlang_stack_entry_modcall_t	modcall;
 		unlang_stack_entry_foreach_t	foreach;
 		unlang_stack_entry_redundant_t	redundant;
+		unlang_stack_entry_parallel_t	parallel;
 	};
 } unlang_stack_frame_t;
 
@@ -242,6 +278,8 @@ typedef struct {
  */
 typedef struct {
 	int			depth;		//!< Current depth we're executing at.
+	unlang_parallel_child_t	*parallel;	//!< The child of a parallel section this stack runs,
+						//!< if any.
 	unlang_stack_frame_t	frame[UNLANG_STACK_MAX];	//!< The stack...
 } unlang_stack_t;
 
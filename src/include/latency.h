@@ -0,0 +1,124 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_LATENCY_H
+#define _FR_LATENCY_H
+/**
+ * $Id$
+ *
+ * @file include/latency.h
+ * @brief Latency histograms for module calls and sections.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(latency_h, "$Id$")
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	Buckets are log-linear.  Each power of two is divided into
+ *	FR_LATENCY_SUB buckets, so any value is within 25% of the
+ *	bucket it's counted in.  Values of 2^FR_LATENCY_MAX_BITS ns
+ *	(about 18 minutes) and over are counted in the last bucket.
+ */
+#define FR_LATENCY_SUB_BITS	(2)
+#define FR_LATENCY_SUB		(1 << FR_LATENCY_SUB_BITS)
+#define FR_LATENCY_MAX_BITS	(40)
+#define FR_LATENCY_BUCKETS	(((FR_LATENCY_MAX_BITS - FR_LATENCY_SUB_BITS) + 1) * FR_LATENCY_SUB)
+
+/** A histogram of elapsed times, in nanoseconds
+ *
+ */
+typedef struct fr_latency_t {
+	uint64_t	count;				//!< Number of samples.
+	uint64_t	total;				//!< Sum of all samples.
+	uint64_t	max;				//!< Largest sample.
+	uint64_t	bucket[FR_LATENCY_BUCKETS];	//!< Samples in each bucket.
+} fr_latency_t;
+
+/** Called for each histogram with samples by #fr_latency_walk
+ *
+ * @param[in] ctx	passed to #fr_latency_walk.
+ * @param[in] name	of the histogram.
+ * @param[in] hist	totals from all threads.
+ * @return
+ *	- 0 to continue walking.
+ *	- -1 to stop.
+ */
+typedef int (*fr_latency_walk_t)(void *ctx, char const *name, fr_latency_t const *hist);
+
+/** Return the current time, in nanoseconds, from a monotonic clock
+ *
+ */
+static inline uint64_t fr_latency_now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/** Return the bucket a sample is counted in
+ *
+ */
+static inline unsigned int fr_latency_bucket(uint64_t elapsed)
+{
+	unsigned int bits;
+
+	if (elapsed < FR_LATENCY_SUB) return elapsed;
+
+#ifdef __GNUC__
+	bits = 63 - __builtin_clzll(elapsed);
+#else
+	{
+		uint64_t tmp = elapsed;
+
+		for (bits = 0; tmp > 1; bits++) tmp >>= 1;
+	}
+#endif
+	if (bits >= FR_LATENCY_MAX_BITS) return FR_LATENCY_BUCKETS - 1;
+
+	return ((bits - FR_LATENCY_SUB_BITS + 1) * FR_LATENCY_SUB) +
+		((elapsed >> (bits - FR_LATENCY_SUB_BITS)) & (FR_LATENCY_SUB - 1));
+}
+
+/** Return the smallest sample counted in a bucket
+ *
+ */
+static inline uint64_t fr_latency_bucket_min(unsigned int bucket)
+{
+	unsigned int bits;
+
+	if (bucket < FR_LATENCY_SUB) return bucket;
+
+	bits = (bucket / FR_LATENCY_SUB) + FR_LATENCY_SUB_BITS - 1;
+
+	return ((uint64_t) (FR_LATENCY_SUB + (bucket % FR_LATENCY_SUB))) << (bits - FR_LATENCY_SUB_BITS);
+}
+
+uint32_t	fr_latency_register(char const *fmt, ...) CC_HINT(format (printf, 1, 2));
+void		fr_latency_record(uint32_t id, uint64_t elapsed);
+uint64_t	fr_latency_percentile(fr_latency_t const *hist, unsigned int permille);
+int		fr_latency_walk(fr_latency_walk_t callback, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_LATENCY_H */
@@ -90,6 +90,7 @@ RCSIDH(libradius_h, "$Id$")
  */
 #include <freeradius-devel/sha1.h>
 #include <freeradius-devel/md4.h>
+#include <freeradius-devel/md5.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -226,12 +227,21 @@ ssize_t		fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *sr
 
 int		fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret);
 
+int		fr_radius_verify_keyed(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+				       fr_hmac_md5_key_t const *hkey);
+
+int		fr_radius_verify_batch(int rcode[], RADIUS_PACKET *packets[], RADIUS_PACKET *originals[],
+				       char const *secrets[], unsigned int num);
+
 int		fr_radius_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret);
 
 int		fr_radius_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret);
 
 int		fr_radius_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret);
 
+int		fr_radius_sign_keyed(RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret,
+				     fr_hmac_md5_key_t const *hkey);
+
 int		fr_radius_digest_cmp(uint8_t const *a, uint8_t const *b, size_t length);
 
 RADIUS_PACKET	*fr_radius_alloc(TALLOC_CTX *ctx, bool new_vector);
@@ -362,6 +372,10 @@ int		rad_unlockfd(int fd, int lock_len);
 char		*fr_abin2hex(TALLOC_CTX *ctx, uint8_t const *bin, size_t inlen);
 size_t		fr_bin2hex(char *hex, uint8_t const *bin, size_t inlen);
 size_t		fr_hex2bin(uint8_t *bin, size_t outlen, char const *hex, size_t inlen);
+
+#define FR_UINT_STRLEN	(21)	//!< Longest 64bit integer, plus the \0.
+size_t		fr_uint2dec(char *out, uint64_t num);
+size_t		fr_sint2dec(char *out, int64_t num);
 uint32_t	fr_strtoul(char const *value, char **end);
 bool		is_whitespace(char const *value);
 bool		is_printable(void const *value, size_t len);
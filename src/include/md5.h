@@ -79,6 +79,20 @@ USES_APPLE_DEPRECATED_API
 #endif
 
 /* hmac.c */
+
+/** Precomputed HMAC-MD5 key
+ *
+ * MD5 states after hashing the key XORd with ipad and opad.
+ */
+typedef struct {
+	FR_MD5_CTX	inner;			//!< State after key ^ ipad.
+	FR_MD5_CTX	outer;			//!< State after key ^ opad.
+} fr_hmac_md5_key_t;
+
+void	fr_hmac_md5_key_init(fr_hmac_md5_key_t *hkey, uint8_t const *key, size_t key_len);
+void	fr_hmac_md5_keyed(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
+			  fr_hmac_md5_key_t const *hkey)
+	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
 void	fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
 		    uint8_t const *key, size_t key_len)
 	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
@@ -86,6 +100,24 @@ void	fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t
 /* md5.c */
 void	fr_md5_calc(uint8_t *out, uint8_t const *in, size_t inlen);
 
+/* md5_mb.c */
+#define FR_MD5_MB_LANES_MAX	8		//!< Most messages hashed in parallel (AVX2).
+
+/** A message to hash with #fr_md5_mb_calc
+ *
+ * The digest is calculated over data, followed by suffix.
+ */
+typedef struct {
+	uint8_t const	*data;			//!< Start of the message.
+	size_t		data_len;		//!< Length of data.
+	uint8_t const	*suffix;		//!< Hashed after data, e.g. a shared secret.  May be NULL.
+	size_t		suffix_len;		//!< Length of suffix.
+	uint8_t		*digest;		//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_md5_mb_msg_t;
+
+unsigned int	fr_md5_mb_lanes(void);
+void	fr_md5_mb_calc(fr_md5_mb_msg_t const msgs[], unsigned int num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -58,6 +58,9 @@ typedef struct {
 
 	rlm_rcode_t			code;		//!< Code module will return when 'force' has
 							//!< has been set to true.
+
+	uint32_t			latency_id[MOD_COUNT];	//!< Histograms of calls to each method,
+							//!< allocated as the calls are compiled.
 } module_instance_t;
 
 /** Per thread per instance data
@@ -216,6 +216,10 @@ rlm_rcode_t	unlang_interpret_continue(REQUEST *request);
 
 rlm_rcode_t	unlang_interpret(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t default_action);
 
+int		unlang_interpret_synchronous_init(fr_event_list_t *el);
+
+rlm_rcode_t	unlang_interpret_synchronous(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t default_action);
+
 int		unlang_compile(CONF_SECTION *cs, rlm_components_t component);
 
 /** A callback when the the timeout occurs
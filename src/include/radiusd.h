@@ -279,6 +279,8 @@ struct rad_request {
 
 	void			*stack;		//!< unlang interpreter stack.
 
+	tmpl_memo_t		memo;		//!< Where attributes were found, while evaluating conditions.
+
 	REQUEST			*parent;
 
 #ifdef WITH_PROXY
@@ -433,6 +435,7 @@ void		*request_data_reference(REQUEST *request, void const *unique_ptr, int uniq
 
 int		request_data_by_persistance(request_data_t **out, REQUEST *request, bool persist);
 void		request_data_restore(REQUEST *request, request_data_t *entry);
+void		request_data_reparent(TALLOC_CTX *to, TALLOC_CTX *from, request_data_t *entry);
 
 #ifdef WITH_VERIFY_PTR
 bool		request_data_verify_parent(TALLOC_CTX *parent, request_data_t *entry);
@@ -488,9 +491,9 @@ void	regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value,
 int	regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t num);
 
 /*
- *	Named capture groups only supported by PCRE.
+ *	Named capture groups only supported by PCRE and PCRE2.
  */
-#  ifdef HAVE_PCRE
+#  if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
 int	regex_request_to_sub_named(TALLOC_CTX *ctx, char **out, REQUEST *request, char const *name);
 #  endif
 #endif
@@ -96,6 +96,7 @@ typedef struct home_server {
 	fr_socket_limit_t 	limit;
 
 	char const		*secret;
+	fr_hmac_md5_key_t	*secret_hmac;		//!< Precomputed HMAC-MD5 key for secret.
 
 	fr_event_timer_t		*ev;
 	struct timeval		when;
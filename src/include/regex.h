@@ -29,7 +29,26 @@ RCSIDH(regex_h, "$Id$")
 #  ifdef __cplusplus
 extern "C" {
 #  endif
-#  ifdef HAVE_PCRE
+#  ifdef HAVE_PCRE2
+#    define PCRE2_CODE_UNIT_WIDTH 8
+#    include <pcre2.h>
+/*
+ *  libpcre2 writes its matches to match data we reuse for each
+ *  thread, and we copy the offsets out into an array of these.
+ */
+typedef struct regmatch {
+	PCRE2_SIZE	rm_so;		//!< Start of the match, or PCRE2_UNSET.
+	PCRE2_SIZE	rm_eo;		//!< End of the match, or PCRE2_UNSET.
+} regmatch_t;
+
+typedef struct regex {
+	bool		precompiled;	//!< Whether this regex was precompiled, or compiled for one of evaluation.
+	bool		cached;		//!< Owned by the per-thread cache of dynamic expressions.
+	pcre2_code	*compiled;	//!< Compiled regular expression.
+
+	bool		jitd;		//!< Whether the pattern was JIT compiled.
+} regex_t;
+#  elif defined(HAVE_PCRE)
 #    include <pcre.h>
 /*
  *  Versions older then 8.20 didn't have the JIT functionality
@@ -50,6 +69,7 @@ typedef struct regmatch {
 
 typedef struct regex {
 	bool		precompiled;	//!< Whether this regex was precompiled, or compiled for one of evaluation.
+	bool		cached;		//!< Owned by the per-thread cache of dynamic expressions.
 	pcre		*compiled;	//!< Compiled regular expression.
 
 	bool		jitd;		//!< Whether JIT data is available.
@@ -69,8 +89,20 @@ typedef struct regex {
 #      define REG_NOSUB (0)
 #    endif
 #  endif
+
+/*
+ *  Maximum number of dynamic expressions each thread keeps compiled.
+ */
+#  ifndef REGEX_CACHE_SIZE
+#    define REGEX_CACHE_SIZE	(128)
+#  endif
+
 ssize_t regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
 		      bool ignore_case, bool multiline, bool subcaptures, bool runtime);
+#  if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+ssize_t regex_compile_cached(regex_t **out, char const *pattern, size_t len,
+			     bool ignore_case, bool multiline, bool subcaptures);
+#  endif
 int	regex_exec(regex_t *preg, char const *string, size_t len, regmatch_t pmatch[], size_t *nmatch);
 #  ifdef __cplusplus
 }
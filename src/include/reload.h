@@ -0,0 +1,79 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_RELOAD_H
+#define _FR_RELOAD_H
+/**
+ * $Id$
+ *
+ * @file include/reload.h
+ * @brief Reload data files in the background, without blocking requests.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(reload_h, "$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_reload fr_reload_t;
+
+/** Read a data file, and build the structures used to search it
+ *
+ * Called once by #fr_reload_create, and then by the reload thread, concurrently
+ * with requests using the previous data.  It must not modify anything other than
+ * the new data.
+ *
+ * @param[out] out	The new data.  Will be freed with talloc_free() when it's
+ *			replaced.
+ * @param[out] entries	Number of entries read, for statistics.
+ * @param[in] uctx	passed to #fr_reload_create.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The previous data continues to be used.
+ */
+typedef int (*fr_reload_load_t)(void **out, uint64_t *entries, void *uctx);
+
+/** Counters for a reloadable data set
+ *
+ */
+typedef struct {
+	uint64_t	reloads;		//!< Number of times the data was replaced.
+	uint64_t	failed;			//!< Number of reloads which failed.
+	uint64_t	entries;		//!< Entries in the current data.
+	uint64_t	load_usec;		//!< How long reading the current data took.
+	time_t		loaded;			//!< When the current data was published.
+} fr_reload_stats_t;
+
+fr_reload_t	*fr_reload_create(TALLOC_CTX *ctx, char const *name, fr_reload_load_t load, void *uctx,
+				  char const * const *files, size_t num_files, uint32_t check_interval);
+
+void const	*fr_reload_acquire(fr_reload_t *r, unsigned int *ref);
+
+void		fr_reload_release(fr_reload_t *r, unsigned int ref);
+
+int		fr_reload_trigger(fr_reload_t *r);
+
+void		fr_reload_stats(fr_reload_t *r, fr_reload_stats_t *stats);
+
+ssize_t		fr_reload_xlat(char **out, fr_reload_t *r, REQUEST *request, char const *fmt);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_RELOAD_H */
@@ -250,6 +250,69 @@ typedef struct vp_tmpl_t {
 #endif
 /* @} **/
 
+/** Number of entries in a #tmpl_memo_t.  Must be a power of 2
+ */
+#define TMPL_MEMO_SIZE		16
+
+/** Where the first instance of an attribute was found in a list
+ *
+ */
+typedef struct tmpl_memo_entry_t {
+	VALUE_PAIR * const	*head;		//!< List which was searched.
+	fr_dict_attr_t const	*da;		//!< Attribute which was searched for.
+	int8_t			tag;		//!< Tag which was searched for.
+	uint64_t		gen;		//!< #tmpl_memo_t generation the entry is valid for.
+	VALUE_PAIR		*vp;		//!< First match, or NULL if there were none.
+} tmpl_memo_entry_t;
+
+/** Per-request memo of #tmpl_cursor_init lookups
+ *
+ * The attribute lists are modified directly all over the server, so
+ * there's no single place to invalidate the memo when they change.
+ * Instead the memo is only consulted while it's marked active, which
+ * the interpreter does when evaluating conditions, and every entry is
+ * invalidated (by incrementing gen) whenever anything which may modify
+ * the lists runs.
+ */
+typedef struct tmpl_memo_t {
+	bool			active;		//!< Whether lookups may use the memo.
+	uint64_t		gen;		//!< Current generation.
+	tmpl_memo_entry_t	entry[TMPL_MEMO_SIZE];
+} tmpl_memo_t;
+
+/** Invalidate all entries in a memo
+ *
+ * Must be called whenever the attribute lists of the request may
+ * have been modified.
+ */
+static inline void tmpl_memo_clear(tmpl_memo_t *memo)
+{
+	memo->gen++;
+}
+
+/** Stop a memo being used while calling something which may modify the lists
+ *
+ * @param[in] memo	to suspend.
+ * @return whether the memo was active, to pass to #tmpl_memo_resume.
+ */
+static inline bool tmpl_memo_suspend(tmpl_memo_t *memo)
+{
+	bool active = memo->active;
+
+	memo->active = false;
+
+	return active;
+}
+
+/** Invalidate a memo, and re-activate it if it was active before #tmpl_memo_suspend
+ *
+ */
+static inline void tmpl_memo_resume(tmpl_memo_t *memo, bool active)
+{
+	memo->gen++;
+	memo->active = active;
+}
+
 #ifndef WITH_VERIFY_PTR
 #  define VERIFY_TMPL(_x)
 #else
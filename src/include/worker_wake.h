@@ -0,0 +1,53 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_WORKER_WAKE_H
+#define _FR_WORKER_WAKE_H
+/**
+ * $Id$
+ *
+ * @file include/worker_wake.h
+ * @brief Wake a worker's event loop from another thread.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(worker_wake_h, "$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_worker_wake fr_worker_wake_t;
+
+/** Called in the worker's thread after it has been woken
+ *
+ * Wakeups are coalesced, so the callback should process everything
+ * queued for the worker, not just one item.
+ *
+ * @param[in] uctx	passed to #fr_worker_wake_create.
+ */
+typedef void (*fr_worker_wake_func_t)(void *uctx);
+
+fr_worker_wake_t	*fr_worker_wake_create(TALLOC_CTX *ctx, char const *name, fr_event_list_t *el,
+					       fr_worker_wake_func_t func, void *uctx);
+
+void			fr_worker_wake_signal(fr_worker_wake_t *ww);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_WORKER_WAKE_H */
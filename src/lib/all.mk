@@ -9,6 +9,8 @@ SOURCES		:= cbuff.c \
 		   cursor.c \
 		   debug.c \
 		   dict.c \
+		   epoch.c \
+		   escape.c \
 		   filters.c \
 		   hash.c \
 		   hmacmd5.c \
@@ -20,6 +22,7 @@ SOURCES		:= cbuff.c \
 		   missing.c \
 		   md4.c \
 		   md5.c \
+		   md5_mb.c \
 		   net.c \
 		   pair.c \
 		   pair_cursor.c \
@@ -0,0 +1,139 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/epoch.c
+ * @brief Grace periods for data which is read without locks, and replaced by a single writer.
+ *
+ * Readers load a pointer to the current data, and use it without taking any locks.
+ * The writer publishes new data with an atomic pointer swap, and must then wait
+ * until no readers can be using the old data, before freeing or reusing it.
+ *
+ * This uses a simple two phase epoch scheme:
+ *
+ *   - Readers register in the reader count for the current epoch with
+ *     #fr_epoch_enter, and recheck the epoch hasn't changed before loading the
+ *     data pointer.
+ *   - The writer publishes the new data, then calls #fr_epoch_synchronize, which
+ *     advances the epoch, and waits for the reader count for the previous epoch
+ *     to drop to zero.
+ *
+ * Read side critical sections must be short, and must not block, as the writer
+ * spins while it waits for them.  Writers must be serialised by the caller.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/epoch.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <sched.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+struct fr_epoch {
+	atomic_uint_fast32_t	epoch;			//!< Current epoch.  Low bit selects the reader count.
+	atomic_uint_fast32_t	readers[2];		//!< Readers in the odd and even epochs.
+};
+
+/** Allocate a new epoch counter
+ *
+ * @param[in] ctx	to allocate the counter in.
+ * @return
+ *	- A new epoch counter.
+ *	- NULL on error.
+ */
+fr_epoch_t *fr_epoch_alloc(TALLOC_CTX *ctx)
+{
+	fr_epoch_t *e;
+
+	e = talloc_zero(ctx, fr_epoch_t);
+	if (!e) return NULL;
+
+	atomic_init(&e->epoch, 0);
+	atomic_init(&e->readers[0], 0);
+	atomic_init(&e->readers[1], 0);
+
+	return e;
+}
+
+/** Register as a reader
+ *
+ * Any data loaded after this returns won't be freed by the writer until
+ * #fr_epoch_exit is called.
+ *
+ * @param[in] e		to register with.
+ * @return a reference to pass to #fr_epoch_exit.
+ */
+unsigned int fr_epoch_enter(fr_epoch_t *e)
+{
+	uint_fast32_t	epoch;
+	unsigned int	ref;
+
+	/*
+	 *	If the epoch changed between reading it, and
+	 *	registering, the writer may not be waiting on
+	 *	our reader count, so try again.
+	 */
+	for (;;) {
+		epoch = atomic_load(&e->epoch);
+		ref = epoch & 0x01;
+
+		atomic_fetch_add(&e->readers[ref], 1);
+		if (atomic_load(&e->epoch) == epoch) break;
+		atomic_fetch_sub(&e->readers[ref], 1);
+	}
+
+	return ref;
+}
+
+/** Deregister as a reader
+ *
+ * @param[in] e		to deregister from.
+ * @param[in] ref	returned by #fr_epoch_enter.
+ */
+void fr_epoch_exit(fr_epoch_t *e, unsigned int ref)
+{
+	rad_assert(atomic_load(&e->readers[ref]) > 0);
+
+	atomic_fetch_sub(&e->readers[ref], 1);
+}
+
+/** Wait until no readers can be using data that was replaced before this call
+ *
+ * @note Writers must be serialised by the caller.
+ *
+ * @param[in] e		to wait on.
+ */
+void fr_epoch_synchronize(fr_epoch_t *e)
+{
+	uint_fast32_t epoch;
+
+	epoch = atomic_fetch_add(&e->epoch, 1);
+
+	/*
+	 *	Wait for any readers that may have loaded
+	 *	the old data pointer.
+	 */
+	while (atomic_load(&e->readers[epoch & 0x01]) > 0) sched_yield();
+}
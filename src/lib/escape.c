@@ -0,0 +1,300 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/escape.c
+ * @brief Table driven escaping of strings for SQL, LDAP, URIs etc.
+ *
+ * Most bytes of most strings don't need escaping.  So instead of
+ * checking each byte against a list of special characters, we find
+ * the length of the run of bytes which can be copied, copy it with
+ * memcpy(), then escape the byte which ended the run.
+ *
+ * Runs are found with a 256 entry lookup table.  On x86, long strings
+ * are classified 16 or 32 bytes at a time with SSSE3 or AVX2, using
+ * two 16 entry nibble tables built from the lookup table.  The
+ * instruction set is selected at runtime.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/escape.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ >= 5))
+#  define ESCAPE_X86 1
+#  include <immintrin.h>
+#endif
+
+#ifdef ESCAPE_X86
+/*
+ *	The low nibble of each input byte selects an entry from the
+ *	escaper's mask, the high nibble selects a bit in that entry.
+ *	High nibbles of 8 and over select no bit, so bytes >= 0x80
+ *	are always left for the lookup table.
+ */
+#define ESCAPE_BITS	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+
+/** Return the number of bytes at the start of p which can be copied, 16 at a time
+ *
+ */
+static CC_HINT(target("ssse3")) size_t escape_span_ssse3(uint8_t const mask[16], uint8_t const *p, size_t len)
+{
+	__m128i	table = _mm_loadu_si128((__m128i const *) mask);
+	__m128i	bits = _mm_setr_epi8(ESCAPE_BITS);
+	__m128i	nibble = _mm_set1_epi8(0x0f);
+	size_t	i;
+
+	for (i = 0; (i + 16) <= len; i += 16) {
+		__m128i		in = _mm_loadu_si128((__m128i const *) (p + i));
+		__m128i		row, col;
+		unsigned int	escape;
+
+		row = _mm_shuffle_epi8(table, _mm_and_si128(in, nibble));
+		col = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+
+		escape = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, col), _mm_setzero_si128()));
+		if (escape) return i + __builtin_ctz(escape);
+	}
+
+	return i;
+}
+
+/** Return the number of bytes at the start of p which can be copied, 32 at a time
+ *
+ */
+static CC_HINT(target("avx2")) size_t escape_span_avx2(uint8_t const mask[16], uint8_t const *p, size_t len)
+{
+	__m256i	table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *) mask));
+	__m256i	bits = _mm256_setr_epi8(ESCAPE_BITS, ESCAPE_BITS);
+	__m256i	nibble = _mm256_set1_epi8(0x0f);
+	size_t	i;
+
+	for (i = 0; (i + 32) <= len; i += 32) {
+		__m256i		in = _mm256_loadu_si256((__m256i const *) (p + i));
+		__m256i		row, col;
+		uint32_t	escape;
+
+		row = _mm256_shuffle_epi8(table, _mm256_and_si256(in, nibble));
+		col = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+
+		escape = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, col),
+								_mm256_setzero_si256()));
+		if (escape) return i + __builtin_ctz(escape);
+	}
+
+	return i;
+}
+#endif
+
+/** Return the number of bytes at the start of p which can be copied
+ *
+ */
+static inline size_t escape_span(fr_escape_t const *esc, uint8_t const *p, size_t len)
+{
+	size_t i = 0;
+
+#ifdef ESCAPE_X86
+	if (esc->classify && (len >= 16)) {
+		if ((len >= 32) && __builtin_cpu_supports("avx2")) {
+			i = escape_span_avx2(esc->mask, p, len);
+		} else if (__builtin_cpu_supports("ssse3")) {
+			i = escape_span_ssse3(esc->mask, p, len);
+		}
+	}
+#endif
+
+	while ((i < len) && (esc->action[p[i]] == FR_ESCAPE_COPY)) i++;
+
+	return i;
+}
+
+/** Update the classification masks for a byte
+ *
+ */
+static void escape_classify(fr_escape_t *esc, uint8_t c)
+{
+	if (c >= 0x80) return;
+
+	if (esc->action[c] == FR_ESCAPE_COPY) {
+		esc->mask[c & 0x0f] |= (1 << (c >> 4));
+	} else {
+		esc->mask[c & 0x0f] &= ~(1 << (c >> 4));
+	}
+}
+
+/** Initialise an escaper
+ *
+ * @param[out] esc	to initialise.
+ * @param[in] chars	the bytes which may be copied verbatim, or with
+ *			#FR_ESCAPE_FLAG_SPECIALS, the bytes which must be escaped.
+ * @param[in] prefix	to write before hex escape sequences, e.g. '%' for URIs.
+ * @param[in] flags	FR_ESCAPE_FLAG_* values.
+ */
+void fr_escape_init(fr_escape_t *esc, char const *chars, char prefix, unsigned int flags)
+{
+	uint8_t const	*p;
+	unsigned int	i;
+
+	memset(esc, 0, sizeof(*esc));
+
+	if (flags & FR_ESCAPE_FLAG_SPECIALS) {
+		memset(esc->action, FR_ESCAPE_COPY, sizeof(esc->action));
+		for (p = (uint8_t const *) chars; *p; p++) esc->action[*p] = FR_ESCAPE_HEX;
+	} else {
+		memset(esc->action, FR_ESCAPE_HEX, sizeof(esc->action));
+		for (p = (uint8_t const *) chars; *p; p++) esc->action[*p] = FR_ESCAPE_COPY;
+	}
+
+	if (flags & FR_ESCAPE_FLAG_UTF8) for (i = 0x80; i < 256; i++) {
+		if (esc->action[i] == FR_ESCAPE_HEX) esc->action[i] = FR_ESCAPE_UTF8;
+	}
+
+	esc->prefix = prefix;
+	esc->hextab = (flags & FR_ESCAPE_FLAG_LOWER) ? "0123456789abcdef" : "0123456789ABCDEF";
+
+	for (i = 0; i < 0x80; i++) escape_classify(esc, i);
+	esc->classify = true;
+}
+
+/** Allocate and initialise an escaper
+ *
+ * @see fr_escape_init
+ *
+ * @param[in] ctx	to allocate the escaper in.
+ * @param[in] chars	the bytes which may be copied verbatim, or with
+ *			#FR_ESCAPE_FLAG_SPECIALS, the bytes which must be escaped.
+ * @param[in] prefix	to write before hex escape sequences.
+ * @param[in] flags	FR_ESCAPE_FLAG_* values.
+ * @return
+ *	- A new escaper.
+ *	- NULL on error.
+ */
+fr_escape_t *fr_escape_alloc(TALLOC_CTX *ctx, char const *chars, char prefix, unsigned int flags)
+{
+	fr_escape_t *esc;
+
+	esc = talloc(ctx, fr_escape_t);
+	if (!esc) return NULL;
+
+	fr_escape_init(esc, chars, prefix, flags);
+
+	return esc;
+}
+
+/** Change what an escaper does with a byte
+ *
+ * @param[in] esc	to modify.
+ * @param[in] c		byte to change the action for.
+ * @param[in] action	#FR_ESCAPE_COPY, #FR_ESCAPE_HEX, #FR_ESCAPE_UTF8,
+ *			or the character to write after a backslash.
+ */
+void fr_escape_set(fr_escape_t *esc, uint8_t c, uint8_t action)
+{
+	esc->action[c] = action;
+	escape_classify(esc, c);
+}
+
+/** Escape a string
+ *
+ * Escape sequences are never split.  If there isn't room for a whole
+ * sequence, output stops before it.
+ *
+ * @param[in] esc	describing how to escape each byte.
+ * @param[out] out	where to write the escaped string.
+ * @param[in] outlen	size of out, including room for the \0.
+ * @param[in] in	string to escape.
+ * @param[in] inlen	length of in.  If < 0, strlen(in) is used.
+ * @return the length of the escaped string, not including the \0.
+ */
+size_t fr_escape(fr_escape_t const *esc, char *out, size_t outlen, char const *in, ssize_t inlen)
+{
+	uint8_t const	*p = (uint8_t const *) in;
+	uint8_t const	*end;
+	char		*o = out;
+	size_t		left = outlen;
+
+	if (!outlen) return 0;
+
+	if (inlen < 0) inlen = strlen(in);
+	end = p + inlen;
+
+	while (p < end) {
+		size_t	run;
+		uint8_t	action;
+
+		run = escape_span(esc, p, end - p);
+		if (run) {
+			if (run >= left) {
+				memcpy(o, p, left - 1);
+				o += left - 1;
+				break;
+			}
+
+			memcpy(o, p, run);
+			o += run;
+			p += run;
+			left -= run;
+
+			if (p == end) break;
+		}
+
+		action = esc->action[*p];
+		switch (action) {
+		case FR_ESCAPE_UTF8:
+			run = fr_utf8_char(p, end - p);
+			if (run > 1) {
+				if (run >= left) goto done;
+
+				memcpy(o, p, run);
+				o += run;
+				p += run;
+				left -= run;
+				continue;
+			}
+			/* FALL-THROUGH */
+
+		case FR_ESCAPE_HEX:
+			if (left <= 3) goto done;
+
+			o[0] = esc->prefix;
+			o[1] = esc->hextab[*p >> 4];
+			o[2] = esc->hextab[*p & 0x0f];
+			o += 3;
+			left -= 3;
+			p++;
+			break;
+
+		default:
+			if (left <= 2) goto done;
+
+			o[0] = '\\';
+			o[1] = action;
+			o += 2;
+			left -= 2;
+			p++;
+			break;
+		}
+	}
+
+done:
+	*o = '\0';
+
+	return o - out;
+}
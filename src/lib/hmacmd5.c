@@ -33,21 +33,21 @@ RCSID("$Id$")
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/md5.h>
 
-/** Calculate HMAC using MD5
+/** Precompute the inner and outer MD5 states for an HMAC key
  *
- * @param digest Caller digest to be filled in.
- * @param text Pointer to data stream.
- * @param text_len length of data stream.
+ * HMAC-MD5 starts both of its passes by hashing a single 64 byte block
+ * derived from the key.  As the key is usually fixed (a shared secret),
+ * the state of the MD5 context after that block can be calculated once
+ * and reused for every message, saving two MD5 compressions per HMAC.
+ *
+ * @param hkey Where to write the precomputed states.
  * @param key Pointer to authentication key.
  * @param key_len Length of authentication key.
- *
  */
-void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
-		 uint8_t const *key, size_t key_len)
+void fr_hmac_md5_key_init(fr_hmac_md5_key_t *hkey, uint8_t const *key, size_t key_len)
 {
-	FR_MD5_CTX context;
-	uint8_t k_ipad[65];    /* inner padding - key XORd with ipad */
-	uint8_t k_opad[65];    /* outer padding - key XORd with opad */
+	uint8_t k_ipad[64];    /* inner padding - key XORd with ipad */
+	uint8_t k_opad[64];    /* outer padding - key XORd with opad */
 	uint8_t tk[16];
 	int i;
 
@@ -86,25 +86,62 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t
 		k_ipad[i] ^= 0x36;
 		k_opad[i] ^= 0x5c;
 	}
+
+	fr_md5_init(&hkey->inner);
+	fr_md5_update(&hkey->inner, k_ipad, 64);	/* start with inner pad */
+
+	fr_md5_init(&hkey->outer);
+	fr_md5_update(&hkey->outer, k_opad, 64);	/* start with outer pad */
+}
+
+/** Calculate HMAC using MD5, starting from a precomputed key
+ *
+ * @param digest Caller digest to be filled in.
+ * @param text Pointer to data stream.
+ * @param text_len length of data stream.
+ * @param hkey Precomputed key states, from #fr_hmac_md5_key_init.
+ */
+void fr_hmac_md5_keyed(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
+		       fr_hmac_md5_key_t const *hkey)
+{
+	FR_MD5_CTX context;
+
 	/*
 	 * perform inner MD5
 	 */
-	fr_md5_init(&context);		   /* init context for 1st
-					      * pass */
-	fr_md5_update(&context, k_ipad, 64);      /* start with inner pad */
+	fr_md5_copy(&context, &hkey->inner);	/* resume after inner pad */
 	fr_md5_update(&context, text, text_len); /* then text of datagram */
 	fr_md5_final(digest, &context);	  /* finish up 1st pass */
 	/*
 	 * perform outer MD5
 	 */
-	fr_md5_init(&context);		   /* init context for 2nd
-					      * pass */
-	fr_md5_update(&context, k_opad, 64);     /* start with outer pad */
+	fr_md5_copy(&context, &hkey->outer);	/* resume after outer pad */
 	fr_md5_update(&context, digest, 16);     /* then results of 1st
 					      * hash */
 	fr_md5_final(digest, &context);	  /* finish up 2nd pass */
 }
 
+/** Calculate HMAC using MD5
+ *
+ * @note Callers signing many messages with the same key should use
+ *	#fr_hmac_md5_key_init and #fr_hmac_md5_keyed instead.
+ *
+ * @param digest Caller digest to be filled in.
+ * @param text Pointer to data stream.
+ * @param text_len length of data stream.
+ * @param key Pointer to authentication key.
+ * @param key_len Length of authentication key.
+ *
+ */
+void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
+		 uint8_t const *key, size_t key_len)
+{
+	fr_hmac_md5_key_t hkey;
+
+	fr_hmac_md5_key_init(&hkey, key, key_len);
+	fr_hmac_md5_keyed(digest, text, text_len, &hkey);
+}
+
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
 
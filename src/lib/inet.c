@@ -278,6 +278,49 @@ static int ip_octet_from_str(uint32_t *out, char const *str)
 	return p - str;
 }
 
+/** Parse an IPv4 address in strict dotted quad notation
+ *
+ * Only accepts four decimal octets without leading zeros.  That's what
+ * almost every address looks like, and it means the same thing to
+ * inet_pton() and getaddrinfo(), so the caller can skip calling them.
+ *
+ * @note output is in network order.
+ *
+ * @param[out] out Where to write parsed address.
+ * @param[in] str to parse.
+ * @return
+ *	- 0 on success.
+ *	- -1 if str isn't a strict dotted quad.
+ */
+static int ip_quad_from_str(struct in_addr *out, char const *str)
+{
+	uint32_t	addr = 0;
+	char const	*p = str;
+	int		i;
+
+	for (i = 0; i < 4; i++) {
+		uint32_t	octet;
+		int		length;
+
+		/*
+		 *	Might be octal to inet_aton() and friends.
+		 */
+		if ((p[0] == '0') && (p[1] >= '0') && (p[1] <= '9')) return -1;
+
+		length = ip_octet_from_str(&octet, p);
+		if (length <= 0) return -1;
+
+		addr = (addr << 8) | octet;
+		p += length;
+
+		if (*p != ((i < 3) ? '.' : '\0')) return -1;
+		p++;
+	}
+
+	out->s_addr = htonl(addr);
+	return 0;
+}
+
 /** Parses the network portion of an IPv4 prefix into an in_addr
  *
  * @note output is in network order.
@@ -375,6 +418,12 @@ int fr_inet_pton4(fr_ipaddr_t *out, char const *value, ssize_t inlen, bool resol
 		out->prefix = 32;
 		out->af = AF_INET;
 
+		/*
+		 *	The common case, which needs neither inet_pton
+		 *	nor a resolver.
+		 */
+		if (ip_quad_from_str(&out->ipaddr.ip4addr, value) == 0) return 0;
+
 		/*
 		 *	Allow '*' as the wildcard address usually 0.0.0.0
 		 */
@@ -713,6 +762,11 @@ char *fr_inet_ntop(char out[FR_IPADDR_STRLEN], size_t outlen, fr_ipaddr_t const
 	char	*p;
 	size_t	len;
 
+	if ((addr->af == AF_INET) && (outlen >= INET_ADDRSTRLEN)) {
+		fr_inet_ntop4(out, &addr->ipaddr.ip4addr);
+		return out;
+	}
+
 	if (inet_ntop(addr->af, &addr->ipaddr, out, outlen) == NULL) return NULL;
 
 	if ((addr->af == AF_INET) || (addr->zone_id == 0)) return out;
@@ -748,6 +802,40 @@ char *fr_inet_ntop(char out[FR_IPADDR_STRLEN], size_t outlen, fr_ipaddr_t const
 	return out;
 }
 
+/** Print an IPv4 address in dotted quad notation
+ *
+ * Produces the same output as inet_ntop(AF_INET, ...), without printing
+ * each octet with snprintf().
+ *
+ * @param[out] out Where to write the resulting IP string.
+ *	Must be at least INET_ADDRSTRLEN bytes.
+ * @param[in] addr to convert to presentation format, in network order.
+ * @return the length of the string written to out, not including the \0.
+ */
+size_t fr_inet_ntop4(char out[INET_ADDRSTRLEN], struct in_addr const *addr)
+{
+	uint8_t const	*octet = (uint8_t const *) &addr->s_addr;
+	char		*p = out;
+	int		i;
+
+	for (i = 0; i < 4; i++) {
+		unsigned int v = octet[i];
+
+		if (v >= 100) {
+			*p++ = '0' + (v / 100);
+			v %= 100;
+			*p++ = '0' + (v / 10);
+		} else if (v >= 10) {
+			*p++ = '0' + (v / 10);
+		}
+		*p++ = '0' + (v % 10);
+		*p++ = '.';
+	}
+	*--p = '\0';
+
+	return p - out;
+}
+
 /** Print a #fr_ipaddr_t as a CIDR style network prefix
  *
  * @param[out] out Where to write the resulting prefix string.
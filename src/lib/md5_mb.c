@@ -0,0 +1,420 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/md5_mb.c
+ * @brief Multi-buffer MD5.
+ *
+ * MD5 is a serial algorithm, so a single digest can't be sped up with
+ * SIMD instructions.  What we can do is calculate the digests of several
+ * independent messages at once, with each message occupying one 32bit
+ * lane of a vector register.  SSE2 gives us four lanes, AVX2 eight.
+ *
+ * The instruction set is selected at runtime, so binaries built for
+ * generic x86 CPUs still get the wider lanes where they're available.
+ * On other architectures, messages are hashed one at a time.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ >= 5))
+#  define MD5_MB_X86 1
+#  include <immintrin.h>
+#endif
+
+#define MD5_MB_BLOCK_LEN	64
+
+#ifdef MD5_MB_X86
+/** State of one lane of a multi-buffer calculation
+ *
+ */
+typedef struct {
+	fr_md5_mb_msg_t const	*msg;		//!< Message being hashed, NULL if the lane is unused.
+	size_t			blocks;		//!< Number of blocks, including padding.
+	uint8_t			scratch[MD5_MB_BLOCK_LEN];	//!< For blocks which aren't wholly
+							//!< contained in msg->data.
+} md5_mb_lane_t;
+
+static uint8_t const md5_mb_zero_block[MD5_MB_BLOCK_LEN];
+
+static void md5_mb_lane_init(md5_mb_lane_t *lane, fr_md5_mb_msg_t const *msg)
+{
+	lane->msg = msg;
+
+	/*
+	 *	Data, the 0x80 terminator, and the 64bit length,
+	 *	rounded up to a whole number of blocks.
+	 */
+	lane->blocks = msg ? ((msg->data_len + msg->suffix_len + 8) / MD5_MB_BLOCK_LEN) + 1 : 0;
+}
+
+/** Return the Nth block of a lane's message, with MD5 padding applied
+ *
+ * Most blocks are returned directly from the message data.  Blocks which
+ * include the suffix or padding are assembled in the lane's scratch buffer.
+ */
+static uint8_t const *md5_mb_block(md5_mb_lane_t *lane, size_t i)
+{
+	fr_md5_mb_msg_t const	*msg = lane->msg;
+	size_t			off = i * MD5_MB_BLOCK_LEN;
+	size_t			total, start, end;
+
+	if (i >= lane->blocks) return md5_mb_zero_block;
+
+	if ((off + MD5_MB_BLOCK_LEN) <= msg->data_len) return msg->data + off;
+
+	memset(lane->scratch, 0, sizeof(lane->scratch));
+
+	if (off < msg->data_len) memcpy(lane->scratch, msg->data + off, msg->data_len - off);
+
+	total = msg->data_len + msg->suffix_len;
+	start = off > msg->data_len ? off : msg->data_len;
+	end = total < (off + MD5_MB_BLOCK_LEN) ? total : (off + MD5_MB_BLOCK_LEN);
+	if (start < end) memcpy(lane->scratch + (start - off), msg->suffix + (start - msg->data_len), end - start);
+
+	if ((total >= off) && (total < (off + MD5_MB_BLOCK_LEN))) lane->scratch[total - off] = 0x80;
+
+	if (i == (lane->blocks - 1)) {
+		uint64_t bits = (uint64_t)total << 3;
+		int j;
+
+		for (j = 0; j < 8; j++) lane->scratch[56 + j] = (bits >> (j * 8)) & 0xff;
+	}
+
+	return lane->scratch;
+}
+
+static void md5_mb_digest(uint8_t *digest, uint32_t const a[], uint32_t const b[],
+			  uint32_t const c[], uint32_t const d[], int lane)
+{
+	uint32_t	state[4] = { a[lane], b[lane], c[lane], d[lane] };
+	int		i;
+
+	for (i = 0; i < 4; i++) {
+		digest[(i * 4) + 0] = state[i];
+		digest[(i * 4) + 1] = state[i] >> 8;
+		digest[(i * 4) + 2] = state[i] >> 16;
+		digest[(i * 4) + 3] = state[i] >> 24;
+	}
+}
+
+/*
+ *	The core functions and step from md5.c, expressed in terms
+ *	of V_* vector operations.  The V_* macros are defined just
+ *	before each transform, for the instruction set it uses.
+ */
+#define MB_F1(x, y, z) V_XOR(z, V_AND(x, V_XOR(y, z)))
+#define MB_F2(x, y, z) MB_F1(z, x, y)
+#define MB_F3(x, y, z) V_XOR(V_XOR(x, y), z)
+#define MB_F4(x, y, z) V_XOR(y, V_OR(x, V_XOR(z, V_SET1(-1))))
+
+#define MB_STEP(f, w, x, y, z, data, k, s) do { \
+	w = V_ADD(w, V_ADD(f(x, y, z), V_ADD(data, V_SET1((int)k)))); \
+	w = V_OR(V_SLLI(w, s), V_SRLI(w, 32 - s)); \
+	w = V_ADD(w, x); \
+} while (0)
+
+#define MB_ROUNDS(a, b, c, d, in) do { \
+	MB_STEP(MB_F1, a, b, c, d, in[ 0], 0xd76aa478,  7); \
+	MB_STEP(MB_F1, d, a, b, c, in[ 1], 0xe8c7b756, 12); \
+	MB_STEP(MB_F1, c, d, a, b, in[ 2], 0x242070db, 17); \
+	MB_STEP(MB_F1, b, c, d, a, in[ 3], 0xc1bdceee, 22); \
+	MB_STEP(MB_F1, a, b, c, d, in[ 4], 0xf57c0faf,  7); \
+	MB_STEP(MB_F1, d, a, b, c, in[ 5], 0x4787c62a, 12); \
+	MB_STEP(MB_F1, c, d, a, b, in[ 6], 0xa8304613, 17); \
+	MB_STEP(MB_F1, b, c, d, a, in[ 7], 0xfd469501, 22); \
+	MB_STEP(MB_F1, a, b, c, d, in[ 8], 0x698098d8,  7); \
+	MB_STEP(MB_F1, d, a, b, c, in[ 9], 0x8b44f7af, 12); \
+	MB_STEP(MB_F1, c, d, a, b, in[10], 0xffff5bb1, 17); \
+	MB_STEP(MB_F1, b, c, d, a, in[11], 0x895cd7be, 22); \
+	MB_STEP(MB_F1, a, b, c, d, in[12], 0x6b901122,  7); \
+	MB_STEP(MB_F1, d, a, b, c, in[13], 0xfd987193, 12); \
+	MB_STEP(MB_F1, c, d, a, b, in[14], 0xa679438e, 17); \
+	MB_STEP(MB_F1, b, c, d, a, in[15], 0x49b40821, 22); \
+	MB_STEP(MB_F2, a, b, c, d, in[ 1], 0xf61e2562,  5); \
+	MB_STEP(MB_F2, d, a, b, c, in[ 6], 0xc040b340,  9); \
+	MB_STEP(MB_F2, c, d, a, b, in[11], 0x265e5a51, 14); \
+	MB_STEP(MB_F2, b, c, d, a, in[ 0], 0xe9b6c7aa, 20); \
+	MB_STEP(MB_F2, a, b, c, d, in[ 5], 0xd62f105d,  5); \
+	MB_STEP(MB_F2, d, a, b, c, in[10], 0x02441453,  9); \
+	MB_STEP(MB_F2, c, d, a, b, in[15], 0xd8a1e681, 14); \
+	MB_STEP(MB_F2, b, c, d, a, in[ 4], 0xe7d3fbc8, 20); \
+	MB_STEP(MB_F2, a, b, c, d, in[ 9], 0x21e1cde6,  5); \
+	MB_STEP(MB_F2, d, a, b, c, in[14], 0xc33707d6,  9); \
+	MB_STEP(MB_F2, c, d, a, b, in[ 3], 0xf4d50d87, 14); \
+	MB_STEP(MB_F2, b, c, d, a, in[ 8], 0x455a14ed, 20); \
+	MB_STEP(MB_F2, a, b, c, d, in[13], 0xa9e3e905,  5); \
+	MB_STEP(MB_F2, d, a, b, c, in[ 2], 0xfcefa3f8,  9); \
+	MB_STEP(MB_F2, c, d, a, b, in[ 7], 0x676f02d9, 14); \
+	MB_STEP(MB_F2, b, c, d, a, in[12], 0x8d2a4c8a, 20); \
+	MB_STEP(MB_F3, a, b, c, d, in[ 5], 0xfffa3942,  4); \
+	MB_STEP(MB_F3, d, a, b, c, in[ 8], 0x8771f681, 11); \
+	MB_STEP(MB_F3, c, d, a, b, in[11], 0x6d9d6122, 16); \
+	MB_STEP(MB_F3, b, c, d, a, in[14], 0xfde5380c, 23); \
+	MB_STEP(MB_F3, a, b, c, d, in[ 1], 0xa4beea44,  4); \
+	MB_STEP(MB_F3, d, a, b, c, in[ 4], 0x4bdecfa9, 11); \
+	MB_STEP(MB_F3, c, d, a, b, in[ 7], 0xf6bb4b60, 16); \
+	MB_STEP(MB_F3, b, c, d, a, in[10], 0xbebfbc70, 23); \
+	MB_STEP(MB_F3, a, b, c, d, in[13], 0x289b7ec6,  4); \
+	MB_STEP(MB_F3, d, a, b, c, in[ 0], 0xeaa127fa, 11); \
+	MB_STEP(MB_F3, c, d, a, b, in[ 3], 0xd4ef3085, 16); \
+	MB_STEP(MB_F3, b, c, d, a, in[ 6], 0x04881d05, 23); \
+	MB_STEP(MB_F3, a, b, c, d, in[ 9], 0xd9d4d039,  4); \
+	MB_STEP(MB_F3, d, a, b, c, in[12], 0xe6db99e5, 11); \
+	MB_STEP(MB_F3, c, d, a, b, in[15], 0x1fa27cf8, 16); \
+	MB_STEP(MB_F3, b, c, d, a, in[ 2], 0xc4ac5665, 23); \
+	MB_STEP(MB_F4, a, b, c, d, in[ 0], 0xf4292244,  6); \
+	MB_STEP(MB_F4, d, a, b, c, in[ 7], 0x432aff97, 10); \
+	MB_STEP(MB_F4, c, d, a, b, in[14], 0xab9423a7, 15); \
+	MB_STEP(MB_F4, b, c, d, a, in[ 5], 0xfc93a039, 21); \
+	MB_STEP(MB_F4, a, b, c, d, in[12], 0x655b59c3,  6); \
+	MB_STEP(MB_F4, d, a, b, c, in[ 3], 0x8f0ccc92, 10); \
+	MB_STEP(MB_F4, c, d, a, b, in[10], 0xffeff47d, 15); \
+	MB_STEP(MB_F4, b, c, d, a, in[ 1], 0x85845dd1, 21); \
+	MB_STEP(MB_F4, a, b, c, d, in[ 8], 0x6fa87e4f,  6); \
+	MB_STEP(MB_F4, d, a, b, c, in[15], 0xfe2ce6e0, 10); \
+	MB_STEP(MB_F4, c, d, a, b, in[ 6], 0xa3014314, 15); \
+	MB_STEP(MB_F4, b, c, d, a, in[13], 0x4e0811a1, 21); \
+	MB_STEP(MB_F4, a, b, c, d, in[ 4], 0xf7537e82,  6); \
+	MB_STEP(MB_F4, d, a, b, c, in[11], 0xbd3af235, 10); \
+	MB_STEP(MB_F4, c, d, a, b, in[ 2], 0x2ad7d2bb, 15); \
+	MB_STEP(MB_F4, b, c, d, a, in[ 9], 0xeb86d391, 21); \
+} while (0)
+
+/** Load one block from each of four lanes, transposing so w[n] holds word n of every lane
+ *
+ */
+static inline CC_HINT(target("sse2")) void md5_mb_load_x4(__m128i w[16], uint8_t const *p[4])
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		__m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+		r0 = _mm_loadu_si128((__m128i const *)(p[0] + (i * 16)));
+		r1 = _mm_loadu_si128((__m128i const *)(p[1] + (i * 16)));
+		r2 = _mm_loadu_si128((__m128i const *)(p[2] + (i * 16)));
+		r3 = _mm_loadu_si128((__m128i const *)(p[3] + (i * 16)));
+
+		t0 = _mm_unpacklo_epi32(r0, r1);
+		t1 = _mm_unpacklo_epi32(r2, r3);
+		t2 = _mm_unpackhi_epi32(r0, r1);
+		t3 = _mm_unpackhi_epi32(r2, r3);
+
+		w[(i * 4) + 0] = _mm_unpacklo_epi64(t0, t1);
+		w[(i * 4) + 1] = _mm_unpackhi_epi64(t0, t1);
+		w[(i * 4) + 2] = _mm_unpacklo_epi64(t2, t3);
+		w[(i * 4) + 3] = _mm_unpackhi_epi64(t2, t3);
+	}
+}
+
+#define V_ADD(_x, _y)	_mm_add_epi32(_x, _y)
+#define V_AND(_x, _y)	_mm_and_si128(_x, _y)
+#define V_OR(_x, _y)	_mm_or_si128(_x, _y)
+#define V_XOR(_x, _y)	_mm_xor_si128(_x, _y)
+#define V_SLLI(_x, _s)	_mm_slli_epi32(_x, _s)
+#define V_SRLI(_x, _s)	_mm_srli_epi32(_x, _s)
+#define V_SET1(_x)	_mm_set1_epi32(_x)
+
+/** Hash the messages in four lanes using SSE2
+ *
+ */
+static CC_HINT(target("sse2")) void md5_mb_x4(md5_mb_lane_t lane[4])
+{
+	__m128i		a, b, c, d, aa, bb, cc, dd, w[16];
+	uint32_t	sa[4], sb[4], sc[4], sd[4];
+	uint8_t const	*p[4];
+	size_t		i, max = 0;
+	int		j;
+
+	for (j = 0; j < 4; j++) if (lane[j].blocks > max) max = lane[j].blocks;
+
+	a = V_SET1(0x67452301);
+	b = V_SET1((int)0xefcdab89);
+	c = V_SET1((int)0x98badcfe);
+	d = V_SET1(0x10325476);
+
+	for (i = 0; i < max; i++) {
+		bool done = false;
+
+		for (j = 0; j < 4; j++) p[j] = md5_mb_block(&lane[j], i);
+		md5_mb_load_x4(w, p);
+
+		aa = a;
+		bb = b;
+		cc = c;
+		dd = d;
+
+		MB_ROUNDS(a, b, c, d, w);
+
+		a = V_ADD(a, aa);
+		b = V_ADD(b, bb);
+		c = V_ADD(c, cc);
+		d = V_ADD(d, dd);
+
+		for (j = 0; j < 4; j++) if (lane[j].blocks == (i + 1)) done = true;
+		if (!done) continue;
+
+		_mm_storeu_si128((__m128i *)sa, a);
+		_mm_storeu_si128((__m128i *)sb, b);
+		_mm_storeu_si128((__m128i *)sc, c);
+		_mm_storeu_si128((__m128i *)sd, d);
+
+		for (j = 0; j < 4; j++) {
+			if (lane[j].blocks == (i + 1)) md5_mb_digest(lane[j].msg->digest, sa, sb, sc, sd, j);
+		}
+	}
+}
+
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_SLLI
+#undef V_SRLI
+#undef V_SET1
+
+#define V_ADD(_x, _y)	_mm256_add_epi32(_x, _y)
+#define V_AND(_x, _y)	_mm256_and_si256(_x, _y)
+#define V_OR(_x, _y)	_mm256_or_si256(_x, _y)
+#define V_XOR(_x, _y)	_mm256_xor_si256(_x, _y)
+#define V_SLLI(_x, _s)	_mm256_slli_epi32(_x, _s)
+#define V_SRLI(_x, _s)	_mm256_srli_epi32(_x, _s)
+#define V_SET1(_x)	_mm256_set1_epi32(_x)
+
+/** Hash the messages in eight lanes using AVX2
+ *
+ */
+static CC_HINT(target("avx2")) void md5_mb_x8(md5_mb_lane_t lane[8])
+{
+	__m256i		a, b, c, d, aa, bb, cc, dd, w[16];
+	__m128i		lo[16], hi[16];
+	uint32_t	sa[8], sb[8], sc[8], sd[8];
+	uint8_t const	*p[8];
+	size_t		i, max = 0;
+	int		j;
+
+	for (j = 0; j < 8; j++) if (lane[j].blocks > max) max = lane[j].blocks;
+
+	a = V_SET1(0x67452301);
+	b = V_SET1((int)0xefcdab89);
+	c = V_SET1((int)0x98badcfe);
+	d = V_SET1(0x10325476);
+
+	for (i = 0; i < max; i++) {
+		bool done = false;
+
+		for (j = 0; j < 8; j++) p[j] = md5_mb_block(&lane[j], i);
+		md5_mb_load_x4(lo, &p[0]);
+		md5_mb_load_x4(hi, &p[4]);
+		for (j = 0; j < 16; j++) w[j] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo[j]), hi[j], 1);
+
+		aa = a;
+		bb = b;
+		cc = c;
+		dd = d;
+
+		MB_ROUNDS(a, b, c, d, w);
+
+		a = V_ADD(a, aa);
+		b = V_ADD(b, bb);
+		c = V_ADD(c, cc);
+		d = V_ADD(d, dd);
+
+		for (j = 0; j < 8; j++) if (lane[j].blocks == (i + 1)) done = true;
+		if (!done) continue;
+
+		_mm256_storeu_si256((__m256i *)sa, a);
+		_mm256_storeu_si256((__m256i *)sb, b);
+		_mm256_storeu_si256((__m256i *)sc, c);
+		_mm256_storeu_si256((__m256i *)sd, d);
+
+		for (j = 0; j < 8; j++) {
+			if (lane[j].blocks == (i + 1)) md5_mb_digest(lane[j].msg->digest, sa, sb, sc, sd, j);
+		}
+	}
+}
+
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_SLLI
+#undef V_SRLI
+#undef V_SET1
+#endif	/* MD5_MB_X86 */
+
+/** Return the number of messages this CPU can hash in parallel
+ *
+ * @return 8 with AVX2, 4 with SSE2, else 1.
+ */
+unsigned int fr_md5_mb_lanes(void)
+{
+#ifdef MD5_MB_X86
+	if (__builtin_cpu_supports("avx2")) return 8;
+	if (__builtin_cpu_supports("sse2")) return 4;
+#endif
+	return 1;
+}
+
+/** Calculate the MD5 digests of multiple independent messages
+ *
+ * Messages are hashed in groups of #fr_md5_mb_lanes.  All the messages in
+ * a group are processed in lockstep, so throughput is best when messages
+ * are of similar lengths.
+ *
+ * @param[in] msgs	to hash.  The digest of each is written to msgs[n].digest.
+ * @param[in] num	number of messages.
+ */
+void fr_md5_mb_calc(fr_md5_mb_msg_t const msgs[], unsigned int num)
+{
+	unsigned int	i = 0;
+
+#ifdef MD5_MB_X86
+	md5_mb_lane_t	lane[FR_MD5_MB_LANES_MAX];
+	unsigned int	lanes = fr_md5_mb_lanes();
+	unsigned int	j;
+
+	if (lanes >= 8) while ((num - i) >= 8) {
+		for (j = 0; j < 8; j++) md5_mb_lane_init(&lane[j], &msgs[i++]);
+		md5_mb_x8(lane);
+	}
+
+	/*
+	 *	Groups smaller than four still beat the scalar
+	 *	code, so pad them out with empty lanes.
+	 */
+	if (lanes >= 4) while ((num - i) >= 2) {
+		for (j = 0; j < 4; j++) md5_mb_lane_init(&lane[j], (i < num) ? &msgs[i++] : NULL);
+		md5_mb_x4(lane);
+	}
+#endif
+
+	for (; i < num; i++) {
+		FR_MD5_CTX ctx;
+
+		fr_md5_init(&ctx);
+		fr_md5_update(&ctx, msgs[i].data, msgs[i].data_len);
+		if (msgs[i].suffix_len) fr_md5_update(&ctx, msgs[i].suffix, msgs[i].suffix_len);
+		fr_md5_final(msgs[i].digest, &ctx);
+	}
+}
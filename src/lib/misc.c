@@ -253,6 +253,108 @@ int rad_unlockfd(int fd, int lock_len)
 
 static char const hextab[] = "0123456789abcdef";
 
+/*
+ *	Value of each hex digit, plus one.  Zero means the
+ *	character isn't a hex digit.
+ */
+static uint8_t const hex_value[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+/*
+ *	Every pair of decimal digits, so integers can be printed
+ *	two digits at a time.
+ */
+static char const dec_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static uint64_t const dec_pow10[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+	100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+	10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ >= 5))
+#  define HEX_X86 1
+#  include <immintrin.h>
+
+/** Convert 16 bytes at a time to hex
+ *
+ * @return the number of bytes of bin converted.
+ */
+static CC_HINT(target("ssse3")) size_t bin2hex_ssse3(char *hex, uint8_t const *bin, size_t inlen)
+{
+	__m128i	table = _mm_loadu_si128((__m128i const *) hextab);
+	__m128i	nibble = _mm_set1_epi8(0x0f);
+	size_t	i;
+
+	for (i = 0; (i + 16) <= inlen; i += 16) {
+		__m128i in = _mm_loadu_si128((__m128i const *) (bin + i));
+		__m128i hi, lo;
+
+		hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+		lo = _mm_shuffle_epi8(table, _mm_and_si128(in, nibble));
+
+		_mm_storeu_si128((__m128i *) (hex + (i * 2)), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (hex + (i * 2) + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+
+	return i;
+}
+
+/** Convert 16 hex digits at a time to binary
+ *
+ * Stops at the first block containing something other than a hex digit,
+ * and leaves it for the scalar code.
+ *
+ * @return the number of bytes written to bin.
+ */
+static CC_HINT(target("ssse3")) size_t hex2bin_ssse3(uint8_t *bin, char const *hex, size_t len)
+{
+	size_t i;
+
+	for (i = 0; (i + 8) <= len; i += 8) {
+		__m128i in = _mm_loadu_si128((__m128i const *) (hex + (i * 2)));
+		__m128i lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+		__m128i digit, alpha, value;
+
+		/*
+		 *	Signed comparisons, so bytes >= 0x80 are
+		 *	neither digits nor letters.
+		 */
+		digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+				      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+		alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+				      _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+		if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff) break;
+
+		value = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+				     _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+
+		/*
+		 *	(high nibble * 16) + low nibble, for each pair.
+		 */
+		value = _mm_maddubs_epi16(value, _mm_set1_epi16(0x0110));
+		_mm_storel_epi64((__m128i *) (bin + i), _mm_packus_epi16(value, value));
+	}
+
+	return i;
+}
+#endif
+
 /** Convert hex strings to binary data
  *
  * @param bin Buffer to write output to.
@@ -263,9 +365,8 @@ static char const hextab[] = "0123456789abcdef";
  */
 size_t fr_hex2bin(uint8_t *bin, size_t outlen, char const *hex, size_t inlen)
 {
-	size_t i;
+	size_t i = 0;
 	size_t len;
-	char *c1, *c2;
 
 	/*
 	 *	Smartly truncate output, caller should check number of bytes
@@ -274,11 +375,16 @@ size_t fr_hex2bin(uint8_t *bin, size_t outlen, char const *hex, size_t inlen)
 	len = inlen >> 1;
 	if (len > outlen) len = outlen;
 
-	for (i = 0; i < len; i++) {
-		if(!(c1 = memchr(hextab, tolower((int) hex[i << 1]), sizeof(hextab))) ||
-		   !(c2 = memchr(hextab, tolower((int) hex[(i << 1) + 1]), sizeof(hextab))))
-			break;
-		bin[i] = ((c1-hextab)<<4) + (c2-hextab);
+#ifdef HEX_X86
+	if ((len >= 8) && __builtin_cpu_supports("ssse3")) i = hex2bin_ssse3(bin, hex, len);
+#endif
+
+	for (; i < len; i++) {
+		uint8_t c1 = hex_value[(uint8_t) hex[i << 1]];
+		uint8_t c2 = hex_value[(uint8_t) hex[(i << 1) + 1]];
+
+		if (!c1 || !c2) break;
+		bin[i] = ((c1 - 1) << 4) | (c2 - 1);
 	}
 
 	return i;
@@ -297,9 +403,17 @@ size_t fr_hex2bin(uint8_t *bin, size_t outlen, char const *hex, size_t inlen)
  */
 size_t fr_bin2hex(char *hex, uint8_t const *bin, size_t inlen)
 {
-	size_t i;
+	size_t i = 0;
 
-	for (i = 0; i < inlen; i++) {
+#ifdef HEX_X86
+	if ((inlen >= 16) && __builtin_cpu_supports("ssse3")) {
+		i = bin2hex_ssse3(hex, bin, inlen);
+		hex += i * 2;
+		bin += i;
+	}
+#endif
+
+	for (; i < inlen; i++) {
 		hex[0] = hextab[((*bin) >> 4) & 0x0f];
 		hex[1] = hextab[*bin & 0x0f];
 		hex += 2;
@@ -331,6 +445,75 @@ char *fr_abin2hex(TALLOC_CTX *ctx, uint8_t const *bin, size_t inlen)
 	return buff;
 }
 
+/** Print an unsigned integer in decimal
+ *
+ * Equivalent to snprintf(out, FR_UINT_STRLEN, "%" PRIu64, num), but
+ * without the format string parsing.  Digits are written two at a time,
+ * from the end of the number.
+ *
+ * @param[out] out	Buffer to write to.  Must be at least #FR_UINT_STRLEN bytes.
+ * @param[in] num	to print.
+ * @return the number of digits written, not including the \0.
+ */
+size_t fr_uint2dec(char *out, uint64_t num)
+{
+	size_t	len;
+	char	*p;
+
+#ifdef __GNUC__
+	{
+		/*
+		 *	log10(2) ~= 1233 / 4096.  The | 1 doesn't
+		 *	change the digit count (no power of ten >= 10
+		 *	is odd), and avoids clz(0).
+		 */
+		int t = ((64 - __builtin_clzll(num | 1)) * 1233) >> 12;
+
+		len = t + ((num | 1) >= dec_pow10[t]);
+	}
+#else
+	for (len = 1; (len < 20) && (num >= dec_pow10[len]); len++);
+#endif
+
+	p = out + len;
+	*p = '\0';
+
+	while (num >= 100) {
+		unsigned int pair = (num % 100) * 2;
+
+		num /= 100;
+		p -= 2;
+		p[0] = dec_pairs[pair];
+		p[1] = dec_pairs[pair + 1];
+	}
+
+	if (num >= 10) {
+		p -= 2;
+		p[0] = dec_pairs[num * 2];
+		p[1] = dec_pairs[(num * 2) + 1];
+	} else {
+		*--p = '0' + num;
+	}
+
+	return len;
+}
+
+/** Print a signed integer in decimal
+ *
+ * @see fr_uint2dec
+ *
+ * @param[out] out	Buffer to write to.  Must be at least #FR_UINT_STRLEN bytes.
+ * @param[in] num	to print.
+ * @return the number of characters written, not including the \0.
+ */
+size_t fr_sint2dec(char *out, int64_t num)
+{
+	if (num >= 0) return fr_uint2dec(out, num);
+
+	*out = '-';
+	return fr_uint2dec(out + 1, -(uint64_t) num) + 1;
+}
+
 /** Consume the integer (or hex) portion of a value string
  *
  * @param value string to parse.
@@ -339,10 +522,26 @@ char *fr_abin2hex(TALLOC_CTX *ctx, uint8_t const *bin, size_t inlen)
  */
 uint32_t fr_strtoul(char const *value, char **end)
 {
+	char const	*p = value;
+	uint64_t	num = 0;
+
 	if ((value[0] == '0') && (value[1] == 'x')) {
 		return strtoul(value, end, 16);
 	}
 
+	/*
+	 *	Up to nineteen digits can't overflow num, and if it
+	 *	fits in an unsigned long, strtoul would have returned
+	 *	the same thing.  Anything else (signs, whitespace,
+	 *	big numbers) is left to strtoul.
+	 */
+	while ((*p >= '0') && (*p <= '9') && ((p - value) < 19)) num = (num * 10) + (*p++ - '0');
+
+	if ((p > value) && ((*p < '0') || (*p > '9')) && (num <= ULONG_MAX)) {
+		if (end) memcpy(end, &p, sizeof(*end));
+		return num;
+	}
+
 	return strtoul(value, end, 10);
 }
 
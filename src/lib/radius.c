@@ -383,6 +383,23 @@ static ssize_t rad_recvfrom(int sockfd, RADIUS_PACKET *packet, int flags)
  */
 int fr_radius_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 		   char const *secret)
+{
+	return fr_radius_sign_keyed(packet, original, secret, NULL);
+}
+
+/** Sign a previously encoded packet, using a precomputed HMAC key for the Message-Authenticator
+ *
+ * @param packet to sign.
+ * @param original request, if packet is a response.
+ * @param secret shared with the other end.
+ * @param hkey precomputed HMAC-MD5 key derived from secret.  If NULL, the key is
+ *	derived from secret for this packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_radius_sign_keyed(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
+			 char const *secret, fr_hmac_md5_key_t const *hkey)
 {
 	radius_packet_t	*hdr = (radius_packet_t *)packet->data;
 
@@ -471,8 +488,12 @@ int fr_radius_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 		 *	into the Message-Authenticator
 		 *	attribute.
 		 */
-		fr_hmac_md5(calc_auth_vector, packet->data, packet->data_len,
-			    (uint8_t const *) secret, talloc_array_length(secret) - 1);
+		if (hkey) {
+			fr_hmac_md5_keyed(calc_auth_vector, packet->data, packet->data_len, hkey);
+		} else {
+			fr_hmac_md5(calc_auth_vector, packet->data, packet->data_len,
+				    (uint8_t const *) secret, talloc_array_length(secret) - 1);
+		}
 		memcpy(packet->data + packet->offset + 2,
 		       calc_auth_vector, AUTH_VECTOR_LEN);
 	}
@@ -1156,6 +1177,23 @@ RADIUS_PACKET *fr_radius_recv(TALLOC_CTX *ctx, int fd, int flags, bool require_m
  *
  */
 int fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret)
+{
+	return fr_radius_verify_keyed(packet, original, secret, NULL);
+}
+
+/** Verify the authenticators of a packet, using a precomputed HMAC key for the Message-Authenticator
+ *
+ * @param packet to verify.
+ * @param original request, if packet is a response.
+ * @param secret shared with the other end.
+ * @param hkey precomputed HMAC-MD5 key derived from secret.  If NULL, the key is
+ *	derived from secret for this packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_radius_verify_keyed(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+			   fr_hmac_md5_key_t const *hkey)
 {
 	uint8_t		*ptr;
 	int		length;
@@ -1222,8 +1260,12 @@ int fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const
 				break;
 			}
 
-			fr_hmac_md5(calc_auth_vector, packet->data, packet->data_len,
-				    (uint8_t const *) secret, talloc_array_length(secret) - 1);
+			if (hkey) {
+				fr_hmac_md5_keyed(calc_auth_vector, packet->data, packet->data_len, hkey);
+			} else {
+				fr_hmac_md5(calc_auth_vector, packet->data, packet->data_len,
+					    (uint8_t const *) secret, talloc_array_length(secret) - 1);
+			}
 			if (fr_radius_digest_cmp(calc_auth_vector, msg_auth_vector,
 						 sizeof(calc_auth_vector)) != 0) {
 				fr_strerror_printf("Received packet from %s with invalid Message-Authenticator!  "
@@ -1326,6 +1368,160 @@ int fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const
 	return 0;
 }
 
+/** Check whether a packet contains a Message-Authenticator
+ *
+ */
+static bool radius_has_message_authenticator(RADIUS_PACKET const *packet)
+{
+	uint8_t const *p = packet->data + RADIUS_HDR_LEN;
+	uint8_t const *end = packet->data + packet->data_len;
+
+	while ((p + 2) <= end) {
+		if (p[0] == PW_MESSAGE_AUTHENTICATOR) return true;
+		if (p[1] < 2) break;
+		p += p[1];
+	}
+
+	return false;
+}
+
+#define VERIFY_BATCH_SIZE	(FR_MD5_MB_LANES_MAX * 4)
+
+/** Calculate the pending authenticators of a batch, and compare them with the received ones
+ *
+ */
+static int radius_verify_batch_flush(int rcode[], RADIUS_PACKET *packets[], fr_md5_mb_msg_t msgs[],
+				     uint8_t digests[][MD5_DIGEST_LENGTH], unsigned int idx[], unsigned int pending)
+{
+	unsigned int	i;
+	int		failed = 0;
+	char		buffer[INET6_ADDRSTRLEN];
+
+	fr_md5_mb_calc(msgs, pending);
+
+	for (i = 0; i < pending; i++) {
+		RADIUS_PACKET	*packet = packets[idx[i]];
+		bool		request;
+
+		switch (packet->code) {
+		case PW_CODE_ACCOUNTING_REQUEST:
+		case PW_CODE_DISCONNECT_REQUEST:
+		case PW_CODE_COA_REQUEST:
+			request = true;
+			break;
+
+		/*
+		 *	Copy the packet's vector back to the packet.
+		 */
+		default:
+			memcpy(packet->data + 4, packet->vector, AUTH_VECTOR_LEN);
+			request = false;
+			break;
+		}
+
+		if (fr_radius_digest_cmp(digests[i], packet->vector, AUTH_VECTOR_LEN) == 0) {
+			rcode[idx[i]] = 0;
+			continue;
+		}
+
+		fr_strerror_printf("Received %s packet from %s port %d with invalid %s-Authenticator!  "
+				   "(Shared secret is incorrect.)",
+				   fr_packet_codes[packet->code],
+				   inet_ntop(packet->src_ipaddr.af,
+					     &packet->src_ipaddr.ipaddr,
+					     buffer, sizeof(buffer)),
+				   packet->src_port,
+				   request ? "Request" : "Response");
+		rcode[idx[i]] = -1;
+		failed++;
+	}
+
+	return failed;
+}
+
+/** Verify the Request/Response Authenticators of multiple packets in one call
+ *
+ * The authenticators of Accounting-Request, CoA-Request, Disconnect-Request
+ * and response packets are calculated in parallel using #fr_md5_mb_calc.
+ *
+ * Packets containing a Message-Authenticator, or whose authenticators are
+ * random (Access-Request, Status-Server) are passed to #fr_radius_verify
+ * individually.
+ *
+ * @param[out] rcode	Per packet result.  0 if the packet is valid, -1 if it isn't.
+ * @param[in] packets	to verify.
+ * @param[in] originals	The requests that packets are responses to.  May be NULL
+ *			if all packets are requests.
+ * @param[in] secrets	Shared secret for each packet.
+ * @param[in] num	Number of packets.
+ * @return the number of packets which failed verification.
+ */
+int fr_radius_verify_batch(int rcode[], RADIUS_PACKET *packets[], RADIUS_PACKET *originals[],
+			   char const *secrets[], unsigned int num)
+{
+	fr_md5_mb_msg_t	msgs[VERIFY_BATCH_SIZE];
+	uint8_t		digests[VERIFY_BATCH_SIZE][MD5_DIGEST_LENGTH];
+	unsigned int	idx[VERIFY_BATCH_SIZE];
+	unsigned int	i, pending = 0;
+	int		failed = 0;
+
+	for (i = 0; i < num; i++) {
+		RADIUS_PACKET	*packet = packets[i];
+		RADIUS_PACKET	*original = originals ? originals[i] : NULL;
+
+		switch (packet->code) {
+		case PW_CODE_ACCOUNTING_REQUEST:
+		case PW_CODE_DISCONNECT_REQUEST:
+		case PW_CODE_COA_REQUEST:
+			if (radius_has_message_authenticator(packet)) goto single;
+
+			/*
+			 *	MD5(packet + secret), with a zero vector.
+			 */
+			memset(packet->data + 4, 0, AUTH_VECTOR_LEN);
+			break;
+
+		case PW_CODE_ACCESS_ACCEPT:
+		case PW_CODE_ACCESS_REJECT:
+		case PW_CODE_ACCESS_CHALLENGE:
+		case PW_CODE_ACCOUNTING_RESPONSE:
+		case PW_CODE_DISCONNECT_ACK:
+		case PW_CODE_DISCONNECT_NAK:
+		case PW_CODE_COA_ACK:
+		case PW_CODE_COA_NAK:
+			if (!original || radius_has_message_authenticator(packet)) goto single;
+
+			/*
+			 *	MD5(packet + secret), with the request's vector.
+			 */
+			memcpy(packet->data + 4, original->vector, AUTH_VECTOR_LEN);
+			break;
+
+		default:
+		single:
+			rcode[i] = (fr_radius_verify(packet, original, secrets[i]) < 0) ? -1 : 0;
+			if (rcode[i] < 0) failed++;
+			continue;
+		}
+
+		msgs[pending].data = packet->data;
+		msgs[pending].data_len = packet->data_len;
+		msgs[pending].suffix = (uint8_t const *)secrets[i];
+		msgs[pending].suffix_len = talloc_array_length(secrets[i]) - 1;
+		msgs[pending].digest = digests[pending];
+		idx[pending++] = i;
+
+		if (pending == VERIFY_BATCH_SIZE) {
+			failed += radius_verify_batch_flush(rcode, packets, msgs, digests, idx, pending);
+			pending = 0;
+		}
+	}
+
+	if (pending) failed += radius_verify_batch_flush(rcode, packets, msgs, digests, idx, pending);
+
+	return failed;
+}
+
 /** Encode a packet
  *
  */
@@ -26,11 +26,271 @@
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/regex.h>
 
+/*
+ *	Wrapper functions for libpcre2.  Preferred over libpcre, as
+ *	patterns are binary safe, and match data can be reused.
+ */
+#ifdef HAVE_PCRE2
+/** Thread local match state
+ *
+ * Allocated on first use in each thread, so that regex_exec doesn't
+ * need to allocate match data for every evaluation.
+ */
+typedef struct {
+	pcre2_match_data	*mdata;		//!< Match data, grown as needed.
+	uint32_t		mdata_size;	//!< Number of pairs of offsets in mdata.
+	pcre2_match_context	*mcontext;	//!< Context holding the JIT stack.
+	pcre2_jit_stack		*jit_stack;	//!< JIT stack for this thread.
+} fr_pcre2_tls_t;
+
+fr_thread_local_setup(fr_pcre2_tls_t *, fr_pcre2_tls)
+
+static bool regex_jit;			//!< Whether libpcre2 was built with JIT support.
+
+/** Free regex_t structure
+ *
+ * Calls libpcre2 specific free functions for the expression.
+ *
+ * @param preg to free.
+ */
+static int _regex_free(regex_t *preg)
+{
+	if (preg->compiled) pcre2_code_free(preg->compiled);
+
+	return 0;
+}
+
+/** Free thread local match state
+ *
+ * @param tls to free.
+ */
+static int _pcre2_tls_free(fr_pcre2_tls_t *tls)
+{
+	if (tls->mdata) pcre2_match_data_free(tls->mdata);
+	if (tls->mcontext) pcre2_match_context_free(tls->mcontext);
+	if (tls->jit_stack) pcre2_jit_stack_free(tls->jit_stack);
+
+	return 0;
+}
+
+/** Free thread local match state on exit
+ *
+ * @param tls to free.
+ */
+static void _pcre2_tls_thread_free(void *tls)
+{
+	talloc_free(tls);
+}
+
+/** Get match state for this thread, allocating it if necessary
+ *
+ * @param[in] nmatch	Number of pairs of offsets the caller wants.
+ * @return
+ *	- Match state.
+ *	- NULL on error.
+ */
+static fr_pcre2_tls_t *regex_pcre2_tls(size_t nmatch)
+{
+	fr_pcre2_tls_t *tls = fr_pcre2_tls;
+
+	if (!tls) {
+		tls = talloc_zero(NULL, fr_pcre2_tls_t);
+		if (!tls) {
+		oom:
+			fr_strerror_printf("Allocating match data failed");
+			return NULL;
+		}
+		talloc_set_destructor(tls, _pcre2_tls_free);
+
+		tls->mcontext = pcre2_match_context_create(NULL);
+		if (!tls->mcontext) {
+			talloc_free(tls);
+			goto oom;
+		}
+
+		if (regex_jit) {
+			tls->jit_stack = pcre2_jit_stack_create(128 * 1024, 512 * 1024, NULL);
+			if (!tls->jit_stack) {
+				talloc_free(tls);
+				fr_strerror_printf("Allocating JIT stack failed");
+				return NULL;
+			}
+			pcre2_jit_stack_assign(tls->mcontext, NULL, tls->jit_stack);
+		}
+
+		fr_thread_local_set_destructor(fr_pcre2_tls, _pcre2_tls_thread_free, tls);
+	}
+
+	if (nmatch < 1) nmatch = 1;
+	if (!tls->mdata || (tls->mdata_size < nmatch)) {
+		if (tls->mdata) pcre2_match_data_free(tls->mdata);
+
+		tls->mdata = pcre2_match_data_create(nmatch, NULL);
+		if (!tls->mdata) {
+			tls->mdata_size = 0;
+			goto oom;
+		}
+		tls->mdata_size = nmatch;
+	}
+
+	return tls;
+}
+
+/** Wrapper around pcre2_compile
+ *
+ * Allows the rest of the code to do compilations using one function signature.
+ *
+ * @note Compiled expression must be freed with talloc_free.
+ *
+ * @param[out] out		Where to write out a pointer to the structure containing
+ *				the compiled expression.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] ignore_case	Whether to do case insensitive matching.
+ * @param[in] multiline		If true $ matches newlines.
+ * @param[in] subcaptures	Whether to compile the regular expression to store subcapture
+ *				data.
+ * @param[in] runtime		If false run the pattern through the PCRE JIT to convert it
+ *				to machine code. This trades startup time (longer) for
+ *				runtime performance (better).
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error. Negative value is offset of parse error.
+ */
+ssize_t regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
+		      bool ignore_case, bool multiline, bool subcaptures, bool runtime)
+{
+	int		errcode;
+	PCRE2_SIZE	offset;
+	uint32_t	cflags = 0;
+	regex_t		*preg;
+
+	static bool	setup;
+
+	if (!setup) {
+		uint32_t do_jit = 0;
+
+		/*
+		 *	Check at runtime to see if this version
+		 *	of libpcre2 was compiled with JIT support.
+		 */
+		pcre2_config(PCRE2_CONFIG_JIT, &do_jit);
+		regex_jit = (do_jit != 0);
+		setup = true;
+	}
+
+	*out = NULL;
+
+	if (len == 0) {
+		fr_strerror_printf("Empty expression");
+		return 0;
+	}
+
+	if (ignore_case) cflags |= PCRE2_CASELESS;
+	if (multiline) cflags |= PCRE2_MULTILINE;
+	if (!subcaptures) cflags |= PCRE2_NO_AUTO_CAPTURE;
+
+	preg = talloc_zero(ctx, regex_t);
+	talloc_set_destructor(preg, _regex_free);
+
+	preg->compiled = pcre2_compile((PCRE2_SPTR)pattern, len, cflags, &errcode, &offset, NULL);
+	if (!preg->compiled) {
+		PCRE2_UCHAR errbuf[128];
+
+		pcre2_get_error_message(errcode, errbuf, sizeof(errbuf));
+
+		talloc_free(preg);
+		fr_strerror_printf("Pattern compilation failed: %s", (char *)errbuf);
+
+		return -(ssize_t)offset;
+	}
+
+	if (!runtime) {
+		preg->precompiled = true;
+
+		/*
+		 *	Not all platforms have JIT support, and
+		 *	the pattern may not be jitable.  Either
+		 *	way, the interpreter will still work.
+		 */
+		if (regex_jit && (pcre2_jit_compile(preg->compiled, PCRE2_JIT_COMPLETE) == 0)) {
+			preg->jitd = true;
+		}
+	}
+
+	*out = preg;
+
+	return len;
+}
+
+/** Wrapper around pcre2_match
+ *
+ * @param preg The compiled expression.
+ * @param subject to match.
+ * @param len Length of subject.
+ * @param pmatch Array of match pointers.
+ * @param nmatch How big the match array is. Updated to number of matches.
+ * @return
+ *	- -1 on failure.
+ *	- 0 on no match.
+ *	- 1 on match.
+ */
+int regex_exec(regex_t *preg, char const *subject, size_t len, regmatch_t pmatch[], size_t *nmatch)
+{
+	int		ret;
+	size_t		matches, i;
+	fr_pcre2_tls_t	*tls;
+	PCRE2_SIZE	*ovector;
+
+	if (!pmatch || !nmatch) {
+		pmatch = NULL;
+		if (nmatch) *nmatch = 0;
+		matches = 0;
+	} else {
+		matches = *nmatch;
+	}
+
+	tls = regex_pcre2_tls(matches);
+	if (!tls) return -1;
+
+	if (preg->jitd) {
+		ret = pcre2_jit_match(preg->compiled, (PCRE2_SPTR)subject, len, 0, 0, tls->mdata, tls->mcontext);
+	} else {
+		ret = pcre2_match(preg->compiled, (PCRE2_SPTR)subject, len, 0, 0, tls->mdata, tls->mcontext);
+	}
+	if (ret < 0) {
+		PCRE2_UCHAR errbuf[128];
+
+		if (ret == PCRE2_ERROR_NOMATCH) return 0;
+
+		pcre2_get_error_message(ret, errbuf, sizeof(errbuf));
+		fr_strerror_printf("regex evaluation failed with code (%i): %s", ret, (char *)errbuf);
+		return -1;
+	}
+
+	if (!matches) return 1;
+
+	/*
+	 *	0 signifies more offsets than we provided space
+	 *	for, so we fill in all of them.
+	 */
+	if ((ret == 0) || ((size_t)ret > matches)) ret = matches;
+
+	ovector = pcre2_get_ovector_pointer(tls->mdata);
+	for (i = 0; i < (size_t)ret; i++) {
+		pmatch[i].rm_so = ovector[i * 2];
+		pmatch[i].rm_eo = ovector[(i * 2) + 1];
+	}
+	*nmatch = ret;
+
+	return 1;
+}
+
 /*
  *	Wrapper functions for libpcre. Much more powerful, and guaranteed
  *	to be binary safe but require libpcre.
  */
-#ifdef HAVE_PCRE
+#elif defined(HAVE_PCRE)
 
 #if (PCRE_MAJOR >= 8) && (PCRE_MINOR >= 32) && defined(PCRE_CONFIG_JIT)
 #  define HAVE_PCRE_JIT_EXEC 1
@@ -461,4 +721,208 @@ int regex_exec(regex_t *preg, char const *subject, size_t len, regmatch_t pmatch
 	return 1;
 }
 #  endif
+
+#  if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+/*
+ *	Cache of dynamic expressions, i.e. those built from xlat
+ *	expansions.  Each thread keeps the most recently used
+ *	REGEX_CACHE_SIZE patterns compiled, so that a pattern is
+ *	compiled (and JIT'd) once, instead of once per evaluation.
+ */
+typedef struct regex_cache_entry regex_cache_entry_t;
+
+struct regex_cache_entry {
+	regex_t			*preg;		//!< Compiled expression.
+	char const		*pattern;	//!< The expanded pattern.
+	size_t			len;		//!< Length of the pattern.
+	uint8_t			flags;		//!< Flags the pattern was compiled with.
+
+	regex_cache_entry_t	*prev;		//!< More recently used entry.
+	regex_cache_entry_t	*next;		//!< Less recently used entry.
+};
+
+typedef struct {
+	fr_hash_table_t		*ht;		//!< Entries indexed by pattern and flags.
+	regex_cache_entry_t	*head;		//!< Most recently used entry.
+	regex_cache_entry_t	*tail;		//!< Least recently used entry, evicted first.
+} regex_cache_t;
+
+fr_thread_local_setup(regex_cache_t *, fr_regex_cache)
+
+#define REGEX_CACHE_IGNORE_CASE	(1 << 0)
+#define REGEX_CACHE_MULTILINE	(1 << 1)
+#define REGEX_CACHE_SUBCAPTURES	(1 << 2)
+
+static uint32_t regex_cache_hash(void const *data)
+{
+	regex_cache_entry_t const *entry = data;
+
+	return fr_hash_update(&entry->flags, sizeof(entry->flags), fr_hash(entry->pattern, entry->len));
+}
+
+static int regex_cache_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const *a = one, *b = two;
+
+	if (a->flags != b->flags) return a->flags - b->flags;
+	if (a->len != b->len) return (a->len < b->len) ? -1 : +1;
+
+	return memcmp(a->pattern, b->pattern, a->len);
+}
+
+/** Release an entry's expression
+ *
+ * Subcapture data for a request may hold a reference to the
+ * expression, in which case it's freed along with that.
+ *
+ * @param entry being freed.
+ */
+static int _regex_cache_entry_free(regex_cache_entry_t *entry)
+{
+	if (entry->preg) talloc_unlink(entry, entry->preg);
+
+	return 0;
+}
+
+/** Free the cache on thread exit
+ *
+ * @param cache to free.
+ */
+static void _regex_cache_thread_free(void *cache)
+{
+	talloc_free(cache);
+}
+
+static void regex_cache_unlink(regex_cache_t *cache, regex_cache_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void regex_cache_push(regex_cache_t *cache, regex_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if (!cache->tail) cache->tail = entry;
+}
+
+/** Compile a dynamic expression, or return it from this thread's cache
+ *
+ * @note The compiled expression belongs to the cache, and must not be freed
+ *	by the caller.  It remains valid until the next call to this function
+ *	in the same thread, unless a reference to it is taken with
+ *	talloc_reference().
+ *
+ * @param[out] out		Where to write out a pointer to the compiled expression.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] ignore_case	Whether to do case insensitive matching.
+ * @param[in] multiline		If true $ matches newlines.
+ * @param[in] subcaptures	Whether to compile the regular expression to store subcapture
+ *				data.
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error. Negative value is offset of parse error.
+ */
+ssize_t regex_compile_cached(regex_t **out, char const *pattern, size_t len,
+			     bool ignore_case, bool multiline, bool subcaptures)
+{
+	regex_cache_t		*cache = fr_regex_cache;
+	regex_cache_entry_t	find, *entry;
+	ssize_t			slen;
+
+	*out = NULL;
+
+	if (!cache) {
+		cache = talloc_zero(NULL, regex_cache_t);
+		if (!cache) {
+		oom:
+			fr_strerror_printf("Out of memory");
+			return 0;
+		}
+
+		cache->ht = fr_hash_table_create(cache, regex_cache_hash, regex_cache_cmp, NULL);
+		if (!cache->ht) {
+			talloc_free(cache);
+			goto oom;
+		}
+
+		fr_thread_local_set_destructor(fr_regex_cache, _regex_cache_thread_free, cache);
+	}
+
+	memset(&find, 0, sizeof(find));
+	find.pattern = pattern;
+	find.len = len;
+	if (ignore_case) find.flags |= REGEX_CACHE_IGNORE_CASE;
+	if (multiline) find.flags |= REGEX_CACHE_MULTILINE;
+	if (subcaptures) find.flags |= REGEX_CACHE_SUBCAPTURES;
+
+	entry = fr_hash_table_finddata(cache->ht, &find);
+	if (entry) {
+		if (entry != cache->head) {
+			regex_cache_unlink(cache, entry);
+			regex_cache_push(cache, entry);
+		}
+
+		*out = entry->preg;
+		return len;
+	}
+
+	entry = talloc_zero(cache, regex_cache_entry_t);
+	if (!entry) goto oom;
+
+	/*
+	 *	It's going to be reused, so it's worth the JIT.
+	 */
+	slen = regex_compile(entry, &entry->preg, pattern, len, ignore_case, multiline, subcaptures, false);
+	if (slen <= 0) {
+		talloc_free(entry);
+		return slen;
+	}
+	entry->preg->cached = true;
+	talloc_set_destructor(entry, _regex_cache_entry_free);
+
+	entry->pattern = talloc_bstrndup(entry, pattern, len);
+	if (!entry->pattern) {
+		talloc_free(entry);
+		goto oom;
+	}
+	entry->len = len;
+	entry->flags = find.flags;
+
+	/*
+	 *	Make room by evicting the least recently used entry.
+	 */
+	if (fr_hash_table_num_elements(cache->ht) >= REGEX_CACHE_SIZE) {
+		regex_cache_entry_t *old = cache->tail;
+
+		fr_hash_table_yank(cache->ht, old);
+		regex_cache_unlink(cache, old);
+		talloc_free(old);
+	}
+
+	if (!fr_hash_table_insert(cache->ht, entry)) {
+		talloc_free(entry);
+		goto oom;
+	}
+	regex_cache_push(cache, entry);
+
+	*out = entry->preg;
+
+	return slen;
+}
+#  endif
 #endif
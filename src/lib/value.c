@@ -733,6 +733,37 @@ void value_box_clear(value_box_t *data)
 	data->length = 0;
 }
 
+/** Parse an unsigned 64bit integer
+ *
+ * sscanf() is slow, so plain strings of digits are handled here, and
+ * anything else (whitespace, signs, overflow) is left to it.
+ *
+ * @param[out] out	Where to write the integer.
+ * @param[in] in	String to parse.  Trailing garbage is ignored.
+ * @return
+ *	- 0 on success.
+ *	- -1 if in doesn't start with an integer.
+ */
+static int value_box_uint64_from_str(uint64_t *out, char const *in)
+{
+	char const	*p = in;
+	uint64_t	num = 0;
+
+	/*
+	 *	Up to nineteen digits can't overflow.
+	 */
+	while ((*p >= '0') && (*p <= '9') && ((p - in) < 19)) num = (num * 10) + (*p++ - '0');
+
+	if ((p > in) && ((*p < '0') || (*p > '9'))) {
+		*out = num;
+		return 0;
+	}
+
+	if (sscanf(in, "%" PRIu64, out) != 1) return -1;
+
+	return 0;
+}
+
 /** Convert string value to a value_box_t type
  *
  * @todo Should take taint param.
@@ -1076,7 +1107,7 @@ int value_box_from_str(TALLOC_CTX *ctx, value_box_t *dst,
 		/*
 		 *	Note that ALL integers are unsigned!
 		 */
-		if (sscanf(in, "%" PRIu64, &i) != 1) {
+		if (value_box_uint64_from_str(&i, in) < 0) {
 			fr_strerror_printf("Failed parsing \"%s\" as unsigned 64bit integer", in);
 			return -1;
 		}
@@ -1086,9 +1117,9 @@ int value_box_from_str(TALLOC_CTX *ctx, value_box_t *dst,
 
 	case PW_TYPE_SIZE:
 	{
-		size_t i;
+		uint64_t i;
 
-		if (sscanf(in, "%zu", &i) != 1) {
+		if ((value_box_uint64_from_str(&i, in) < 0) || (i > SIZE_MAX)) {
 			fr_strerror_printf("Failed parsing \"%s\" as a file or memory size", in);
 			return -1;
 		}
@@ -1854,6 +1885,174 @@ int value_box_steal(TALLOC_CTX *ctx, value_box_t *dst, const value_box_t *src)
 	return 0;
 }
 
+/** Longest string value_box_number_print() can produce, including the \0
+ *
+ * A timeval with a 20 digit tv_sec and (invalid) 20 digit tv_usec.
+ */
+#define VALUE_BOX_NUMBER_STRLEN	((FR_UINT_STRLEN * 2) + 1)
+
+/** Print the integer types, and the types which are printed as integers
+ *
+ * These are printed often enough (logging, detail files, SQL queries)
+ * that avoiding snprintf() and inet_ntop() is worthwhile.  The output
+ * is the same as theirs.
+ *
+ * @param[out] out	Where to write the string.  Must be at least
+ *			#VALUE_BOX_NUMBER_STRLEN bytes.
+ * @param[in] data	to print.
+ * @return
+ *	- The length of the string written to out.
+ *	- -1 if data isn't one of the types handled here.
+ */
+static ssize_t value_box_number_print(char *out, value_box_t const *data)
+{
+	size_t	len;
+	int	i;
+
+	switch (data->type) {
+	case PW_TYPE_BYTE:
+		return fr_uint2dec(out, data->datum.byte);
+
+	case PW_TYPE_SHORT:
+		return fr_uint2dec(out, data->datum.ushort);
+
+	case PW_TYPE_INTEGER:
+		return fr_uint2dec(out, data->datum.integer);
+
+	case PW_TYPE_INTEGER64:
+		return fr_uint2dec(out, data->datum.integer64);
+
+	case PW_TYPE_SIZE:
+		return fr_uint2dec(out, data->datum.size);
+
+	case PW_TYPE_SIGNED:
+		return fr_sint2dec(out, data->datum.sinteger);
+
+	case PW_TYPE_TIMEVAL:
+	{
+		uint64_t usec = (uint64_t)data->datum.timeval.tv_usec;
+
+		len = fr_uint2dec(out, (uint64_t)data->datum.timeval.tv_sec);
+		out[len++] = '.';
+
+		if (usec >= 1000000) return len + fr_uint2dec(out + len, usec);
+
+		for (i = 5; i >= 0; i--) {
+			out[len + i] = '0' + (usec % 10);
+			usec /= 10;
+		}
+		len += 6;
+		out[len] = '\0';
+	}
+		return len;
+
+	case PW_TYPE_IPV4_ADDR:
+		return fr_inet_ntop4(out, &data->datum.ipaddr);
+
+	case PW_TYPE_IPV4_PREFIX:
+	{
+		struct in_addr addr;
+
+		/*
+		 *	Alignment issues.
+		 */
+		memcpy(&addr, &(data->datum.ipv4prefix[2]), sizeof(addr));
+
+		len = fr_inet_ntop4(out, &addr);
+		out[len++] = '/';
+		len += fr_uint2dec(out + len, data->datum.ipv4prefix[1] & 0x3f);
+	}
+		return len;
+
+	case PW_TYPE_ETHERNET:
+		for (i = 0, len = 0; i < 6; i++) {
+			out[len++] = hextab[data->datum.ether[i] >> 4];
+			out[len++] = hextab[data->datum.ether[i] & 0x0f];
+			out[len++] = ':';
+		}
+		out[--len] = '\0';
+		return len;
+
+	default:
+		return -1;
+	}
+}
+
+/** The last date printed by a thread
+ *
+ */
+typedef struct value_box_date_cache_t {
+	time_t		date;			//!< Seconds since the epoch.
+	size_t		len;			//!< Length of str.
+	char		str[64];		//!< date, formatted with strftime().
+} value_box_date_cache_t;
+
+fr_thread_local_setup(value_box_date_cache_t *, value_box_date_cache)	/* macro */
+
+/** Free the date cache on thread exit
+ *
+ */
+static void _value_box_date_cache_free(void *cache)
+{
+	talloc_free(cache);
+}
+
+/** Print a date in the local timezone
+ *
+ * Dates are printed for most requests (Event-Timestamp in detail files
+ * and SQL accounting), and most requests in a busy second have the same
+ * one.  So we remember the last date each thread printed, and skip
+ * localtime_r() and strftime() if it's the same.
+ *
+ * @param[out] out	Where to write the date, must be at least 64 bytes.
+ * @param[in] date	to print.
+ * @param[in] quote	char to put either side of the date, or \0.
+ * @return the length of the string written to out, not including the \0.
+ */
+static size_t value_box_date_print(char out[64], time_t date, char quote)
+{
+	value_box_date_cache_t	*cache = value_box_date_cache;
+	struct tm		s_tm;
+	size_t			len;
+
+	if (!cache) {
+		cache = talloc_zero(NULL, value_box_date_cache_t);
+		if (!cache) goto no_cache;
+
+		fr_thread_local_set_destructor(value_box_date_cache, _value_box_date_cache_free, cache);
+	}
+
+	if ((cache->date != date) || !cache->len) {
+		cache->len = strftime(cache->str, sizeof(cache->str) - 2,
+				      "%b %e %Y %H:%M:%S %Z", localtime_r(&date, &s_tm));
+		cache->date = date;
+	}
+
+	len = cache->len;
+	if (quote > 0) {
+		out[0] = quote;
+		memcpy(out + 1, cache->str, len);
+		out[len + 1] = quote;
+		len += 2;
+	} else {
+		memcpy(out, cache->str, len);
+	}
+	out[len] = '\0';
+
+	return len;
+
+no_cache:
+	if (quote > 0) {
+		len = strftime(out, 63, "%%%b %e %Y %H:%M:%S %Z%%", localtime_r(&date, &s_tm));
+		out[0] = quote;
+		out[len - 1] = quote;
+		out[len] = '\0';
+		return len;
+	}
+
+	return strftime(out, 64, "%b %e %Y %H:%M:%S %Z", localtime_r(&date, &s_tm));
+}
+
 /** Print one attribute value to a string
  *
  */
@@ -1899,39 +2098,26 @@ char *value_box_asprint(TALLOC_CTX *ctx, value_box_t const *data, char quote)
 	}
 
 	case PW_TYPE_BYTE:
-		p = talloc_typed_asprintf(ctx, "%u", data->datum.byte);
-		break;
-
 	case PW_TYPE_SHORT:
-		p = talloc_typed_asprintf(ctx, "%u", data->datum.ushort);
-		break;
-
 	case PW_TYPE_INTEGER:
-		p = talloc_typed_asprintf(ctx, "%u", data->datum.integer);
-		break;
-
 	case PW_TYPE_INTEGER64:
-		p = talloc_typed_asprintf(ctx, "%" PRIu64, data->datum.integer64);
-		break;
-
 	case PW_TYPE_SIZE:
-		p = talloc_typed_asprintf(ctx, "%zu", data->datum.size);
-		break;
-
 	case PW_TYPE_SIGNED:
-		p = talloc_typed_asprintf(ctx, "%d", data->datum.sinteger);
-		break;
-
 	case PW_TYPE_TIMEVAL:
-		p = talloc_typed_asprintf(ctx, "%" PRIu64 ".%06" PRIu64,
-					  (uint64_t)data->datum.timeval.tv_sec, (uint64_t)data->datum.timeval.tv_usec);
-		break;
-
 	case PW_TYPE_ETHERNET:
-		p = talloc_typed_asprintf(ctx, "%02x:%02x:%02x:%02x:%02x:%02x",
-					  data->datum.ether[0], data->datum.ether[1],
-					  data->datum.ether[2], data->datum.ether[3],
-					  data->datum.ether[4], data->datum.ether[5]);
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV4_PREFIX:
+	{
+		char	buff[VALUE_BOX_NUMBER_STRLEN];
+		ssize_t	len;
+
+		len = value_box_number_print(buff, data);
+		if (!fr_cond_assert(len >= 0)) return NULL;
+
+		p = talloc_bstrndup(ctx, buff, len);
+		if (!p) return NULL;
+		talloc_set_type(p, char);
+	}
 		break;
 
 	case PW_TYPE_ABINARY:
@@ -1956,36 +2142,24 @@ char *value_box_asprint(TALLOC_CTX *ctx, value_box_t const *data, char quote)
 
 	case PW_TYPE_DATE:
 	{
-		time_t t;
-		struct tm s_tm;
+		char	buff[64];
+		size_t	len;
 
-		t = data->datum.date;
+		len = value_box_date_print(buff, data->datum.date, '\0');
 
-		p = talloc_array(ctx, char, 64);
-		strftime(p, 64, "%b %e %Y %H:%M:%S %Z",
-			 localtime_r(&t, &s_tm));
-		break;
+		p = talloc_bstrndup(ctx, buff, len);
+		if (!p) return NULL;
+		talloc_set_type(p, char);
 	}
+		break;
 
 	/*
-	 *	We need to use the proper inet_ntop functions for IP
+	 *	We need to use the proper inet_ntop functions for IPv6
 	 *	addresses, else the output might not match output of
 	 *	other functions, which makes testing difficult.
 	 *
 	 *	An example is tunneled ipv4 in ipv6 addresses.
 	 */
-	case PW_TYPE_IPV4_ADDR:
-	case PW_TYPE_IPV4_PREFIX:
-	{
-		char buff[INET_ADDRSTRLEN  + 4]; // + /prefix
-
-		buff[0] = '\0';
-		value_box_snprint(buff, sizeof(buff), data, '\0');
-
-		p = talloc_typed_strdup(ctx, buff);
-	}
-	break;
-
 	case PW_TYPE_IPV6_ADDR:
 	case PW_TYPE_IPV6_PREFIX:
 	{
@@ -2046,8 +2220,6 @@ size_t value_box_snprint(char *out, size_t outlen, value_box_t const *data, char
 	char		buf[1024];	/* Interim buffer to use with poorly behaved printing functions */
 	char const	*a = NULL;
 	char		*p = out;
-	time_t		t;
-	struct tm	s_tm;
 
 	size_t		len = 0, freespace = outlen;
 
@@ -2103,49 +2275,30 @@ size_t value_box_snprint(char *out, size_t outlen, value_box_t const *data, char
 		return fr_snprint(out, outlen, data->datum.strvalue, data->length, quote);
 
 	case PW_TYPE_BYTE:
-		return snprintf(out, outlen, "%u", data->datum.byte);
-
 	case PW_TYPE_SHORT:
-		return snprintf(out, outlen, "%u", data->datum.ushort);
-
 	case PW_TYPE_INTEGER:
-		return snprintf(out, outlen, "%u", data->datum.integer);
-
 	case PW_TYPE_INTEGER64:
-		return snprintf(out, outlen, "%" PRIu64, data->datum.integer64);
-
 	case PW_TYPE_SIZE:
-		return snprintf(out, outlen, "%zu", data->datum.size);
-
 	case PW_TYPE_SIGNED: /* Damned code for 1 WiMAX attribute */
-		len = snprintf(buf, sizeof(buf), "%d", data->datum.sinteger);
-		a = buf;
-		break;
-
 	case PW_TYPE_TIMEVAL:
-		len = snprintf(buf, sizeof(buf),  "%" PRIu64 ".%06" PRIu64,
-			       (uint64_t)data->datum.timeval.tv_sec, (uint64_t)data->datum.timeval.tv_usec);
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV4_PREFIX:
+	case PW_TYPE_ETHERNET:
+		/*
+		 *	Print directly into the output buffer if
+		 *	it's big enough, which it nearly always is.
+		 */
+		if (outlen >= VALUE_BOX_NUMBER_STRLEN) return value_box_number_print(out, data);
+
+		len = value_box_number_print(buf, data);
 		a = buf;
 		break;
 
 	case PW_TYPE_DATE:
-		t = data->datum.date;
-		if (quote > 0) {
-			len = strftime(buf, sizeof(buf) - 1, "%%%b %e %Y %H:%M:%S %Z%%", localtime_r(&t, &s_tm));
-			buf[0] = (char) quote;
-			buf[len - 1] = (char) quote;
-			buf[len] = '\0';
-		} else {
-			len = strftime(buf, sizeof(buf), "%b %e %Y %H:%M:%S %Z", localtime_r(&t, &s_tm));
-		}
+		len = value_box_date_print(buf, data->datum.date, quote);
 		a = buf;
 		break;
 
-	case PW_TYPE_IPV4_ADDR:
-		a = inet_ntop(AF_INET, &(data->datum.ipaddr), buf, sizeof(buf));
-		len = strlen(buf);
-		break;
-
 	case PW_TYPE_ABINARY:
 #ifdef WITH_ASCEND_BINARY
 		print_abinary(buf, sizeof(buf), (uint8_t const *) data->datum.filter, data->length, quote);
@@ -2217,32 +2370,6 @@ size_t value_box_snprint(char *out, size_t outlen, value_box_t const *data, char
 	}
 		break;
 
-	case PW_TYPE_IPV4_PREFIX:
-	{
-		struct in_addr addr;
-
-		/*
-		 *	Alignment issues.
-		 */
-		memcpy(&addr, &(data->datum.ipv4prefix[2]), sizeof(addr));
-
-		a = inet_ntop(AF_INET, &addr, buf, sizeof(buf));
-		if (a) {
-			p = buf;
-
-			len = strlen(buf);
-			p += len;
-			len += snprintf(p, sizeof(buf) - len, "/%u", (unsigned int) (data->datum.ipv4prefix[1] & 0x3f));
-		}
-	}
-		break;
-
-	case PW_TYPE_ETHERNET:
-		return snprintf(out, outlen, "%02x:%02x:%02x:%02x:%02x:%02x",
-				data->datum.ether[0], data->datum.ether[1],
-				data->datum.ether[2], data->datum.ether[3],
-				data->datum.ether[4], data->datum.ether[5]);
-
 	case PW_TYPE_DECIMAL:
 		return snprintf(out, outlen, "%g", data->datum.decimal);
 
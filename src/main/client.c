@@ -205,6 +205,18 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	fr_inet_ntop_prefix(buffer, sizeof(buffer), &client->ipaddr);
 	DEBUG3("Adding client %s (%s) to prefix tree %i", buffer, client->longname, client->ipaddr.prefix);
 
+	/*
+	 *	Derive the HMAC-MD5 key states for the secret once,
+	 *	instead of for every packet we sign or verify.
+	 */
+	if (client->secret && !client->secret_hmac) {
+		client->secret_hmac = talloc(client, fr_hmac_md5_key_t);
+		if (!client->secret_hmac) return false;
+
+		fr_hmac_md5_key_init(client->secret_hmac,
+				     (uint8_t const *)client->secret, talloc_array_length(client->secret) - 1);
+	}
+
 	/*
 	 *	If the client also defines a server, do that now.
 	 */
@@ -27,6 +27,7 @@
 #include <freeradius-devel/md5.h>
 #include <freeradius-devel/conduit.h>
 #include <freeradius-devel/state.h>
+#include <freeradius-devel/latency.h>
 
 #include <libgen.h>
 #ifdef HAVE_INTTYPES_H
@@ -2677,6 +2678,44 @@ static int command_stats_state(rad_listen_t *listener, UNUSED int argc, UNUSED c
 	return CMD_OK;
 }
 
+typedef struct {
+	rad_listen_t	*listener;
+	char const	*prefix;
+	size_t		len;
+} command_latency_ctx_t;
+
+static int command_print_latency(void *ctx, char const *name, fr_latency_t const *hist)
+{
+	command_latency_ctx_t *cl = ctx;
+
+	if (cl->prefix && (strncmp(name, cl->prefix, cl->len) != 0)) return 0;
+
+	cprintf(cl->listener, "%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+		"\t%" PRIu64 "\t%" PRIu64 "\n", name, hist->count,
+		(hist->total / hist->count) / 1000,
+		fr_latency_percentile(hist, 500) / 1000,
+		fr_latency_percentile(hist, 900) / 1000,
+		fr_latency_percentile(hist, 990) / 1000,
+		fr_latency_percentile(hist, 999) / 1000,
+		hist->max / 1000);
+
+	return 0;
+}
+
+static int command_stats_latency(rad_listen_t *listener, int argc, char *argv[])
+{
+	command_latency_ctx_t cl;
+
+	cl.listener = listener;
+	cl.prefix = (argc > 0) ? argv[0] : NULL;
+	cl.len = cl.prefix ? strlen(cl.prefix) : 0;
+
+	cprintf(listener, "name\tcount\tmean_us\tp50_us\tp90_us\tp99_us\tp999_us\tmax_us\n");
+	(void) fr_latency_walk(command_print_latency, &cl);
+
+	return CMD_OK;
+}
+
 #ifndef NDEBUG
 static int command_stats_memory(rad_listen_t *listener, int argc, char *argv[])
 {
@@ -3095,6 +3134,11 @@ static fr_command_table_t command_table_stats[] = {
 	  "stats state - show statistics for states",
 	  command_stats_state, NULL },
 
+	{ "latency", FR_READ,
+	  "stats latency [<prefix>] - show how long module calls and sections take, "
+	  "for all of them, or those whose names start with <prefix>",
+	  command_stats_latency, NULL },
+
 	{ "socket", FR_READ,
 	  "stats socket <ipaddr> <port> [udp|tcp] "
 	  "- show statistics for given socket",
@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/parser.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/escape.h>
 
 #include <ctype.h>
 
@@ -185,15 +186,25 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	default:
 		if (!rad_cond_assert(rhs && rhs->type == PW_TYPE_STRING)) return -1;
 		if (!rad_cond_assert(rhs && rhs->datum.strvalue)) return -1;
+#if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+		/*
+		 *	Expanded patterns are usually the same from one
+		 *	request to the next, so the compiled expression
+		 *	is taken from (and owned by) the thread's cache.
+		 */
+		slen = regex_compile_cached(&preg, rhs->datum.strvalue, rhs->length,
+					    map->rhs->tmpl_iflag, map->rhs->tmpl_mflag, true);
+#else
 		slen = regex_compile(request, &rreg, rhs->datum.strvalue, rhs->length,
 				     map->rhs->tmpl_iflag, map->rhs->tmpl_mflag, true, true);
+		preg = rreg;
+#endif
 		if (slen <= 0) {
 			REMARKER(rhs->datum.strvalue, -slen, fr_strerror());
 			EVAL_DEBUG("FAIL %d", __LINE__);
 
 			return -1;
 		}
-		preg = rreg;
 		break;
 	}
 
@@ -345,39 +356,21 @@ finish:
 }
 
 
-static size_t regex_escape(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
-{
-	char *p = out;
-
-	while (*in && (outlen >= 2)) {
-		switch (*in) {
-		case '\\':
-		case '.':
-		case '*':
-		case '+':
-		case '?':
-		case '|':
-		case '^':
-		case '$':
-		case '[':	/* we don't list close braces */
-		case '{':
-		case '(':
-			if (outlen < 3) goto done;
-
-			*(p++) = '\\';
-			outlen--;
-			/* FALL-THROUGH */
-
-		default:
-			*(p++) = *(in++);
-			outlen--;
-			break;
-		}
+/*
+ *	Regex metacharacters are written out after a backslash,
+ *	everything else is copied.  We don't list close braces.
+ */
+static fr_escape_t const regex_escaper = {
+	.action = {
+		['\\'] = '\\', ['.'] = '.', ['*'] = '*', ['+'] = '+',
+		['?'] = '?', ['|'] = '|', ['^'] = '^', ['$'] = '$',
+		['['] = '[', ['{'] = '{', ['('] = '('
 	}
+};
 
-done:
-	*(p++) = '\0';
-	return p - out;
+static size_t regex_escape(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
+{
+	return fr_escape(&regex_escaper, out, outlen, in, -1);
 }
 
 
@@ -32,9 +32,23 @@ RCSID("$Id$")
 #include <freeradius-devel/heap.h>
 #include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/threads.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
 
 typedef struct fr_connection fr_connection_t;
 
+/*
+ *	Slot in a thread cache's idle array.  Only the owning thread
+ *	fills slots, but any thread holding the pool mutex may empty
+ *	them, so reclaiming a connection is a single exchange.
+ */
+typedef _Atomic(fr_connection_t *) fr_connection_slot_t;
+
 static int fr_connection_pool_check(fr_connection_pool_t *pool, REQUEST *request);
 
 /** An individual connection within the connection pool
@@ -65,11 +79,75 @@ struct fr_connection {
 
 	bool		needs_reconnecting;	//!< Reconnect this connection before use.
 
+	fr_connection_thread_cache_t *owner;	//!< Cache of the thread which reserved the
+						//!< connection.  NULL if reserved by a thread
+						//!< without a cache.
+	fr_connection_t	*owner_prev;		//!< Previous connection reserved by the owner.
+	fr_connection_t	*owner_next;		//!< Next connection reserved by the owner.
+
 #ifdef PTHREAD_DEBUG
 	pthread_t	pthread_id;		//!< When 'in_use == true'.
 #endif
 };
 
+/** A thread's local cache of idle connections for a single pool
+ *
+ * As far as the pool is concerned, connections in a thread's cache are
+ * still reserved, so the pool's checks never look at them.  The owning
+ * thread reserves connections from, and releases them to, the cache
+ * without the pool mutex.
+ *
+ * A thread which finds the pool at max reclaims idle connections from
+ * other threads' caches, so a thread which goes quiet can't keep
+ * connections from everyone else.
+ *
+ * Counters are added to the pool's state with the mutex held, either
+ * when the cache falls back to the pool, or at most once a second when
+ * connections are released to the cache.
+ *
+ * @note Connections must be released by the thread which reserved them,
+ *	as PTHREAD_DEBUG builds already assert.
+ */
+struct fr_connection_thread_cache {
+	fr_connection_pool_t	*pool;		//!< Pool the cache belongs to.  NULL if the
+						//!< pool has been freed.
+	uint32_t		id;		//!< Of the pool, and the cache's index in the
+						//!< thread's cache array.
+	uint32_t		refs;		//!< Number of modules sharing the pool which
+						//!< have instantiated the cache.
+	fr_connection_thread_cache_t *next;	//!< Next cache belonging to the same pool.
+
+	fr_connection_slot_t	*idle;		//!< Idle connections, one per slot.  The owning
+						//!< thread fills the lowest empty slot, and takes
+						//!< from the highest full one.
+
+	fr_connection_t		*reserved;	//!< Connections currently reserved by this thread.
+
+	uint32_t		reconnects;	//!< Value of pool->reconnects when the idle
+						//!< connections were last checked.
+	time_t			last_at_max;	//!< Copy of the pool's last_at_max.
+	time_t			last_synced;	//!< Last time the counters were added to the pool's.
+	time_t			last_held_min;	//!< Last time we fired the min held trigger.
+	time_t			last_held_max;	//!< Last time we fired the max held trigger.
+	struct timeval		last_released;	//!< Last time a connection was released to the cache.
+
+	uint64_t		hits;		//!< Reservations satisfied from the cache, which
+						//!< haven't been added to the pool's state yet.
+#ifdef WITH_STATS
+	fr_stats_t		held_stats;	//!< How long cached connections were held for, which
+						//!< hasn't been added to the pool's state yet.
+#endif
+};
+
+/** All of a thread's connection caches, indexed by pool id
+ *
+ */
+typedef struct {
+	fr_connection_thread_cache_t **cache;	//!< Array of caches.
+	uint32_t		num;		//!< Length of the array.
+	uint32_t		used;		//!< Number of caches in the array.
+} fr_connection_thread_caches_t;
+
 /** A connection pool
  *
  * Defines the configuration of the connection pool, all the counters and
@@ -106,6 +184,15 @@ struct fr_connection_pool_t {
 	bool		spread;			//!< If true we spread requests over the connections,
 						//!< using the connection released longest ago, first.
 
+	uint32_t	thread_cache;		//!< Maximum number of idle connections each thread
+						//!< may keep in its local cache.  0 disables caching.
+	uint32_t	id;			//!< Index of this pool's cache in each thread's
+						//!< cache array.
+	fr_connection_thread_cache_t *caches;	//!< Thread caches belonging to this pool.
+	atomic_uint_fast32_t reconnects;	//!< Incremented when the pool is reconnected, so
+						//!< threads know to empty their caches.
+	atomic_uint_fast32_t cached;		//!< Number of idle connections in thread caches.
+
 	fr_heap_t	*heap;			//!< For the next connection heap
 
 	fr_connection_t	*head;			//!< Start of the connection list.
@@ -157,9 +244,28 @@ static const CONF_PARSER connection_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", PW_TYPE_TIMEVAL, fr_connection_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", PW_TYPE_INTEGER, fr_connection_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", PW_TYPE_BOOLEAN, fr_connection_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("thread_cache", PW_TYPE_INTEGER, fr_connection_pool_t, thread_cache), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Each thread has an array of caches, one for each pool it has
+ *	been instantiated for, indexed by pool id.  Pool ids are never
+ *	reused, so a stale entry for a freed pool is never looked up.
+ *
+ *	Caches are created and freed by modules' thread_instantiate
+ *	and thread_detach callbacks, so no destructor is needed.
+ */
+static _Thread_local fr_connection_thread_caches_t *connection_thread_caches;
+
+/*
+ *	Protects the link between caches and their pools, so that a
+ *	thread detaching and a pool being freed don't race.  Lock
+ *	ordering is connection_cache_mutex, then pool->mutex.
+ */
+static pthread_mutex_t connection_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t connection_pool_next_id;
+
 /** Order connections by reserved most recently
  */
 static int last_reserved_cmp(void const *one, void const *two)
@@ -248,6 +354,46 @@ static void fr_connection_link_head(fr_connection_pool_t *pool, fr_connection_t
 	}
 }
 
+/** Add a connection to the list of connections reserved through a thread's cache
+ *
+ * @note Must be called by the thread reserving the connection.
+ *
+ * @param[in] cache	of the reserving thread.
+ * @param[in] this	Connection being reserved.
+ */
+static void fr_connection_own(fr_connection_thread_cache_t *cache, fr_connection_t *this)
+{
+	this->owner = cache;
+	this->owner_prev = NULL;
+	this->owner_next = cache->reserved;
+	if (cache->reserved) cache->reserved->owner_prev = this;
+	cache->reserved = this;
+}
+
+/** Remove a connection from the list of connections reserved through a thread's cache
+ *
+ * @note Must be called by the thread which reserved the connection.
+ *
+ * @param[in] this	Connection being released or closed.
+ */
+static void fr_connection_disown(fr_connection_t *this)
+{
+	fr_connection_thread_cache_t *cache = this->owner;
+
+	if (!cache) return;
+
+	if (this->owner_prev) {
+		this->owner_prev->owner_next = this->owner_next;
+	} else {
+		rad_assert(cache->reserved == this);
+		cache->reserved = this->owner_next;
+	}
+	if (this->owner_next) this->owner_next->owner_prev = this->owner_prev;
+
+	this->owner = NULL;
+	this->owner_prev = this->owner_next = NULL;
+}
+
 /** Send a connection pool trigger.
  *
  * @param[in] pool	to send trigger for.
@@ -548,6 +694,7 @@ static void fr_connection_close_internal(fr_connection_pool_t *pool, REQUEST *re
 		rad_assert(pthread_equal(this->pthread_id, pthread_id) != 0);
 #endif
 
+		fr_connection_disown(this);
 		this->in_use = false;
 
 		rad_assert(pool->state.active != 0);
@@ -594,7 +741,9 @@ static int fr_connection_manage(fr_connection_pool_t *pool,
 	rad_assert(this != NULL);
 
 	/*
-	 *	Don't terminated in-use connections
+	 *	Don't terminated in-use connections.  Connections
+	 *	held in a thread's cache are in use, and are checked
+	 *	when they're taken from the cache.
 	 */
 	if (this->in_use) return 1;
 
@@ -650,7 +799,7 @@ static int fr_connection_manage(fr_connection_pool_t *pool,
  */
 static int fr_connection_pool_check(fr_connection_pool_t *pool, REQUEST *request)
 {
-	uint32_t spawn, idle, extra;
+	uint32_t spawn, idle, unused, extra;
 	time_t now = time(NULL);
 	fr_connection_t *this, *next;
 
@@ -659,12 +808,21 @@ static int fr_connection_pool_check(fr_connection_pool_t *pool, REQUEST *request
 		return 1;
 	}
 
+	/*
+	 *	Connections idle in threads' caches are reserved as
+	 *	far as we're concerned, but they're reclaimed when a
+	 *	thread finds the pool at max, so they count as spares.
+	 *	Only the unused ones can be closed here.
+	 */
+	unused = pool->state.num - pool->state.active;
+	idle = unused + atomic_load(&pool->cached);
+	if (idle > pool->state.num) idle = pool->state.num;
+
 	/*
 	 *	Some idle connections are OK, if they're within the
 	 *	configured "spare" range.  Any extra connections
 	 *	outside of that range can be closed.
 	 */
-	idle = pool->state.num - pool->state.active;
 	if (idle <= pool->spare) {
 		extra = 0;
 	} else {
@@ -744,6 +902,8 @@ static int fr_connection_pool_check(fr_connection_pool_t *pool, REQUEST *request
 		/* leave extra alone from above */
 	}
 
+	if (extra > unused) extra = unused;
+
 	/*
 	 *	Only try to open spares if we're not already attempting to open
 	 *	a connection. Avoids spurious log messages.
@@ -800,7 +960,383 @@ done:
 	return 1;
 }
 
+/** Check whether a cached connection has hit any of its limits
+ *
+ * Mirrors the checks in fr_connection_manage, but doesn't require the mutex.
+ * Connections needing to be reconnected are found by comparing the pool's
+ * reconnect count.
+ *
+ * @param[in] pool	the connection belongs to.
+ * @param[in] this	Connection to check.
+ * @param[in] now	Current time.
+ * @return
+ *	- true if the connection should be closed.
+ *	- false if the connection is still usable.
+ */
+static inline bool fr_connection_expired(fr_connection_pool_t *pool, fr_connection_t *this, time_t now)
+{
+	if ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) return true;
+	if ((pool->lifetime > 0) && ((this->created + pool->lifetime) < now)) return true;
+	if ((pool->idle_timeout > 0) && ((this->last_released.tv_sec + pool->idle_timeout) < now)) return true;
+
+	return false;
+}
+
+/** Release a connection to the pool's heap
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	the connection belongs to.
+ * @param[in] this	Connection to release.
+ */
+static void fr_connection_release_internal(fr_connection_pool_t *pool, fr_connection_t *this)
+{
+	rad_assert(this->in_use);
+	rad_assert(!this->owner);
+
+	this->in_use = false;
+
+	/*
+	 *	Insert the connection in the heap.
+	 *
+	 *	This will either be based on when we *started* using it
+	 *	(allowing fast links to be re-used, and slow links to be
+	 *	gradually expired), or when we released it (allowing
+	 *	the maximum amount of time between connection use).
+	 */
+	fr_heap_insert(pool->heap, this);
+
+	rad_assert(pool->state.active != 0);
+	pool->state.active--;
+}
+
+/** Place an idle connection in a thread's cache
+ *
+ * @note Must be called by the thread which owns the cache.
+ *
+ * @param[in] pool	the cache belongs to.
+ * @param[in] cache	to place the connection in.
+ * @param[in] this	Connection to place in the cache.  Must still be marked as in use.
+ * @return
+ *	- true if the connection was placed in the cache.
+ *	- false if the cache is full.
+ */
+static bool fr_connection_thread_cache_push(fr_connection_pool_t *pool, fr_connection_thread_cache_t *cache,
+					    fr_connection_t *this)
+{
+	uint32_t i;
+
+	/*
+	 *	Only we fill slots, so an empty slot stays empty
+	 *	until we fill it.
+	 */
+	for (i = 0; i < pool->thread_cache; i++) {
+		if (atomic_load_explicit(&cache->idle[i], memory_order_relaxed)) continue;
+
+		/*
+		 *	Count first, so a thread reclaiming the
+		 *	connection never takes the count below zero.
+		 */
+		atomic_fetch_add(&pool->cached, 1);
+		atomic_store(&cache->idle[i], this);
+		return true;
+	}
+
+	return false;
+}
+
+/** Take an idle connection from a thread's cache
+ *
+ * @note Must be called by the thread which owns the cache, or with the mutex held.
+ *
+ * @param[in] pool	the cache belongs to.
+ * @param[in] cache	to take the connection from.
+ * @return
+ *	- An idle connection, still marked as in use.
+ *	- NULL if the cache has no idle connections.
+ */
+static fr_connection_t *fr_connection_thread_cache_pop(fr_connection_pool_t *pool,
+						       fr_connection_thread_cache_t *cache)
+{
+	uint32_t	i;
+	fr_connection_t	*this;
+
+	for (i = pool->thread_cache; i > 0; i--) {
+		if (!atomic_load_explicit(&cache->idle[i - 1], memory_order_relaxed)) continue;
+
+		/*
+		 *	The connection may have been reclaimed by
+		 *	another thread since we looked.
+		 */
+		this = atomic_exchange(&cache->idle[i - 1], NULL);
+		if (!this) continue;
+
+		atomic_fetch_sub(&pool->cached, 1);
+		return this;
+	}
+
+	return NULL;
+}
+
+/** Release a cache's idle connections to the pool
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	the cache belongs to.
+ * @param[in] cache	to empty.
+ * @return the number of connections released.
+ */
+static uint32_t fr_connection_thread_cache_empty(fr_connection_pool_t *pool, fr_connection_thread_cache_t *cache)
+{
+	fr_connection_t	*this;
+	uint32_t	released = 0;
+
+	while ((this = fr_connection_thread_cache_pop(pool, cache))) {
+		fr_connection_release_internal(pool, this);
+		released++;
+	}
+
+	return released;
+}
+
+/** Reclaim idle connections from all the threads' caches
+ *
+ * Called when a thread finds the pool at max.  Threads which have gone
+ * quiet may be holding idle connections in their caches, which no one
+ * else could otherwise use.
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	to reclaim connections for.
+ * @return the number of connections released to the pool.
+ */
+static uint32_t fr_connection_thread_cache_reclaim(fr_connection_pool_t *pool)
+{
+	fr_connection_thread_cache_t	*cache;
+	uint32_t			released = 0;
+
+	if (atomic_load(&pool->cached) == 0) return 0;
+
+	for (cache = pool->caches; cache; cache = cache->next) {
+		released += fr_connection_thread_cache_empty(pool, cache);
+	}
+
+	return released;
+}
+
+/** Add a cache's counters to the pool's state, and update the cache's copy of the pool's state
+ *
+ * If the pool has been reconnected, the cache's idle connections are
+ * released to the pool so that it can close them.
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	the cache belongs to.
+ * @param[in] cache	to sync.
+ * @param[in] now	Current time.
+ */
+static void fr_connection_thread_cache_sync(fr_connection_pool_t *pool, fr_connection_thread_cache_t *cache,
+					    time_t now)
+{
+	uint32_t reconnects = atomic_load(&pool->reconnects);
+
+	if (cache->reconnects != reconnects) {
+		fr_connection_thread_cache_empty(pool, cache);
+		cache->reconnects = reconnects;
+	}
+
+	pool->state.cache_hits += cache->hits;
+	cache->hits = 0;
+
+#ifdef WITH_STATS
+	{
+		size_t i;
+
+		for (i = 0; i < (sizeof(cache->held_stats.elapsed) / sizeof(*cache->held_stats.elapsed)); i++) {
+			pool->state.held_stats.elapsed[i] += cache->held_stats.elapsed[i];
+		}
+		memset(&cache->held_stats, 0, sizeof(cache->held_stats));
+	}
+#endif
+
+	if (fr_timeval_cmp(&cache->last_released, &pool->state.last_released) > 0) {
+		pool->state.last_released = cache->last_released;
+	}
+
+	cache->last_at_max = pool->state.last_at_max;
+	cache->last_synced = now;
+}
+
+/** Return a cache's idle connections to the pool, and unlink the cache from the pool
+ *
+ * Connections still reserved by the thread will be released to the pool
+ * when the thread releases them.
+ *
+ * @note Must be called with connection_cache_mutex held, and the pool mutex free.
+ *
+ * @param[in] cache	to detach.
+ */
+static void fr_connection_thread_cache_detach(fr_connection_thread_cache_t *cache)
+{
+	fr_connection_pool_t		*pool = cache->pool;
+	fr_connection_thread_cache_t	**last;
+	fr_connection_t			*this, *next;
+
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	fr_connection_thread_cache_empty(pool, cache);
+
+	for (this = cache->reserved; this; this = next) {
+		next = this->owner_next;
+
+		this->owner = NULL;
+		this->owner_prev = this->owner_next = NULL;
+	}
+	cache->reserved = NULL;
+
+	fr_connection_thread_cache_sync(pool, cache, time(NULL));
+
+	for (last = &pool->caches; *last; last = &(*last)->next) {
+		if (*last != cache) continue;
+
+		*last = cache->next;
+		break;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	cache->pool = NULL;
+	cache->next = NULL;
+}
+
+/** Create the current thread's cache for a pool
+ *
+ * Should be called from the thread_instantiate callback of modules using
+ * the pool.  Threads without a cache reserve connections directly from
+ * the pool.
+ *
+ * @param[in] pool	to create the cache for.
+ * @return
+ *	- The thread's cache.
+ *	- NULL if caching is disabled for the pool, or on error.
+ */
+fr_connection_thread_cache_t *fr_connection_pool_thread_instantiate(fr_connection_pool_t *pool)
+{
+	fr_connection_thread_caches_t	*caches = connection_thread_caches;
+	fr_connection_thread_cache_t	*cache;
+	uint32_t			i;
+
+	if (!pool->thread_cache) return NULL;
+
+	if (!caches) {
+		caches = talloc_zero(NULL, fr_connection_thread_caches_t);
+		if (!caches) return NULL;
+
+		connection_thread_caches = caches;
+	}
+
+	/*
+	 *	Several modules may share the pool.
+	 */
+	if ((pool->id < caches->num) && caches->cache[pool->id]) {
+		cache = caches->cache[pool->id];
+		cache->refs++;
+		return cache;
+	}
+
+	if (pool->id >= caches->num) {
+		fr_connection_thread_cache_t **array;
+
+		array = talloc_realloc(caches, caches->cache, fr_connection_thread_cache_t *, pool->id + 1);
+		if (!array) return NULL;
+
+		memset(array + caches->num, 0, sizeof(*array) * ((pool->id + 1) - caches->num));
+		caches->cache = array;
+		caches->num = pool->id + 1;
+	}
+
+	cache = talloc_zero(caches, fr_connection_thread_cache_t);
+	if (!cache) return NULL;
+
+	cache->idle = talloc_array(cache, fr_connection_slot_t, pool->thread_cache);
+	if (!cache->idle) {
+		talloc_free(cache);
+		return NULL;
+	}
+	for (i = 0; i < pool->thread_cache; i++) atomic_init(&cache->idle[i], NULL);
+	cache->pool = pool;
+	cache->id = pool->id;
+	cache->refs = 1;
+	cache->reconnects = atomic_load(&pool->reconnects);
+
+	pthread_mutex_lock(&connection_cache_mutex);
+	pthread_mutex_lock(&pool->mutex);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_mutex_unlock(&connection_cache_mutex);
+
+	caches->cache[pool->id] = cache;
+	caches->used++;
+
+	return cache;
+}
+
+/** Return the connections held in the current thread's cache to the pool, and free the cache
+ *
+ * Should be called from the thread_detach callback of modules using the pool.
+ * May be called after the pool has been freed.
+ *
+ * @param[in] cache	returned by #fr_connection_pool_thread_instantiate, may be NULL.
+ */
+void fr_connection_pool_thread_detach(fr_connection_thread_cache_t *cache)
+{
+	fr_connection_thread_caches_t	*caches = connection_thread_caches;
+
+	if (!cache) return;
+
+	/*
+	 *	Other modules sharing the pool are still using
+	 *	the cache.
+	 */
+	if (--cache->refs > 0) return;
+
+	rad_assert(caches && (cache->id < caches->num) && (caches->cache[cache->id] == cache));
+
+	pthread_mutex_lock(&connection_cache_mutex);
+	fr_connection_thread_cache_detach(cache);
+	pthread_mutex_unlock(&connection_cache_mutex);
+
+	caches->cache[cache->id] = NULL;
+	talloc_free(cache);
+
+	if (--caches->used == 0) {
+		talloc_free(caches);
+		connection_thread_caches = NULL;
+	}
+}
+
+/** Find the current thread's cache for a pool
+ *
+ * @param[in] pool	to find the cache for.
+ * @return
+ *	- The thread's cache.
+ *	- NULL if the thread has no cache for the pool.
+ */
+static inline fr_connection_thread_cache_t *fr_connection_thread_cache(fr_connection_pool_t *pool)
+{
+	fr_connection_thread_caches_t	*caches = connection_thread_caches;
+
+	if (!caches || (pool->id >= caches->num)) return NULL;
+
+	return caches->cache[pool->id];
+}
+
 /** Get a connection from the connection pool
+ *
+ * Tries the thread's local cache first, which doesn't require the mutex.
+ * Only if the cache is empty do we go to the pool's heap (or spawn a new
+ * connection).
  *
  * @note Must be called with the mutex free.
  *
@@ -813,24 +1349,69 @@ done:
  */
 static void *fr_connection_get_internal(fr_connection_pool_t *pool, REQUEST *request, bool spawn)
 {
-	time_t now;
-	fr_connection_t *this;
+	struct timeval			now;
+	fr_connection_t			*this;
+	fr_connection_thread_cache_t	*cache;
 
 	if (!pool) return NULL;
 
-	pthread_mutex_lock(&pool->mutex);
+	gettimeofday(&now, NULL);
 
-	now = time(NULL);
+	cache = fr_connection_thread_cache(pool);
+	if (cache) {
+		/*
+		 *	The pool was reconnected, hand our idle
+		 *	connections back so they can be closed.
+		 */
+		if (cache->reconnects != atomic_load(&pool->reconnects)) {
+			pthread_mutex_lock(&pool->mutex);
+			fr_connection_thread_cache_sync(pool, cache, now.tv_sec);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+
+		while ((this = fr_connection_thread_cache_pop(pool, cache))) {
+			if (!fr_connection_expired(pool, this, now.tv_sec)) {
+				cache->hits++;
+				this->num_uses++;
+				this->last_reserved = now;
+				fr_connection_own(cache, this);
+
+#ifdef PTHREAD_DEBUG
+				this->pthread_id = pthread_self();
+#endif
+				ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ") from thread cache",
+					  this->number);
+
+				return this->connection;
+			}
+
+			/*
+			 *	Hand the connection back to the pool,
+			 *	and let it close it.
+			 */
+			pthread_mutex_lock(&pool->mutex);
+			fr_connection_release_internal(pool, this);
+			fr_connection_manage(pool, request, this, now.tv_sec);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	if (cache) {
+		pool->state.cache_misses++;
+		fr_connection_thread_cache_sync(pool, cache, now.tv_sec);
+	}
 
 	/*
 	 *	Grab the link with the lowest latency, and check it
 	 *	for limits.  If "connection manage" says the link is
 	 *	no longer usable, go grab another one.
 	 */
+retry:
 	do {
 		this = fr_heap_peek(pool->heap);
 		if (!this) break;
-	} while (!fr_connection_manage(pool, request, this, now));
+	} while (!fr_connection_manage(pool, request, this, now.tv_sec));
 
 	/*
 	 *	We have a working connection.  Extract it from the
@@ -844,13 +1425,20 @@ static void *fr_connection_get_internal(fr_connection_pool_t *pool, REQUEST *req
 	if (pool->state.num == pool->max) {
 		bool complain = false;
 
+		/*
+		 *	Other threads may be holding idle connections
+		 *	in their caches.  Take them back, and try again.
+		 */
+		if (fr_connection_thread_cache_reclaim(pool) > 0) goto retry;
+
 		/*
 		 *	Rate-limit complaints.
 		 */
-		if (pool->state.last_at_max != now) {
+		if (pool->state.last_at_max != now.tv_sec) {
 			complain = true;
-			pool->state.last_at_max = now;
+			pool->state.last_at_max = now.tv_sec;
 		}
+		if (cache) cache->last_at_max = now.tv_sec;
 
 		pthread_mutex_unlock(&pool->mutex);
 		if (!RATE_LIMIT_ENABLED || complain) {
@@ -875,14 +1463,15 @@ static void *fr_connection_get_internal(fr_connection_pool_t *pool, REQUEST *req
 	/*
 	 *	Returns unlocked on failure, or locked on success
 	 */
-	this = fr_connection_spawn(pool, request, now, true, false);
+	this = fr_connection_spawn(pool, request, now.tv_sec, true, false);
 	if (!this) return NULL;
 
 do_return:
 	pool->state.active++;
 	this->num_uses++;
-	gettimeofday(&this->last_reserved, NULL);
 	this->in_use = true;
+	this->last_reserved = now;
+	if (cache) fr_connection_own(cache, this);
 
 #ifdef PTHREAD_DEBUG
 	this->pthread_id = pthread_self();
@@ -1036,6 +1625,12 @@ fr_connection_pool_t *fr_connection_pool_init(TALLOC_CTX *ctx,
 
 	pool->log_prefix = log_prefix ? talloc_typed_strdup(pool, log_prefix) : "core";
 	pthread_mutex_init(&pool->mutex, NULL);
+
+	pthread_mutex_lock(&connection_cache_mutex);
+	pool->id = connection_pool_next_id++;
+	pthread_mutex_unlock(&connection_cache_mutex);
+	atomic_init(&pool->reconnects, 0);
+	atomic_init(&pool->cached, 0);
 	pthread_cond_init(&pool->done_spawn, NULL);
 	pthread_cond_init(&pool->done_reconnecting, NULL);
 
@@ -1070,6 +1665,14 @@ fr_connection_pool_t *fr_connection_pool_init(TALLOC_CTX *ctx,
 	FR_INTEGER_BOUND_CHECK("max", pool->max, <=, 1024);
 	FR_INTEGER_BOUND_CHECK("start", pool->start, <=, pool->max);
 	FR_INTEGER_BOUND_CHECK("spare", pool->spare, <=, (pool->max - pool->min));
+	FR_INTEGER_BOUND_CHECK("thread_cache", pool->thread_cache, <=, pool->max);
+
+	/*
+	 *	Thread caches hand out the most recently released
+	 *	connection, which is the opposite of what spread
+	 *	wants.
+	 */
+	if (pool->spread) pool->thread_cache = 0;
 
 	if (pool->lifetime > 0) {
 		FR_INTEGER_COND_CHECK("idle_timeout", pool->idle_timeout, (pool->idle_timeout <= pool->lifetime), 0);
@@ -1243,6 +1846,12 @@ int fr_connection_pool_reconnect(fr_connection_pool_t *pool, REQUEST *request)
 	 */
 	for (this = pool->head; this; this = this->next) this->needs_reconnecting = true;
 
+	/*
+	 *	Idle connections in thread caches are still marked
+	 *	as in use.  Tell the threads to hand them back.
+	 */
+	atomic_fetch_add(&pool->reconnects, 1);
+
 	/*
 	 *	Call the reconnect callback (if one's set)
 	 *	This may modify the opaque data associated
@@ -1304,6 +1913,14 @@ void fr_connection_pool_free(fr_connection_pool_t *pool)
 
 	DEBUG2("Removing connection pool");
 
+	/*
+	 *	Take back any connections held in thread caches,
+	 *	and stop the threads from returning them later.
+	 */
+	pthread_mutex_lock(&connection_cache_mutex);
+	while (pool->caches) fr_connection_thread_cache_detach(pool->caches);
+	pthread_mutex_unlock(&connection_cache_mutex);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	/*
@@ -1356,70 +1973,141 @@ void *fr_connection_get(fr_connection_pool_t *pool, REQUEST *request)
 	return fr_connection_get_internal(pool, request, true);
 }
 
-/** Release a connection
+/** Record release time and held stats for a connection
  *
- * Will mark a connection as unused and decrement the number of active
- * connections.
+ * @note Must be called with the mutex held if cache is NULL.
  *
- * @see fr_connection_get
- * @param[in] pool	to release the connection in.
- * @param[in] request	The current request.
- * @param[in] conn	to release.
+ * @param[in] pool		the connection belongs to.
+ * @param[in] cache		the connection is being released to.  If NULL, the
+ *				pool's state is updated.
+ * @param[in] this		Connection being released.
+ * @param[out] trigger_min	Set to true if the min held trigger should fire.
+ * @param[out] trigger_max	Set to true if the max held trigger should fire.
  */
-void fr_connection_release(fr_connection_pool_t *pool, REQUEST *request, void *conn)
+static void fr_connection_release_stats(fr_connection_pool_t *pool, fr_connection_thread_cache_t *cache,
+					fr_connection_t *this, bool *trigger_min, bool *trigger_max)
 {
-	fr_connection_t *this;
 	struct timeval	held;
-	bool trigger_min = false, trigger_max = false;
-
-	this = fr_connection_find(pool, conn);
-	if (!this) return;
-
-	this->in_use = false;
+	time_t		*last_held_min, *last_held_max;
 
 	/*
 	 *	Record when the connection was last released
 	 */
 	gettimeofday(&this->last_released, NULL);
-	pool->state.last_released = this->last_released;
 
-	/*
-	 *	This is done inside the mutex to ensure
-	 *	updates are atomic.
-	 */
+	if (cache) {
+		cache->last_released = this->last_released;
+		last_held_min = &cache->last_held_min;
+		last_held_max = &cache->last_held_max;
+	} else {
+		pool->state.last_released = this->last_released;
+		last_held_min = &pool->state.last_held_min;
+		last_held_max = &pool->state.last_held_max;
+	}
+
 	fr_timeval_subtract(&held, &this->last_released, &this->last_reserved);
 
 	/*
 	 *	Check we've not exceeded out trigger limits
+	 *
+	 *	Each thread's cache rate limits its own triggers,
+	 *	so they may fire once a second per thread.
 	 */
 	if ((pool->held_trigger_min.tv_sec || pool->held_trigger_min.tv_usec) &&
 	    (fr_timeval_cmp(&held, &pool->held_trigger_min) < 0) &&
-	    (pool->state.last_held_min != this->last_released.tv_sec)) {
-	    	trigger_min = true;
-	    	pool->state.last_held_min = this->last_released.tv_sec;
+	    (*last_held_min != this->last_released.tv_sec)) {
+	    	*trigger_min = true;
+	    	*last_held_min = this->last_released.tv_sec;
 	}
 
 	if ((pool->held_trigger_max.tv_sec || pool->held_trigger_min.tv_usec) &&
 	    (fr_timeval_cmp(&held, &pool->held_trigger_max) > 0) &&
-	    (pool->state.last_held_max != this->last_released.tv_sec)) {
-	    	trigger_max = true;
-	    	pool->state.last_held_max = this->last_released.tv_sec;
+	    (*last_held_max != this->last_released.tv_sec)) {
+	    	*trigger_max = true;
+	    	*last_held_max = this->last_released.tv_sec;
 	}
 
-	fr_stats_bins(&pool->state.held_stats, &this->last_reserved, &this->last_released);
+#ifdef WITH_STATS
+	fr_stats_bins(cache ? &cache->held_stats : &pool->state.held_stats, &this->last_reserved, &this->last_released);
+#endif
+}
 
-	/*
-	 *	Insert the connection in the heap.
-	 *
-	 *	This will either be based on when we *started* using it
-	 *	(allowing fast links to be re-used, and slow links to be
-	 *	gradually expired), or when we released it (allowing
-	 *	the maximum amount of time between connection use).
-	 */
-	fr_heap_insert(pool->heap, this);
+/** Release a connection
+ *
+ * Will mark a connection as unused and decrement the number of active
+ * connections.
+ *
+ * If the connection was reserved through the thread's local cache, and
+ * that cache isn't full, the connection is placed in the cache without
+ * taking the mutex.  It stays reserved as far as the pool is concerned.
+ *
+ * @see fr_connection_get
+ * @param[in] pool	to release the connection in.
+ * @param[in] request	The current request.
+ * @param[in] conn	to release.
+ */
+void fr_connection_release(fr_connection_pool_t *pool, REQUEST *request, void *conn)
+{
+	fr_connection_t			*this = NULL;
+	fr_connection_thread_cache_t	*cache;
+	bool				trigger_min = false, trigger_max = false;
+
+	cache = fr_connection_thread_cache(pool);
+	if (cache) {
+		for (this = cache->reserved; this; this = this->owner_next) {
+			if (this->connection == conn) break;
+		}
+	}
 
-	rad_assert(pool->state.active != 0);
-	pool->state.active--;
+	if (this) {
+		fr_connection_disown(this);
+		fr_connection_release_stats(pool, cache, this, &trigger_min, &trigger_max);
+
+		/*
+		 *	Keep the connection in the thread's cache, unless
+		 *	the cache is full, the pool has been reconnected,
+		 *	or a thread recently found the pool empty (in which
+		 *	case it may be waiting for connections that we'd
+		 *	otherwise be hoarding).
+		 */
+		if ((cache->reconnects == atomic_load(&pool->reconnects)) &&
+		    ((cache->last_at_max + 1) < this->last_released.tv_sec) &&
+		    fr_connection_thread_cache_push(pool, cache, this)) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ") to thread cache", this->number);
+
+			/*
+			 *	Still need to manage the pool, and to
+			 *	add our counters to its state, but only
+			 *	once a second.
+			 */
+			if (cache->last_synced != this->last_released.tv_sec) {
+				pthread_mutex_lock(&pool->mutex);
+				fr_connection_thread_cache_sync(pool, cache, this->last_released.tv_sec);
+				fr_connection_pool_check(pool, request);
+			}
+			goto finish;
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		fr_connection_thread_cache_sync(pool, cache, this->last_released.tv_sec);
+	} else {
+		this = fr_connection_find(pool, conn);
+		if (!this) return;
+
+		/*
+		 *	Connections reserved through a cache must be
+		 *	released by the thread which reserved them.
+		 */
+		rad_assert(!this->owner);
+
+		/*
+		 *	This is done inside the mutex to ensure
+		 *	updates are atomic.
+		 */
+		fr_connection_release_stats(pool, NULL, this, &trigger_min, &trigger_max);
+	}
+
+	fr_connection_release_internal(pool, this);
 
 	ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
 
@@ -1430,6 +2118,7 @@ void fr_connection_release(fr_connection_pool_t *pool, REQUEST *request, void *c
 	 */
 	fr_connection_pool_check(pool, request);
 
+finish:
 	if (trigger_min) fr_connection_trigger_exec(pool, request, "min");
 	if (trigger_max) fr_connection_trigger_exec(pool, request, "max");
 }
@@ -0,0 +1,472 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file crypto_offload.c
+ * @brief Run expensive password hashing in a dedicated thread pool.
+ *
+ * Some password hashing schemes (bcrypt, sha512-crypt, large salted
+ * digests) take milliseconds per attempt.  Running them on a worker
+ * stalls every other request that worker is processing.
+ *
+ * Instead, the worker submits a job to a bounded queue serviced by a
+ * small pool of crypto threads, and yields the request.  When the job
+ * completes, the crypto thread adds it to the submitting worker's done
+ * list, and wakes the worker with its #fr_worker_wake_t.  The worker
+ * then marks the request as resumable.
+ *
+ * Jobs are talloced by the worker, in a ctx only the worker frees.  The
+ * crypto threads only read the job's data, and write its result.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/crypto_offload.h>
+#include <freeradius-devel/worker_wake.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <pthread.h>
+#include <signal.h>
+
+typedef enum {
+	CRYPTO_JOB_INIT = 0,			//!< Allocated, not yet submitted.
+	CRYPTO_JOB_QUEUED,			//!< Waiting for a crypto thread.
+	CRYPTO_JOB_RUNNING,			//!< Being run by a crypto thread.
+	CRYPTO_JOB_DONE,			//!< In the worker's done list.
+	CRYPTO_JOB_COLLECTED			//!< Result seen by the worker.
+} crypto_job_state_t;
+
+/** A thread pool for running hashing functions
+ *
+ */
+struct fr_crypto_offload {
+	char const			*name;		//!< For log messages.
+
+	pthread_mutex_t			mutex;		//!< Protects everything below, and the
+							//!< state and done lists of jobs.
+	pthread_cond_t			work;		//!< Signalled when a job is queued.
+	pthread_cond_t			drained;	//!< Signalled when a worker's last
+							//!< outstanding job completes.
+
+	fr_fifo_t			*queue;		//!< Jobs waiting for a thread.
+
+	pthread_t			*threads;	//!< Crypto threads.
+	uint32_t			num_threads;	//!< Number of crypto threads started.
+
+	bool				stop;		//!< Tell the crypto threads to exit.
+
+	fr_crypto_offload_stats_t	stats;		//!< Metrics for the pool.
+};
+
+/** A worker's view of the pool
+ *
+ */
+struct fr_crypto_offload_thread {
+	fr_crypto_offload_t		*co;		//!< Pool we submit jobs to.
+
+	fr_worker_wake_t		*wake;		//!< Signalled by crypto threads on completion.
+
+	fr_crypto_offload_job_t		*done;		//!< Completed jobs, not yet collected.
+	fr_crypto_offload_job_t		**done_tail;	//!< Where to add the next completed job.
+
+	uint32_t			outstanding;	//!< Jobs queued or running.
+	bool				dead;		//!< Worker is exiting.
+};
+
+/** A single hashing operation
+ *
+ */
+struct fr_crypto_offload_job {
+	fr_crypto_offload_thread_t	*cot;		//!< Worker which submitted the job.
+	REQUEST				*request;	//!< To resume when the job completes.
+
+	fr_crypto_offload_func_t	func;		//!< Hashing function to run.
+	void				*uctx;		//!< Data for func.
+	int				result;		//!< What func returned.
+
+	crypto_job_state_t		state;		//!< Where the job is.
+	bool				cancelled;	//!< Freed by the worker while in flight.
+
+	struct timeval			queued;		//!< When the job was submitted.
+
+	fr_crypto_offload_job_t		*next;		//!< Next in the worker's done list.
+};
+
+static uint64_t timeval_usec(struct timeval const *end, struct timeval const *start)
+{
+	struct timeval elapsed;
+
+	fr_timeval_subtract(&elapsed, end, start);
+
+	return ((uint64_t)elapsed.tv_sec * 1000000) + elapsed.tv_usec;
+}
+
+/** Add a finished job to its worker's done list, and wake the worker
+ *
+ * @note Must be called with the pool mutex held.
+ */
+static void crypto_job_done(fr_crypto_offload_t *co, fr_crypto_offload_job_t *job)
+{
+	fr_crypto_offload_thread_t	*cot = job->cot;
+	bool				wake = (cot->done == NULL);
+
+	job->state = CRYPTO_JOB_DONE;
+	job->next = NULL;
+	*cot->done_tail = job;
+	cot->done_tail = &job->next;
+
+	rad_assert(cot->outstanding > 0);
+	if (--cot->outstanding == 0) pthread_cond_broadcast(&co->drained);
+
+	/*
+	 *	The worker collects the whole done list when woken,
+	 *	so one wakeup per batch of completions is enough.
+	 */
+	if (wake && !cot->dead) fr_worker_wake_signal(cot->wake);
+}
+
+/** Main loop of a crypto thread
+ *
+ */
+static void *crypto_thread(void *arg)
+{
+	fr_crypto_offload_t	*co = arg;
+	fr_crypto_offload_job_t	*job;
+	struct timeval		started, now;
+	sigset_t		sigset;
+	int			result;
+
+	/*
+	 *	Signals are for the main thread.
+	 */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&co->mutex);
+	for (;;) {
+		while (!co->stop && (fr_fifo_num_elements(co->queue) == 0)) pthread_cond_wait(&co->work, &co->mutex);
+		if (co->stop) break;
+
+		job = fr_fifo_pop(co->queue);
+		co->stats.queued--;
+
+		/*
+		 *	Worker gave up on the job, don't bother
+		 *	running it.
+		 */
+		if (job->cancelled || job->cot->dead) {
+			job->result = -1;
+			crypto_job_done(co, job);
+			continue;
+		}
+
+		job->state = CRYPTO_JOB_RUNNING;
+		co->stats.running++;
+		pthread_mutex_unlock(&co->mutex);
+
+		gettimeofday(&started, NULL);
+		result = job->func(job->uctx);
+		gettimeofday(&now, NULL);
+
+		pthread_mutex_lock(&co->mutex);
+		job->result = result;
+		co->stats.running--;
+		co->stats.completed++;
+		co->stats.wait_usec += timeval_usec(&started, &job->queued);
+		co->stats.run_usec += timeval_usec(&now, &started);
+		crypto_job_done(co, job);
+	}
+	pthread_mutex_unlock(&co->mutex);
+
+	return NULL;
+}
+
+/** Stop the crypto threads
+ *
+ * Jobs still queued are abandoned.  By now all the workers should have
+ * exited, so nothing is waiting for them.
+ */
+static int _crypto_offload_free(fr_crypto_offload_t *co)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&co->mutex);
+	co->stop = true;
+	pthread_cond_broadcast(&co->work);
+	pthread_mutex_unlock(&co->mutex);
+
+	for (i = 0; i < co->num_threads; i++) pthread_join(co->threads[i], NULL);
+
+	DEBUG2("%s - Crypto offload: %" PRIu64 " jobs completed, %" PRIu64 " rejected, "
+	       "max queue depth %u", co->name, co->stats.completed, co->stats.rejected, co->stats.queued_max);
+
+	pthread_cond_destroy(&co->drained);
+	pthread_cond_destroy(&co->work);
+	pthread_mutex_destroy(&co->mutex);
+
+	return 0;
+}
+
+/** Create a pool of crypto threads
+ *
+ * @param[in] ctx	to allocate the pool in.  Freeing the pool stops its threads.
+ * @param[in] name	used as a prefix for log messages.
+ * @param[in] config	number of threads, and size of the queue.
+ * @return
+ *	- A new pool.
+ *	- NULL on error.
+ */
+fr_crypto_offload_t *fr_crypto_offload_create(TALLOC_CTX *ctx, char const *name,
+					      fr_crypto_offload_config_t const *config)
+{
+	fr_crypto_offload_t	*co;
+	uint32_t		i;
+	int			ret;
+
+	rad_assert(config->threads > 0);
+
+	co = talloc_zero(ctx, fr_crypto_offload_t);
+	if (!co) return NULL;
+
+	co->name = talloc_typed_strdup(co, name);
+
+	co->queue = fr_fifo_create(co, config->max_queued, NULL);
+	if (!co->queue) {
+		ERROR("%s - Failed creating crypto offload queue", name);
+		talloc_free(co);
+		return NULL;
+	}
+	MEM(co->threads = talloc_array(co, pthread_t, config->threads));
+
+	pthread_mutex_init(&co->mutex, NULL);
+	pthread_cond_init(&co->work, NULL);
+	pthread_cond_init(&co->drained, NULL);
+	talloc_set_destructor(co, _crypto_offload_free);
+
+	for (i = 0; i < config->threads; i++) {
+		ret = pthread_create(&co->threads[i], NULL, crypto_thread, co);
+		if (ret != 0) {
+			ERROR("%s - Failed creating crypto thread: %s", name, fr_syserror(ret));
+			talloc_free(co);
+			return NULL;
+		}
+		co->num_threads++;
+	}
+
+	return co;
+}
+
+/** Copy out the pool's counters and gauges
+ *
+ * @param[in] co	to get statistics for.
+ * @param[out] stats	Where to write the statistics.
+ */
+void fr_crypto_offload_stats(fr_crypto_offload_t *co, fr_crypto_offload_stats_t *stats)
+{
+	pthread_mutex_lock(&co->mutex);
+	memcpy(stats, &co->stats, sizeof(*stats));
+	pthread_mutex_unlock(&co->mutex);
+}
+
+/** Collect completed jobs, and resume their requests
+ *
+ */
+static void _crypto_offload_thread_wake(void *uctx)
+{
+	fr_crypto_offload_thread_t	*cot = talloc_get_type_abort(uctx, fr_crypto_offload_thread_t);
+	fr_crypto_offload_job_t		*job, *next;
+
+	pthread_mutex_lock(&cot->co->mutex);
+	job = cot->done;
+	cot->done = NULL;
+	cot->done_tail = &cot->done;
+	for (next = job; next; next = next->next) next->state = CRYPTO_JOB_COLLECTED;
+	pthread_mutex_unlock(&cot->co->mutex);
+
+	for (; job; job = next) {
+		next = job->next;
+
+		if (job->cancelled) {
+			talloc_free(job);
+			continue;
+		}
+
+		unlang_resumable(job->request);
+	}
+}
+
+/** Wait for any jobs still being run for this worker
+ *
+ * The wakeup handle is freed after this, as it's a child of the worker's handle.
+ */
+static int _crypto_offload_thread_free(fr_crypto_offload_thread_t *cot)
+{
+	fr_crypto_offload_t *co = cot->co;
+
+	pthread_mutex_lock(&co->mutex);
+	cot->dead = true;
+	while (cot->outstanding > 0) pthread_cond_wait(&co->drained, &co->mutex);
+	pthread_mutex_unlock(&co->mutex);
+
+	return 0;
+}
+
+/** Register a worker with a crypto thread pool
+ *
+ * @param[in] ctx	to allocate the handle in.  Must be freed by the worker.
+ * @param[in] co	pool to submit jobs to.
+ * @param[in] el	the worker's event list.  Completion events are delivered here.
+ * @return
+ *	- A new handle.
+ *	- NULL on error.
+ */
+fr_crypto_offload_thread_t *fr_crypto_offload_thread_create(TALLOC_CTX *ctx, fr_crypto_offload_t *co,
+							    fr_event_list_t *el)
+{
+	fr_crypto_offload_thread_t *cot;
+
+	cot = talloc_zero(ctx, fr_crypto_offload_thread_t);
+	if (!cot) return NULL;
+
+	cot->co = co;
+	cot->done_tail = &cot->done;
+
+	cot->wake = fr_worker_wake_create(cot, co->name, el, _crypto_offload_thread_wake, cot);
+	if (!cot->wake) {
+		talloc_free(cot);
+		return NULL;
+	}
+	talloc_set_destructor(cot, _crypto_offload_thread_free);
+
+	return cot;
+}
+
+/** Stop the pool touching a job the worker no longer wants
+ *
+ * If the job is queued or running, it's marked as cancelled, and freed
+ * by the worker when it completes.
+ */
+static int _crypto_offload_job_free(fr_crypto_offload_job_t *job)
+{
+	fr_crypto_offload_t	*co = job->cot->co;
+	int			ret = 0;
+
+	pthread_mutex_lock(&co->mutex);
+	switch (job->state) {
+	case CRYPTO_JOB_QUEUED:
+	case CRYPTO_JOB_RUNNING:
+	case CRYPTO_JOB_DONE:
+		/*
+		 *	The worker is exiting, and has already
+		 *	waited for its jobs to finish.
+		 */
+		if (job->cot->dead && (job->state == CRYPTO_JOB_DONE)) break;
+
+		job->cancelled = true;
+		job->request = NULL;
+		ret = -1;
+		break;
+
+	default:
+		break;
+	}
+	pthread_mutex_unlock(&co->mutex);
+
+	return ret;
+}
+
+/** Allocate a new job
+ *
+ * The caller should allocate data for the job in the job's ctx, so that it
+ * outlives the request if the request is cancelled.
+ *
+ * @param[in] cot	the worker's handle for the pool.
+ * @param[in] func	hashing function to run.
+ * @return
+ *	- A new job.  Free it with talloc_free() once the request has resumed,
+ *	  or if the request is cancelled.
+ *	- NULL on error.
+ */
+fr_crypto_offload_job_t *fr_crypto_offload_job_alloc(fr_crypto_offload_thread_t *cot,
+						     fr_crypto_offload_func_t func)
+{
+	fr_crypto_offload_job_t *job;
+
+	job = talloc_zero(cot, fr_crypto_offload_job_t);
+	if (!job) return NULL;
+
+	job->cot = cot;
+	job->func = func;
+	talloc_set_destructor(job, _crypto_offload_job_free);
+
+	return job;
+}
+
+/** Queue a job, the request should yield after this returns successfully
+ *
+ * @param[in] job	to submit.
+ * @param[in] request	to mark as resumable when the job completes.
+ * @param[in] uctx	Data to pass to the job's function.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the queue is full.  The caller should run the job's function inline.
+ */
+int fr_crypto_offload_job_submit(fr_crypto_offload_job_t *job, REQUEST *request, void *uctx)
+{
+	fr_crypto_offload_t *co = job->cot->co;
+
+	rad_assert(job->state == CRYPTO_JOB_INIT);
+
+	job->request = request;
+	job->uctx = uctx;
+	gettimeofday(&job->queued, NULL);
+
+	pthread_mutex_lock(&co->mutex);
+	if (fr_fifo_push(co->queue, job) < 0) {
+		co->stats.rejected++;
+		pthread_mutex_unlock(&co->mutex);
+
+		RWDEBUG("%s - Crypto offload queue full (%u jobs)", co->name, co->stats.queued);
+		return -1;
+	}
+	job->state = CRYPTO_JOB_QUEUED;
+	job->cot->outstanding++;
+
+	co->stats.submitted++;
+	if (++co->stats.queued > co->stats.queued_max) co->stats.queued_max = co->stats.queued;
+	RDEBUG3("%s - Crypto offload queue depth %u, %u running", co->name, co->stats.queued, co->stats.running);
+
+	pthread_cond_signal(&co->work);
+	pthread_mutex_unlock(&co->mutex);
+
+	return 0;
+}
+
+/** Return the result of a completed job
+ *
+ * @param[in] job	which has completed.
+ * @return the value returned by the job's function.
+ */
+int fr_crypto_offload_job_result(fr_crypto_offload_job_t const *job)
+{
+	rad_assert(job->state == CRYPTO_JOB_COLLECTED);
+
+	return job->result;
+}
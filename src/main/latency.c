@@ -0,0 +1,284 @@
+/*
+ * latency.c	Latency histograms for module calls and sections.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/latency.h>
+
+/*
+ *	Each thread records into its own set of histograms, so
+ *	recording a sample needs no locks or atomic operations.
+ *	The sets are only summed when someone asks for them.
+ */
+typedef struct fr_latency_shard_t fr_latency_shard_t;
+
+struct fr_latency_shard_t {
+	fr_latency_t		**hist;		//!< Histograms, indexed by id.
+	uint32_t		num;		//!< Size of the hist array.
+	fr_latency_shard_t	*next;		//!< Next thread's histograms.
+};
+
+fr_thread_local_setup(fr_latency_shard_t *, latency_shard)	/* macro */
+
+/*
+ *	Protects everything below, and the hist arrays of every
+ *	shard.  A thread only takes it to add a histogram to its
+ *	own shard, which happens once per id.
+ */
+static pthread_mutex_t		latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char const		**latency_names;	//!< Names, indexed by id.  Id 0 is never used.
+static uint32_t			latency_num;		//!< Number of ids allocated, including 0.
+static fr_latency_shard_t	*latency_shards;	//!< Histograms of running threads.
+static fr_latency_shard_t	latency_retired;	//!< Histograms of threads which have exited.
+
+static void latency_add(fr_latency_t *out, fr_latency_t const *in)
+{
+	unsigned int i;
+
+	out->count += in->count;
+	out->total += in->total;
+	if (in->max > out->max) out->max = in->max;
+
+	for (i = 0; i < FR_LATENCY_BUCKETS; i++) out->bucket[i] += in->bucket[i];
+}
+
+/** Make sure a shard has a histogram for an id
+ *
+ * @note Must be called with latency_mutex held.
+ */
+static fr_latency_t *latency_shard_hist(fr_latency_shard_t *shard, uint32_t id)
+{
+	if (id >= shard->num) {
+		fr_latency_t **array;
+
+		array = talloc_realloc(NULL, shard->hist, fr_latency_t *, latency_num);
+		if (!array) return NULL;
+
+		memset(array + shard->num, 0, sizeof(*array) * (latency_num - shard->num));
+		shard->hist = array;
+		shard->num = latency_num;
+	}
+
+	if (!shard->hist[id]) shard->hist[id] = talloc_zero(shard->hist, fr_latency_t);
+
+	return shard->hist[id];
+}
+
+/** Fold a thread's histograms into the totals when the thread exits
+ *
+ * @param[in] arg	fr_latency_shard_t to free.
+ */
+static void _latency_shard_free(void *arg)
+{
+	fr_latency_shard_t	*shard = arg;
+	fr_latency_shard_t	**last;
+	uint32_t		i;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (last = &latency_shards; *last; last = &(*last)->next) {
+		if (*last != shard) continue;
+
+		*last = shard->next;
+		break;
+	}
+
+	for (i = 1; i < shard->num; i++) {
+		fr_latency_t *hist;
+
+		if (!shard->hist[i]) continue;
+
+		hist = latency_shard_hist(&latency_retired, i);
+		if (hist) latency_add(hist, shard->hist[i]);
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	talloc_free(shard->hist);
+	talloc_free(shard);
+}
+
+/** Allocate an id for a new histogram
+ *
+ * If a histogram with the same name already exists, its id is
+ * returned, so callers which discover what they're timing at run
+ * time (from many threads) share one histogram.
+ *
+ * @param[in] fmt	name of the histogram, printed in the output
+ *			of #fr_latency_walk.
+ * @return
+ *	- The id to pass to #fr_latency_record.
+ *	- 0 on error.  Recording samples for id 0 does nothing.
+ */
+uint32_t fr_latency_register(char const *fmt, ...)
+{
+	va_list		ap;
+	char		*name;
+	char const	**array;
+	uint32_t	id = 0, i;
+
+	pthread_mutex_lock(&latency_mutex);
+	if (!latency_num) latency_num = 1;
+
+	array = talloc_realloc(NULL, latency_names, char const *, latency_num + 1);
+	if (!array) goto done;
+	latency_names = array;
+
+	va_start(ap, fmt);
+	name = talloc_vasprintf(latency_names, fmt, ap);
+	va_end(ap);
+	if (!name) goto done;
+
+	for (i = 1; i < latency_num; i++) {
+		if (strcmp(latency_names[i], name) != 0) continue;
+
+		talloc_free(name);
+		id = i;
+		goto done;
+	}
+
+	id = latency_num++;
+	latency_names[id] = name;
+
+done:
+	pthread_mutex_unlock(&latency_mutex);
+
+	return id;
+}
+
+/** Record a sample
+ *
+ * @param[in] id	from #fr_latency_register.
+ * @param[in] elapsed	time, in nanoseconds.
+ */
+void fr_latency_record(uint32_t id, uint64_t elapsed)
+{
+	fr_latency_shard_t	*shard = latency_shard;
+	fr_latency_t		*hist;
+
+	if (!id) return;
+
+	if (shard && (id < shard->num) && shard->hist[id]) {
+		hist = shard->hist[id];
+	} else {
+		if (!shard) {
+			shard = talloc_zero(NULL, fr_latency_shard_t);
+			if (!shard) return;
+
+			fr_thread_local_set_destructor(latency_shard, _latency_shard_free, shard);
+
+			pthread_mutex_lock(&latency_mutex);
+			shard->next = latency_shards;
+			latency_shards = shard;
+			pthread_mutex_unlock(&latency_mutex);
+		}
+
+		pthread_mutex_lock(&latency_mutex);
+		hist = latency_shard_hist(shard, id);
+		pthread_mutex_unlock(&latency_mutex);
+		if (!hist) return;
+	}
+
+	hist->count++;
+	hist->total += elapsed;
+	if (elapsed > hist->max) hist->max = elapsed;
+	hist->bucket[fr_latency_bucket(elapsed)]++;
+}
+
+/** Return an upper bound for a percentile of the samples
+ *
+ * @param[in] hist	to examine.
+ * @param[in] permille	the percentile * 10, e.g. 999 for the 99.9th percentile.
+ * @return the largest value which could have been counted in the
+ *	bucket holding the percentile.  This is never more than the
+ *	largest sample.
+ */
+uint64_t fr_latency_percentile(fr_latency_t const *hist, unsigned int permille)
+{
+	uint64_t	target, seen = 0;
+	unsigned int	i;
+
+	if (!hist->count) return 0;
+
+	target = ((hist->count * permille) + 999) / 1000;
+	if (!target) target = 1;
+
+	for (i = 0; i < (FR_LATENCY_BUCKETS - 1); i++) {
+		uint64_t max;
+
+		seen += hist->bucket[i];
+		if (seen < target) continue;
+
+		max = fr_latency_bucket_min(i + 1) - 1;
+		return (max < hist->max) ? max : hist->max;
+	}
+
+	return hist->max;
+}
+
+/** Call a function for every histogram with samples, summed over all threads
+ *
+ * The counters of running threads are read without locking, so the
+ * totals may be slightly behind.
+ *
+ * @note The callback must not record samples, or register histograms.
+ *
+ * @param[in] callback	to call.
+ * @param[in] ctx	to pass to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the callback stopped the walk.
+ */
+int fr_latency_walk(fr_latency_walk_t callback, void *ctx)
+{
+	fr_latency_t		*total;
+	fr_latency_shard_t	*shard;
+	uint32_t		i;
+	int			ret = 0;
+
+	total = talloc(NULL, fr_latency_t);
+	if (!total) return -1;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (i = 1; i < latency_num; i++) {
+		memset(total, 0, sizeof(*total));
+
+		if ((i < latency_retired.num) && latency_retired.hist[i]) {
+			latency_add(total, latency_retired.hist[i]);
+		}
+
+		for (shard = latency_shards; shard; shard = shard->next) {
+			if ((i < shard->num) && shard->hist[i]) latency_add(total, shard->hist[i]);
+		}
+
+		if (!total->count) continue;
+
+		if (callback(ctx, latency_names[i], total) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	talloc_free(total);
+
+	return ret;
+}
@@ -2451,7 +2451,8 @@ static int client_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 			request->reply->data_len, MAX_PACKET_LEN);
 	}
 
-	if (fr_radius_sign(request->reply, request->packet, request->client->secret) < 0) {
+	if (fr_radius_sign_keyed(request->reply, request->packet, request->client->secret,
+				 request->client->secret_hmac) < 0) {
 		RERROR("Failed signing packet: %s", fr_strerror());
 
 		return -1;
@@ -2467,8 +2468,8 @@ static int client_socket_decode(UNUSED rad_listen_t *listener, REQUEST *request)
 	listen_socket_t *sock;
 #endif
 
-	if (fr_radius_verify(request->packet, NULL,
-			     request->client->secret) < 0) {
+	if (fr_radius_verify_keyed(request->packet, NULL,
+				   request->client->secret, request->client->secret_hmac) < 0) {
 		return -1;
 	}
 
@@ -2510,7 +2511,8 @@ static int proxy_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 			request->proxy->packet->data_len, MAX_PACKET_LEN);
 	}
 
-	if (fr_radius_sign(request->proxy->packet, NULL, request->proxy->home_server->secret) < 0) {
+	if (fr_radius_sign_keyed(request->proxy->packet, NULL, request->proxy->home_server->secret,
+				 request->proxy->home_server->secret_hmac) < 0) {
 		RERROR("Failed signing proxied packet: %s", fr_strerror());
 
 		return -1;
@@ -281,8 +281,22 @@ int radius_callback_compare(REQUEST *request, VALUE_PAIR *req,
 	 */
 	for (c = cmp; c; c = c->next) {
 		if (c->attribute == check->da) {
-			return (c->compare)(c->instance, request, req, check,
-				check_pairs, reply_pairs);
+			int	ret;
+			bool	memo;
+
+			if (!request) return (c->compare)(c->instance, request, req, check,
+							   check_pairs, reply_pairs);
+
+			/*
+			 *	The comparison function may modify
+			 *	the request's attribute lists.
+			 */
+			memo = tmpl_memo_suspend(&request->memo);
+			ret = (c->compare)(c->instance, request, req, check,
+					   check_pairs, reply_pairs);
+			tmpl_memo_resume(&request->memo, memo);
+
+			return ret;
 		}
 	}
 
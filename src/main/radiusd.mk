@@ -4,12 +4,15 @@ SOURCES := acct.c \
     conduit.c \
     client.c \
     crypt.c \
+    crypto_offload.c \
     files.c \
+    latency.c \
     listen.c \
     mainconfig.c \
     modules.c \
     radiusd.c \
     realms.c \
+    reload.c \
     state.c \
     stats.c \
     soh.c \
@@ -19,6 +22,7 @@ SOURCES := acct.c \
     unlang_compile.c \
     unlang_interpret.c \
     virtual_servers.c \
+    worker_wake.c \
     process.c
 
 ifneq ($(OPENSSL_LIBS),)
@@ -125,6 +125,22 @@ static void home_server_free(void *data)
 	talloc_free(home);
 }
 
+/** Precompute the HMAC-MD5 key states for a home server's secret
+ *
+ * The key length is taken from the talloc'd secret, the same as
+ * the fallback in the RADIUS signing code when there's no key.
+ */
+static int home_server_secret_hmac_init(home_server_t *home)
+{
+	home->secret_hmac = talloc(home, fr_hmac_md5_key_t);
+	if (!home->secret_hmac) return -1;
+
+	fr_hmac_md5_key_init(home->secret_hmac, (uint8_t const *)home->secret,
+			     talloc_array_length(home->secret) - 1);
+
+	return 0;
+}
+
 static int home_server_name_cmp(void const *one, void const *two)
 {
 	home_server_t const *a = one;
@@ -663,7 +679,7 @@ home_server_t *home_server_afrom_cs(TALLOC_CTX *ctx, realm_config_t *rc, CONF_SE
 			goto error;
 		}
 
-		home->secret = "";
+		home->secret = talloc_typed_strdup(home, "");
 		home->log_name = talloc_typed_strdup(home, home->server);
 	/*
 	 *	Otherwise it's an invalid config section and we
@@ -814,7 +830,7 @@ home_server_t *home_server_afrom_cs(TALLOC_CTX *ctx, realm_config_t *rc, CONF_SE
 	if (!home->secret) {
 #ifdef WITH_TLS
 		if (tls && (home->proto == IPPROTO_TCP)) {
-			home->secret = "radsec";
+			home->secret = talloc_typed_strdup(home, "radsec");
 		} else
 #endif
 		{
@@ -822,6 +838,10 @@ home_server_t *home_server_afrom_cs(TALLOC_CTX *ctx, realm_config_t *rc, CONF_SE
 			goto error;
 		}
 	}
+	if (home_server_secret_hmac_init(home) < 0) {
+		cf_log_err_cs(cs, "Out of memory");
+		goto error;
+	}
 
 	/*
 	 *	Virtual servers have some TLS restrictions.
@@ -1479,6 +1499,11 @@ static int old_server_add(realm_config_t *rc, CONF_SECTION *cs,
 		home->name = name;
 		home->type = type;
 		home->secret = secret;
+		if (secret && (home_server_secret_hmac_init(home) < 0)) {
+			cf_log_err_cs(cs, "Out of memory");
+			talloc_free(home);
+			return 0;
+		}
 		home->cs = cs;
 		home->proto = IPPROTO_UDP;
 
@@ -90,8 +90,15 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value, s
 	new_sc->value = p;
 	new_sc->nmatch = nmatch;
 
-#ifdef HAVE_PCRE
-	if (!(*preg)->precompiled) {
+#if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+	/*
+	 *	Expressions from the cache may be evicted while the
+	 *	request still needs them, so keep a reference.
+	 */
+	if ((*preg)->cached) {
+		new_sc->preg = *preg;
+		if (!talloc_reference(new_sc, *preg)) MEM(NULL);
+	} else if (!(*preg)->precompiled) {
 		new_sc->preg = talloc_steal(new_sc, *preg);
 		*preg = NULL;
 	} else
@@ -103,7 +110,125 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value, s
 	request_data_add(request, request, REQUEST_DATA_REGEX, new_sc, true, false, false);
 }
 
-#  ifdef HAVE_PCRE
+#  ifdef HAVE_PCRE2
+/** Copy a subcapture out of the original string
+ *
+ * @param ctx To allocate subcapture buffer in.
+ * @param out Where to write the subcapture string.
+ * @param request The current request.
+ * @param cap Subcapture data.
+ * @param num Subcapture index (0 for entire match).
+ * @return
+ *	- 0 on success.
+ *	- -1 on notfound.
+ */
+static int regex_sub_copy(TALLOC_CTX *ctx, char **out, REQUEST *request, regcapture_t *cap, uint32_t num)
+{
+	char		*p;
+	char const	*start;
+	size_t		len;
+
+	if ((num >= cap->nmatch) || (cap->rxmatch[num].rm_so == PCRE2_UNSET) ||
+	    (cap->rxmatch[num].rm_eo == PCRE2_UNSET)) {
+		RDEBUG4("%i/%zu Not found", num, cap->nmatch);
+		*out = NULL;
+		return -1;
+	}
+
+	/*
+	 *	Sanity checks on the offsets
+	 */
+	rad_assert(cap->rxmatch[num].rm_eo <= talloc_array_length(cap->value));
+	rad_assert(cap->rxmatch[num].rm_so <= cap->rxmatch[num].rm_eo);
+
+	start = cap->value + cap->rxmatch[num].rm_so;
+	len = cap->rxmatch[num].rm_eo - cap->rxmatch[num].rm_so;
+
+	RDEBUG4("%i/%zu Found: %.*s (%zu)", num, cap->nmatch, (int)len, start, len);
+	MEM(p = talloc_array(ctx, char, len + 1));
+	memcpy(p, start, len);
+	p[len] = '\0';
+
+	*out = p;
+
+	return 0;
+}
+
+/** Extract a subcapture value from the request
+ *
+ * @note This is the PCRE2 variant of the function.
+ *
+ * @param ctx To allocate subcapture buffer in.
+ * @param out Where to write the subcapture string.
+ * @param request to extract.
+ * @param num Subcapture index (0 for entire match).
+ * @return
+ *	- 0 on success.
+ *	- -1 on notfound.
+ */
+int regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t num)
+{
+	regcapture_t *cap;
+
+	cap = request_data_reference(request, request, REQUEST_DATA_REGEX);
+	if (!cap) {
+		RDEBUG4("No subcapture data found");
+		*out = NULL;
+		return 1;
+	}
+
+	return regex_sub_copy(ctx, out, request, cap, num);
+}
+
+/** Extract a named subcapture value from the request
+ *
+ * @note This is the PCRE2 variant of the function.
+ *
+ * @param ctx To allocate subcapture buffer in.
+ * @param out Where to write the subcapture string.
+ * @param request to extract.
+ * @param name of subcapture.
+ * @return
+ *	- 0 on success.
+ *	- -1 on notfound.
+ */
+int regex_request_to_sub_named(TALLOC_CTX *ctx, char **out, REQUEST *request, char const *name)
+{
+	regcapture_t	*cap;
+	PCRE2_SPTR	first, last, entry;
+	int		size;
+
+	cap = request_data_reference(request, request, REQUEST_DATA_REGEX);
+	if (!cap) {
+		RDEBUG4("No subcapture data found");
+		*out = NULL;
+		return 1;
+	}
+
+	/*
+	 *	Names may be duplicated with (?J), in which case
+	 *	we use the first group of that name which matched.
+	 */
+	size = pcre2_substring_nametable_scan(cap->preg->compiled, (PCRE2_SPTR)name, &first, &last);
+	if (size < 0) {
+		RDEBUG4("No named capture group \"%s\"", name);
+		*out = NULL;
+		return -1;
+	}
+
+	for (entry = first; entry <= last; entry += size) {
+		uint32_t num = (entry[0] << 8) | entry[1];
+
+		if ((num < cap->nmatch) && (cap->rxmatch[num].rm_so != PCRE2_UNSET)) {
+			return regex_sub_copy(ctx, out, request, cap, num);
+		}
+	}
+
+	RDEBUG4("No named capture group \"%s\"", name);
+	*out = NULL;
+	return -1;
+}
+#  elif defined(HAVE_PCRE)
 /** Extract a subcapture value from the request
  *
  * @note This is the PCRE variant of the function.
@@ -0,0 +1,455 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file reload.c
+ * @brief Reload data files in the background, without blocking requests.
+ *
+ * Modules such as rlm_files and rlm_passwd read their data files into memory
+ * when they're instantiated.  Large files take seconds to parse, so they can't
+ * be re-read by the workers without stalling requests.
+ *
+ * Instead, each data set has a reload thread.  When a reload is triggered, or
+ * one of the data files changes, the reload thread reads the files and builds
+ * a complete new data set, while the workers continue to use the current one.
+ * The new data set is then published with an atomic pointer swap.  If the files
+ * aren't checked for changes, the thread is only started by the first trigger.
+ *
+ * The old data set is freed once no requests can be using it (see lib/epoch.c).
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/reload.h>
+#include <freeradius-devel/epoch.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+/** A data file, and what it looked like when it was last read
+ *
+ */
+typedef struct {
+	char const		*filename;
+	time_t			mtime;
+	ino_t			ino;
+	off_t			size;
+} reload_file_t;
+
+/** A data set, which is replaced in the background
+ *
+ */
+struct fr_reload {
+	char const		*name;		//!< For log messages.
+
+	fr_reload_load_t	load;		//!< Reads the data files.
+	void			*uctx;		//!< Passed to load.
+
+	_Atomic(void *)		data;		//!< Data used by readers.
+	fr_epoch_t		*epoch;		//!< Tracks readers of the data.
+
+	reload_file_t		*files;		//!< Files to check for changes.
+	size_t			num_files;
+	uint32_t		check_interval;	//!< How often to check them.  0 means never.
+
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	pthread_t		thread;		//!< Reload thread.
+	bool			thread_started;
+	pthread_cond_t		cond;		//!< Signalled to wake the reload thread.
+	bool			pending;	//!< A reload has been requested.
+	bool			stop;		//!< Tell the reload thread to exit.
+
+	fr_reload_stats_t	stats;		//!< Counters for the data set.
+};
+
+/** Record the current state of the data files
+ *
+ * @return true if any of them changed since they were last recorded.
+ */
+static bool reload_files_stat(fr_reload_t *r)
+{
+	struct stat	buf;
+	bool		changed = false;
+	size_t		i;
+
+	for (i = 0; i < r->num_files; i++) {
+		reload_file_t *f = &r->files[i];
+
+		/*
+		 *	Probably being replaced.  Try again later,
+		 *	it makes no sense to reload a missing file.
+		 */
+		if (stat(f->filename, &buf) < 0) continue;
+
+		if ((buf.st_mtime != f->mtime) || (buf.st_ino != f->ino) || (buf.st_size != f->size)) {
+			f->mtime = buf.st_mtime;
+			f->ino = buf.st_ino;
+			f->size = buf.st_size;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+/** Read the data files, and replace the current data with them
+ *
+ * @note Must only be called by the reload thread.
+ */
+static void reload_run(fr_reload_t *r)
+{
+	void		*data, *old;
+	uint64_t	entries = 0, usec;
+	struct timeval	start, end, elapsed;
+
+	DEBUG("%s - Reloading", r->name);
+
+	gettimeofday(&start, NULL);
+	if (r->load(&data, &entries, r->uctx) < 0) {
+		pthread_mutex_lock(&r->mutex);
+		r->stats.failed++;
+		pthread_mutex_unlock(&r->mutex);
+
+		ERROR("%s - Reload failed, continuing to use the current data", r->name);
+		return;
+	}
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, &start);
+	usec = ((uint64_t)elapsed.tv_sec * 1000000) + elapsed.tv_usec;
+
+	old = atomic_exchange(&r->data, data);
+	fr_epoch_synchronize(r->epoch);
+	talloc_free(old);
+
+	pthread_mutex_lock(&r->mutex);
+	r->stats.reloads++;
+	r->stats.entries = entries;
+	r->stats.load_usec = usec;
+	r->stats.loaded = end.tv_sec;
+	pthread_mutex_unlock(&r->mutex);
+
+	INFO("%s - Reloaded %" PRIu64 " entries in %" PRIu64 ".%06" PRIu64 "s",
+	     r->name, entries, usec / 1000000, usec % 1000000);
+}
+
+/** Main loop of the reload thread
+ *
+ */
+static void *reload_thread(void *arg)
+{
+	fr_reload_t	*r = arg;
+	sigset_t	sigset;
+	bool		pending;
+
+	/*
+	 *	Signals are for the main thread.
+	 */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&r->mutex);
+	for (;;) {
+		if (!r->stop && !r->pending) {
+			if (r->check_interval) {
+				struct timespec when;
+
+				clock_gettime(CLOCK_REALTIME, &when);
+				when.tv_sec += r->check_interval;
+				pthread_cond_timedwait(&r->cond, &r->mutex, &when);
+			} else {
+				pthread_cond_wait(&r->cond, &r->mutex);
+			}
+		}
+		if (r->stop) break;
+
+		pending = r->pending;
+		r->pending = false;
+		pthread_mutex_unlock(&r->mutex);
+
+		/*
+		 *	Always record the state of the files, so
+		 *	changes made while we're reading them
+		 *	trigger another reload.
+		 */
+		if (reload_files_stat(r) || pending) reload_run(r);
+
+		pthread_mutex_lock(&r->mutex);
+	}
+	pthread_mutex_unlock(&r->mutex);
+
+	return NULL;
+}
+
+/** Start the reload thread
+ *
+ * @note Must be called with the mutex held.
+ */
+static int reload_thread_start(fr_reload_t *r)
+{
+	int ret;
+
+	if (r->thread_started) return 0;
+
+	ret = pthread_create(&r->thread, NULL, reload_thread, r);
+	if (ret != 0) {
+		ERROR("%s - Failed creating reload thread: %s", r->name, fr_syserror(ret));
+		return -1;
+	}
+	r->thread_started = true;
+
+	return 0;
+}
+
+/** Stop the reload thread, and free the current data
+ *
+ * By now all the workers should have exited, so there are no readers.
+ */
+static int _reload_free(fr_reload_t *r)
+{
+	bool started;
+
+	pthread_mutex_lock(&r->mutex);
+	started = r->thread_started;
+	r->stop = true;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+
+	if (started) pthread_join(r->thread, NULL);
+
+	talloc_free(atomic_load(&r->data));
+
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->mutex);
+
+	return 0;
+}
+
+/** Read a data set, and start a thread to reload it
+ *
+ * The data is read once, synchronously, so callers can fail if it can't be read.
+ *
+ * @param[in] ctx		to allocate the data set in.  Freeing it stops the reload thread,
+ *				and frees the current data.  As the data set is modified
+ *				after the server has started, this must not be instance data.
+ * @param[in] name		used as a prefix for log messages.
+ * @param[in] load		callback to read the data.
+ * @param[in] uctx		passed to load.  Must remain valid for the lifetime of the
+ *				data set.
+ * @param[in] files		read by load.  NULL entries are ignored.
+ * @param[in] num_files		in the files array.
+ * @param[in] check_interval	how often to check whether any of the files have changed,
+ *				and reload them if they have.  0 means they're only reloaded
+ *				by #fr_reload_trigger, and the reload thread isn't started
+ *				until the first trigger.
+ * @return
+ *	- A new data set.
+ *	- NULL on error.
+ */
+fr_reload_t *fr_reload_create(TALLOC_CTX *ctx, char const *name, fr_reload_load_t load, void *uctx,
+			      char const * const *files, size_t num_files, uint32_t check_interval)
+{
+	fr_reload_t	*r;
+	void		*data;
+	uint64_t	entries = 0;
+	struct timeval	start, end, elapsed;
+	size_t		i;
+
+	r = talloc_zero(ctx, fr_reload_t);
+	if (!r) return NULL;
+
+	r->name = talloc_typed_strdup(r, name);
+	r->load = load;
+	r->uctx = uctx;
+	r->check_interval = check_interval;
+
+	MEM(r->files = talloc_zero_array(r, reload_file_t, num_files));
+	for (i = 0; i < num_files; i++) {
+		if (!files[i]) continue;
+		r->files[r->num_files++].filename = talloc_typed_strdup(r->files, files[i]);
+	}
+	reload_files_stat(r);
+
+	MEM(r->epoch = fr_epoch_alloc(r));
+
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	atomic_init(&r->data, NULL);
+	talloc_set_destructor(r, _reload_free);
+
+	gettimeofday(&start, NULL);
+	if (load(&data, &entries, uctx) < 0) {
+		talloc_free(r);
+		return NULL;
+	}
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, &start);
+
+	atomic_store(&r->data, data);
+	r->stats.entries = entries;
+	r->stats.load_usec = ((uint64_t)elapsed.tv_sec * 1000000) + elapsed.tv_usec;
+	r->stats.loaded = end.tv_sec;
+
+	DEBUG("%s - Loaded %" PRIu64 " entries in %" PRIu64 ".%06" PRIu64 "s", name, entries,
+	      r->stats.load_usec / 1000000, r->stats.load_usec % 1000000);
+
+	/*
+	 *	Nothing to check, wait until we're asked
+	 *	to reload.
+	 */
+	if (!check_interval) return r;
+
+	pthread_mutex_lock(&r->mutex);
+	if (reload_thread_start(r) < 0) {
+		pthread_mutex_unlock(&r->mutex);
+		talloc_free(r);
+		return NULL;
+	}
+	pthread_mutex_unlock(&r->mutex);
+
+	return r;
+}
+
+/** Register as a reader of the current data
+ *
+ * The data won't be freed until #fr_reload_release is called.  Readers must not
+ * yield, or block for any length of time, as this delays the reload thread.
+ *
+ * @param[in] r		to read.
+ * @param[out] ref	to pass to #fr_reload_release.
+ * @return the current data.
+ */
+void const *fr_reload_acquire(fr_reload_t *r, unsigned int *ref)
+{
+	*ref = fr_epoch_enter(r->epoch);
+
+	return atomic_load(&r->data);
+}
+
+/** Finish using the data returned by #fr_reload_acquire
+ *
+ * @param[in] r		which was read.
+ * @param[in] ref	returned by #fr_reload_acquire.
+ */
+void fr_reload_release(fr_reload_t *r, unsigned int ref)
+{
+	fr_epoch_exit(r->epoch, ref);
+}
+
+/** Ask the reload thread to read the data files again
+ *
+ * Returns immediately.  If a reload is already in progress, another one is
+ * started when it completes.
+ *
+ * @param[in] r		to reload.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the reload thread couldn't be started.
+ */
+int fr_reload_trigger(fr_reload_t *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	if (reload_thread_start(r) < 0) {
+		pthread_mutex_unlock(&r->mutex);
+		return -1;
+	}
+	r->pending = true;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+
+	return 0;
+}
+
+/** Copy out the data set's counters
+ *
+ * @param[in] r		to get statistics for.
+ * @param[out] stats	Where to write the statistics.
+ */
+void fr_reload_stats(fr_reload_t *r, fr_reload_stats_t *stats)
+{
+	pthread_mutex_lock(&r->mutex);
+	memcpy(stats, &r->stats, sizeof(*stats));
+	pthread_mutex_unlock(&r->mutex);
+}
+
+/** Implement the reload and statistics commands of a module's xlat
+ *
+ * "reload" triggers a reload, and returns "ok".  "stats <name>" returns one of
+ * the data set's counters, where <name> is one of reloads, failed, entries,
+ * load_usec or loaded.
+ *
+ * @param[out] out	Where to write the result.  Allocated in the request.
+ * @param[in] r		the module's data set.
+ * @param[in] request	the current request.
+ * @param[in] fmt	the command.
+ * @return
+ *	- Length of the result.
+ *	- -1 on error.
+ */
+ssize_t fr_reload_xlat(char **out, fr_reload_t *r, REQUEST *request, char const *fmt)
+{
+	fr_reload_stats_t	stats;
+	uint64_t		value;
+	char const		*name;
+
+	if (strcmp(fmt, "reload") == 0) {
+		RDEBUG("Triggering reload of %s", r->name);
+		if (fr_reload_trigger(r) < 0) {
+			REDEBUG("Failed triggering reload of %s", r->name);
+			return -1;
+		}
+
+		*out = talloc_typed_strdup(request, "ok");
+		return 2;
+	}
+
+	if (strncmp(fmt, "stats ", 6) != 0) {
+		REDEBUG("Unknown command \"%s\", expected \"reload\" or \"stats <name>\"", fmt);
+		return -1;
+	}
+	name = fmt + 6;
+
+	fr_reload_stats(r, &stats);
+
+	if (strcmp(name, "reloads") == 0) {
+		value = stats.reloads;
+	} else if (strcmp(name, "failed") == 0) {
+		value = stats.failed;
+	} else if (strcmp(name, "entries") == 0) {
+		value = stats.entries;
+	} else if (strcmp(name, "load_usec") == 0) {
+		value = stats.load_usec;
+	} else if (strcmp(name, "loaded") == 0) {
+		value = stats.loaded;
+	} else {
+		REDEBUG("Unknown reload statistic \"%s\"", name);
+		return -1;
+	}
+
+	*out = talloc_typed_asprintf(request, "%" PRIu64, value);
+
+	return talloc_array_length(*out) - 1;
+}
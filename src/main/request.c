@@ -487,6 +487,23 @@ void request_data_restore(REQUEST *request, request_data_t *entry)
 #endif
 }
 
+/** Reparent request data held by one talloc ctx to another
+ *
+ * Used where a copy of a request stands in for the original, so that data
+ * added by the copy outlives it.
+ *
+ * @param to		ctx to parent the request data with.
+ * @param from		ctx currently parenting the request data.
+ * @param entry		list of request data to reparent.
+ */
+void request_data_reparent(TALLOC_CTX *to, TALLOC_CTX *from, request_data_t *entry)
+{
+	for (; entry; entry = entry->next) {
+		if (talloc_parent(entry) == from) (void) talloc_steal(to, entry);
+		if (entry->opaque && (talloc_parent(entry->opaque) == from)) (void) talloc_steal(to, entry->opaque);
+	}
+}
+
 /** Get opaque data from a request without removing it
  *
  * @note The unique ptr is meant to be a module configuration, and the unique
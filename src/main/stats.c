@@ -25,6 +25,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/latency.h>
 
 #ifdef WITH_STATS
 
@@ -428,19 +429,96 @@ static void request_stats_addvp(REQUEST *request,
 	}
 }
 
+typedef struct {
+	REQUEST		*request;
+	char const	*prefix;
+	size_t		len;
+	size_t		room;		//!< Bytes left in the reply packet.
+	unsigned int	omitted;	//!< Histograms which didn't fit.
+} request_stats_latency_t;
 
-void request_stats_reply(REQUEST *request)
+/*
+ *	Encoded size of a FreeRADIUS VSA, and the most a single
+ *	attribute can hold.
+ */
+#define STATS_VSA_HDR_LEN	(8)
+#define STATS_VSA_MAX_LEN	(255 - STATS_VSA_HDR_LEN)
+
+/*
+ *	Name, a 64bit count, and six 32bit times.
+ */
+#define STATS_LATENCY_LEN(_name_len)	((STATS_VSA_HDR_LEN + (_name_len)) + \
+					 (STATS_VSA_HDR_LEN + 8) + \
+					 (6 * (STATS_VSA_HDR_LEN + 4)))
+
+/** Return roughly how many more bytes of attributes will fit in the reply
+ *
+ */
+static size_t request_stats_room(REQUEST *request)
 {
-	VALUE_PAIR *flag, *vp;
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+	size_t		used = 20 + 18;	/* RADIUS_HDR_LEN + Message-Authenticator */
 
-	/*
-	 *	Statistics are available ONLY on a "status" port.
-	 */
-	rad_assert(request->packet->code == PW_CODE_STATUS_SERVER);
-	rad_assert(request->listener->type == RAD_LISTEN_NONE);
+	for (vp = fr_pair_cursor_init(&cursor, &request->reply->vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		used += (vp->da->vendor ? STATS_VSA_HDR_LEN : 2) + vp->vp_length;
+	}
 
-	flag = fr_pair_find_by_num(request->packet->vps, VENDORPEC_FREERADIUS, PW_FREERADIUS_STATISTICS_TYPE, TAG_ANY);
-	if (!flag || (flag->vp_integer == 0)) return;
+	return (used < MAX_PACKET_LEN) ? (MAX_PACKET_LEN - used) : 0;
+}
+
+static void request_stats_latency_usec(REQUEST *request, unsigned int attr, uint64_t nsec)
+{
+	VALUE_PAIR *vp;
+
+	vp = radius_pair_create(request->reply, &request->reply->vps, attr, VENDORPEC_FREERADIUS);
+	if (!vp) return;
+
+	nsec /= 1000;
+	vp->vp_integer = (nsec > UINT32_MAX) ? UINT32_MAX : nsec;
+}
+
+static int request_stats_latency(void *ctx, char const *name, fr_latency_t const *hist)
+{
+	request_stats_latency_t	*rl = ctx;
+	REQUEST			*request = rl->request;
+	VALUE_PAIR		*vp;
+	size_t			needed, name_len;
+
+	if (rl->prefix && (strncmp(name, rl->prefix, rl->len) != 0)) return 0;
+
+	name_len = strlen(name);
+	if (name_len > STATS_VSA_MAX_LEN) name_len = STATS_VSA_MAX_LEN;
+
+	needed = STATS_LATENCY_LEN(name_len);
+	if (needed > rl->room) {
+		rl->omitted++;
+		return 0;
+	}
+	rl->room -= needed;
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+			       PW_FREERADIUS_STATS_LATENCY_NAME, VENDORPEC_FREERADIUS);
+	if (!vp) return -1;
+	fr_pair_value_strcpy(vp, name);
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+			       PW_FREERADIUS_STATS_LATENCY_COUNT, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer64 = hist->count;
+
+	request_stats_latency_usec(request, PW_FREERADIUS_STATS_LATENCY_USEC_MEAN, hist->total / hist->count);
+	request_stats_latency_usec(request, PW_FREERADIUS_STATS_LATENCY_USEC_P50, fr_latency_percentile(hist, 500));
+	request_stats_latency_usec(request, PW_FREERADIUS_STATS_LATENCY_USEC_P90, fr_latency_percentile(hist, 900));
+	request_stats_latency_usec(request, PW_FREERADIUS_STATS_LATENCY_USEC_P99, fr_latency_percentile(hist, 990));
+	request_stats_latency_usec(request, PW_FREERADIUS_STATS_LATENCY_USEC_P999, fr_latency_percentile(hist, 999));
+	request_stats_latency_usec(request, PW_FREERADIUS_STATS_LATENCY_USEC_MAX, hist->max);
+
+	return 0;
+}
+
+static void request_stats_counters(REQUEST *request, VALUE_PAIR *flag)
+{
+	VALUE_PAIR *vp;
 
 	/*
 	 *	Authentication.
@@ -757,6 +835,51 @@ void request_stats_reply(REQUEST *request)
 #endif	/* WITH_PROXY */
 }
 
+void request_stats_reply(REQUEST *request)
+{
+	VALUE_PAIR *flag, *vp;
+
+	/*
+	 *	Statistics are available ONLY on a "status" port.
+	 */
+	rad_assert(request->packet->code == PW_CODE_STATUS_SERVER);
+	rad_assert(request->listener->type == RAD_LISTEN_NONE);
+
+	flag = fr_pair_find_by_num(request->packet->vps, VENDORPEC_FREERADIUS, PW_FREERADIUS_STATISTICS_TYPE, TAG_ANY);
+	if (!flag || (flag->vp_integer == 0)) return;
+
+	request_stats_counters(request, flag);
+
+	/*
+	 *	Latency of module calls and sections.  There may be
+	 *	more histograms than fit in a packet, so these go
+	 *	last, and get whatever room is left.
+	 */
+	if ((flag->vp_integer & 0x100) != 0) {
+		request_stats_latency_t	rl;
+
+		rl.request = request;
+		rl.prefix = NULL;
+		rl.len = 0;
+		rl.room = request_stats_room(request);
+		rl.omitted = 0;
+
+		vp = fr_pair_find_by_num(request->packet->vps, VENDORPEC_FREERADIUS,
+					 PW_FREERADIUS_STATS_LATENCY_NAME, TAG_ANY);
+		if (vp) {
+			rl.prefix = vp->vp_strvalue;
+			rl.len = vp->vp_length;
+		}
+
+		(void) fr_latency_walk(request_stats_latency, &rl);
+
+		if (rl.omitted) {
+			RWDEBUG("Omitted %u latency histograms which didn't fit in the reply.  "
+				"Set FreeRADIUS-Stats-Latency-Name to select fewer", rl.omitted);
+		}
+	}
+}
+
 void radius_stats_init(int flag)
 {
 	if (!flag) {
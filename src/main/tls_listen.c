@@ -408,8 +408,8 @@ int dual_tls_send(rad_listen_t *listener, REQUEST *request)
 	/*
 	 *	Sign the packet.
 	 */
-	if (fr_radius_sign(request->reply, request->packet,
-			   request->client->secret) < 0) {
+	if (fr_radius_sign_keyed(request->reply, request->packet,
+				 request->client->secret, request->client->secret_hmac) < 0) {
 		RERROR("Failed signing packet: %s", fr_strerror());
 		return 0;
 	}
@@ -2062,6 +2062,51 @@ finish:
 	return (out_p - out);
 }
 
+/** Find the first instance of an attribute, using the request's memo if it's active
+ *
+ * @param[in] request	whose memo to use.
+ * @param[in] cursor	initialised to the start of vps.
+ * @param[in] vps	list being searched.
+ * @param[in] vpt	specifying the attribute and tag to find.
+ * @return the first matching #VALUE_PAIR, or NULL if there are none.
+ *	The cursor is left as #fr_pair_cursor_next_by_da would leave it.
+ */
+static VALUE_PAIR *tmpl_cursor_first(REQUEST *request, vp_cursor_t *cursor, VALUE_PAIR **vps,
+				     vp_tmpl_t const *vpt)
+{
+	tmpl_memo_t		*memo = &request->memo;
+	tmpl_memo_entry_t	*entry;
+	VALUE_PAIR		*vp;
+
+	if (!memo->active) return fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag);
+
+	entry = &memo->entry[((((uintptr_t) vps) >> 3) ^ (((uintptr_t) vpt->tmpl_da) >> 4)) &
+			     (TMPL_MEMO_SIZE - 1)];
+	if ((entry->gen == memo->gen) && (entry->head == vps) &&
+	    (entry->da == vpt->tmpl_da) && (entry->tag == vpt->tmpl_tag)) {
+		vp = entry->vp;
+		if (!vp) {
+			cursor->current = cursor->next = NULL;
+			return NULL;
+		}
+
+		VERIFY_VP(vp);
+		cursor->current = cursor->found = vp;
+		cursor->next = vp->next;
+		return vp;
+	}
+
+	vp = fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag);
+
+	entry->head = vps;
+	entry->da = vpt->tmpl_da;
+	entry->tag = vpt->tmpl_tag;
+	entry->gen = memo->gen;
+	entry->vp = vp;
+
+	return vp;
+}
+
 /** Initialise a #vp_cursor_t to the #VALUE_PAIR specified by a #vp_tmpl_t
  *
  * This makes iterating over the one or more #VALUE_PAIR specified by a #vp_tmpl_t
@@ -2084,6 +2129,7 @@ finish:
 VALUE_PAIR *tmpl_cursor_init(int *err, vp_cursor_t *cursor, REQUEST *request, vp_tmpl_t const *vpt)
 {
 	VALUE_PAIR **vps, *vp = NULL;
+	REQUEST *current = request;
 	int num;
 
 	VERIFY_TMPL(vpt);
@@ -2110,7 +2156,7 @@ VALUE_PAIR *tmpl_cursor_init(int *err, vp_cursor_t *cursor, REQUEST *request, vp
 	case TMPL_TYPE_ATTR:
 		switch (vpt->tmpl_num) {
 		case NUM_ANY:
-			vp = fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag);
+			vp = tmpl_cursor_first(current, cursor, vps, vpt);
 			if (!vp) {
 				if (err) *err = -1;
 				return NULL;
@@ -2125,7 +2171,9 @@ VALUE_PAIR *tmpl_cursor_init(int *err, vp_cursor_t *cursor, REQUEST *request, vp
 		{
 			VALUE_PAIR *last = NULL;
 
-			while ((vp = fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag))) {
+			for (vp = tmpl_cursor_first(current, cursor, vps, vpt);
+			     vp;
+			     vp = fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag)) {
 				VERIFY_VP(vp);
 				last = vp;
 			}
@@ -2143,11 +2191,13 @@ VALUE_PAIR *tmpl_cursor_init(int *err, vp_cursor_t *cursor, REQUEST *request, vp
 		 *	total number of attributes.
 		 */
 		case NUM_COUNT:
-			return fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag);
+			return tmpl_cursor_first(current, cursor, vps, vpt);
 
 		default:
 			num = vpt->tmpl_num;
-			while ((vp = fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag))) {
+			for (vp = tmpl_cursor_first(current, cursor, vps, vpt);
+			     vp;
+			     vp = fr_pair_cursor_next_by_da(cursor, vpt->tmpl_da, vpt->tmpl_tag)) {
 				VERIFY_VP(vp);
 				if (num-- <= 0) return vp;
 			}
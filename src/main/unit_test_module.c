@@ -890,6 +890,12 @@ int main(int argc, char *argv[])
 	 */
 	if (modules_thread_instantiate(main_config.config, el) < 0) goto exit_failure;
 
+	/*
+	 *	There's no worker to resume requests, so service
+	 *	the event list ourselves when a module yields.
+	 */
+	if (unlang_interpret_synchronous_init(el) < 0) goto exit_failure;
+
 	/*
 	 *	And then load the virtual servers.
 	 */
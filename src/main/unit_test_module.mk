@@ -4,6 +4,7 @@ SOURCES := \
 	auth.c \
 	client.c \
 	crypt.c \
+	crypto_offload.c \
 	files.c \
 	mainconfig.c \
 	modules.c \
@@ -15,7 +16,9 @@ SOURCES := \
 	virtual_servers.c \
 	unlang_compile.c \
 	unlang_interpret.c \
-	realms.c
+	realms.c \
+	reload.c \
+	worker_wake.c
 
 ifneq ($(OPENSSL_LIBS),)
 include ${top_srcdir}/src/main/tls.mk
@@ -28,6 +28,9 @@ RCSID("$Id$")
 #include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/interpreter.h>
 #include <freeradius-devel/parser.h>
+#include <freeradius-devel/latency.h>
+
+#include <ctype.h>
 
 /* Here's where we recognize all of our keywords: first the rcodes, then the
  * actions */
@@ -616,6 +619,42 @@ static bool pass2_fixup_tmpl(CONF_ITEM const *ci, vp_tmpl_t **pvpt, bool convert
 	return true;
 }
 
+/*
+ *	Convert a literal RHS to the data type of the LHS attribute,
+ *	so that it doesn't need to be parsed on every evaluation.
+ *
+ *	Prefixes and "combo" IP addresses are type-dependent, and
+ *	are left for the run-time code to figure out.
+ */
+static bool pass2_fixup_cast(vp_map_t *map)
+{
+	fr_dict_attr_t const *da = map->lhs->tmpl_da;
+
+	rad_assert(map->lhs->type == TMPL_TYPE_ATTR);
+	rad_assert(map->rhs->type == TMPL_TYPE_UNPARSED);
+
+	switch (da->type) {
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV6_ADDR:
+		if (strchr(map->rhs->name, '/') != NULL) return true;
+		break;
+
+	case PW_TYPE_COMBO_IP_ADDR:
+		return true;
+
+	default:
+		break;
+	}
+
+	if (tmpl_cast_in_place(map->rhs, da->type, da) < 0) {
+		cf_log_err(map->ci, "Failed to parse data type %s from string: %s",
+			   fr_int2str(dict_attr_types, da->type, "<UNKNOWN>"), map->rhs->name);
+		return false;
+	}
+
+	return true;
+}
+
 static bool pass2_cond_callback(void *ctx, fr_cond_t *c)
 {
 	vp_map_t *map;
@@ -664,6 +703,16 @@ static bool pass2_cond_callback(void *ctx, fr_cond_t *c)
 			return false;
 		}
 
+		/*
+		 *	The value exists now, so convert it once here,
+		 *	instead of looking it up on every evaluation.
+		 */
+		if (tmpl_cast_in_place(map->rhs, map->lhs->tmpl_da->type, map->lhs->tmpl_da) < 0) {
+			cf_log_err(map->ci, "Failed to parse value for attribute %s: %s",
+				   map->lhs->tmpl_da->name, fr_strerror());
+			return false;
+		}
+
 		/*
 		 *	These guys can't have a paircompare fixup applied.
 		 */
@@ -680,6 +729,16 @@ static bool pass2_cond_callback(void *ctx, fr_cond_t *c)
 			if (!pass2_fixup_undefined(map->ci, map->rhs)) return false;
 		}
 
+		/*
+		 *	&Attr == data, where &Attr is defined by a
+		 *	module.  Do the cast which the parser couldn't.
+		 */
+		if (!c->cast && (map->lhs->type == TMPL_TYPE_ATTR) &&
+		    (map->rhs->type == TMPL_TYPE_UNPARSED) &&
+		    !pass2_fixup_cast(map)) {
+			return false;
+		}
+
 		c->pass2_fixup = PASS2_FIXUP_NONE;
 	}
 
@@ -908,6 +967,102 @@ static bool pass2_cond_callback(void *ctx, fr_cond_t *c)
 	return true;
 }
 
+/*
+ *	Fold the constant parts of a condition, once pass2 has fixed
+ *	up everything it can.  The parser folds each node against the
+ *	ones which follow it, but leaves "Foo && true", and "(...)"
+ *	which only became constant during pass2.
+ */
+static void pass2_cond_fold(fr_cond_t *head)
+{
+	fr_cond_t *c, *prev = NULL, *next;
+
+	for (c = head; c != NULL; c = next) {
+		if (c->type == COND_TYPE_CHILD) {
+			fr_cond_t *child = c->data.child;
+
+			pass2_cond_fold(child);
+
+			/*
+			 *	(true) --> true
+			 */
+			if (!child->next &&
+			    ((child->type == COND_TYPE_TRUE) || (child->type == COND_TYPE_FALSE))) {
+				c->type = child->type;
+				TALLOC_FREE(c->data.child);
+			}
+		}
+
+		/*
+		 *	!true --> false, and !false --> true
+		 */
+		if (c->negate && ((c->type == COND_TYPE_TRUE) || (c->type == COND_TYPE_FALSE))) {
+			c->type = (c->type == COND_TYPE_TRUE) ? COND_TYPE_FALSE : COND_TYPE_TRUE;
+			c->negate = false;
+		}
+
+		next = c->next;
+
+		if ((c->type != COND_TYPE_TRUE) && (c->type != COND_TYPE_FALSE)) {
+			prev = c;
+			continue;
+		}
+
+		/*
+		 *	false && FOO --> false
+		 *	true || FOO --> true
+		 */
+		if (((c->type == COND_TYPE_FALSE) && (c->next_op == COND_AND)) ||
+		    ((c->type == COND_TYPE_TRUE) && (c->next_op == COND_OR))) {
+			TALLOC_FREE(c->next);
+			c->next_op = COND_NONE;
+			next = NULL;
+		}
+
+		/*
+		 *	FOO && true && BAR --> FOO && BAR
+		 *	FOO || false || BAR --> FOO || BAR
+		 */
+		if (next &&
+		    (((c->type == COND_TYPE_TRUE) && (c->next_op == COND_AND)) ||
+		     ((c->type == COND_TYPE_FALSE) && (c->next_op == COND_OR)))) {
+			/*
+			 *	The head can't be freed, as the section
+			 *	data points to it.  So it becomes BAR.
+			 */
+			if (!prev) {
+				*c = *next;
+				(void) talloc_steal(c, c->data.map);
+				(void) talloc_steal(c, c->next);
+
+				next->next = NULL;
+				talloc_free(next);
+				next = c;
+				continue;
+			}
+
+			prev->next = talloc_steal(prev, next);
+			c->next = NULL;
+			talloc_free(c);
+			continue;
+		}
+
+		/*
+		 *	FOO && true --> FOO
+		 *	FOO || false --> FOO
+		 */
+		if (prev && !next &&
+		    (((c->type == COND_TYPE_TRUE) && (prev->next_op == COND_AND)) ||
+		     ((c->type == COND_TYPE_FALSE) && (prev->next_op == COND_OR)))) {
+			prev->next = NULL;
+			prev->next_op = COND_NONE;
+			talloc_free(c);
+			continue;
+		}
+
+		prev = c;
+	}
+}
 
 /*
  *	Compile the RHS of update sections to xlat_exp_t
@@ -936,6 +1091,19 @@ static bool pass2_fixup_update(unlang_group_t *g)
 		 */
 		if (map->lhs->type == TMPL_TYPE_ATTR_UNDEFINED) {
 			if (!pass2_fixup_undefined(map->ci, map->lhs)) return false;
+
+			/*
+			 *	unlang_fixup_update() couldn't cast
+			 *	the value, as it didn't know the type
+			 *	of the attribute.  Map sections pass
+			 *	the RHS to the map processor as-is.
+			 */
+			if ((g->self.type == UNLANG_TYPE_UPDATE) &&
+			    (map->op != T_OP_CMP_FALSE) &&
+			    (map->rhs->type == TMPL_TYPE_UNPARSED) &&
+			    !pass2_fixup_cast(map)) {
+				return false;
+			}
 		}
 
 		if (map->rhs->type == TMPL_TYPE_ATTR_UNDEFINED) {
@@ -1906,6 +2074,100 @@ static unlang_t *compile_group(unlang_t *parent, unlang_compile_t *unlang_ctx, C
 	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
 }
 
+/*
+ *	If we're switching over an attribute, and all of the 'case'
+ *	statements are literals of the same type, sort them by value.
+ *	The interpreter can then do a binary search, instead of
+ *	comparing the attribute against each 'case' in turn.
+ */
+static void compile_switch_cases(unlang_group_t *g)
+{
+	unlang_t	*this, *null_case = NULL;
+	unlang_t	**cases;
+	int		num_cases = 0;
+
+	if (g->vpt->type != TMPL_TYPE_ATTR) return;
+
+	/*
+	 *	Types where "==" is the same as value_box_cmp().
+	 *	Prefixes match on the network, so aren't here.
+	 */
+	switch (g->vpt->tmpl_da->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+	case PW_TYPE_BOOLEAN:
+	case PW_TYPE_BYTE:
+	case PW_TYPE_SHORT:
+	case PW_TYPE_INTEGER:
+	case PW_TYPE_INTEGER64:
+	case PW_TYPE_SIGNED:
+	case PW_TYPE_DATE:
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV6_ADDR:
+	case PW_TYPE_ETHERNET:
+	case PW_TYPE_IFID:
+		break;
+
+	default:
+		return;
+	}
+
+	cases = talloc_array(g, unlang_t *, g->num_children + 1);
+	if (!cases) return;
+
+	for (this = g->children; this != NULL; this = this->next) {
+		unlang_group_t	*h = unlang_generic_to_group(this);
+		int		lo, hi;
+
+		if (!h->vpt) {
+			null_case = this;
+			continue;
+		}
+
+		/*
+		 *	xlats, attribute references, etc. have to be
+		 *	evaluated at run time, in order.
+		 */
+		if ((h->vpt->type != TMPL_TYPE_DATA) ||
+		    (h->vpt->tmpl_value_box_type != g->vpt->tmpl_da->type)) {
+			talloc_free(cases);
+			return;
+		}
+
+		lo = 0;
+		hi = num_cases;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+
+			if (value_box_cmp(&unlang_generic_to_group(cases[mid])->vpt->tmpl_value_box,
+					  &h->vpt->tmpl_value_box) < 0) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		/*
+		 *	The first 'case' with a given value is the one
+		 *	which matches, so later duplicates are ignored.
+		 */
+		if ((lo < num_cases) &&
+		    (value_box_cmp(&unlang_generic_to_group(cases[lo])->vpt->tmpl_value_box,
+				   &h->vpt->tmpl_value_box) == 0)) {
+			continue;
+		}
+
+		memmove(&cases[lo + 1], &cases[lo], sizeof(cases[0]) * (num_cases - lo));
+		cases[lo] = this;
+		num_cases++;
+	}
+
+	cases[num_cases] = null_case;
+
+	g->cases = cases;
+	g->num_cases = num_cases;
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				   unlang_group_type_t group_type, unlang_group_type_t parentgroup_type, unlang_type_t mod_type)
 {
@@ -2002,7 +2264,12 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		return NULL;
 	}
 
-	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	c = compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	if (!c) return NULL;
+
+	compile_switch_cases(g);
+
+	return c;
 }
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
@@ -2292,6 +2559,14 @@ static unlang_t *compile_if(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF
 	if (!fr_cond_walk(cond, pass2_cond_callback, NULL)) {
 		return NULL;
 	}
+	pass2_cond_fold(cond);
+
+	if (cond->type == COND_TYPE_FALSE) {
+		INFO(" # Skipping contents of '%s' as it is always 'false' -- %s:%d",
+		     unlang_ops[mod_type].name,
+		     cf_section_filename(cs), cf_section_lineno(cs));
+		return compile_empty(parent, unlang_ctx, cs, group_type, parentgroup_type, mod_type, COND_TYPE_FALSE);
+	}
 
 	c = compile_group(parent, unlang_ctx, cs, group_type, parentgroup_type, mod_type);
 	if (!c) return NULL;
@@ -2533,9 +2808,10 @@ static unlang_t *compile_redundant(unlang_t *parent, unlang_compile_t *unlang_ct
 static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				      unlang_group_type_t group_type, unlang_group_type_t parentgroup_type, unlang_type_t mod_type)
 {
-	unlang_t *c;
-	unlang_t *child;
-	unlang_group_t *g;
+	unlang_t	*c;
+	unlang_group_t	*g;
+	char const	*name2;
+	unsigned long	quorum = 0;
 
 	/*
 	 *	No children?  Die!
@@ -2545,35 +2821,40 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 		return NULL;
 	}
 
-	if (cf_section_name2(cs) != NULL) {
-		cf_log_err_cs(cs, "%s sections cannot have an argument", unlang_ops[mod_type].name);
-		return NULL;
+	/*
+	 *	"parallel first-success" finishes when one child
+	 *	succeeds, "parallel <num>" when <num> children do.
+	 */
+	name2 = cf_section_name2(cs);
+	if (name2) {
+		if (strcmp(name2, "first-success") == 0) {
+			quorum = 1;
+		} else {
+			char *end;
+
+			quorum = strtoul(name2, &end, 10);
+			if (*end || (quorum == 0)) {
+				cf_log_err_cs(cs, "Invalid argument '%s' for %s, expected 'first-success' "
+					      "or a number of children", name2, unlang_ops[mod_type].name);
+				return NULL;
+			}
+		}
 	}
 
 	c = compile_group(parent, unlang_ctx, cs, group_type, parentgroup_type, mod_type);
 	if (!c) return NULL;
 
-	c->name = c->debug_name = unlang_ops[c->type].name;
-
-	/*
-	 *	Check that all children are of the new type.
-	 */
 	g = unlang_generic_to_group(c);
-
-	for (child = g->children; child != NULL; child = child->next) {
-		unlang_module_call_t *single;
-
-		if (child->type != UNLANG_TYPE_MODULE_CALL) {
-			cf_log_err_cs(cs, "%s sections cannot a child of type %s", unlang_ops[mod_type].name, child->debug_name);
-			return NULL;
-		}
-
-		single = unlang_generic_to_module_call(child);
-		if ((single->module_instance->module->type & RLM_TYPE_RESUMABLE) == 0) {
-			cf_log_err_cs(cs, "%s sections cannot a non-resumable child of %s", unlang_ops[mod_type].name, child->debug_name);
-			return NULL;
-		}
+	if (quorum > (unsigned long)g->num_children) {
+		cf_log_err_cs(cs, "%s section has %i children, so %lu cannot succeed",
+			      unlang_ops[mod_type].name, g->num_children, quorum);
+		talloc_free(c);
+		return NULL;
 	}
+	g->quorum = quorum;
+
+	c->name = unlang_ops[c->type].name;
+	c->debug_name = name2 ? talloc_asprintf(c, "%s %s", c->name, name2) : c->name;
 
 	return c;
 }
@@ -2694,6 +2975,16 @@ static unlang_t *compile_module(unlang_t *parent, unlang_compile_t *unlang_ctx,
 	single->module_instance = this;
 	single->method = this->module->methods[unlang_ctx->component];
 
+	/*
+	 *	All calls to the same method of an instance share
+	 *	one histogram.
+	 */
+	if (!this->latency_id[unlang_ctx->component]) {
+		this->latency_id[unlang_ctx->component] = fr_latency_register("%s.%s", this->name,
+									      comp2str[unlang_ctx->component]);
+	}
+	single->latency_id = this->latency_id[unlang_ctx->component];
+
 	c = unlang_module_call_to_generic(single);
 	c->parent = parent;
 	c->next = NULL;
@@ -2752,6 +3043,205 @@ static modcall_compile_t compile_table[] = {
 	unlang_ctx2.section_name1 = unlang_ctx->section_name1; \
 	unlang_ctx2.section_name2 = unlang_ctx->section_name2
 
+#if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+/** Check whether a pattern means the same thing when it's one alternative of many
+ *
+ * Back-references, sub-routine calls, verbs, and options which change
+ * how the rest of the pattern is parsed would all refer to, or affect,
+ * the other alternatives.  We're conservative, and reject anything
+ * which looks like one of those.
+ *
+ * @param[in] p		the pattern.
+ * @param[in] len	of the pattern.
+ * @return true if the pattern can be combined with others.
+ */
+static bool compile_regex_set_safe(char const *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (p[i] == '\\') {
+			if ((i + 1) == len) return false;
+
+			i++;
+			if (isdigit((int) p[i]) || (p[i] == 'g') || (p[i] == 'k') ||
+			    (p[i] == 'Q') || (p[i] == 'E')) return false;
+			continue;
+		}
+
+		if (p[i] != '(') continue;
+		if ((i + 1) == len) return false;
+
+		if (p[i + 1] == '*') return false;
+		if (p[i + 1] != '?') continue;
+		if ((i + 2) == len) return false;
+
+		switch (p[i + 2]) {
+		case ':':	/* non-capturing group */
+		case '=':	/* lookahead */
+		case '!':
+		case '<':	/* lookbehind, or named group */
+		case '>':	/* atomic group */
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Return the map of an "if" or "elsif" which can be part of a regex set
+ *
+ * @param[in] c		the "if" or "elsif".
+ * @param[in] first	map of the first statement in the set, or NULL.
+ * @return
+ *	- the map, if the condition is a single regex match against
+ *	  the same attribute (and with the same flags) as first.
+ *	- NULL otherwise.
+ */
+static vp_map_t const *compile_regex_set_map(unlang_t *c, vp_map_t const *first)
+{
+	unlang_group_t		*g;
+	fr_cond_t const		*cond;
+	vp_map_t const		*map;
+
+	if ((c->type != UNLANG_TYPE_IF) && (c->type != UNLANG_TYPE_ELSIF)) return NULL;
+
+	g = unlang_generic_to_group(c);
+	cond = g->cond;
+	if (!cond || (cond->type != COND_TYPE_MAP) || cond->next || cond->negate || cond->cast) return NULL;
+
+	map = cond->data.map;
+	if ((map->op != T_OP_REG_EQ) ||
+	    (map->lhs->type != TMPL_TYPE_ATTR) || (map->lhs->tmpl_da->type != PW_TYPE_STRING) ||
+	    (map->rhs->type != TMPL_TYPE_REGEX_STRUCT)) return NULL;
+
+	if (!compile_regex_set_safe(map->rhs->name, map->rhs->len)) return NULL;
+
+	if (!first) return map;
+
+	if ((map->lhs->tmpl_da != first->lhs->tmpl_da) ||
+	    (map->lhs->tmpl_request != first->lhs->tmpl_request) ||
+	    (map->lhs->tmpl_list != first->lhs->tmpl_list) ||
+	    (map->lhs->tmpl_num != first->lhs->tmpl_num) ||
+	    (map->lhs->tmpl_tag != first->lhs->tmpl_tag) ||
+	    (map->rhs->tmpl_iflag != first->rhs->tmpl_iflag) ||
+	    (map->rhs->tmpl_mflag != first->rhs->tmpl_mflag)) return NULL;
+
+	return map;
+}
+
+/** Combine the regexes of an "if" / "elsif" chain into one expression
+ *
+ * Where the leading statements of a chain all match the same attribute
+ * against a static regex, the patterns are joined into one alternation.
+ * When that doesn't match, the interpreter can skip the whole set
+ * with one pass over the attribute, instead of one per statement.
+ *
+ * @param[in] c		the "if" which starts the chain.
+ */
+static void compile_regex_set(unlang_t *c)
+{
+	unlang_group_t		*g = unlang_generic_to_group(c);
+	vp_map_t const		*first, *map;
+	unlang_t		*p, *end = NULL;
+	char			*pattern;
+	int			count = 0;
+	ssize_t			slen;
+
+	if (g->regex_set) return;
+
+	first = compile_regex_set_map(c, NULL);
+	if (!first) return;
+
+	pattern = talloc_strdup(c, "");
+	for (p = c; p; p = p->next) {
+		if ((p != c) && (p->type != UNLANG_TYPE_ELSIF)) break;
+
+		map = compile_regex_set_map(p, first);
+		if (!map) break;
+
+		pattern = talloc_asprintf_append_buffer(pattern, "%s(?:%.*s)", count ? "|" : "",
+							(int) map->rhs->len, map->rhs->name);
+		end = p;
+		count++;
+	}
+
+	/*
+	 *	Not worth it for a single statement.
+	 */
+	if (count < 2) {
+		talloc_free(pattern);
+		return;
+	}
+
+	/*
+	 *	The patterns compiled on their own, but they may not
+	 *	compile together (e.g. duplicate group names).  That's
+	 *	fine, we just evaluate them one by one.
+	 */
+	slen = regex_compile(c, &g->regex_set, pattern, talloc_array_length(pattern) - 1,
+			     first->rhs->tmpl_iflag, first->rhs->tmpl_mflag, false, false);
+	talloc_free(pattern);
+	if (slen <= 0) {
+		g->regex_set = NULL;
+		return;
+	}
+
+	g->regex_set_end = end;
+}
+#endif
+
+/** Resolve the jump targets in a compiled section, and count its instructions
+ *
+ * Each "if" and "elsif" is pointed at the last "elsif" or "else" of its
+ * chain, so that once a branch has been taken, the interpreter can
+ * continue after the chain, instead of stepping through the rest of it.
+ * Where possible, the regexes at the start of the chain are combined
+ * into a regex set.
+ *
+ * Resolving the same tree more than once is harmless.
+ *
+ * @param[in] c		the instruction to resolve.
+ * @return the number of instructions in c, including c itself.
+ */
+static uint32_t compile_resolve(unlang_t *c)
+{
+	unlang_group_t	*g;
+	unlang_t	*child;
+	uint32_t	count = 1;
+
+	if (!unlang_ops[c->type].children) return count;
+
+	g = unlang_generic_to_group(c);
+	for (child = g->children; child != NULL; child = child->next) {
+#ifdef WITH_UNLANG
+		unlang_t *end, *p;
+
+		if (child->type == UNLANG_TYPE_IF) {
+			for (end = child;
+			     end->next && ((end->next->type == UNLANG_TYPE_ELSIF) ||
+					   (end->next->type == UNLANG_TYPE_ELSE));
+			     end = end->next);
+
+			for (p = child; p != end; p = p->next) {
+				unlang_generic_to_group(p)->chain_end = end;
+			}
+
+#  if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+			compile_regex_set(child);
+#  endif
+		}
+#endif
+
+		count += compile_resolve(child);
+	}
+
+	return count;
+}
+
 /*
  *	Compile one entry of a module call.
  */
@@ -2764,6 +3254,7 @@ static unlang_t *compile_item(unlang_t *parent, unlang_compile_t *unlang_ctx, CO
 	CONF_SECTION *cs, *subcs, *modules;
 	CONF_SECTION *loop;
 	char const *realname;
+	uint32_t count;
 	rlm_components_t component = unlang_ctx->component;
 	unlang_compile_t unlang_ctx2;
 
@@ -2962,6 +3453,9 @@ static unlang_t *compile_item(unlang_t *parent, unlang_compile_t *unlang_ctx, CO
 			c->debug_name = c->name;
 		}
 
+		count = compile_resolve(c);
+		DEBUG3("policy %s { ... } # %u instructions", modrefname, count);
+
 		/*
 		 *	Return the compiled thing if we can.
 		 */
@@ -3031,6 +3525,8 @@ int unlang_compile(CONF_SECTION *cs, rlm_components_t component)
 	char const *name1, *name2;
 	unlang_t *c;
 	unlang_compile_t unlang_ctx;
+	uint32_t count;
+	CONF_SECTION *server;
 
 	unlang_ctx.component = component;
 	unlang_ctx.name = comp2str[component];
@@ -3060,6 +3556,24 @@ int unlang_compile(CONF_SECTION *cs, rlm_components_t component)
 		c->debug_name = talloc_asprintf(c, "%s %s", name1, name2);
 	}
 
+	count = compile_resolve(c);
+	DEBUG3("%s { ... } # %u instructions", c->debug_name, count);
+
+	/*
+	 *	Name the histogram after the virtual server, if the
+	 *	section is in one.
+	 */
+	for (server = cf_item_parent(cf_section_to_item(cs));
+	     server && (strcmp(cf_section_name1(server), "server") != 0);
+	     server = cf_item_parent(cf_section_to_item(server)));
+
+	if (server && cf_section_name2(server)) {
+		unlang_generic_to_group(c)->latency_id = fr_latency_register("%s:%s", cf_section_name2(server),
+									      c->debug_name);
+	} else {
+		unlang_generic_to_group(c)->latency_id = fr_latency_register("%s", c->debug_name);
+	}
+
 	if (rad_debug_lvl > 3) {
 		unlang_dump(c, 2);
 	}
@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/interpreter.h>
 #include <freeradius-devel/parser.h>
+#include <freeradius-devel/latency.h>
 
 static FR_NAME_NUMBER unlang_action_table[] = {
 	{ "calculate-result",	UNLANG_ACTION_CALCULATE_RESULT },
@@ -56,6 +57,8 @@ static void safe_unlock(module_instance_t *instance)
 		pthread_mutex_unlock(instance->mutex);
 }
 
+static rlm_rcode_t unlang_run(REQUEST *request, unlang_stack_t *stack);
+
 static void unlang_push(unlang_stack_t *stack, unlang_t *program, rlm_rcode_t result, bool do_next_sibling)
 {
 	unlang_stack_frame_t *next;
@@ -81,6 +84,9 @@ static void unlang_push(unlang_stack_t *stack, unlang_t *program, rlm_rcode_t re
 	next->was_if = false;
 	next->if_taken = false;
 	next->resume = false;
+	next->top_frame = false;
+	next->latency_id = 0;
+	next->latency_running = 0;
 }
 
 static void unlang_pop(unlang_stack_t *stack)
@@ -269,34 +275,355 @@ static unlang_action_t unlang_group(REQUEST *request, unlang_stack_t *stack,
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
-typedef struct unlang_parallel_t {
+/** How far a child of a parallel section has got
+ *
+ */
+typedef enum {
+	PARALLEL_CHILD_INIT = 0,			//!< Not started.
+	PARALLEL_CHILD_RUNNING,				//!< Being run now.
+	PARALLEL_CHILD_YIELDED,				//!< Waiting for an event.
+	PARALLEL_CHILD_RESUMABLE,			//!< The event occurred, waiting to be run again.
+	PARALLEL_CHILD_DONE,				//!< Finished, and its result recorded.
+	PARALLEL_CHILD_CANCELLED			//!< Stopped before it finished.
+} unlang_parallel_child_state_t;
+
+/** A child of a parallel section
+ *
+ */
+struct unlang_parallel_child {
+	unlang_parallel_t		*parallel;	//!< Section we're a child of.
+	unlang_parallel_child_state_t	state;
+	unlang_t			*instruction;	//!< The child.
+	REQUEST				*request;	//!< The child runs as.  Modules keep this pointer
+							//!< when they yield, and pass it to unlang_resumable(),
+							//!< which is how we know which child to resume.
+	unlang_stack_t			*stack;		//!< The child runs on.
+	uint8_t				unlang_indent;	//!< Of the child's log messages, when it yielded.
+};
+
+/** The state of a parallel section
+ *
+ */
+struct unlang_parallel {
+	REQUEST			*request;	//!< Running the section.
+	uint32_t		quorum;		//!< Copied from the #unlang_group_t.
+
+	rlm_rcode_t		result;		//!< Highest priority result of the children.
+	int			priority;
+	rlm_rcode_t		good_result;	//!< Highest priority result of the children which succeeded.
+	int			good_priority;
+	uint32_t		good;		//!< Number of children which succeeded.
+	int			outstanding;	//!< Number of children which haven't finished.
+
+	bool			finished;	//!< Don't need the results of the other children.
+	bool			running;	//!< Children are being run, so the request mustn't
+						//!< be marked as resumable.
+	bool			signalled;	//!< The request has been marked as resumable.
+
+	int			num_children;
+	unlang_parallel_child_t	*children;
+};
+
+/** Move everything a request points to from one talloc ctx to another
+ *
+ * Children run as a copy of the request, so whatever the request owns
+ * has to be parented by whichever copy is running.  Otherwise anything
+ * a child allocates is freed with the child, and left dangling in the
+ * request its changes are copied back to.
+ *
+ * @param[in] request	whose fields are walked.
+ * @param[in] to	ctx to parent things with.
+ * @param[in] from	ctx currently parenting them.
+ */
+static void parallel_child_reparent(REQUEST *request, TALLOC_CTX *to, TALLOC_CTX *from)
+{
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+
+	/*
+	 *	Control attributes must be parented by the
+	 *	request they're in.
+	 */
+	for (vp = fr_pair_cursor_init(&cursor, &request->control); vp; vp = fr_pair_cursor_next(&cursor)) {
+		if (talloc_parent(vp) == from) (void) talloc_steal(to, vp);
+	}
+
+	if (request->packet && (talloc_parent(request->packet) == from)) (void) talloc_steal(to, request->packet);
+	if (request->reply && (talloc_parent(request->reply) == from)) (void) talloc_steal(to, request->reply);
+#ifdef WITH_PROXY
+	if (request->proxy && (talloc_parent(request->proxy) == from)) (void) talloc_steal(to, request->proxy);
+#endif
+#ifdef WITH_COA
+	if (request->coa && (talloc_parent(request->coa) == from)) (void) talloc_steal(to, request->coa);
+#endif
+
+	request_data_reparent(to, from, request->data);
+}
+
+/** Move attributes a child added to the lists of the packets they're in
+ *
+ */
+static void parallel_child_reparent_list(VALUE_PAIR **vps, TALLOC_CTX *to, REQUEST *c)
+{
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+
+	for (vp = fr_pair_cursor_init(&cursor, vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		if (talloc_parent(vp) == c) (void) talloc_steal(to, vp);
+	}
+}
+
+/** Make the child's REQUEST a copy of the request running the section
+ *
+ * Only one child runs at a time, so the children share the request's lists by
+ * copying the request before each child runs, and copying it back afterwards.
+ */
+static void parallel_child_enter(unlang_parallel_child_t *child, REQUEST *request)
+{
+	REQUEST		*c = child->request;
+
+	*c = *request;
+	c->stack = child->stack;
+	c->heap_id = -1;
+	if (child->state != PARALLEL_CHILD_INIT) c->log.unlang_indent = child->unlang_indent;
+
+	parallel_child_reparent(c, c, request);
+
+	child->state = PARALLEL_CHILD_RUNNING;
+}
+
+/** Copy the child's changes back to the request running the section
+ *
+ */
+static void parallel_child_exit(unlang_parallel_child_t *child, REQUEST *request)
+{
+	REQUEST		*c = child->request;
+	unlang_stack_t	*stack = request->stack;
+	int		heap_id = request->heap_id;
+	uint8_t		unlang_indent = request->log.unlang_indent;
+
+	parallel_child_reparent(c, request, c);
+
+	/*
+	 *	Attributes the child allocated itself, and then
+	 *	added to one of the other lists.
+	 */
+	if (c->packet) parallel_child_reparent_list(&c->packet->vps, c->packet, c);
+	if (c->reply) parallel_child_reparent_list(&c->reply->vps, c->reply, c);
+	if (c->state_ctx) parallel_child_reparent_list(&c->state, c->state_ctx, c);
+
+	child->unlang_indent = c->log.unlang_indent;
+
+	*request = *c;
+	request->stack = stack;
+	request->heap_id = heap_id;
+	request->log.unlang_indent = unlang_indent;
+}
+
+/** Record the result of a child
+ *
+ * The results are combined using the same priorities as the children of a group.
+ * If a child's action is "return" or "reject", we stop waiting for the others.
+ *
+ * With a quorum, we stop waiting once enough children have succeeded, or once
+ * it's impossible for enough to succeed.  The failure of one child is then
+ * no reason to stop.
+ */
+static void parallel_child_result(unlang_parallel_t *state, unlang_parallel_child_t *child, rlm_rcode_t rcode)
+{
+	int priority = child->instruction->actions[rcode];
+
+	child->state = PARALLEL_CHILD_DONE;
+	state->outstanding--;
+
+	if (!state->quorum) {
+		if (priority == MOD_ACTION_RETURN) {
+			state->result = rcode;
+			state->finished = true;
+			return;
+		}
+
+		if (priority == MOD_ACTION_REJECT) {
+			state->result = RLM_MODULE_REJECT;
+			state->finished = true;
+			return;
+		}
+	} else if (priority < 0) {
+		if (priority == MOD_ACTION_REJECT) rcode = RLM_MODULE_REJECT;
+		priority = MOD_PRIORITY_MAX;
+	}
+
+	if (priority > state->priority) {
+		state->priority = priority;
+		state->result = rcode;
+	}
+
+	if (!state->quorum) return;
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_NOOP:
+		state->good++;
+		if (priority > state->good_priority) {
+			state->good_priority = priority;
+			state->good_result = rcode;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if ((state->good >= state->quorum) || ((state->good + state->outstanding) < state->quorum)) {
+		state->finished = true;
+	}
+}
+
+/** Run a child until it yields or finishes
+ *
+ */
+static void parallel_child_run(unlang_parallel_t *state, unlang_parallel_child_t *child)
+{
+	REQUEST		*request = state->request;
 	rlm_rcode_t	rcode;
-	int		priority;
 
-	unlang_stack_t	*stacks;
-} unlang_parallel_t;
+	parallel_child_enter(child, request);
+	rcode = unlang_run(child->request, child->stack);
+	parallel_child_exit(child, request);
+
+	if (rcode == RLM_MODULE_YIELD) {
+		child->state = PARALLEL_CHILD_YIELDED;
+		return;
+	}
+
+	parallel_child_result(state, child, rcode);
+}
+
+/** Pass an action to a child which is waiting for an event
+ *
+ * FR_ACTION_DONE cancels the child.
+ */
+static void parallel_child_signal(unlang_parallel_t *state, unlang_parallel_child_t *child, fr_state_action_t action)
+{
+	unlang_parallel_child_state_t	prev = child->state;
+
+	switch (prev) {
+	case PARALLEL_CHILD_YIELDED:
+	case PARALLEL_CHILD_RESUMABLE:
+		parallel_child_enter(child, state->request);
+		unlang_action(child->request, action);
+		parallel_child_exit(child, state->request);
+		child->state = prev;
+		break;
+
+	case PARALLEL_CHILD_INIT:
+		break;
+
+	default:
+		return;
+	}
+
+	if (action == FR_ACTION_DONE) {
+		child->state = PARALLEL_CHILD_CANCELLED;
+		state->outstanding--;
+	}
+}
 
-static unlang_action_t unlang_parallel(UNUSED REQUEST *request, unlang_stack_t *stack,
-				       UNUSED rlm_rcode_t *result, UNUSED int *priority)
+/** Run the children of a parallel section concurrently
+ *
+ * Each child runs on its own stack.  When a child yields, we run the next one,
+ * so the children wait for their events at the same time.  Once every child
+ * has yielded, so do we.  When we're resumed, we run the children which have
+ * been marked as resumable.
+ */
+static unlang_action_t unlang_parallel(REQUEST *request, unlang_stack_t *stack,
+				       rlm_rcode_t *presult, int *priority)
 {
 	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
 	unlang_t		*instruction = frame->instruction;
-	unlang_group_t	*g;
+	unlang_group_t		*g;
+	unlang_parallel_t	*state;
+	unlang_t		*child;
+	int			i;
+	bool			again;
 
 	g = unlang_generic_to_group(instruction);
 
 	if (!frame->resume) {
 		/*
-		 *	Set up some stacks and a return code.
+		 *	Modules may allocate attributes, request data
+		 *	and events in the children's REQUESTs, so
+		 *	the state lives as long as the request.
 		 */
+		MEM(state = talloc_zero(request, unlang_parallel_t));
+		MEM(state->children = talloc_zero_array(state, unlang_parallel_child_t, g->num_children));
+		state->request = request;
+		state->quorum = g->quorum;
+		state->result = frame->result;
+
+		for (child = g->children, i = 0; child && (i < g->num_children); child = child->next, i++) {
+			unlang_parallel_child_t *c = &state->children[i];
+
+			c->parallel = state;
+			c->instruction = child;
+			MEM(c->request = talloc_zero(state, REQUEST));
+			MEM(c->stack = talloc_zero(c->request, unlang_stack_t));
+			c->stack->parallel = c;
+
+			unlang_push(c->stack, child, frame->result, false);
+			c->stack->frame[c->stack->depth].top_frame = true;
+		}
+		state->num_children = state->outstanding = i;
+		frame->parallel.state = state;
+
+		state->running = true;
+		for (i = 0; (i < state->num_children) && !state->finished; i++) {
+			parallel_child_run(state, &state->children[i]);
+		}
 	} else {
-		/*
-		 *	Find a resumption child and run it.
-		 */
+		state = frame->parallel.state;
+		state->signalled = false;
+		state->running = true;
 	}
 
-	unlang_push(stack, g->children, frame->result, true);
-	return UNLANG_ACTION_PUSHED_CHILD;
+	/*
+	 *	Children may have been marked as resumable while
+	 *	other children were running.
+	 */
+	do {
+		again = false;
+
+		for (i = 0; (i < state->num_children) && !state->finished; i++) {
+			if (state->children[i].state != PARALLEL_CHILD_RESUMABLE) continue;
+
+			parallel_child_run(state, &state->children[i]);
+			again = true;
+		}
+	} while (again);
+	state->running = false;
+
+	if (!state->finished && (state->outstanding > 0)) {
+		RDEBUG3("parallel - waiting for %i of %i children", state->outstanding, state->num_children);
+		*presult = RLM_MODULE_YIELD;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	/*
+	 *	Stop the children we no longer need.
+	 */
+	for (i = 0; i < state->num_children; i++) {
+		parallel_child_signal(state, &state->children[i], FR_ACTION_DONE);
+	}
+
+	if (state->quorum && (state->good >= state->quorum)) {
+		*presult = state->good_result;
+	} else {
+		*presult = state->result;
+	}
+	*priority = instruction->actions[*presult];
+
+	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
 static unlang_action_t unlang_case(REQUEST *request, unlang_stack_t *stack,
@@ -489,6 +816,35 @@ static unlang_action_t unlang_xlat_inline(REQUEST *request, unlang_stack_t *stac
 	return UNLANG_ACTION_CONTINUE;
 }
 
+/** Find the 'case' statement matching a value, using the index built by the compiler
+ *
+ * @param[in] g		the switch statement.
+ * @param[in] value	to look for.
+ * @return
+ *	- The matching 'case'.
+ *	- NULL if no 'case' matches.
+ */
+static unlang_t *unlang_switch_find(unlang_group_t *g, value_box_t const *value)
+{
+	int lo = 0, hi = g->num_cases - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		int cmp;
+
+		cmp = value_box_cmp(value, &unlang_generic_to_group(g->cases[mid])->vpt->tmpl_value_box);
+		if (cmp == 0) return g->cases[mid];
+
+		if (cmp < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
 static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 				       UNUSED rlm_rcode_t *presult, UNUSED int *priority)
 {
@@ -517,6 +873,8 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 	null_case = found = NULL;
 	data.datum.ptr = NULL;
 
+	request->memo.active = true;
+
 	/*
 	 *	The attribute doesn't exist.  We can skip
 	 *	directly to the default 'case' statement.
@@ -536,6 +894,47 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 		goto do_null_case;
 	}
 
+	/*
+	 *	All of the 'case' statements are literals, so we
+	 *	can look up the value instead of comparing the
+	 *	attribute against each one in turn.
+	 */
+	if (g->cases) {
+		VALUE_PAIR	*vp;
+		vp_cursor_t	cursor;
+		int		err;
+
+		for (vp = tmpl_cursor_init(&err, &cursor, request, g->vpt);
+		     vp;
+		     vp = tmpl_cursor_next(&cursor, g->vpt)) {
+			unlang_t *match;
+
+			match = unlang_switch_find(g, &vp->data);
+			if (!match || (match == found)) continue;
+
+			if (!found) {
+				found = match;
+				continue;
+			}
+
+			/*
+			 *	Different instances match different
+			 *	'case' statements.  The first one wins.
+			 */
+			for (this = g->children; this; this = this->next) {
+				if (this == found) break;
+				if (this == match) {
+					found = match;
+					break;
+				}
+			}
+		}
+
+		if (!found) found = g->cases[g->num_cases];
+
+		goto do_null_case;
+	}
+
 	/*
 	 *	Expand the template if necessary, so that it
 	 *	is evaluated once instead of for each 'case'
@@ -619,6 +1018,7 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 	if (!found) found = null_case;
 
 do_null_case:
+	request->memo.active = false;
 	talloc_free(data.datum.ptr);
 
 	/*
@@ -682,6 +1082,7 @@ static unlang_action_t unlang_module_call(REQUEST *request, unlang_stack_t *stac
 	unlang_module_call_t		*sp;
 	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
 	unlang_t			*instruction = frame->instruction;
+	uint64_t			start, elapsed;
 
 	/*
 	 *	Process a stand-alone child, and fall through
@@ -712,12 +1113,24 @@ static unlang_action_t unlang_module_call(REQUEST *request, unlang_stack_t *stac
 	 */
 	request->module = sp->module_instance->name;
 
+	start = fr_latency_now();
 	safe_lock(sp->module_instance);
 	request->rcode = sp->method(sp->module_instance->data, frame->modcall.thread, request);
 	safe_unlock(sp->module_instance);
+	elapsed = fr_latency_now() - start;
 
 	request->module = NULL;
 
+	/*
+	 *	If the module yielded, the time it's spent so far is
+	 *	added to the time it spends after being resumed.
+	 */
+	if ((request->rcode == RLM_MODULE_YIELD) && (frame->instruction->type == UNLANG_TYPE_RESUME)) {
+		unlang_generic_to_resumption(frame->instruction)->running = elapsed;
+	} else {
+		fr_latency_record(sp->latency_id, elapsed);
+	}
+
 	/*
 	 *	Is now marked as "stop" when it wasn't before, we must have been blocked.
 	 */
@@ -758,7 +1171,49 @@ static unlang_action_t unlang_if(REQUEST *request, unlang_stack_t *stack,
 	g = unlang_generic_to_group(instruction);
 	rad_assert(g->cond != NULL);
 
+	request->memo.active = true;
+
+#if defined(HAVE_PCRE) || defined(HAVE_PCRE2)
+	/*
+	 *	If none of the attribute's values match any of the
+	 *	regexes in the set, we can skip straight to the
+	 *	first statement after the set.
+	 */
+	if (g->regex_set && (instruction->type == UNLANG_TYPE_IF)) {
+		vp_tmpl_t const	*vpt = g->cond->data.map->lhs;
+		VALUE_PAIR	*vp;
+		vp_cursor_t	cursor;
+		int		err, ret = 0;
+		bool		tested = false;
+
+		for (vp = tmpl_cursor_init(&err, &cursor, request, vpt);
+		     vp;
+		     vp = tmpl_cursor_next(&cursor, vpt)) {
+			tested = true;
+
+			ret = regex_exec(g->regex_set, vp->vp_strvalue, vp->vp_length, NULL, NULL);
+			if (ret != 0) break;
+		}
+
+		if (tested && (ret == 0)) {
+			request->memo.active = false;
+
+			RDEBUG2("  ... no match for any regex up to %s", g->regex_set_end->debug_name);
+			regex_sub_to_request(request, NULL, NULL, 0, NULL, 0);	/* clear out old entries */
+
+			frame->was_if = true;
+			frame->if_taken = false;
+			frame->instruction = g->regex_set_end;
+
+			*priority = instruction->actions[*presult];
+
+			return UNLANG_ACTION_CONTINUE;
+		}
+	}
+#endif
+
 	condition = cond_eval(request, *presult, 0, g->cond);
+	request->memo.active = false;
 	if (condition < 0) {
 		switch (condition) {
 		case -2:
@@ -854,6 +1309,7 @@ static unlang_action_t unlang_resumption(REQUEST *request, unlang_stack_t *stack
 	unlang_resumption_t	*mr = unlang_generic_to_resumption(instruction);
 	unlang_module_call_t	*sp;
 	void 			*mutable;
+	uint64_t		start;
 
 	sp = &mr->module;
 
@@ -863,9 +1319,13 @@ static unlang_action_t unlang_resumption(REQUEST *request, unlang_stack_t *stack
 
 	memcpy(&mutable, &mr->ctx, sizeof(mutable));
 
+	start = fr_latency_now();
 	safe_lock(sp->module_instance);
 	*presult = mr->callback(request, mr->module.module_instance->data, mr->thread, mutable);
 	safe_unlock(sp->module_instance);
+	mr->running += fr_latency_now() - start;
+
+	if (*presult != RLM_MODULE_YIELD) fr_latency_record(sp->latency_id, mr->running);
 
 	RDEBUG2("%s (%s)", instruction->name ? instruction->name : "",
 		fr_int2str(mod_rcode_table, *presult, "<invalid>"));
@@ -1001,6 +1461,12 @@ static rlm_rcode_t unlang_run(REQUEST *request, unlang_stack_t *stack)
 
 	RDEBUG4("** [%i] %s - entered", stack->depth, __FUNCTION__);
 
+	/*
+	 *	Anything may have happened to the attribute lists
+	 *	since we were last running.
+	 */
+	tmpl_memo_clear(&request->memo);
+
 redo:
 	priority = -1;
 
@@ -1040,13 +1506,66 @@ redo:
 			RINDENT();
 		}
 
+		/*
+		 *	Conditions only read the attribute lists, so an
+		 *	"elsif" can re-use the attributes the "if" found.
+		 *	Anything else may change the lists.
+		 */
+		if ((instruction->type != UNLANG_TYPE_IF) &&
+		    (instruction->type != UNLANG_TYPE_ELSIF) &&
+		    (instruction->type != UNLANG_TYPE_SWITCH)) tmpl_memo_clear(&request->memo);
+
 		/*
 		 *	Execute an operation
 		 */
 		RDEBUG4("** [%i] %s >> %s", stack->depth, __FUNCTION__,
 			unlang_ops[instruction->type].name);
 
-		action = unlang_ops[instruction->type].func(request, stack, &result, &priority);
+		/*
+		 *	The common instructions are called directly, so
+		 *	the compiler can inline them.  Everything else
+		 *	goes through #unlang_ops.
+		 */
+		switch (instruction->type) {
+		case UNLANG_TYPE_MODULE_CALL:
+			action = unlang_module_call(request, stack, &result, &priority);
+			break;
+
+		case UNLANG_TYPE_GROUP:
+		case UNLANG_TYPE_POLICY:
+			action = unlang_group(request, stack, &result, &priority);
+			break;
+
+#ifdef WITH_UNLANG
+		case UNLANG_TYPE_IF:
+			action = unlang_if(request, stack, &result, &priority);
+			break;
+
+		case UNLANG_TYPE_ELSIF:
+			action = unlang_elsif(request, stack, &result, &priority);
+			break;
+
+		case UNLANG_TYPE_ELSE:
+			action = unlang_else(request, stack, &result, &priority);
+			break;
+
+		case UNLANG_TYPE_UPDATE:
+			action = unlang_update(request, stack, &result, &priority);
+			break;
+#endif
+
+		case UNLANG_TYPE_RESUME:
+			action = unlang_resumption(request, stack, &result, &priority);
+			break;
+
+		default:
+			if ((instruction->type >= UNLANG_TYPE_MAX) || !unlang_ops[instruction->type].func) {
+				RERROR("Invalid instruction type %u", instruction->type);
+				goto do_stop;
+			}
+			action = unlang_ops[instruction->type].func(request, stack, &result, &priority);
+			break;
+		}
 
 		RDEBUG4("** [%i] %s << %s (%d)", stack->depth, __FUNCTION__,
 			fr_int2str(unlang_action_table, action, "<INVALID>"), priority);
@@ -1101,7 +1620,8 @@ redo:
 
 		case UNLANG_ACTION_CALCULATE_RESULT:
 			if (result == RLM_MODULE_YIELD) {
-				rad_assert(frame->instruction->type == UNLANG_TYPE_RESUME);
+				rad_assert((frame->instruction->type == UNLANG_TYPE_RESUME) ||
+					   (frame->instruction->type == UNLANG_TYPE_PARALLEL));
 				frame->resume = true;
 				RDEBUG4("** [%i] %s - exited (yield)", stack->depth, __FUNCTION__);
 				return RLM_MODULE_YIELD;
@@ -1175,6 +1695,25 @@ redo:
 			if (!frame->do_next_sibling) goto done;
 		} /* switch over return code from the interpreter function */
 
+#ifdef WITH_UNLANG
+		/*
+		 *	We took an "if" or "elsif".  Skip the rest of
+		 *	the chain, using the target the compiler
+		 *	resolved for us.
+		 */
+		if (frame->if_taken &&
+		    ((instruction->type == UNLANG_TYPE_IF) || (instruction->type == UNLANG_TYPE_ELSIF))) {
+			unlang_t *end = unlang_generic_to_group(instruction)->chain_end;
+
+			if (end) {
+				frame->was_if = false;
+				frame->if_taken = false;
+				frame->instruction = end->next;
+				continue;
+			}
+		}
+#endif
+
 		frame->instruction = frame->instruction->next;
 	}
 
@@ -1239,6 +1778,31 @@ void unlang_push_section(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t action)
 	 *	stack into segments.
 	 */
 	stack->frame[stack->depth].top_frame = true;
+	stack->frame[stack->depth].latency_id = unlang_generic_to_group(instruction)->latency_id;
+}
+
+/** Run the current section, and record how long it took to finish
+ *
+ * Only the time spent running is counted.  If the section yields,
+ * the time spent waiting to be resumed isn't.
+ */
+static rlm_rcode_t unlang_run_section(REQUEST *request, unlang_stack_t *stack)
+{
+	unlang_stack_frame_t	*top;
+	int			depth;
+	uint64_t		start;
+	rlm_rcode_t		rcode;
+
+	for (depth = stack->depth; (depth > 0) && !stack->frame[depth].top_frame; depth--);
+	top = &stack->frame[depth];
+
+	start = fr_latency_now();
+	rcode = unlang_run(request, stack);
+	top->latency_running += fr_latency_now() - start;
+
+	if (rcode != RLM_MODULE_YIELD) fr_latency_record(top->latency_id, top->latency_running);
+
+	return rcode;
 }
 
 /** Continue interpreting after a previous push or yield.
@@ -1246,7 +1810,7 @@ void unlang_push_section(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t action)
  */
 rlm_rcode_t unlang_interpret_continue(REQUEST *request)
 {
-	return unlang_run(request, request->stack);
+	return unlang_run_section(request, request->stack);
 }
 
 /** Call a module, iteratively, with a local stack, rather than recursively
@@ -1264,7 +1828,7 @@ rlm_rcode_t unlang_interpret(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t act
 	 */
 	unlang_push_section(request, cs, action);
 
-	rcode = unlang_run(request, stack);
+	rcode = unlang_run_section(request, stack);
 	if (rcode != RLM_MODULE_YIELD) {
 		rad_assert(stack->frame[stack->depth].top_frame);
 		rad_assert(!stack->frame[stack->depth].instruction || /* processed the whole section */
@@ -1279,6 +1843,123 @@ rlm_rcode_t unlang_interpret(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t act
 	return rcode;
 }
 
+/** Event list and backlog used to run yielded requests synchronously
+ *
+ */
+typedef struct unlang_synchronous_t {
+	fr_event_list_t		*el;		//!< Serviced while a request is yielded.
+	fr_heap_t		*backlog;	//!< Requests marked resumable by unlang_resumable().
+} unlang_synchronous_t;
+
+fr_thread_local_setup(unlang_synchronous_t *, unlang_synchronous)	/* macro */
+
+static int synchronous_cmp(void const *one, void const *two)
+{
+	return (one > two) - (one < two);
+}
+
+static void _unlang_synchronous_free(void *arg)
+{
+	unlang_synchronous_t *sync = arg;
+
+	fr_heap_delete(sync->backlog);
+	talloc_free(sync);
+}
+
+/** Service an event list for requests which yield in #unlang_interpret_synchronous
+ *
+ * There's no worker to resume requests run by the old-style process
+ * functions, so by default a module yielding ends the section.  Once
+ * this has been called, the calling thread's requests instead wait
+ * in #unlang_interpret_synchronous, servicing el until they're
+ * resumable.  Used by unit_test_module.
+ *
+ * @param[in] el	to service.  Should be the one passed to
+ *			modules_thread_instantiate().
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int unlang_interpret_synchronous_init(fr_event_list_t *el)
+{
+	unlang_synchronous_t *sync;
+
+	sync = unlang_synchronous;
+	if (sync) {
+		sync->el = el;
+		return 0;
+	}
+
+	sync = talloc_zero(NULL, unlang_synchronous_t);
+	if (!sync) return -1;
+
+	sync->backlog = fr_heap_create(synchronous_cmp, offsetof(REQUEST, heap_id));
+	if (!sync->backlog) {
+		talloc_free(sync);
+		return -1;
+	}
+	sync->el = el;
+
+	fr_thread_local_set_destructor(unlang_synchronous, _unlang_synchronous_free, sync);
+
+	return 0;
+}
+
+/** Run a section to completion, servicing events while the request is yielded
+ *
+ * Behaves exactly like #unlang_interpret unless #unlang_interpret_synchronous_init
+ * has been called by this thread, and the request isn't already being
+ * run by a worker's event loop.
+ *
+ * @param[in] request	to run.
+ * @param[in] cs	section to run.
+ * @param[in] action	default return code for the section.
+ * @return the result of the section.
+ */
+rlm_rcode_t unlang_interpret_synchronous(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t action)
+{
+	unlang_synchronous_t	*sync = unlang_synchronous;
+	unlang_stack_t		*stack = request->stack;
+	int			depth = stack->depth;
+	rlm_rcode_t		rcode;
+
+	if (!sync || (request->el && (request->el != sync->el))) return unlang_interpret(request, cs, action);
+
+	/*
+	 *	Modules check request->el before yielding.
+	 */
+	if (!request->el) {
+		request->el = sync->el;
+		request->backlog = sync->backlog;
+	}
+
+	rcode = unlang_interpret(request, cs, action);
+	while (rcode == RLM_MODULE_YIELD) {
+		if (request->heap_id < 0) {
+			if (fr_event_corral(sync->el, true) < 0) {
+				REDEBUG("Failed servicing events: %s", fr_strerror());
+
+				unlang_action(request, FR_ACTION_DONE);
+				stack->depth = depth;
+				return RLM_MODULE_FAIL;
+			}
+			fr_event_service(sync->el);
+			continue;
+		}
+
+		(void) fr_heap_extract(sync->backlog, request);
+		rcode = unlang_interpret_continue(request);
+	}
+
+	/*
+	 *	Pop the section, as unlang_interpret() does when
+	 *	it's not yielding.
+	 */
+	if (stack->depth > depth) stack->depth = depth;
+
+	return rcode;
+}
+
 /** Wrap an #fr_event_timer_t providing data needed for unlang events
  *
  */
@@ -1507,6 +2188,28 @@ int unlang_event_fd_delete(REQUEST *request, void const *ctx, int fd)
  */
 void unlang_resumable(REQUEST *request)
 {
+	unlang_stack_t		*stack = request->stack;
+	unlang_parallel_child_t	*child = stack->parallel;
+
+	/*
+	 *	The request is running a child of a parallel
+	 *	section.  Mark the child as resumable, and the
+	 *	request running the section, unless that's
+	 *	already been done, or the section is running.
+	 */
+	if (child) {
+		unlang_parallel_t *state = child->parallel;
+
+		if (child->state != PARALLEL_CHILD_YIELDED) return;
+
+		child->state = PARALLEL_CHILD_RESUMABLE;
+		if (state->running || state->signalled) return;
+
+		state->signalled = true;
+		unlang_resumable(state->request);
+		return;
+	}
+
 	fr_heap_insert(request->backlog, request);
 }
 
@@ -1531,6 +2234,20 @@ void unlang_action(REQUEST *request, fr_state_action_t action)
 
 	frame = &stack->frame[stack->depth];
 
+	/*
+	 *	Pass the action to the children which are
+	 *	waiting for events.
+	 */
+	if (frame->instruction->type == UNLANG_TYPE_PARALLEL) {
+		unlang_parallel_t	*state = frame->parallel.state;
+		int			i;
+
+		for (i = 0; i < state->num_children; i++) {
+			parallel_child_signal(state, &state->children[i], action);
+		}
+		return;
+	}
+
 	rad_assert(frame->instruction->type == UNLANG_TYPE_RESUME);
 
 	mr = unlang_generic_to_resumption(frame->instruction);
@@ -1574,6 +2291,7 @@ rlm_rcode_t unlang_yield(REQUEST *request, fr_unlang_resume_t callback,
 	mr->action_callback = action_callback;
 	mr->thread = module_thread_instance_find(sp->module_instance);
 	mr->ctx = ctx;
+	mr->running = 0;
 
 	frame->instruction = unlang_resumption_to_generic(mr);
 
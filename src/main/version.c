@@ -396,7 +396,15 @@ void version_init_features(CONF_SECTION *cs)
 #endif
 				);
 
-#if !defined(HAVE_PCRE) && defined(HAVE_REGEX)
+	version_feature_add(cs, "regex-pcre2",
+#ifdef HAVE_PCRE2
+				true
+#else
+				false
+#endif
+				);
+
+#if !defined(HAVE_PCRE) && !defined(HAVE_PCRE2) && defined(HAVE_REGEX)
 	version_feature_add(cs, "regex-posix", true);
 	version_feature_add(cs, "regex-posix-extended",
 #  ifdef HAVE_REG_EXTENDED
@@ -499,7 +507,10 @@ void version_numbers_init(CONF_SECTION *cs)
 
 	version_number_add(cs, "ssl", ssl_version_num());
 
-#if defined(HAVE_REGEX) && defined(HAVE_PCRE)
+#if defined(HAVE_REGEX) && defined(HAVE_PCRE2)
+	pcre2_config(PCRE2_CONFIG_VERSION, buffer);
+	version_number_add(cs, "pcre2", buffer);
+#elif defined(HAVE_REGEX) && defined(HAVE_PCRE)
 	version_number_add(cs, "pcre", pcre_version());
 #endif
 }
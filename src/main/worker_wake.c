@@ -0,0 +1,136 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file worker_wake.c
+ * @brief Wake a worker's event loop from another thread.
+ *
+ * Requests can only be marked as resumable by the worker running them.
+ * Code which finishes work for a request in another thread adds the
+ * result to a list owned by the worker, and signals the worker.  The
+ * worker is then called back from its event loop, and collects the list.
+ *
+ * The signal is a byte written to a non-blocking pipe registered with the
+ * worker's event list.  The callback runs after the pipe is drained, so a
+ * single signal per batch of results is enough.
+ *
+ * Callers must stop signalling before freeing the handle, usually by
+ * setting a flag under the same lock that protects their list.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/worker_wake.h>
+
+/** A worker's wakeup pipe
+ *
+ */
+struct fr_worker_wake {
+	char const		*name;		//!< For log messages.
+	fr_event_list_t		*el;		//!< Event list the pipe is registered with.
+
+	int			pipe[2];	//!< Other threads write to [1].
+
+	fr_worker_wake_func_t	func;		//!< Called in the worker's thread when woken.
+	void			*uctx;		//!< Data for func.
+};
+
+/** Drain the pipe, and call the owner's callback
+ *
+ */
+static void _worker_wake_readable(UNUSED fr_event_list_t *el, int fd, void *ctx)
+{
+	fr_worker_wake_t	*ww = talloc_get_type_abort(ctx, fr_worker_wake_t);
+	uint8_t			buffer[64];
+
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	ww->func(ww->uctx);
+}
+
+static int _worker_wake_free(fr_worker_wake_t *ww)
+{
+	fr_event_fd_delete(ww->el, ww->pipe[0]);
+	close(ww->pipe[0]);
+	close(ww->pipe[1]);
+
+	return 0;
+}
+
+/** Create a wakeup pipe for a worker
+ *
+ * @param[in] ctx	to allocate the handle in.  Must be freed by the worker.
+ * @param[in] name	used as a prefix for log messages.
+ * @param[in] el	the worker's event list.  func is called from here.
+ * @param[in] func	to call when the worker is woken.
+ * @param[in] uctx	Data for func.
+ * @return
+ *	- A new handle.
+ *	- NULL on error.
+ */
+fr_worker_wake_t *fr_worker_wake_create(TALLOC_CTX *ctx, char const *name, fr_event_list_t *el,
+					fr_worker_wake_func_t func, void *uctx)
+{
+	fr_worker_wake_t *ww;
+
+	ww = talloc_zero(ctx, fr_worker_wake_t);
+	if (!ww) return NULL;
+
+	ww->name = talloc_typed_strdup(ww, name);
+	ww->el = el;
+	ww->func = func;
+	ww->uctx = uctx;
+
+	if (pipe(ww->pipe) < 0) {
+		ERROR("%s - Failed creating wakeup pipe: %s", name, fr_syserror(errno));
+		talloc_free(ww);
+		return NULL;
+	}
+
+	if ((fr_nonblock(ww->pipe[0]) < 0) || (fr_nonblock(ww->pipe[1]) < 0)) {
+		ERROR("%s - Failed setting wakeup pipe non-blocking: %s", name, fr_syserror(errno));
+	error:
+		close(ww->pipe[0]);
+		close(ww->pipe[1]);
+		talloc_free(ww);
+		return NULL;
+	}
+
+	if (fr_event_fd_insert(el, ww->pipe[0], _worker_wake_readable, NULL, NULL, ww) < 0) {
+		ERROR("%s - Failed registering wakeup pipe: %s", name, fr_strerror());
+		goto error;
+	}
+	talloc_set_destructor(ww, _worker_wake_free);
+
+	return ww;
+}
+
+/** Wake a worker
+ *
+ * May be called from any thread.  A full pipe means the worker already
+ * has a wakeup pending, so isn't an error.
+ *
+ * @param[in] ww	of the worker to wake.
+ */
+void fr_worker_wake_signal(fr_worker_wake_t *ww)
+{
+	if ((write(ww->pipe[1], "", 1) < 0) && (errno != EAGAIN)) {
+		ERROR("%s - Failed signalling worker: %s", ww->name, fr_syserror(errno));
+	}
+}
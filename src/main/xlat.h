@@ -62,6 +62,8 @@ struct xlat_exp {
 
 	xlat_state_t	type;		//!< type of this expansion.
 	xlat_exp_t	*next;		//!< Next in the list.
+	uint32_t	count;		//!< Number of nodes from this one to the end of the list.
+					//!< Set by the tokenizer.
 
 	xlat_exp_t	*child;		//!< Nested expansion.
 
@@ -75,9 +77,17 @@ struct xlat_exp {
 	xlat_t const	*xlat;		//!< The xlat expansion to expand format with.
 };
 
+/** Where the output of an expansion is written
+ *
+ * Either a fixed buffer provided by the caller, or a talloced buffer
+ * which is grown as required.
+ */
 typedef struct xlat_out {
-	char const	*out;		//!< Output data.
-	size_t		len;		//!< Length of the output string.
+	TALLOC_CTX	*ctx;		//!< To grow the buffer in.  NULL if the buffer is fixed.
+	char		*out;		//!< Output data, always \0 terminated.
+	size_t		size;		//!< Size of the buffer.
+	size_t		len;		//!< Length of the output string.  May be >= size if a
+					//!< fixed buffer was truncated.
 } xlat_out_t;
 
 
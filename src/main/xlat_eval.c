@@ -330,6 +330,7 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 	ssize_t rcode;
 	char *str = NULL, *child;
 	char const *p;
+	bool memo;
 
 	XLAT_DEBUG("%.*sxlat aprint %d %s", lvl, xlat_spaces, node->type, node->fmt);
 
@@ -476,7 +477,9 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 			str = talloc_array(ctx, char, node->xlat->buf_len);
 			str[0] = '\0';	/* Be sure the string is \0 terminated */
 		}
+		memo = tmpl_memo_suspend(&request->memo);
 		rcode = node->xlat->func(ctx, &str, node->xlat->buf_len, node->xlat->mod_inst, NULL, request, NULL);
+		tmpl_memo_resume(&request->memo, memo);
 		if (rcode < 0) {
 			talloc_free(str);
 			return NULL;
@@ -554,7 +557,9 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 			str = talloc_array(ctx, char, node->xlat->buf_len);
 			str[0] = '\0';	/* Be sure the string is \0 terminated */
 		}
+		memo = tmpl_memo_suspend(&request->memo);
 		rcode = node->xlat->func(ctx, &str, node->xlat->buf_len, node->xlat->mod_inst, NULL, request, child);
+		tmpl_memo_resume(&request->memo, memo);
 		talloc_free(child);
 		if (rcode < 0) {
 			talloc_free(str);
@@ -632,13 +637,206 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 }
 
 
+/** Make sure there's room for another inlen bytes, and the \0, in the output buffer
+ *
+ * Fixed buffers are never grown, data written to them is truncated instead.
+ *
+ * @param[in] xo	to grow.
+ * @param[in] inlen	how much data we're about to write.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int xlat_out_reserve(xlat_out_t *xo, size_t inlen)
+{
+	size_t	need = xo->len + inlen + 1;
+	size_t	size;
+	char	*out;
+
+	if (!xo->ctx || (need <= xo->size)) return 0;
+
+	size = xo->size * 2;
+	if (size < need) size = need;
+
+	out = talloc_realloc(xo->ctx, xo->out, char, size);
+	if (!out) return -1;
+
+	xo->out = out;
+	xo->size = size;
+
+	return 0;
+}
+
+/** Append data to the output buffer
+ *
+ * @param[in] xo	to append to.
+ * @param[in] in	data to append.
+ * @param[in] inlen	length of the data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int xlat_out_append(xlat_out_t *xo, char const *in, size_t inlen)
+{
+	if (xlat_out_reserve(xo, inlen) < 0) return -1;
+
+	if (xo->len < xo->size) {
+		size_t copy = xo->size - xo->len - 1;
+
+		if (copy > inlen) copy = inlen;
+		memcpy(xo->out + xo->len, in, copy);
+		xo->out[xo->len + copy] = '\0';
+	}
+	xo->len += inlen;
+
+	return 0;
+}
+
+/** Print an attribute reference directly into the output buffer
+ *
+ * Handles the common case of a real attribute, which is either in the
+ * request, or isn't, and which has a string, integer or IP address value.
+ * Everything else (virtual attributes, counts, concatenation, enumerated
+ * values and the more obscure data types) is left to #xlat_getvp.
+ *
+ * The output is the same as #xlat_aprint would produce.
+ *
+ * @return
+ *	- 1 if the attribute was printed.
+ *	- 0 if the caller should use #xlat_aprint instead.
+ *	- -1 on failure.
+ */
+static int xlat_attr_append(xlat_out_t *xo, REQUEST *request, vp_tmpl_t const *vpt,
+			    xlat_escape_t escape, void const *escape_ctx)
+{
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+	char		buffer[INET6_ADDRSTRLEN + 4];
+	char const	*value;
+	size_t		len, space;
+	void		*mutable;
+
+	if ((vpt->type != TMPL_TYPE_ATTR) || vpt->tmpl_da->flags.virtual ||
+	    (vpt->tmpl_num == NUM_ALL) || (vpt->tmpl_num == NUM_COUNT)) return 0;
+
+	vp = tmpl_cursor_init(NULL, &cursor, request, vpt);
+	if (!vp) return 1;	/* Expands to nothing */
+
+	if (vp->type != VT_DATA) return 0;
+
+	switch (vp->vp_type) {
+	case PW_TYPE_STRING:
+		/*
+		 *	No escape function, so the value is escaped
+		 *	as if it was in a double quoted string.
+		 */
+		if (!escape) {
+			len = fr_snprint_len(vp->vp_strvalue, vp->vp_length, '"') - 1;
+			if (xlat_out_reserve(xo, len) < 0) return -1;
+
+			if (xo->len < xo->size) {
+				fr_snprint(xo->out + xo->len, xo->size - xo->len,
+					   vp->vp_strvalue, vp->vp_length, '"');
+			}
+			xo->len += len;
+			return 1;
+		}
+
+		value = vp->vp_strvalue;
+		len = strlen(value);
+		break;
+
+	case PW_TYPE_BYTE:
+	case PW_TYPE_SHORT:
+	case PW_TYPE_INTEGER:
+	case PW_TYPE_INTEGER64:
+	case PW_TYPE_SIGNED:
+		if (vp->data.datum.enumv) return 0;
+		/* FALL-THROUGH */
+
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV4_PREFIX:
+	case PW_TYPE_IPV6_ADDR:
+	case PW_TYPE_IPV6_PREFIX:
+		len = value_box_snprint(buffer, sizeof(buffer), &vp->data, '\0');
+		if (len >= sizeof(buffer)) return 0;
+		value = buffer;
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (len == 0) return 1;
+
+	if (!escape) return (xlat_out_append(xo, value, len) < 0) ? -1 : 1;
+
+	/*
+	 *	Escaping can triple the length of the data.  Don't
+	 *	try to deal with truncated escape sequences.
+	 */
+	if (xlat_out_reserve(xo, (len + 1) * 3) < 0) return -1;
+
+	space = (xo->len < xo->size) ? xo->size - xo->len : 0;
+	if (space < ((len + 1) * 3)) return 0;
+
+	memcpy(&mutable, &escape_ctx, sizeof(mutable));
+	escape(request, xo->out + xo->len, space, value, mutable);
+	xo->len += strlen(xo->out + xo->len);
+
+	return 1;
+}
+
+/** Expand a list of nodes, appending the results to the output buffer
+ *
+ * Literals, and most attribute references, are written directly to the
+ * output.  Everything else is expanded with #xlat_aprint, and copied.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int xlat_process_append(xlat_out_t *xo, REQUEST *request, xlat_exp_t const * const head,
+			       xlat_escape_t escape, void const *escape_ctx)
+{
+	xlat_exp_t const	*node;
+	char			*str;
+	int			ret;
+
+	for (node = head; node != NULL; node = node->next) {
+		switch (node->type) {
+		case XLAT_LITERAL:
+			if (!node->fmt) continue;
+
+			if (xlat_out_append(xo, node->fmt, node->len) < 0) return -1;
+			continue;
+
+		case XLAT_ATTRIBUTE:
+			ret = xlat_attr_append(xo, request, node->attr, escape, escape_ctx);
+			if (ret < 0) return -1;
+			if (ret > 0) continue;
+			break;
+
+		default:
+			break;
+		}
+
+		str = xlat_aprint(request, request, node, escape, escape_ctx, 0); /* may be NULL */
+		if (!str) continue;
+
+		ret = xlat_out_append(xo, str, strlen(str));
+		talloc_free(str);
+		if (ret < 0) return -1;
+	}
+
+	return 0;
+}
+
 static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_exp_t const * const head,
 			   xlat_escape_t escape, void const *escape_ctx)
 {
-	int i, list;
-	size_t total;
-	char **array, *answer;
-	xlat_exp_t const *node;
+	char		*answer;
+	xlat_out_t	xo;
 
 	*out = NULL;
 
@@ -653,8 +851,8 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_e
 
 	/*
 	 *	Hack for speed.  If it's one expansion, just allocate
-	 *	that and return, instead of allocating an intermediary
-	 *	array.
+	 *	that and return, instead of allocating an output
+	 *	buffer and copying it.
 	 */
 	if (!head->next) {
 		/*
@@ -671,46 +869,34 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_e
 		return strlen(answer);
 	}
 
-	list = 0;		/* FIXME: calculate this once */
-	for (node = head; node != NULL; node = node->next) {
-		list++;
-	}
-
-	array = talloc_array(ctx, char *, list);
-	if (!array) return -1;
-
-	for (node = head, i = 0; node != NULL; node = node->next, i++) {
-		array[i] = xlat_aprint(array, request, node, escape, escape_ctx, 0); /* may be NULL */
-	}
-
-	total = 0;
-	for (i = 0; i < list; i++) {
-		if (array[i]) total += strlen(array[i]); /* FIXME: calculate strlen once */
-	}
-
-	if (!total) {
-		talloc_free(array);
-		*out = talloc_zero_array(ctx, char, 1);
-		return 0;
+	/*
+	 *	Guess at the size of the output, so that we
+	 *	(usually) don't need to grow it.
+	 */
+	memset(&xo, 0, sizeof(xo));
+	xo.ctx = ctx;
+	xo.size = (head->count + 1) * 32;
+	xo.out = talloc_array(ctx, char, xo.size);
+	if (!xo.out) return -1;
+	xo.out[0] = '\0';
+
+	if (xlat_process_append(&xo, request, head, escape, escape_ctx) < 0) {
+		talloc_free(xo.out);
+		return -1;
 	}
 
-	answer = talloc_array(ctx, char, total + 1);
-
-	total = 0;
-	for (i = 0; i < list; i++) {
-		size_t len;
-
-		if (array[i]) {
-			len = strlen(array[i]);
-			memcpy(answer + total, array[i], len);
-			total += len;
-		}
+	/*
+	 *	Callers use talloc_array_length() to find the length
+	 *	of the expansion, so trim the buffer to fit.
+	 */
+	answer = talloc_realloc(ctx, xo.out, char, xo.len + 1);
+	if (!answer) {
+		talloc_free(xo.out);
+		return -1;
 	}
-	answer[total] = '\0';
-	talloc_free(array);	/* and child entries */
 
 	*out = answer;
-	return total;
+	return xo.len;
 }
 
 /** Replace %whatever in a string.
@@ -734,6 +920,25 @@ static ssize_t _xlat_eval_compiled(TALLOC_CTX *ctx, char **out, size_t outlen, R
 
 	rad_assert(node != NULL);
 
+	/*
+	 *	Expand directly into the caller's buffer.
+	 */
+	if (*out) {
+		xlat_out_t xo;
+
+		memset(&xo, 0, sizeof(xo));
+		xo.out = *out;
+		xo.size = outlen;
+		if (outlen > 0) **out = '\0';
+
+		if (xlat_process_append(&xo, request, node, escape, escape_ctx) < 0) {
+			if (outlen > 0) **out = '\0';
+			return -1;
+		}
+
+		return xo.len;
+	}
+
 	len = xlat_process(ctx, &buff, request, node, escape, escape_ctx);
 	if ((len < 0) || !buff) {
 		rad_assert(buff == NULL);
@@ -741,23 +946,8 @@ static ssize_t _xlat_eval_compiled(TALLOC_CTX *ctx, char **out, size_t outlen, R
 		return len;
 	}
 
-	len = strlen(buff);
-
-	/*
-	 *	If out doesn't point to an existing buffer
-	 *	copy the pointer to our buffer over.
-	 */
-	if (!*out) {
-		*out = buff;
-		return len;
-	}
-
-	/*
-	 *	Otherwise copy the talloced buffer to the fixed one.
-	 */
-	strlcpy(*out, buff, outlen);
-	talloc_free(buff);
-	return len;
+	*out = buff;
+	return strlen(buff);
 }
 
 static ssize_t _xlat_eval(TALLOC_CTX *ctx, char **out, size_t outlen, REQUEST *request, char const *fmt,
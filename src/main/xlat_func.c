@@ -466,7 +466,7 @@ static ssize_t xlat_module(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 	return strlen(*out);
 }
 
-#if defined(HAVE_REGEX) && defined(HAVE_PCRE)
+#if defined(HAVE_REGEX) && (defined(HAVE_PCRE) || defined(HAVE_PCRE2))
 static ssize_t xlat_regex(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 			  UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
 			  REQUEST *request, char const *fmt)
@@ -746,7 +746,7 @@ int xlat_register(void *mod_inst, char const *name,
 		XLAT_REGISTER(map);
 		XLAT_REGISTER(module);
 		XLAT_REGISTER(debug_attr);
-#if defined(HAVE_REGEX) && defined(HAVE_PCRE)
+#if defined(HAVE_REGEX) && (defined(HAVE_PCRE) || defined(HAVE_PCRE2))
 		XLAT_REGISTER(regex);
 #endif
 
@@ -511,6 +511,36 @@ static ssize_t xlat_tokenize_literal(TALLOC_CTX *ctx, char *fmt, xlat_exp_t **he
 	return p - fmt;
 }
 
+/** Record the length of each list of nodes, so that it doesn't need to be calculated at run time
+ *
+ * @param[in] head	of the list.  May be NULL.
+ */
+static void xlat_tokenize_count(xlat_exp_t *head)
+{
+	xlat_exp_t	*node;
+	uint32_t	count = 0;
+
+	for (node = head; node != NULL; node = node->next) count++;
+
+	for (node = head; node != NULL; node = node->next) {
+		node->count = count--;
+
+		switch (node->type) {
+		case XLAT_MODULE:
+			xlat_tokenize_count(node->child);
+			break;
+
+		case XLAT_ALTERNATE:
+			xlat_tokenize_count(node->child);
+			xlat_tokenize_count(node->alternate);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
 static void xlat_tokenize_debug(REQUEST *request, xlat_exp_t const *node)
 {
 	rad_assert(node != NULL);
@@ -761,6 +791,8 @@ ssize_t xlat_tokenize_request(TALLOC_CTX *ctx, REQUEST *request, char const *fmt
 		return slen;
 	}
 
+	xlat_tokenize_count(*head);
+
 	if (*head && RDEBUG_ENABLED3) {
 		RDEBUG3("%s", fmt);
 		RDEBUG3("Parsed xlat tree:");
@@ -786,6 +818,11 @@ ssize_t xlat_tokenize_request(TALLOC_CTX *ctx, REQUEST *request, char const *fmt
  */
 ssize_t xlat_tokenize(TALLOC_CTX *ctx, char *fmt, xlat_exp_t **head, char const **error)
 {
-	return xlat_tokenize_literal(ctx, fmt, head, false, error);
+	ssize_t slen;
+
+	slen = xlat_tokenize_literal(ctx, fmt, head, false, error);
+	if (slen > 0) xlat_tokenize_count(*head);
+
+	return slen;
 }
 
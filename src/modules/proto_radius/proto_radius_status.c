@@ -214,7 +214,8 @@ static void status_running(REQUEST *request, fr_state_action_t action)
 			goto done;
 		}
 
-		if (fr_radius_sign(request->reply, request->packet, request->client->secret) < 0) {
+		if (fr_radius_sign_keyed(request->reply, request->packet, request->client->secret,
+					 request->client->secret_hmac) < 0) {
 			RDEBUG("Failed signing RADIUS reply: %s", fr_strerror());
 			goto done;
 		}
@@ -0,0 +1,438 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file coalesce.c
+ * @brief Track which request is loading a cache entry, so others can wait for it.
+ *
+ * When a request misses, and is going to fetch the data for the entry from
+ * elsewhere, it claims the key.  Other requests which miss on the same key
+ * register as waiters, and yield.
+ *
+ * When the entry is inserted, or the request which claimed the key is freed,
+ * the waiters are moved to the wake list of the worker they belong to, and
+ * the worker is woken with its #fr_worker_wake_t.  The worker then marks
+ * the requests as resumable.
+ *
+ * A single mutex protects all of the state, as it's only touched when
+ * lookups miss.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/worker_wake.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <pthread.h>
+
+#include "coalesce.h"
+
+typedef struct cache_load cache_load_t;
+
+/** Shared state for all workers
+ *
+ */
+struct cache_coalesce {
+	char const		*name;		//!< Of the module instance, for log messages.
+	pthread_mutex_t		mutex;		//!< Protects everything below, and all loads and waiters.
+	fr_hash_table_t		*loads;		//!< Keys currently being loaded.
+};
+
+/** Per-worker state
+ *
+ */
+struct cache_coalesce_thread {
+	cache_coalesce_t	*cc;		//!< Shared state.
+	fr_worker_wake_t	*wake;		//!< Signalled when waiters are added to the wake list.
+	cache_coalesce_waiter_t	*woken;		//!< Waiters ready to be resumed.
+	bool			dead;		//!< Worker is exiting, don't signal it.
+};
+
+/** A key being loaded by a request
+ *
+ * Allocated in the ctx of the request loading the key.
+ */
+struct cache_load {
+	cache_coalesce_t	*cc;		//!< Shared state.
+	REQUEST			*owner;		//!< Request loading the key.
+	uint8_t			*key;		//!< Key being loaded.
+	size_t			key_len;	//!< Length of the key.
+	bool			linked;		//!< Whether the load is in the hash table.
+	cache_coalesce_waiter_t	*waiters;	//!< Requests waiting for the load to finish.
+};
+
+typedef enum {
+	CACHE_WAITER_WAITING = 0,		//!< In the list of a load.
+	CACHE_WAITER_WOKEN,			//!< In the wake list of a worker.
+	CACHE_WAITER_COLLECTED,			//!< Removed from the wake list by the worker.
+	CACHE_WAITER_CANCELLED			//!< No longer waiting.
+} cache_waiter_state_t;
+
+/** A request waiting for another request to load a key
+ *
+ */
+struct cache_coalesce_waiter {
+	cache_coalesce_thread_t	*cct;		//!< Worker the request belongs to.
+	REQUEST			*request;	//!< Request to resume.
+	cache_load_t		*load;		//!< Load being waited on, while WAITING.
+	cache_waiter_state_t	state;
+
+	cache_coalesce_waiter_t	*prev;		//!< In the list of the load, or the wake list.
+	cache_coalesce_waiter_t	*next;		//!< In the list of the load, or the wake list.
+};
+
+static uint32_t cache_load_hash(void const *data)
+{
+	cache_load_t const *load = data;
+
+	return fr_hash(load->key, load->key_len);
+}
+
+static int cache_load_cmp(void const *one, void const *two)
+{
+	cache_load_t const *a = one, *b = two;
+
+	if (a->key_len != b->key_len) return (a->key_len < b->key_len) - (a->key_len > b->key_len);
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Remove a waiter from whichever list it's in
+ *
+ * @note Must be called with the mutex held.
+ */
+static void cache_waiter_unlink(cache_coalesce_waiter_t *waiter, cache_coalesce_waiter_t **head)
+{
+	if (waiter->prev) {
+		waiter->prev->next = waiter->next;
+	} else {
+		*head = waiter->next;
+	}
+	if (waiter->next) waiter->next->prev = waiter->prev;
+
+	waiter->prev = waiter->next = NULL;
+}
+
+/** Move all the waiters of a load to the wake lists of their workers
+ *
+ * @note Must be called with the mutex held.
+ */
+static void cache_load_wake(cache_load_t *load)
+{
+	cache_coalesce_waiter_t *waiter, *next;
+
+	for (waiter = load->waiters; waiter; waiter = next) {
+		cache_coalesce_thread_t *cct = waiter->cct;
+		bool			wake = (cct->woken == NULL);
+
+		next = waiter->next;
+
+		waiter->state = CACHE_WAITER_WOKEN;
+		waiter->load = NULL;
+		waiter->prev = NULL;
+		waiter->next = cct->woken;
+		if (cct->woken) cct->woken->prev = waiter;
+		cct->woken = waiter;
+
+		/*
+		 *	The worker collects the whole wake list
+		 *	when woken, so one wakeup per batch is enough.
+		 */
+		if (wake && !cct->dead) fr_worker_wake_signal(cct->wake);
+	}
+	load->waiters = NULL;
+
+	if (load->linked) {
+		fr_hash_table_delete(load->cc->loads, load);
+		load->linked = false;
+	}
+}
+
+/** Wake anything waiting on the load, as the request loading the key is done
+ *
+ */
+static int _cache_load_free(cache_load_t *load)
+{
+	pthread_mutex_lock(&load->cc->mutex);
+	cache_load_wake(load);
+	pthread_mutex_unlock(&load->cc->mutex);
+
+	return 0;
+}
+
+/** Stop a freed waiter from being resumed
+ *
+ */
+static int _cache_coalesce_waiter_free(cache_coalesce_waiter_t *waiter)
+{
+	(void) cache_coalesce_waiter_cancel(waiter);
+
+	return 0;
+}
+
+/** Collect woken waiters, and resume their requests
+ *
+ */
+static void _cache_coalesce_thread_wake(void *uctx)
+{
+	cache_coalesce_thread_t	*cct = talloc_get_type_abort(uctx, cache_coalesce_thread_t);
+	cache_coalesce_waiter_t	*waiter, *next;
+
+	pthread_mutex_lock(&cct->cc->mutex);
+	waiter = cct->woken;
+	cct->woken = NULL;
+	for (next = waiter; next; next = next->next) next->state = CACHE_WAITER_COLLECTED;
+	pthread_mutex_unlock(&cct->cc->mutex);
+
+	/*
+	 *	Collected waiters are only touched by this worker,
+	 *	so the list is safe to walk without the mutex.
+	 */
+	for (; waiter; waiter = next) {
+		next = waiter->next;
+		waiter->prev = waiter->next = NULL;
+
+		unlang_resumable(waiter->request);
+	}
+}
+
+static int _cache_coalesce_thread_free(cache_coalesce_thread_t *cct)
+{
+	cache_coalesce_waiter_t *waiter;
+
+	pthread_mutex_lock(&cct->cc->mutex);
+	cct->dead = true;
+	for (waiter = cct->woken; waiter; waiter = waiter->next) waiter->state = CACHE_WAITER_CANCELLED;
+	cct->woken = NULL;
+	pthread_mutex_unlock(&cct->cc->mutex);
+
+	return 0;
+}
+
+static int _cache_coalesce_free(cache_coalesce_t *cc)
+{
+	talloc_free(cc->loads);
+	pthread_mutex_destroy(&cc->mutex);
+
+	return 0;
+}
+
+/** Allocate the state shared by all workers
+ *
+ * @note Allocated in the NULL ctx, as it's modified after the module
+ *	instance data is made read only.  Must be freed by the caller.
+ *
+ * @param[in] name	of the module instance, for log messages.
+ * @return
+ *	- New shared state.
+ *	- NULL on error.
+ */
+cache_coalesce_t *cache_coalesce_alloc(char const *name)
+{
+	cache_coalesce_t *cc;
+
+	cc = talloc_zero(NULL, cache_coalesce_t);
+	if (!cc) return NULL;
+
+	cc->name = talloc_typed_strdup(cc, name);
+	cc->loads = fr_hash_table_create(cc, cache_load_hash, cache_load_cmp, NULL);
+	if (!cc->loads) {
+		talloc_free(cc);
+		return NULL;
+	}
+
+	pthread_mutex_init(&cc->mutex, NULL);
+	talloc_set_destructor(cc, _cache_coalesce_free);
+
+	return cc;
+}
+
+/** Register a worker, so requests it's running can wait for loads
+ *
+ * @param[in] ctx	to allocate the handle in.  Must be freed by the worker.
+ * @param[in] cc	shared state.
+ * @param[in] el	the worker's event list.  Wakeups are delivered here.
+ * @return
+ *	- A new handle.
+ *	- NULL on error.
+ */
+cache_coalesce_thread_t *cache_coalesce_thread_alloc(TALLOC_CTX *ctx, cache_coalesce_t *cc, fr_event_list_t *el)
+{
+	cache_coalesce_thread_t *cct;
+
+	cct = talloc_zero(ctx, cache_coalesce_thread_t);
+	if (!cct) return NULL;
+
+	cct->cc = cc;
+
+	cct->wake = fr_worker_wake_create(cct, cc->name, el, _cache_coalesce_thread_wake, cct);
+	if (!cct->wake) {
+		talloc_free(cct);
+		return NULL;
+	}
+	talloc_set_destructor(cct, _cache_coalesce_thread_free);
+
+	return cct;
+}
+
+/** Find out who's loading a key, optionally claiming it, or waiting for it
+ *
+ * @param[in] ctx	to allocate the waiter in.  Freeing the waiter stops the
+ *			request being resumed.
+ * @param[out] out	Where to write the waiter, if another request is loading
+ *			the key.  May be NULL if the caller doesn't want to wait.
+ *			If a waiter is returned, the caller must yield, and will be
+ *			marked as resumable when the key is inserted, or the
+ *			request loading it is freed.
+ * @param[in] cct	handle of the worker running the request.
+ * @param[in] request	the current request.
+ * @param[in] key	to check.
+ * @param[in] key_len	Length of key.
+ * @param[in] start	Claim the key, if no other request is loading it.
+ *			The claim lasts until #cache_coalesce_done is called
+ *			for the key, or the request is freed.
+ * @return
+ *	- #CACHE_LOAD_NONE if nothing is loading the key, and start was false.
+ *	- #CACHE_LOAD_OWNER if the request is loading the key.
+ *	- #CACHE_LOAD_WAIT if another request is loading the key.
+ */
+cache_load_status_t cache_coalesce_claim(TALLOC_CTX *ctx, cache_coalesce_waiter_t **out,
+					 cache_coalesce_thread_t *cct, REQUEST *request,
+					 uint8_t const *key, size_t key_len, bool start)
+{
+	cache_coalesce_t	*cc = cct->cc;
+	cache_load_t		find, *load;
+	cache_coalesce_waiter_t	*waiter;
+
+	if (out) *out = NULL;
+
+	memcpy(&find.key, &key, sizeof(find.key));
+	find.key_len = key_len;
+
+	pthread_mutex_lock(&cc->mutex);
+	load = fr_hash_table_finddata(cc->loads, &find);
+	if (!load) {
+		if (!start) {
+			pthread_mutex_unlock(&cc->mutex);
+			return CACHE_LOAD_NONE;
+		}
+
+		load = talloc_zero(request, cache_load_t);
+		if (!load) {
+		oom:
+			pthread_mutex_unlock(&cc->mutex);
+			return CACHE_LOAD_NONE;
+		}
+		load->cc = cc;
+		load->owner = request;
+		load->key = talloc_memdup(load, key, key_len);
+		load->key_len = key_len;
+		if (!load->key || !fr_hash_table_insert(cc->loads, load)) {
+			talloc_free(load);
+			goto oom;
+		}
+		load->linked = true;
+		talloc_set_destructor(load, _cache_load_free);
+		pthread_mutex_unlock(&cc->mutex);
+
+		return CACHE_LOAD_OWNER;
+	}
+
+	if (load->owner == request) {
+		pthread_mutex_unlock(&cc->mutex);
+		return CACHE_LOAD_OWNER;
+	}
+
+	if (!out) {
+		pthread_mutex_unlock(&cc->mutex);
+		return CACHE_LOAD_WAIT;
+	}
+
+	waiter = talloc_zero(ctx, cache_coalesce_waiter_t);
+	if (!waiter) {
+		pthread_mutex_unlock(&cc->mutex);
+		return CACHE_LOAD_WAIT;
+	}
+	waiter->cct = cct;
+	waiter->request = request;
+	waiter->load = load;
+	waiter->state = CACHE_WAITER_WAITING;
+	waiter->next = load->waiters;
+	if (load->waiters) load->waiters->prev = waiter;
+	load->waiters = waiter;
+	talloc_set_destructor(waiter, _cache_coalesce_waiter_free);
+	pthread_mutex_unlock(&cc->mutex);
+
+	*out = waiter;
+
+	return CACHE_LOAD_WAIT;
+}
+
+/** Mark a key as loaded, waking any requests waiting for it
+ *
+ * @param[in] cc	shared state.
+ * @param[in] key	which has been inserted.
+ * @param[in] key_len	Length of key.
+ */
+void cache_coalesce_done(cache_coalesce_t *cc, uint8_t const *key, size_t key_len)
+{
+	cache_load_t find, *load;
+
+	memcpy(&find.key, &key, sizeof(find.key));
+	find.key_len = key_len;
+
+	pthread_mutex_lock(&cc->mutex);
+	load = fr_hash_table_finddata(cc->loads, &find);
+	if (load) cache_load_wake(load);
+	pthread_mutex_unlock(&cc->mutex);
+}
+
+/** Stop waiting for a load
+ *
+ * @param[in] waiter	to cancel.
+ * @return
+ *	- true if the waiter was still waiting, and the caller should resume the request.
+ *	- false if the waiter has already been woken.
+ */
+bool cache_coalesce_waiter_cancel(cache_coalesce_waiter_t *waiter)
+{
+	cache_coalesce_t	*cc = waiter->cct->cc;
+	bool			waiting = false;
+
+	pthread_mutex_lock(&cc->mutex);
+	switch (waiter->state) {
+	case CACHE_WAITER_WAITING:
+		cache_waiter_unlink(waiter, &waiter->load->waiters);
+		waiter->load = NULL;
+		waiting = true;
+		break;
+
+	case CACHE_WAITER_WOKEN:
+		cache_waiter_unlink(waiter, &waiter->cct->woken);
+		break;
+
+	default:
+		break;
+	}
+	waiter->state = CACHE_WAITER_CANCELLED;
+	pthread_mutex_unlock(&cc->mutex);
+
+	return waiting;
+}
@@ -0,0 +1,51 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ * @file coalesce.h
+ * @brief Track which request is loading a cache entry, so others can wait for it.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSIDH(coalesce_h, "$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+typedef struct cache_coalesce cache_coalesce_t;
+typedef struct cache_coalesce_thread cache_coalesce_thread_t;
+typedef struct cache_coalesce_waiter cache_coalesce_waiter_t;
+
+/** The state of a key, as seen by a request
+ *
+ */
+typedef enum {
+	CACHE_LOAD_NONE = 0,				//!< Nothing is loading the entry.
+	CACHE_LOAD_OWNER,				//!< This request is loading the entry.
+	CACHE_LOAD_WAIT					//!< Another request is loading the entry.
+} cache_load_status_t;
+
+cache_coalesce_t	*cache_coalesce_alloc(char const *name);
+
+cache_coalesce_thread_t	*cache_coalesce_thread_alloc(TALLOC_CTX *ctx, cache_coalesce_t *cc, fr_event_list_t *el);
+
+cache_load_status_t	cache_coalesce_claim(TALLOC_CTX *ctx, cache_coalesce_waiter_t **out,
+					     cache_coalesce_thread_t *cct, REQUEST *request,
+					     uint8_t const *key, size_t key_len, bool start);
+
+void			cache_coalesce_done(cache_coalesce_t *cc, uint8_t const *key, size_t key_len);
+
+bool			cache_coalesce_waiter_cancel(cache_coalesce_waiter_t *waiter);
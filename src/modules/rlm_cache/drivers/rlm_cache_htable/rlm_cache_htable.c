@@ -0,0 +1,547 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_htable.c
+ * @brief Sharded hash table based cache.
+ *
+ * Entries are spread over a number of shards by the hash of their key.
+ * Each shard has its own lock, hash table, and CLOCK ring, so workers
+ * looking up different keys rarely contend.  A shard is only locked for
+ * the duration of a single driver operation.
+ *
+ * Entries returned by find are reference counted, so an entry which is
+ * evicted or replaced while a request is still merging it is only freed
+ * when the request is done with it.
+ *
+ * Expired entries are removed lazily, when they're looked up, or when the
+ * CLOCK hand passes over them.  When a shard exceeds its share of
+ * max_entries or max_size, the hand sweeps the ring, clearing the
+ * referenced bit of recently used entries, and evicting the first entry
+ * it finds which hasn't been used since the last sweep.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+#include "../../rlm_cache.h"
+
+typedef struct rlm_cache_htable_entry rlm_cache_htable_entry_t;
+typedef struct rlm_cache_htable_shard rlm_cache_htable_shard_t;
+
+struct rlm_cache_htable_entry {
+	rlm_cache_entry_t		fields;		//!< Entry data.
+
+	uint32_t			hash;		//!< Of the key.
+	size_t				size;		//!< Memory used by the entry.
+	time_t				expires;	//!< Copy of fields.expires, which is only
+							//!< updated with the shard locked.
+	bool				referenced;	//!< Entry was used since the hand last passed.
+
+	rlm_cache_htable_shard_t	*shard;		//!< Shard the entry was inserted into.
+	uint32_t			refs;		//!< Requests using the entry.
+	bool				removed;	//!< No longer in the shard, free when refs
+							//!< reaches 0.
+
+	rlm_cache_htable_entry_t	*prev;		//!< Previous entry in the CLOCK ring.
+	rlm_cache_htable_entry_t	*next;		//!< Next entry in the CLOCK ring.
+};
+
+struct rlm_cache_htable_shard {
+	pthread_mutex_t			mutex;		//!< Protects everything in the shard.
+
+	fr_hash_table_t			*ht;		//!< For looking up cache keys.
+	rlm_cache_htable_entry_t	*hand;		//!< CLOCK hand.  Next entry to consider
+							//!< for eviction.
+
+	uint32_t			num_entries;	//!< Entries in this shard.
+	size_t				size;		//!< Memory used by entries in this shard.
+
+	uint64_t			hits;		//!< Lookups which found an entry.
+	uint64_t			misses;		//!< Lookups which didn't find an entry.
+	uint64_t			inserts;	//!< Entries added.
+	uint64_t			evictions;	//!< Entries removed to stay within limits.
+	uint64_t			expired;	//!< Entries removed because their TTL passed.
+};
+
+typedef struct rlm_cache_htable {
+	uint32_t			num_shards;	//!< Must be a power of 2.
+	uint32_t			shard_shift;	//!< Shift to get a shard index from a hash.
+	size_t				max_size;	//!< Maximum memory used by all entries.
+
+	uint32_t			shard_max_entries;	//!< Per-shard share of max_entries.
+	size_t				shard_max_size;		//!< Per-shard share of max_size.
+
+	rlm_cache_htable_shard_t	**shards;	//!< Array of shards.
+} rlm_cache_htable_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", PW_TYPE_INTEGER, rlm_cache_htable_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_size", PW_TYPE_SIZE, rlm_cache_htable_t, max_size), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_htable_entry_t const *c = data;
+
+	return c->hash;
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one;
+	rlm_cache_entry_t const *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Lock the shard a key belongs to
+ *
+ * The shard is picked using the high bits of the hash, as each shard's
+ * hash table uses the low bits to pick a bucket.
+ */
+static rlm_cache_htable_shard_t *cache_shard_lock(rlm_cache_htable_t const *driver, uint32_t hash)
+{
+	rlm_cache_htable_shard_t *shard;
+
+	shard = driver->shards[(uint32_t)((uint64_t)hash >> driver->shard_shift)];
+	pthread_mutex_lock(&shard->mutex);
+
+	return shard;
+}
+
+/** Remove an entry from its shard, and free it if no requests are using it
+ *
+ * @note Shard must be locked.
+ */
+static void cache_entry_remove(rlm_cache_htable_shard_t *shard, rlm_cache_htable_entry_t *c)
+{
+	fr_hash_table_yank(shard->ht, c);
+
+	if (c->next == c) {
+		shard->hand = NULL;
+	} else {
+		c->prev->next = c->next;
+		c->next->prev = c->prev;
+		if (shard->hand == c) shard->hand = c->next;
+	}
+
+	shard->num_entries--;
+	shard->size -= c->size;
+
+	if (c->refs) {
+		c->removed = true;
+		return;
+	}
+
+	talloc_free(c);
+}
+
+/** Evict one entry using the CLOCK algorithm
+ *
+ * Expired entries are evicted as soon as the hand reaches them.
+ *
+ * @note Shard must be locked.
+ *
+ * @return
+ *	- true if an entry was evicted.
+ *	- false if the shard is empty.
+ */
+static bool cache_shard_evict(rlm_cache_htable_shard_t *shard, time_t now)
+{
+	rlm_cache_htable_entry_t *c;
+
+	while ((c = shard->hand)) {
+		if (c->expires < now) {
+			shard->expired++;
+			cache_entry_remove(shard, c);
+			return true;
+		}
+
+		if (!c->referenced) {
+			shard->evictions++;
+			cache_entry_remove(shard, c);
+			return true;
+		}
+
+		c->referenced = false;
+		shard->hand = c->next;
+	}
+
+	return false;
+}
+
+/** Free all entries in a shard
+ *
+ */
+static int _cache_shard_free(rlm_cache_htable_shard_t *shard)
+{
+	while (shard->hand) cache_entry_remove(shard, shard->hand);
+
+	fr_hash_table_free(shard->ht);
+	pthread_mutex_destroy(&shard->mutex);
+
+	return 0;
+}
+
+/** Cleanup a cache_htable instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_htable_t	*driver = instance;
+	uint32_t		i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) talloc_free(driver->shards[i]);
+	TALLOC_FREE(driver->shards);
+
+	return 0;
+}
+
+/** Create a new cache_htable instance
+ *
+ * @copydetails cache_instantiate_t
+ */
+static int mod_instantiate(rlm_cache_config_t const *config, void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_htable_t	*driver = instance;
+	uint32_t		i;
+
+	if ((driver->num_shards == 0) || (driver->num_shards > 1024) ||
+	    ((driver->num_shards & (driver->num_shards - 1)) != 0)) {
+		cf_log_err_cs(conf, "'shards' must be a power of 2, between 1 and 1024");
+		return -1;
+	}
+
+	for (driver->shard_shift = 32, i = driver->num_shards; i > 1; i >>= 1) driver->shard_shift--;
+
+	if (config->max_entries) {
+		driver->shard_max_entries = (config->max_entries + driver->num_shards - 1) / driver->num_shards;
+	}
+	if (driver->max_size) driver->shard_max_size = (driver->max_size + driver->num_shards - 1) / driver->num_shards;
+
+	/*
+	 *	Shards are allocated outside of the instance data,
+	 *	as it's marked read only once we return.
+	 */
+	driver->shards = talloc_zero_array(NULL, rlm_cache_htable_shard_t *, driver->num_shards);
+	if (!driver->shards) {
+	oom:
+		ERROR("Out of memory");
+		mod_detach(driver);
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htable_shard_t *shard;
+
+		shard = driver->shards[i] = talloc_zero(driver->shards, rlm_cache_htable_shard_t);
+		if (!shard) goto oom;
+
+		shard->ht = fr_hash_table_create(shard, cache_entry_hash, cache_entry_cmp, NULL);
+		if (!shard->ht) goto oom;
+
+		pthread_mutex_init(&shard->mutex, NULL);
+		talloc_set_destructor(shard, _cache_shard_free);
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_htable_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_htable_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+	c->refs = 1;	/* Held by the caller until it calls cache_entry_free */
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Stop using an entry
+ *
+ * Frees the entry if it was removed from its shard while it was in use,
+ * or was never inserted.
+ *
+ * @copydetails cache_entry_free_t
+ */
+static void cache_entry_free(rlm_cache_entry_t *to_free)
+{
+	rlm_cache_htable_entry_t	*c = (rlm_cache_htable_entry_t *)to_free;
+	rlm_cache_htable_shard_t	*shard = c->shard;
+	bool				free_it;
+
+	if (!shard) {
+		talloc_free(c);
+		return;
+	}
+
+	pthread_mutex_lock(&shard->mutex);
+	rad_assert(c->refs > 0);
+	c->refs--;
+	free_it = (c->removed && (c->refs == 0));
+	pthread_mutex_unlock(&shard->mutex);
+
+	if (free_it) talloc_free(c);
+}
+
+/** Locate a cache entry
+ *
+ * The caller must pass the entry to #cache_entry_free when it's done with it.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_t		*driver = instance;
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*c, my_c;
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	shard = cache_shard_lock(driver, my_c.hash);
+
+	c = fr_hash_table_finddata(shard->ht, &my_c);
+	if (!c) {
+		shard->misses++;
+		pthread_mutex_unlock(&shard->mutex);
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	/*
+	 *	Lazily remove expired entries.
+	 */
+	if (c->expires < request->packet->timestamp.tv_sec) {
+		shard->expired++;
+		shard->misses++;
+		cache_entry_remove(shard, c);
+		pthread_mutex_unlock(&shard->mutex);
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	shard->hits++;
+	c->referenced = true;
+	c->refs++;
+	pthread_mutex_unlock(&shard->mutex);
+
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_t		*driver = instance;
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*c, my_c;
+
+	if (!request) return CACHE_ERROR;
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	shard = cache_shard_lock(driver, my_c.hash);
+
+	c = fr_hash_table_finddata(shard->ht, &my_c);
+	if (!c) {
+		pthread_mutex_unlock(&shard->mutex);
+		return CACHE_MISS;
+	}
+
+	cache_entry_remove(shard, c);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store, evicting entries if the shard is full
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 rlm_cache_entry_t const *to_insert)
+{
+	rlm_cache_htable_t		*driver = instance;
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*c, *old;
+	time_t				now = request->packet->timestamp.tv_sec;
+
+	memcpy(&c, &to_insert, sizeof(c));
+
+	/*
+	 *	An entry we already hold, i.e. a TTL update.
+	 */
+	if (c->shard) {
+		pthread_mutex_lock(&c->shard->mutex);
+		c->expires = c->fields.expires;
+		pthread_mutex_unlock(&c->shard->mutex);
+		return CACHE_OK;
+	}
+
+	c->hash = fr_hash(c->fields.key, c->fields.key_len);
+	c->size = talloc_total_size(c);
+	c->expires = c->fields.expires;
+	c->referenced = false;
+
+	shard = cache_shard_lock(driver, c->hash);
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = fr_hash_table_finddata(shard->ht, c);
+	if (old) cache_entry_remove(shard, old);
+
+	while ((driver->shard_max_entries && (shard->num_entries >= driver->shard_max_entries)) ||
+	       (driver->shard_max_size && ((shard->size + c->size) > driver->shard_max_size))) {
+		if (!cache_shard_evict(shard, now)) break;
+	}
+
+	if (!fr_hash_table_insert(shard->ht, c)) {
+		pthread_mutex_unlock(&shard->mutex);
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+	c->shard = shard;
+
+	/*
+	 *	New entries go just behind the hand, so they're
+	 *	the last to be considered for eviction.
+	 */
+	if (!shard->hand) {
+		c->prev = c->next = c;
+		shard->hand = c;
+	} else {
+		c->next = shard->hand;
+		c->prev = shard->hand->prev;
+		c->prev->next = c;
+		shard->hand->prev = c;
+	}
+
+	shard->num_entries++;
+	shard->size += c->size;
+	shard->inserts++;
+	pthread_mutex_unlock(&shard->mutex);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * The new expiry time has already been written to the entry, which
+ * the request still holds a reference to.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					  UNUSED REQUEST *request, UNUSED void *handle,
+					  rlm_cache_entry_t *to_update)
+{
+	rlm_cache_htable_entry_t *c = (rlm_cache_htable_entry_t *)to_update;
+
+	if (!rad_cond_assert(c->shard)) return CACHE_ERROR;
+
+	/*
+	 *	If the entry was removed since it was found, this
+	 *	does nothing, which is the same as the entry
+	 *	having been removed just after the update.
+	 */
+	pthread_mutex_lock(&c->shard->mutex);
+	c->expires = c->fields.expires;
+	pthread_mutex_unlock(&c->shard->mutex);
+
+	return CACHE_OK;
+}
+
+/** Sum the counters of all the shards
+ *
+ * @copydetails cache_stats_t
+ */
+static void cache_stats(rlm_cache_stats_t *out, UNUSED rlm_cache_config_t const *config, void *instance)
+{
+	rlm_cache_htable_t	*driver = instance;
+	uint32_t		i;
+
+	memset(out, 0, sizeof(*out));
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htable_shard_t *shard = driver->shards[i];
+
+		pthread_mutex_lock(&shard->mutex);
+		out->hits += shard->hits;
+		out->misses += shard->misses;
+		out->inserts += shard->inserts;
+		out->evictions += shard->evictions;
+		out->expired += shard->expired;
+		out->entries += shard->num_entries;
+		out->size += shard->size;
+		pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+extern cache_driver_t rlm_cache_htable;
+cache_driver_t rlm_cache_htable = {
+	.name		= "rlm_cache_htable",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_htable_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+	.free		= cache_entry_free,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+
+	.stats		= cache_stats,
+};
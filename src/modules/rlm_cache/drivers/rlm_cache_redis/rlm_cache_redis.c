@@ -29,22 +29,26 @@
 #include "../../rlm_cache.h"
 #include "../../../rlm_redis/redis.h"
 #include "../../../rlm_redis/cluster.h"
-
-static CONF_PARSER driver_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
+#include "../../serialize.h"
 
 typedef struct rlm_cache_redis {
 	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
 						//!< Must be first field in this struct.
 
+	bool			binary;		//!< Store entries as a single binary blob.
+
 	vp_tmpl_t		*created_attr;	//!< LHS of the Cache-Created map.
 	vp_tmpl_t		*expires_attr;	//!< LHS of the Cache-Expires map.
 
 	fr_redis_cluster_t	*cluster;
 } rlm_cache_redis_t;
 
+static CONF_PARSER driver_config[] = {
+	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("binary", PW_TYPE_BOOLEAN, rlm_cache_redis_t, binary), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
 /** Create a new rlm_cache_redis instance
  *
  * @copydetails cache_instantiate_t
@@ -163,6 +167,27 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_MISS;
 	}
 
+	/*
+	 *	A single element means the entry was written
+	 *	by cache_serialize_binary().
+	 */
+	if ((reply->elements == 1) && (reply->element[0]->type == REDIS_REPLY_STRING) &&
+	    (reply->element[0]->len > 0) && ((uint8_t)reply->element[0]->str[0] == CACHE_SERIALIZE_MAGIC)) {
+		c = talloc_zero(NULL, rlm_cache_entry_t);
+		if (cache_deserialize_binary(c, (uint8_t const *)reply->element[0]->str, reply->element[0]->len) < 0) {
+			REDEBUG("Failed deserializing entry: %s", fr_strerror());
+			talloc_free(c);
+			goto error;
+		}
+		fr_redis_reply_free(reply);
+
+		c->key = talloc_memdup(c, key, key_len);
+		c->key_len = key_len;
+		*out = c;
+
+		return CACHE_OK;
+	}
+
 	if (reply->elements % 3) {
 		REDEBUG("Invalid number of reply elements (%zu).  "
 			"Reply must contain triplets of keys operators and values",
@@ -314,6 +339,31 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	pool = talloc_pool(request, 1024);
 	if (!pool) return CACHE_ERROR;
 
+	/*
+	 *	Store the whole entry as a single list element.
+	 *	Not all entries can be represented in the binary
+	 *	format, those that can't are stored as triplets.
+	 */
+	if (driver->binary) {
+		uint8_t	*blob;
+		size_t	blob_len;
+
+		if (cache_serialize_binary(pool, &blob, &blob_len, c) == 0) {
+			argv = talloc_array(pool, char const *, 3);	/* cmd + key + blob */
+			argv_len = talloc_array(pool, size_t, 3);
+
+			argv[0] = command;
+			argv_len[0] = sizeof(command) - 1;
+			argv[1] = (char const *)c->key;
+			argv_len[1] = c->key_len;
+			argv[2] = (char const *)blob;
+			argv_len[2] = blob_len;
+
+			goto pipeline;
+		}
+		RDEBUG2("Storing entry as triplets: %s", fr_strerror());
+	}
+
 	argv_p = argv = talloc_array(pool, char const *, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 	argv_len_p = argv_len = talloc_array(pool, size_t, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 
@@ -336,6 +386,7 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		argv_len_p += 3;
 	}
 
+pipeline:
 	RDEBUG3("Pipelining commands");
 
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, c->key, c->key_len, false);
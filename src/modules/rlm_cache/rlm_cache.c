@@ -43,6 +43,10 @@ static const CONF_PARSER module_config[] = {
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", PW_TYPE_SIGNED, rlm_cache_config_t, epoch), .dflt = "0" },
 	{ FR_CONF_OFFSET("add_stats", PW_TYPE_BOOLEAN, rlm_cache_config_t, stats), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("coalesce", PW_TYPE_BOOLEAN, rlm_cache_config_t, coalesce), .dflt = "no" },
+	{ FR_CONF_OFFSET("coalesce_timeout", PW_TYPE_TIMEVAL, rlm_cache_config_t, coalesce_timeout), .dflt = "1.0" },
+	{ FR_CONF_OFFSET("soft_ttl", PW_TYPE_INTEGER, rlm_cache_config_t, soft_ttl), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -229,7 +233,7 @@ static rlm_rcode_t cache_find(rlm_cache_entry_t **out, rlm_cache_t const *inst,
 			talloc_free(p);
 		}
 
-		inst->driver->expire(&inst->config, inst->driver_inst, request, handle, c->key, c->key_len);
+		inst->driver->expire(&inst->config, inst->driver_inst, request, *handle, c->key, c->key_len);
 		cache_free(inst, &c);
 		return RLM_MODULE_NOTFOUND;	/* Couldn't find a non-expired entry */
 	}
@@ -297,7 +301,7 @@ static rlm_rcode_t cache_insert(rlm_cache_t const *inst, REQUEST *request, rlm_c
 	TALLOC_CTX		*pool;
 
 	if ((inst->config.max_entries > 0) && inst->driver->count &&
-	    (inst->driver->count(&inst->config, inst->driver_inst, request, handle) > inst->config.max_entries)) {
+	    (inst->driver->count(&inst->config, inst->driver_inst, request, *handle) > inst->config.max_entries)) {
 		RWDEBUG("Cache is full: %d entries", inst->config.max_entries);
 		return RLM_MODULE_FAIL;
 	}
@@ -527,19 +531,151 @@ static int cache_verify(vp_map_t *map, void *ctx)
 	return 0;
 }
 
-/** Do caching checks
+/** Data for a request waiting for another request to load an entry
  *
- * Since we can update ANY VP list, we do exactly the same thing for all sections
- * (autz / auth / etc.)
+ */
+typedef struct rlm_cache_wait_t {
+	cache_coalesce_waiter_t	*waiter;		//!< Registration with the load.
+	bool			fired;			//!< The timeout event has fired.
+	bool			timed_out;		//!< The entry wasn't loaded before the timeout.
+} rlm_cache_wait_t;
+
+static rlm_rcode_t cache_it(rlm_cache_t const *inst, rlm_cache_thread_t *t, REQUEST *request, bool coalesce);
+
+static rlm_rcode_t mod_cache_it_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_cache_wait_t	*wait = talloc_get_type_abort(ctx, rlm_cache_wait_t);
+	bool			timed_out = wait->timed_out;
+
+	if (!wait->fired) unlang_event_timeout_delete(request, wait);
+	talloc_free(wait);
+
+	/*
+	 *	Don't wait again, the request which claimed the
+	 *	key is probably stuck.
+	 */
+	if (timed_out) {
+		RWDEBUG("Timed out waiting for another request to load the entry");
+		return cache_it(instance, thread, request, false);
+	}
+
+	RDEBUG2("Another request finished loading the entry, retrying");
+
+	return cache_it(instance, thread, request, true);
+}
+
+static void mod_cache_it_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				 UNUSED struct timeval *fired)
+{
+	rlm_cache_wait_t	*wait = talloc_get_type_abort(ctx, rlm_cache_wait_t);
+
+	wait->fired = true;
+
+	if (!cache_coalesce_waiter_cancel(wait->waiter)) return;	/* Already woken */
+
+	wait->timed_out = true;
+	unlang_resumable(request);
+}
+
+static void mod_cache_it_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				fr_state_action_t action)
+{
+	rlm_cache_wait_t	*wait = talloc_get_type_abort(ctx, rlm_cache_wait_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling wait for cache entry");
+
+	if (!wait->fired) unlang_event_timeout_delete(request, wait);
+	talloc_free(wait);	/* Frees the waiter too */
+}
+
+/** Register as waiting for another request to load the entry
  *
- * If you want to cache something different in different sections, configure
- * another cache module.
+ * @return
+ *	- A new #rlm_cache_wait_t if the caller should yield.
+ *	- NULL if the caller should continue, either because no other request
+ *	  is loading the entry, or because we failed to set up the wait.
  */
-static rlm_rcode_t mod_cache_it(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_cache_it(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_cache_wait_t *cache_wait(rlm_cache_t const *inst, rlm_cache_thread_t *t, REQUEST *request,
+				    uint8_t const *key, size_t key_len, bool insert)
+{
+	rlm_cache_wait_t	*wait;
+	struct timeval		now, when;
+
+	MEM(wait = talloc_zero(request, rlm_cache_wait_t));
+
+	/*
+	 *	If we're inserting, we'll create the entry ourselves
+	 *	before this call returns, so there's no need to claim
+	 *	the key.  We still wait if someone else is loading it.
+	 */
+	switch (cache_coalesce_claim(wait, &wait->waiter, t->coalesce, request, key, key_len, !insert)) {
+	case CACHE_LOAD_OWNER:
+		RDEBUG2("Other requests for this entry will wait for it to be inserted");
+		/* FALL-THROUGH */
+
+	case CACHE_LOAD_NONE:
+		talloc_free(wait);
+		return NULL;
+
+	case CACHE_LOAD_WAIT:
+		if (!wait->waiter) {
+			talloc_free(wait);
+			return NULL;
+		}
+		break;
+	}
+
+	gettimeofday(&now, NULL);
+	fr_timeval_add(&when, &now, &inst->config.coalesce_timeout);
+
+	if (unlang_event_timeout_add(request, mod_cache_it_timeout, wait, &when) < 0) {
+		talloc_free(wait);
+		return NULL;
+	}
+
+	RDEBUG2("Another request is loading this entry, waiting for it");
+
+	return wait;
+}
+
+/** Decide whether a stale entry should be refreshed by this request
+ *
+ * Entries older than soft_ttl are refreshed by the first request to find them.
+ * Other requests are given the stale entry until it's replaced.
+ *
+ * @return
+ *	- true if this request is refreshing the entry, and should treat it as missing.
+ *	- false if the entry should be used.
+ */
+static bool cache_refresh(rlm_cache_t const *inst, rlm_cache_thread_t *t, REQUEST *request,
+			  uint8_t const *key, size_t key_len, rlm_cache_entry_t const *c)
+{
+	if (!inst->config.soft_ttl || !t->coalesce) return false;
+
+	if ((c->created + (time_t)inst->config.soft_ttl) > request->packet->timestamp.tv_sec) return false;
+
+	if (cache_coalesce_claim(NULL, NULL, t->coalesce, request, key, key_len, true) != CACHE_LOAD_OWNER) {
+		RDEBUG2("Entry is stale, using it while another request refreshes it");
+		return false;
+	}
+
+	RDEBUG2("Entry is stale, refreshing it");
+
+	return true;
+}
+
+/** Do caching checks
+ *
+ * @param[in] inst	Module instance.
+ * @param[in] t		Thread specific instance data.
+ * @param[in] request	The current request.
+ * @param[in] coalesce	Whether to wait for other requests loading the same entry.
+ */
+static rlm_rcode_t cache_it(rlm_cache_t const *inst, rlm_cache_thread_t *t, REQUEST *request, bool coalesce)
 {
 	rlm_cache_entry_t	*c = NULL;
-	rlm_cache_t const	*inst = instance;
 
 	rlm_cache_handle_t	*handle;
 
@@ -628,6 +764,12 @@ static rlm_rcode_t mod_cache_it(void *instance, UNUSED void *thread, REQUEST *re
 			goto finish;
 
 		case RLM_MODULE_OK:
+			if (cache_refresh(inst, t, request, key, key_len, c)) {
+				cache_free(inst, &c);
+				rcode = RLM_MODULE_NOTFOUND;
+				exists = 0;
+				break;
+			}
 			rcode = cache_merge(inst, request, c);
 			exists = 1;
 			break;
@@ -635,6 +777,16 @@ static rlm_rcode_t mod_cache_it(void *instance, UNUSED void *thread, REQUEST *re
 		case RLM_MODULE_NOTFOUND:
 			rcode = RLM_MODULE_NOTFOUND;
 			exists = 0;
+
+			if (coalesce && t->coalesce) {
+				rlm_cache_wait_t *wait;
+
+				wait = cache_wait(inst, t, request, key, key_len, insert);
+				if (wait) {
+					cache_release(inst, request, &handle);
+					return unlang_yield(request, mod_cache_it_resume, mod_cache_it_action, wait);
+				}
+			}
 			break;
 
 		default:
@@ -688,6 +840,11 @@ static rlm_rcode_t mod_cache_it(void *instance, UNUSED void *thread, REQUEST *re
 			goto finish;
 
 		case RLM_MODULE_OK:
+			if (insert && cache_refresh(inst, t, request, key, key_len, c)) {
+				cache_free(inst, &c);
+				exists = 0;
+				break;
+			}
 			exists = 1;
 			if (rcode != RLM_MODULE_UPDATED) rcode = RLM_MODULE_OK;
 			break;
@@ -749,6 +906,11 @@ static rlm_rcode_t mod_cache_it(void *instance, UNUSED void *thread, REQUEST *re
 			rad_assert(0);
 		}
 		rad_assert(!inst->driver->acquire || handle);
+
+		/*
+		 *	Wake any requests waiting for this entry.
+		 */
+		if (inst->coalesce) cache_coalesce_done(inst->coalesce, key, key_len);
 		goto finish;
 	}
 
@@ -779,8 +941,65 @@ finish:
 	return rcode;
 }
 
+/** Do caching checks
+ *
+ * Since we can update ANY VP list, we do exactly the same thing for all sections
+ * (autz / auth / etc.)
+ *
+ * If you want to cache something different in different sections, configure
+ * another cache module.
+ */
+static rlm_rcode_t mod_cache_it(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_cache_it(void *instance, void *thread, REQUEST *request)
+{
+	rlm_cache_t const	*inst = instance;
+
+	return cache_it(inst, thread, request, inst->config.coalesce);
+}
+
+/** Return one of the datastore's statistics
+ *
+ */
+static ssize_t cache_stats_xlat(char **out, rlm_cache_t const *inst, REQUEST *request, char const *name)
+{
+	rlm_cache_stats_t	stats;
+	uint64_t		value;
+
+	if (!inst->driver->stats) {
+		REDEBUG("Driver %s does not provide statistics", inst->driver->name);
+		return -1;
+	}
+
+	inst->driver->stats(&stats, &inst->config, inst->driver_inst);
+
+	if (strcmp(name, "hits") == 0) {
+		value = stats.hits;
+	} else if (strcmp(name, "misses") == 0) {
+		value = stats.misses;
+	} else if (strcmp(name, "inserts") == 0) {
+		value = stats.inserts;
+	} else if (strcmp(name, "evictions") == 0) {
+		value = stats.evictions;
+	} else if (strcmp(name, "expired") == 0) {
+		value = stats.expired;
+	} else if (strcmp(name, "entries") == 0) {
+		value = stats.entries;
+	} else if (strcmp(name, "size") == 0) {
+		value = stats.size;
+	} else {
+		REDEBUG("Unknown cache statistic \"%s\"", name);
+		return -1;
+	}
+
+	*out = talloc_typed_asprintf(request, "%" PRIu64, value);
+
+	return talloc_array_length(*out) - 1;
+}
+
 /** Allow single attribute values to be retrieved from the cache
  *
+ * "stats <name>" returns one of the datastore's counters instead, where <name>
+ * is one of hits, misses, inserts, evictions, expired, entries or size.
  */
 static ssize_t cache_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
 			  void const *mod_inst, UNUSED void const *xlat_inst,
@@ -803,6 +1022,8 @@ static ssize_t cache_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
 	vp_tmpl_t		*target = NULL;
 	vp_map_t		*map = NULL;
 
+	if (strncmp(fmt, "stats ", 6) == 0) return cache_stats_xlat(out, inst, request, fmt + 6);
+
 	key_len = tmpl_expand((char const **)&key, (char *)buffer, sizeof(buffer),
 			      request, inst->config.key, NULL, NULL);
 	if (key_len < 0) return -1;
@@ -818,16 +1039,16 @@ static ssize_t cache_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
 		return -1;
 	}
 
-	switch (cache_find(&c, mod_inst, request, handle, key, key_len)) {
+	switch (cache_find(&c, mod_inst, request, &handle, key, key_len)) {
 	case RLM_MODULE_OK:		/* found */
 		break;
 
 	case RLM_MODULE_NOTFOUND:	/* not found */
-		return 0;
+		goto finish;
 
 	default:
-		talloc_free(target);
-		return -1;
+		ret = -1;
+		goto finish;
 	}
 
 	for (map = c->maps; map; map = map->next) {
@@ -840,13 +1061,8 @@ static ssize_t cache_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
 		break;
 	}
 
+finish:
 	talloc_free(target);
-
-	/*
-	 *	Check if we found a matching map
-	 */
-	if (!map) return 0;
-
 	cache_free(mod_inst, &c);
 	cache_release(mod_inst, request, &handle);
 
@@ -861,6 +1077,7 @@ static int mod_detach(void *instance)
 	rlm_cache_t *inst = instance;
 
 	talloc_free(inst->maps);
+	TALLOC_FREE(inst->coalesce);
 
 	/*
 	 *	We need to explicitly free all children, so if the driver
@@ -991,6 +1208,41 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->config.soft_ttl >= inst->config.ttl) {
+		cf_log_err_cs(conf, "'soft_ttl' must be less than 'ttl'");
+		return -1;
+	}
+
+	if (inst->config.coalesce || inst->config.soft_ttl) {
+		FR_TIMEVAL_BOUND_CHECK("coalesce_timeout", &inst->config.coalesce_timeout, >=, 0, 1000);
+		FR_TIMEVAL_BOUND_CHECK("coalesce_timeout", &inst->config.coalesce_timeout, <=, 60, 0);
+
+		inst->coalesce = cache_coalesce_alloc(inst->config.name);
+		if (!inst->coalesce) return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_cache_t		*inst = instance;
+	rlm_cache_thread_t	*t = thread;
+
+	if (!inst->coalesce) return 0;
+
+	t->coalesce = cache_coalesce_thread_alloc(NULL, inst->coalesce, el);
+	if (!t->coalesce) return -1;
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_cache_thread_t	*t = thread;
+
+	TALLOC_FREE(t->coalesce);
+
 	return 0;
 }
 
@@ -1005,13 +1257,16 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
  */
 extern rad_module_t rlm_cache;
 rad_module_t rlm_cache = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "cache",
-	.inst_size	= sizeof(rlm_cache_t),
-	.config		= module_config,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "cache",
+	.inst_size		= sizeof(rlm_cache_t),
+	.thread_inst_size	= sizeof(rlm_cache_thread_t),
+	.config			= module_config,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_cache_it,
 		[MOD_PREACCT]		= mod_cache_it,
@@ -27,6 +27,8 @@ RCSIDH(cache_h, "$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/dl.h>
 
+#include "coalesce.h"
+
 typedef struct cache_driver cache_driver_t;
 
 typedef void rlm_cache_handle_t;
@@ -53,6 +55,12 @@ typedef struct rlm_cache_config_t {
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
+
+	bool			coalesce;		//!< Make requests which miss wait for the request
+							//!< already loading the entry.
+	struct timeval		coalesce_timeout;	//!< How long to wait for the entry to be loaded.
+	uint32_t		soft_ttl;		//!< Age after which entries are refreshed by one
+							//!< request, and returned to the others.
 } rlm_cache_config_t;
 
 /*
@@ -72,8 +80,14 @@ typedef struct rlm_cache_t {
 	vp_map_t		*maps;			//!< Attribute map applied to users.
 							//!< and profiles.
 	CONF_SECTION		*cs;
+
+	cache_coalesce_t	*coalesce;		//!< Keys being loaded by requests.
 } rlm_cache_t;
 
+typedef struct rlm_cache_thread_t {
+	cache_coalesce_thread_t	*coalesce;		//!< This worker's handle for waiting on loads.
+} rlm_cache_thread_t;
+
 typedef struct rlm_cache_entry_t {
 	uint8_t const		*key;			//!< Key used to identify entry.
 	size_t			key_len;		//!< Length of key data.
@@ -84,6 +98,19 @@ typedef struct rlm_cache_entry_t {
 	vp_map_t		*maps;			//!< Head of the maps list.
 } rlm_cache_entry_t;
 
+/** Counters and gauges for a cache datastore
+ *
+ */
+typedef struct rlm_cache_stats_t {
+	uint64_t		hits;			//!< Lookups which found an entry.
+	uint64_t		misses;			//!< Lookups which didn't find an entry.
+	uint64_t		inserts;		//!< Entries added.
+	uint64_t		evictions;		//!< Entries removed to make space for new ones.
+	uint64_t		expired;		//!< Entries removed because their TTL passed.
+	uint64_t		entries;		//!< Entries currently in the datastore.
+	uint64_t		size;			//!< Memory used by entries, in bytes.
+} rlm_cache_stats_t;
+
 /** Instantiate a driver
  *
  * Function to handle any driver specific instantiation.
@@ -277,6 +304,16 @@ typedef void		(*cache_release_t)(rlm_cache_config_t const *config, void *instanc
 typedef int		(*cache_reconnect_t)(rlm_cache_handle_t **handle, rlm_cache_config_t const *config,
 					     void *instance, REQUEST *request);
 
+/** Get statistics for the datastore
+ *
+ * @note This callback is optional.  If it's not provided, the cache xlat won't return statistics.
+ *
+ * @param[out] out Where to write the statistics.
+ * @param[in] config for this instance of the rlm_cache module.
+ * @param[in] instance Driver specific instance data.
+ */
+typedef void		(*cache_stats_t)(rlm_cache_stats_t *out, rlm_cache_config_t const *config, void *instance);
+
 struct cache_driver {
 	RAD_MODULE_COMMON;					//!< Common fields for all loadable modules.
 
@@ -296,4 +333,6 @@ struct cache_driver {
 	cache_release_t			release;		//!< (optional) Release access to resource acquired
 								//!< with acquire callback.
 	cache_reconnect_t		reconnect;		//!< (optional) Re-initialise resource.
+
+	cache_stats_t			stats;			//!< (optional) Get hit/miss/eviction counters.
 };
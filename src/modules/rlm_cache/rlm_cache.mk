@@ -1,3 +1,3 @@
 TARGET		:= rlm_cache.a
-SOURCES		:= rlm_cache.c
+SOURCES		:= rlm_cache.c coalesce.c
 TGT_LDLIBS	:= $(LIBS)
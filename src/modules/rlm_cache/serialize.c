@@ -25,6 +25,8 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/rad_assert.h>
+
 #include "rlm_cache.h"
 #include "serialize.h"
 
@@ -64,8 +66,9 @@ int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c)
 	}
 
 	for (map = c->maps; map; map = map->next) {
-		char	*value;
-		size_t	len;
+		char		*value;
+		char const	*quote;
+		size_t		len;
 
 		len = tmpl_snprint(attr, sizeof(attr), map->lhs);
 		if (is_truncated(len, sizeof(attr))) {
@@ -77,9 +80,15 @@ int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c)
 		value = value_box_asprint(value_pool, &map->rhs->tmpl_value_box, '\'');
 		if (!value) goto error;
 
-		to_store = talloc_asprintf_append_buffer(to_store, "%s %s %s\n", attr,
+		/*
+		 *	Strings need quoting, or whitespace ends
+		 *	the value when it's parsed.
+		 */
+		quote = (map->rhs->tmpl_value_box_type == PW_TYPE_STRING) ? "'" : "";
+
+		to_store = talloc_asprintf_append_buffer(to_store, "%s %s %s%s%s\n", attr,
 							 fr_int2str(fr_tokens_table, map->op, "<INVALID>"),
-							 value);
+							 quote, value, quote);
 		if (!to_store) goto error;
 	}
 finish:
@@ -90,6 +99,9 @@ finish:
 }
 
 /** Converts a serialized cache entry back into a structure
+ *
+ * Entries written by #cache_serialize_binary are detected, and passed to
+ * #cache_deserialize_binary.
  *
  * @param c Cache entry to populate (should already be allocated)
  * @param in String representation of cache entry.
@@ -106,6 +118,13 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 
 	if (inlen < 0) inlen = strlen(in);
 
+	/*
+	 *	Written by cache_serialize_binary()
+	 */
+	if ((inlen > 0) && ((uint8_t)in[0] == CACHE_SERIALIZE_MAGIC)) {
+		return cache_deserialize_binary(c, (uint8_t const *)in, inlen);
+	}
+
 	p = in;
 
 	while (((size_t)(p - in)) < (size_t)inlen) {
@@ -131,7 +150,10 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 			goto error;
 		}
 
-		if (map->rhs->type != TMPL_TYPE_UNPARSED) {
+		/*
+		 *	Hex strings (octets values) are parsed to data.
+		 */
+		if ((map->rhs->type != TMPL_TYPE_UNPARSED) && (map->rhs->type != TMPL_TYPE_DATA)) {
 			fr_strerror_printf("Pair right hand side \"%s\" parsed as %s, needed literal.  "
 					   "Check serialized data quoting", map->rhs->name,
 					   fr_int2str(tmpl_names, map->rhs->type, "<INVALID>"));
@@ -172,3 +194,407 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 
 	return 0;
 }
+
+/*
+ *	Binary serialization format, version 1
+ *
+ *	 0                   1                   2                   3
+ *	 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|     Magic     |    Version    |            Created ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	                           ... Created ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	      ... Created              |            Expires ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	                           ... Expires ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	      ... Expires              |    Maps ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ *	Each map is then encoded as:
+ *
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|    Request    |     List      |   Operator    |      Tag      |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                             Num                               |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                            Vendor                             |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                           Attribute                           |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|     Type      |                    Length ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	  ... Length    |    Value ...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ *	All integers are in network byte order.  Values are stored as they
+ *	would be on the wire, so integer types are in network byte order,
+ *	and strings and octets are stored verbatim.
+ *
+ *	The magic byte can never start a text entry, which always begins
+ *	with an attribute reference, so cache_deserialize() can tell the
+ *	two formats apart.
+ */
+#define CACHE_BINARY_HDR_LEN	(1 + 1 + 8 + 8)
+#define CACHE_BINARY_MAP_LEN	(1 + 1 + 1 + 1 + 4 + 4 + 4 + 1 + 4)
+
+/** Calculate how many bytes a map's value needs, and check it can be binary serialized
+ *
+ * @param map to check.
+ * @return
+ *	- Length of the value.
+ *	- -1 if the map can't be represented in the binary format.
+ */
+static ssize_t cache_binary_value_len(vp_map_t const *map)
+{
+	fr_dict_attr_t const	*da;
+	value_box_t const	*box;
+
+	if ((map->lhs->type != TMPL_TYPE_ATTR) || (map->rhs->type != TMPL_TYPE_DATA)) {
+		fr_strerror_printf("Can only binary serialize attribute to value maps");
+		return -1;
+	}
+
+	/*
+	 *	Attributes are encoded by number, so we need to be
+	 *	sure we'll get the same attribute back.
+	 */
+	da = map->lhs->tmpl_da;
+	if (fr_dict_attr_by_num(NULL, da->vendor, da->attr) != da) {
+		fr_strerror_printf("Attribute \"%s\" can't be referenced by number", da->name);
+		return -1;
+	}
+
+	box = &map->rhs->tmpl_value_box;
+	switch (box->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+		break;
+
+	default:
+		if ((box->length > sizeof(box->datum)) ||
+		    (box->length < dict_attr_sizes[box->type][0]) ||
+		    (box->length > dict_attr_sizes[box->type][1])) {
+			fr_strerror_printf("Can't binary serialize %s values",
+					   fr_int2str(dict_attr_types, box->type, "<INVALID>"));
+			return -1;
+		}
+		break;
+	}
+
+	if (box->length > UINT32_MAX) {
+		fr_strerror_printf("Value of \"%s\" too long", da->name);
+		return -1;
+	}
+
+	return box->length;
+}
+
+/** Serialize a cache entry in a compact binary format
+ *
+ * Unlike #cache_serialize the output can be converted back into a cache
+ * entry without parsing attribute names or values.
+ *
+ * Entries containing attributes which can't be looked up by number, or
+ * values with no fixed binary representation, can't be serialized in this
+ * format. The caller should fall back to #cache_serialize.
+ *
+ * @param ctx to alloc new buffer in.
+ * @param out Where to write pointer to serialized cache entry.
+ * @param outlen Where to write the length of the serialized cache entry.
+ * @param c Cache entry to serialize.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, size_t *outlen, rlm_cache_entry_t const *c)
+{
+	vp_map_t	*map;
+	size_t		len = CACHE_BINARY_HDR_LEN;
+	uint8_t		*buff, *p;
+	uint64_t	u64;
+	uint32_t	u32;
+
+	/*
+	 *	Figure out how much space we need, so we only
+	 *	do one allocation.
+	 */
+	for (map = c->maps; map; map = map->next) {
+		ssize_t vlen;
+
+		vlen = cache_binary_value_len(map);
+		if (vlen < 0) return -1;
+
+		len += CACHE_BINARY_MAP_LEN + vlen;
+	}
+
+	p = buff = talloc_array(ctx, uint8_t, len);
+	if (!buff) return -1;
+
+	*p++ = CACHE_SERIALIZE_MAGIC;
+	*p++ = CACHE_SERIALIZE_VERSION;
+
+	u64 = htonll((uint64_t)c->created);
+	memcpy(p, &u64, sizeof(u64));
+	p += sizeof(u64);
+
+	u64 = htonll((uint64_t)c->expires);
+	memcpy(p, &u64, sizeof(u64));
+	p += sizeof(u64);
+
+	for (map = c->maps; map; map = map->next) {
+		value_box_t const	*box = &map->rhs->tmpl_value_box;
+		value_box_t		value;
+
+		*p++ = map->lhs->tmpl_request;
+		*p++ = map->lhs->tmpl_list;
+		*p++ = map->op;
+		*p++ = (uint8_t)map->lhs->tmpl_tag;
+
+		u32 = htonl((uint32_t)map->lhs->tmpl_num);
+		memcpy(p, &u32, sizeof(u32));
+		p += sizeof(u32);
+
+		u32 = htonl(map->lhs->tmpl_da->vendor);
+		memcpy(p, &u32, sizeof(u32));
+		p += sizeof(u32);
+
+		u32 = htonl(map->lhs->tmpl_da->attr);
+		memcpy(p, &u32, sizeof(u32));
+		p += sizeof(u32);
+
+		*p++ = box->type;
+
+		u32 = htonl((uint32_t)box->length);
+		memcpy(p, &u32, sizeof(u32));
+		p += sizeof(u32);
+
+		switch (box->type) {
+		case PW_TYPE_STRING:
+		case PW_TYPE_OCTETS:
+			if (box->length) memcpy(p, box->datum.ptr, box->length);
+			break;
+
+		default:
+			value_box_hton(&value, box);
+			memcpy(p, &value.datum, box->length);
+			break;
+		}
+		p += box->length;
+	}
+	rad_assert((size_t)(p - buff) == len);
+
+	*out = buff;
+	*outlen = len;
+
+	return 0;
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param c Cache entry to populate (should already be allocated)
+ * @param in Binary representation of cache entry, as produced by #cache_serialize_binary.
+ * @param inlen Length of the binary data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen)
+{
+	vp_map_t	**last = &c->maps;
+	uint8_t const	*p = in, *end = in + inlen;
+	uint64_t	u64;
+	uint32_t	u32;
+
+	if ((inlen < CACHE_BINARY_HDR_LEN) || (p[0] != CACHE_SERIALIZE_MAGIC)) {
+		fr_strerror_printf("Not a binary serialized cache entry");
+		return -1;
+	}
+
+	if (p[1] != CACHE_SERIALIZE_VERSION) {
+		fr_strerror_printf("Unsupported binary serialization version %u, expected %u",
+				   p[1], CACHE_SERIALIZE_VERSION);
+		return -1;
+	}
+	p += 2;
+
+	memcpy(&u64, p, sizeof(u64));
+	c->created = ntohll(u64);
+	p += sizeof(u64);
+
+	memcpy(&u64, p, sizeof(u64));
+	c->expires = ntohll(u64);
+	p += sizeof(u64);
+
+	while (p < end) {
+		vp_map_t		*map;
+		vp_tmpl_t		*lhs, *rhs;
+		fr_dict_attr_t const	*da;
+		value_box_t		*box;
+		unsigned int		vendor, attr;
+		uint8_t			type;
+		size_t			len;
+		char			buff[256];
+
+		if ((size_t)(end - p) < CACHE_BINARY_MAP_LEN) {
+			fr_strerror_printf("Truncated map header, need %i bytes, have %zu bytes",
+					   CACHE_BINARY_MAP_LEN, (size_t)(end - p));
+			return -1;
+		}
+
+		/*
+		 *	These are used as array indexes and switch
+		 *	values, so anything we didn't write is fatal.
+		 */
+		if (!fr_int2str(request_refs, p[0], NULL)) {
+			fr_strerror_printf("Invalid request qualifier %u", p[0]);
+			return -1;
+		}
+
+		if (!fr_int2str(pair_lists, p[1], NULL)) {
+			fr_strerror_printf("Invalid list qualifier %u", p[1]);
+			return -1;
+		}
+
+		if ((p[2] < T_OP_INCRM) || (p[2] > T_OP_CMP_EQ)) {
+			fr_strerror_printf("Invalid operator %u", p[2]);
+			return -1;
+		}
+
+		MEM(map = talloc_zero(c, vp_map_t));
+		MEM(lhs = tmpl_init(talloc(map, vp_tmpl_t), TMPL_TYPE_ATTR, NULL, 0, T_BARE_WORD));
+		map->lhs = lhs;
+
+		lhs->tmpl_request = p[0];
+		lhs->tmpl_list = p[1];
+		map->op = p[2];
+		lhs->tmpl_tag = (int8_t)p[3];
+		p += 4;
+
+		memcpy(&u32, p, sizeof(u32));
+		lhs->tmpl_num = (int)ntohl(u32);
+		p += sizeof(u32);
+
+		memcpy(&u32, p, sizeof(u32));
+		vendor = ntohl(u32);
+		p += sizeof(u32);
+
+		memcpy(&u32, p, sizeof(u32));
+		attr = ntohl(u32);
+		p += sizeof(u32);
+
+		type = *p++;
+
+		memcpy(&u32, p, sizeof(u32));
+		len = ntohl(u32);
+		p += sizeof(u32);
+
+		if (len > (size_t)(end - p)) {
+			fr_strerror_printf("Truncated value, need %zu bytes, have %zu bytes", len, (size_t)(end - p));
+		error:
+			talloc_free(map);
+			return -1;
+		}
+
+		da = fr_dict_attr_by_num(NULL, vendor, attr);
+		if (!da) {
+			fr_strerror_printf("Unknown attribute %u:%u.  Check local dictionaries", vendor, attr);
+			goto error;
+		}
+
+		if ((type != da->type) || (type == PW_TYPE_INVALID) || (type >= PW_TYPE_MAX)) {
+			fr_strerror_printf("Attribute \"%s\" has type %s, serialized value has type %i.  "
+					   "Check local dictionaries", da->name,
+					   fr_int2str(dict_attr_types, da->type, "<INVALID>"), type);
+			goto error;
+		}
+		lhs->tmpl_da = da;
+
+		/*
+		 *	The name is only used for debug output, but needs
+		 *	to be the same as the text format would produce.
+		 */
+		lhs->len = tmpl_snprint(buff, sizeof(buff), lhs);
+		if (is_truncated(lhs->len, sizeof(buff))) {
+			fr_strerror_printf("Attribute name too long");
+			goto error;
+		}
+		lhs->name = talloc_bstrndup(lhs, buff, lhs->len);
+
+		MEM(rhs = tmpl_init(talloc(map, vp_tmpl_t), TMPL_TYPE_DATA, "<BINARY>", 8, T_BARE_WORD));
+		map->rhs = rhs;
+
+		box = &rhs->tmpl_value_box;
+		box->type = type;
+		box->length = len;
+
+		switch (type) {
+		case PW_TYPE_STRING:
+			box->datum.strvalue = talloc_bstrndup(rhs, (char const *)p, len);
+			if (!box->datum.strvalue) goto error;
+			rhs->quote = is_printable(p, len) ? T_SINGLE_QUOTED_STRING : T_DOUBLE_QUOTED_STRING;
+			break;
+
+		case PW_TYPE_OCTETS:
+			box->datum.octets = talloc_memdup(rhs, p, len);
+			if (!box->datum.octets) goto error;
+			talloc_set_type(box->datum.octets, uint8_t);
+			break;
+
+		default:
+			if ((len > sizeof(box->datum)) ||
+			    (len < dict_attr_sizes[type][0]) || (len > dict_attr_sizes[type][1])) {
+				fr_strerror_printf("Invalid length %zu for %s value", len,
+						   fr_int2str(dict_attr_types, type, "<INVALID>"));
+				goto error;
+			}
+			memcpy(&box->datum, p, len);
+
+			switch (type) {
+			case PW_TYPE_INTEGER64:
+				box->datum.integer64 = ntohll(box->datum.integer64);
+				break;
+
+			case PW_TYPE_INTEGER:
+			case PW_TYPE_DATE:
+			case PW_TYPE_SIGNED:
+				box->datum.integer = ntohl(box->datum.integer);
+				break;
+
+			case PW_TYPE_SHORT:
+				box->datum.ushort = ntohs(box->datum.ushort);
+				break;
+
+			default:
+				break;
+			}
+			break;
+		}
+		p += len;
+
+		/*
+		 *	Cache-Created and Cache-Expires are in the header,
+		 *	but be lenient and accept them as maps too.
+		 */
+		if (da->vendor == 0) switch (da->attr) {
+		case PW_CACHE_CREATED:
+			c->created = box->datum.date;
+			talloc_free(map);
+			continue;
+
+		case PW_CACHE_EXPIRES:
+			c->expires = box->datum.date;
+			talloc_free(map);
+			continue;
+
+		default:
+			break;
+		}
+
+		*last = map;
+		last = &(*last)->next;
+	}
+
+	return 0;
+}
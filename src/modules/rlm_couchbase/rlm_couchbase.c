@@ -39,6 +39,13 @@ RCSID("$Id$")
 #include "mod.h"
 #include "couchbase.h"
 
+/**
+ * Thread specific data
+ */
+typedef struct rlm_couchbase_thread {
+	fr_connection_thread_cache_t *conn_cache;	//!< This worker's cache of idle connections.
+} rlm_couchbase_thread_t;
+
 /**
  * Client Configuration
  */
@@ -854,6 +861,40 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/** Create this worker's cache of idle connections
+ *
+ * @param conf	Configuration section.
+ * @param instance	The module instance.
+ * @param el		The worker's event list.
+ * @param thread	specific data.
+ * @return Returns 0.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_couchbase_t *inst = instance;
+	rlm_couchbase_thread_t *t = thread;
+
+	t->conn_cache = fr_connection_pool_thread_instantiate(inst->pool);
+
+	return 0;
+}
+
+/** Return this worker's idle connections to the pool
+ *
+ * @param thread	specific data.
+ * @return Returns 0.
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_couchbase_thread_t *t = thread;
+
+	fr_connection_pool_thread_detach(t->conn_cache);
+	t->conn_cache = NULL;
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	INFO("libcouchbase version: %s", lcb_get_version(NULL));
@@ -866,14 +907,17 @@ static int mod_load(void)
  */
 extern rad_module_t rlm_couchbase;
 rad_module_t rlm_couchbase = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "couchbase",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_couchbase_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "couchbase",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_couchbase_t),
+	.thread_inst_size	= sizeof(rlm_couchbase_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
@@ -26,44 +26,73 @@ RCSID("$Id$")
 
 #include	<freeradius-devel/radiusd.h>
 #include	<freeradius-devel/modules.h>
+#include	<freeradius-devel/reload.h>
 
 #include	<ctype.h>
 #include	<fcntl.h>
 
-typedef struct rlm_files_t {
-	char const *compat_mode;
+/** Which file an entry point reads
+ *
+ */
+typedef enum {
+	FILES_COMMON = 0,				//!< "filename", used if there's no specific file.
+	FILES_AUTHORIZE,				//!< "usersfile".
+	FILES_AUTHENTICATE,				//!< "auth_usersfile".
+	FILES_PREACCT,					//!< "acctusersfile".
+	FILES_PRE_PROXY,				//!< "preproxy_usersfile".
+	FILES_POST_PROXY,				//!< "postproxy_usersfile".
+	FILES_POST_AUTH,				//!< "postauth_usersfile".
+	FILES_MAX
+} files_section_t;
+
+/** A users file, compiled for fast lookups
+ *
+ * Entries have to be checked in the order they appear in the file, but most
+ * DEFAULT entries can only match requests containing a particular attribute
+ * with a particular value.  These are indexed by that attribute and value,
+ * so a request only checks the DEFAULT entries which could match it.
+ */
+typedef struct files_table {
+	rbtree_t		*tree;			//!< Entries by name.  The first DEFAULT entry is
+							//!< the head of the DEFAULT chain.
+	uint32_t		num_entries;		//!< Total number of entries.
+	PAIR_LIST		**defaults;		//!< All DEFAULT entries, in file order.
+	uint32_t		num_defaults;
 
-	char const *key;
+	uint32_t		*unindexed;		//!< DEFAULT entries which every request must check.
+	uint32_t		num_unindexed;
+
+	fr_hash_table_t		*index;			//!< Remaining DEFAULT entries, by attribute and value.
+} files_table_t;
 
-	char const *filename;
-	rbtree_t *common;
+/** DEFAULT entries which check for the same attribute and value
+ *
+ */
+typedef struct files_index_entry {
+	VALUE_PAIR const	*vp;			//!< Check item the entries are indexed by.
+	uint32_t		*defaults;		//!< Positions in files_table_t.defaults, ascending.
+	uint32_t		num_defaults;
+} files_index_entry_t;
 
-	/* autz */
-	char const *usersfile;
-	rbtree_t *users;
+/** All the files an instance reads, replaced as a unit on reload
+ *
+ */
+typedef struct files_data {
+	files_table_t		*table[FILES_MAX];
+} files_data_t;
 
+typedef struct rlm_files_t {
+	char const *name;
 
-	/* authenticate */
-	char const *auth_usersfile;
-	rbtree_t *auth_users;
+	char const *compat_mode;
 
-	/* preacct */
-	char const *acct_usersfile;
-	rbtree_t *acct_users;
+	char const *key;
 
-#ifdef WITH_PROXY
-	/* pre-proxy */
-	char const *preproxy_usersfile;
-	rbtree_t *preproxy_users;
+	char const *filename[FILES_MAX];
 
-	/* post-proxy */
-	char const *postproxy_usersfile;
-	rbtree_t *postproxy_users;
-#endif
+	uint32_t check_interval;
 
-	/* post-authenticate */
-	char const *postauth_usersfile;
-	rbtree_t *postauth_users;
+	fr_reload_t *reload;				//!< The files, as currently loaded.
 } rlm_files_t;
 
 
@@ -79,17 +108,18 @@ static int fall_through(VALUE_PAIR *vp)
 }
 
 static const CONF_PARSER module_config[] = {
-	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_INPUT, rlm_files_t, filename) },
-	{ FR_CONF_OFFSET("usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, usersfile) },
-	{ FR_CONF_OFFSET("acctusersfile", PW_TYPE_FILE_INPUT, rlm_files_t, acct_usersfile) },
+	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_INPUT, rlm_files_t, filename[FILES_COMMON]) },
+	{ FR_CONF_OFFSET("usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, filename[FILES_AUTHORIZE]) },
+	{ FR_CONF_OFFSET("acctusersfile", PW_TYPE_FILE_INPUT, rlm_files_t, filename[FILES_PREACCT]) },
 #ifdef WITH_PROXY
-	{ FR_CONF_OFFSET("preproxy_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, preproxy_usersfile) },
-	{ FR_CONF_OFFSET("postproxy_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, postproxy_usersfile) },
+	{ FR_CONF_OFFSET("preproxy_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, filename[FILES_PRE_PROXY]) },
+	{ FR_CONF_OFFSET("postproxy_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, filename[FILES_POST_PROXY]) },
 #endif
-	{ FR_CONF_OFFSET("auth_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, auth_usersfile) },
-	{ FR_CONF_OFFSET("postauth_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, postauth_usersfile) },
+	{ FR_CONF_OFFSET("auth_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, filename[FILES_AUTHENTICATE]) },
+	{ FR_CONF_OFFSET("postauth_usersfile", PW_TYPE_FILE_INPUT, rlm_files_t, filename[FILES_POST_AUTH]) },
 	{ FR_CONF_OFFSET("compat", PW_TYPE_STRING | PW_TYPE_DEPRECATED, rlm_files_t, compat_mode) },
 	{ FR_CONF_OFFSET("key", PW_TYPE_STRING | PW_TYPE_XLAT, rlm_files_t, key) },
+	{ FR_CONF_OFFSET("check_interval", PW_TYPE_INTEGER, rlm_files_t, check_interval), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -100,21 +130,304 @@ static int pairlist_cmp(void const *a, void const *b)
 		      ((PAIR_LIST const *)b)->name);
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree, char const *compat_mode_str)
+/** Return the bytes paircompare() checks for equality, for an indexable type
+ *
+ * @param[out] len	of the value.
+ * @param[in] vp	to return the value of.
+ * @return
+ *	- The value.
+ *	- NULL if values of this type can't be indexed.
+ */
+static uint8_t const *files_index_value(size_t *len, VALUE_PAIR const *vp)
+{
+#define VALUE(_field) *len = sizeof(vp->_field); return (uint8_t const *)&vp->_field
+
+	switch (vp->vp_type) {
+	case PW_TYPE_STRING:
+		/*
+		 *	Compared with strcmp()
+		 */
+		*len = strlen(vp->vp_strvalue);
+		return (uint8_t const *)vp->vp_strvalue;
+
+	case PW_TYPE_OCTETS:
+		*len = vp->vp_length;
+		return vp->vp_octets;
+
+	case PW_TYPE_BYTE:
+		VALUE(vp_byte);
+
+	case PW_TYPE_SHORT:
+		VALUE(vp_short);
+
+	case PW_TYPE_INTEGER:
+		VALUE(vp_integer);
+
+	case PW_TYPE_INTEGER64:
+		VALUE(vp_integer64);
+
+	case PW_TYPE_SIGNED:
+		VALUE(vp_signed);
+
+	case PW_TYPE_DATE:
+		VALUE(vp_date);
+
+	case PW_TYPE_IPV4_ADDR:
+		VALUE(vp_ipaddr);
+
+	case PW_TYPE_IPV6_ADDR:
+		VALUE(vp_ipv6addr);
+
+	case PW_TYPE_IFID:
+		VALUE(vp_ifid);
+
+	default:
+		return NULL;
+	}
+#undef VALUE
+}
+
+static uint32_t files_index_hash(void const *data)
+{
+	VALUE_PAIR const	*vp = ((files_index_entry_t const *)data)->vp;
+	uint8_t const		*value;
+	size_t			len;
+	uint32_t		hash;
+
+	hash = fr_hash(&vp->da, sizeof(vp->da));
+	value = files_index_value(&len, vp);
+
+	return fr_hash_update(value, len, hash);
+}
+
+static int files_index_cmp(void const *one, void const *two)
+{
+	VALUE_PAIR const	*a = ((files_index_entry_t const *)one)->vp;
+	VALUE_PAIR const	*b = ((files_index_entry_t const *)two)->vp;
+	uint8_t const		*a_value, *b_value;
+	size_t			a_len, b_len;
+
+	if (a->da < b->da) return -1;
+	if (a->da > b->da) return +1;
+
+	a_value = files_index_value(&a_len, a);
+	b_value = files_index_value(&b_len, b);
+
+	if (a_len < b_len) return -1;
+	if (a_len > b_len) return +1;
+
+	return memcmp(a_value, b_value, a_len);
+}
+
+/** Find a check item a DEFAULT entry can be indexed by
+ *
+ * paircompare() fails if the request doesn't contain an attribute equal to
+ * the check item, so entries which aren't in the index slot for any of the
+ * request's attributes don't need to be checked.
+ *
+ * That's only true for check items which are compared by value.  Regular
+ * expressions, other operators, values which are expanded at run time,
+ * and attributes which have comparison functions, all need the entry to be
+ * checked by every request.
+ *
+ * Comparison functions are registered by other modules, possibly after we've
+ * been instantiated, so only RADIUS attributes are indexed.
+ *
+ * @param[in] check	items of the DEFAULT entry.
+ * @return
+ *	- The check item to index the entry by.
+ *	- NULL if the entry must always be checked.
+ */
+static VALUE_PAIR const *files_index_by(VALUE_PAIR *check)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	size_t		len;
+
+	for (vp = fr_pair_cursor_init(&cursor, &check); vp; vp = fr_pair_cursor_next(&cursor)) {
+		/*
+		 *	'=' is treated as '==' for check items.
+		 */
+		if ((vp->op != T_OP_CMP_EQ) && (vp->op != T_OP_EQ)) continue;
+		if (vp->type != VT_DATA) continue;
+		if (vp->da->flags.has_tag) continue;
+		if ((vp->da->vendor == 0) && ((vp->da->attr >= 0x100) || (vp->da->attr == PW_USER_PASSWORD))) continue;
+		if (radius_find_compare(vp->da)) continue;
+		if (!files_index_value(&len, vp)) continue;
+
+		return vp;
+	}
+
+	return NULL;
+}
+
+/** Index the DEFAULT entries of a users file
+ *
+ * @param[in] table	to build the index for.
+ * @param[in] filename	the table was read from.
+ * @param[in] default_list	the head of the DEFAULT chain.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int files_index_build(files_table_t *table, char const *filename, PAIR_LIST *default_list)
+{
+	PAIR_LIST		*entry;
+	VALUE_PAIR const	**index_by;
+	files_index_entry_t	*ie, my_ie;
+	uint32_t		i;
+
+	for (entry = default_list; entry; entry = entry->next) table->num_defaults++;
+	if (!table->num_defaults) return 0;
+
+	MEM(table->defaults = talloc_array(table, PAIR_LIST *, table->num_defaults));
+	MEM(table->unindexed = talloc_array(table, uint32_t, table->num_defaults));
+	MEM(index_by = talloc_array(NULL, VALUE_PAIR const *, table->num_defaults));
+
+	table->index = fr_hash_table_create(table, files_index_hash, files_index_cmp, NULL);
+	if (!table->index) {
+		talloc_free(index_by);
+		return -1;
+	}
+
+	/*
+	 *	Count the entries for each attribute and value...
+	 */
+	for (i = 0, entry = default_list; entry; i++, entry = entry->next) {
+		table->defaults[i] = entry;
+
+		index_by[i] = files_index_by(entry->check);
+		if (!index_by[i]) {
+			table->unindexed[table->num_unindexed++] = i;
+			continue;
+		}
+
+		my_ie.vp = index_by[i];
+		ie = fr_hash_table_finddata(table->index, &my_ie);
+		if (!ie) {
+			MEM(ie = talloc_zero(table->index, files_index_entry_t));
+			ie->vp = index_by[i];
+			if (!fr_hash_table_insert(table->index, ie)) {
+				talloc_free(index_by);
+				return -1;
+			}
+		}
+		ie->num_defaults++;
+	}
+
+	/*
+	 *	...then fill them in, in order.
+	 */
+	for (i = 0; i < table->num_defaults; i++) {
+		if (!index_by[i]) continue;
+
+		my_ie.vp = index_by[i];
+		ie = fr_hash_table_finddata(table->index, &my_ie);
+		if (!ie->defaults) {
+			MEM(ie->defaults = talloc_array(ie, uint32_t, ie->num_defaults));
+			ie->num_defaults = 0;
+		}
+		ie->defaults[ie->num_defaults++] = i;
+	}
+	talloc_free(index_by);
+
+	DEBUG("%s: Indexed %u of %u DEFAULT entries by %u attribute values", filename,
+	      table->num_defaults - table->num_unindexed, table->num_defaults,
+	      fr_hash_table_num_elements(table->index));
+
+	return 0;
+}
+
+static int files_position_cmp(void const *one, void const *two)
+{
+	uint32_t a = *(uint32_t const *)one;
+	uint32_t b = *(uint32_t const *)two;
+
+	return (a > b) - (a < b);
+}
+
+/** Find the DEFAULT entries a request has to check
+ *
+ * @param[in] ctx	to allocate the list in.
+ * @param[out] out	Positions of the entries in files_table_t.defaults, ascending.
+ *			If this isn't files_table_t.unindexed, the caller must free it.
+ * @param[in] table	to search.
+ * @param[in] vps	the request's attributes.
+ * @return the number of entries.
+ */
+static uint32_t files_defaults(TALLOC_CTX *ctx, uint32_t const **out, files_table_t const *table, VALUE_PAIR *vps)
+{
+	vp_cursor_t		cursor;
+	VALUE_PAIR		*vp;
+	files_index_entry_t	*ie, my_ie;
+	files_index_entry_t	*found[64];
+	uint32_t		num_found = 0, num = table->num_unindexed;
+	uint32_t		*defaults, i, j;
+	size_t			len;
+
+	*out = table->unindexed;
+	if (!table->index || (fr_hash_table_num_elements(table->index) == 0)) return num;
+
+	for (vp = fr_pair_cursor_init(&cursor, &vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		if (!files_index_value(&len, vp)) continue;
+
+		my_ie.vp = vp;
+		ie = fr_hash_table_finddata(table->index, &my_ie);
+		if (!ie) continue;
+
+		/*
+		 *	A request with this many matching attributes
+		 *	is unusual.  Check everything.
+		 */
+		if (num_found == (sizeof(found) / sizeof(*found))) {
+			MEM(defaults = talloc_array(ctx, uint32_t, table->num_defaults));
+			for (i = 0; i < table->num_defaults; i++) defaults[i] = i;
+			*out = defaults;
+			return table->num_defaults;
+		}
+
+		found[num_found++] = ie;
+		num += ie->num_defaults;
+	}
+	if (!num_found) return num;
+
+	MEM(defaults = talloc_array(ctx, uint32_t, num));
+	memcpy(defaults, table->unindexed, sizeof(*defaults) * table->num_unindexed);
+	num = table->num_unindexed;
+	for (i = 0; i < num_found; i++) {
+		memcpy(defaults + num, found[i]->defaults, sizeof(*defaults) * found[i]->num_defaults);
+		num += found[i]->num_defaults;
+	}
+
+	/*
+	 *	Merge into file order, removing duplicates from
+	 *	attributes which appear more than once.
+	 */
+	qsort(defaults, num, sizeof(*defaults), files_position_cmp);
+	for (i = 1, j = 1; i < num; i++) if (defaults[i] != defaults[j - 1]) defaults[j++] = defaults[i];
+
+	*out = defaults;
+
+	return j;
+}
+
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, files_table_t **out, char const *compat_mode_str)
 {
 	int rcode;
 	PAIR_LIST *users = NULL;
 	PAIR_LIST *entry, *next;
 	PAIR_LIST *user_list, *default_list, **default_tail;
+	files_table_t *table;
 	rbtree_t *tree;
 
-	if (!filename) {
-		*ptree = NULL;
-		return 0;
-	}
+	*out = NULL;
+	if (!filename) return 0;
 
-	rcode = pairlist_read(ctx, filename, &users, 1);
+	MEM(table = talloc_zero(ctx, files_table_t));
+
+	rcode = pairlist_read(table, filename, &users, 1);
 	if (rcode < 0) {
+		talloc_free(table);
 		return -1;
 	}
 
@@ -235,11 +548,13 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 		}
 	}
 
-	tree = rbtree_create(ctx, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
+	tree = rbtree_create(table, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
 	if (!tree) {
-		pairlist_free(&users);
+	error:
+		talloc_free(table);
 		return -1;
 	}
+	table->tree = tree;
 
 	default_list = NULL;
 	default_tail = &default_list;
@@ -256,6 +571,7 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 		next = entry->next;
 		entry->next = NULL;
 		(void) talloc_steal(tree, entry);
+		table->num_entries++;
 
 		/*
 		 *	DEFAULT entries get their own list.
@@ -267,13 +583,7 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 				/*
 				 *	Insert the first DEFAULT into the tree.
 				 */
-				if (!rbtree_insert(tree, entry)) {
-				error:
-					pairlist_free(&entry);
-					pairlist_free(&next);
-					rbtree_free(tree);
-					return -1;
-				}
+				if (!rbtree_insert(tree, entry)) goto error;
 
 			} else {
 				/*
@@ -307,34 +617,82 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 		}
 	}
 
-	*ptree = tree;
+	if (files_index_build(table, filename, default_list) < 0) goto error;
+
+	*out = table;
+
+	return 0;
+}
+
+
+
+/** Read all the files an instance uses
+ *
+ * Called by the reload thread, as well as when we're instantiated.
+ */
+static int files_data_load(void **out, uint64_t *entries, void *uctx)
+{
+	rlm_files_t const	*inst = uctx;
+	files_data_t		*data;
+	int			i;
+
+	MEM(data = talloc_zero(NULL, files_data_t));
+
+	for (i = 0; i < FILES_MAX; i++) {
+		if (getusersfile(data, inst->filename[i], &data->table[i], inst->compat_mode) != 0) {
+			ERROR("Failed reading %s", inst->filename[i]);
+			talloc_free(data);
+			return -1;
+		}
+		if (data->table[i]) *entries += data->table[i]->num_entries;
+	}
+
+	*out = data;
 
 	return 0;
 }
 
+/** Reload the files, or return statistics about them
+ *
+ * Example: "%{files:reload}", "%{files:stats entries}"
+ */
+static ssize_t files_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
+			  void const *mod_inst, UNUSED void const *xlat_inst,
+			  REQUEST *request, char const *fmt)
+{
+	rlm_files_t const *inst = mod_inst;
 
+	return fr_reload_xlat(out, inst->reload, request, fmt);
+}
 
 /*
- *	(Re-)read the "users" file into memory.
+ *	Read the "users" files into memory.
  */
-static int mod_instantiate(UNUSED CONF_SECTION *conf, void *instance)
+static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
-	rlm_files_t *inst = instance;
+	rlm_files_t	*inst = instance;
 
-#undef READFILE
-#define READFILE(_x, _y) do { if (getusersfile(inst, inst->_x, &inst->_y, inst->compat_mode) != 0) { ERROR("Failed reading %s", inst->_x); return -1;} } while (0)
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
 
-	READFILE(filename, common);
-	READFILE(usersfile, users);
-	READFILE(acct_usersfile, acct_users);
+	/*
+	 *	Instance data is read only once we're instantiated,
+	 *	so the reloadable data can't be parented by it.
+	 */
+	inst->reload = fr_reload_create(NULL, inst->name, files_data_load, inst,
+					inst->filename, FILES_MAX, inst->check_interval);
+	if (!inst->reload) return -1;
 
-#ifdef WITH_PROXY
-	READFILE(preproxy_usersfile, preproxy_users);
-	READFILE(postproxy_usersfile, postproxy_users);
-#endif
+	xlat_register(inst, inst->name, files_xlat, NULL, NULL, 0, 0);
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_files_t *inst = instance;
 
-	READFILE(auth_usersfile, auth_users);
-	READFILE(postauth_usersfile, postauth_users);
+	TALLOC_FREE(inst->reload);
 
 	return 0;
 }
@@ -342,16 +700,21 @@ static int mod_instantiate(UNUSED CONF_SECTION *conf, void *instance)
 /*
  *	Common code called by everything below.
  */
-static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char const *filename, rbtree_t *tree,
+static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, files_section_t section,
 			       RADIUS_PACKET *request_packet, RADIUS_PACKET *reply_packet)
 {
-	char const	*name, *match;
+	char const	*name, *match, *filename;
 	VALUE_PAIR	*check_tmp;
 	VALUE_PAIR	*reply_tmp;
 	PAIR_LIST const *user_pl, *default_pl;
 	bool		found = false;
 	PAIR_LIST	my_pl;
 	char		buffer[256];
+	files_data_t const	*data;
+	files_table_t const	*table;
+	uint32_t const	*defaults;
+	uint32_t	num_defaults, i = 0;
+	unsigned int	ref;
 
 	if (!inst->key) {
 		VALUE_PAIR	*namepair;
@@ -369,21 +732,34 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 		name = len ? buffer : "NONE";
 	}
 
-	if (!tree) return RLM_MODULE_NOOP;
+	data = fr_reload_acquire(inst->reload, &ref);
+
+	if (!data->table[section]) section = FILES_COMMON;
+	table = data->table[section];
+	filename = inst->filename[section];
+	if (!table) {
+		fr_reload_release(inst->reload, ref);
+		return RLM_MODULE_NOOP;
+	}
 
 	my_pl.name = name;
-	user_pl = rbtree_finddata(tree, &my_pl);
-	my_pl.name = "DEFAULT";
-	default_pl = rbtree_finddata(tree, &my_pl);
+	user_pl = rbtree_finddata(table->tree, &my_pl);
+
+	/*
+	 *	Only the DEFAULT entries which might match.
+	 */
+	num_defaults = files_defaults(request, &defaults, table, request_packet->vps);
 
 	/*
 	 *	Find the entry for the user.
 	 */
-	while (user_pl || default_pl) {
+	while (user_pl || (i < num_defaults)) {
 		vp_cursor_t cursor;
 		VALUE_PAIR *vp;
 		PAIR_LIST const *pl;
 
+		default_pl = (i < num_defaults) ? table->defaults[defaults[i]] : NULL;
+
 		/*
 		 *	Figure out which entry to match on.
 		 */
@@ -396,7 +772,7 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 		} else if (!user_pl && default_pl) {
 			pl = default_pl;
 			match = "DEFAULT";
-			default_pl = default_pl->next;
+			i++;
 
 		} else if (user_pl->lineno < default_pl->lineno) {
 			pl = user_pl;
@@ -406,7 +782,7 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 		} else {
 			pl = default_pl;
 			match = "DEFAULT";
-			default_pl = default_pl->next;
+			i++;
 		}
 
 		check_tmp = fr_pair_list_copy(request, pl->check);
@@ -437,6 +813,9 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 		}
 	}
 
+	if (defaults != table->unindexed) talloc_const_free(defaults);
+	fr_reload_release(inst->reload, ref);
+
 	/*
 	 *	Remove server internal parameters.
 	 */
@@ -461,11 +840,7 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
  */
 static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_files_t const *inst = instance;
-
-	return file_common(inst, request, inst->filename,
-			   inst->users ? inst->users : inst->common,
-			   request->packet, request->reply);
+	return file_common(instance, request, FILES_AUTHORIZE, request->packet, request->reply);
 }
 
 
@@ -476,49 +851,29 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
  */
 static rlm_rcode_t CC_HINT(nonnull) mod_preacct(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_files_t const *inst = instance;
-
-	return file_common(inst, request, inst->acct_usersfile,
-			   inst->acct_users ? inst->acct_users : inst->common,
-			   request->packet, request->reply);
+	return file_common(instance, request, FILES_PREACCT, request->packet, request->reply);
 }
 
 #ifdef WITH_PROXY
 static rlm_rcode_t CC_HINT(nonnull) mod_pre_proxy(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_files_t const *inst = instance;
-
-	return file_common(inst, request, inst->preproxy_usersfile,
-			   inst->preproxy_users ? inst->preproxy_users : inst->common,
-			   request->packet, request->proxy->packet);
+	return file_common(instance, request, FILES_PRE_PROXY, request->packet, request->proxy->packet);
 }
 
 static rlm_rcode_t CC_HINT(nonnull) mod_post_proxy(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_files_t const *inst = instance;
-
-	return file_common(inst, request, inst->postproxy_usersfile,
-			   inst->postproxy_users ? inst->postproxy_users : inst->common,
-			   request->proxy->reply, request->reply);
+	return file_common(instance, request, FILES_POST_PROXY, request->proxy->reply, request->reply);
 }
 #endif
 
 static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_files_t const *inst = instance;
-
-	return file_common(inst, request, inst->auth_usersfile,
-			   inst->auth_users ? inst->auth_users : inst->common,
-			   request->packet, request->reply);
+	return file_common(instance, request, FILES_AUTHENTICATE, request->packet, request->reply);
 }
 
 static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	rlm_files_t const *inst = instance;
-
-	return file_common(inst, request, inst->postauth_usersfile,
-			   inst->postauth_users ? inst->postauth_users : inst->common,
-			   request->packet, request->reply);
+	return file_common(instance, request, FILES_POST_AUTH, request->packet, request->reply);
 }
 
 
@@ -530,6 +885,7 @@ rad_module_t rlm_files = {
 	.inst_size	= sizeof(rlm_files_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
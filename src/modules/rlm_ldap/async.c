@@ -0,0 +1,592 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file async.c
+ * @brief Asynchronous LDAP searches and binds.
+ *
+ * Each worker thread opens a small number of connections bound as the admin user, and
+ * multiplexes the searches of all the requests it's processing over them.  libldap allows
+ * any number of operations to be outstanding on a handle, and results are matched back
+ * to the operation that produced them using the message ID.
+ *
+ * Binds change the identity of the connection they're sent on, so they can't share a
+ * connection with other operations.  Each thread keeps a free list of connections used
+ * exclusively for user binds, and sends a single bind on each.
+ *
+ * The connection file descriptors are registered with the thread's event list, rather
+ * than the event list of an individual request.  A connection is shared by many requests,
+ * and its registration must outlive any one of them.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_ldap.h"
+
+/** A connection used for asynchronous operations
+ *
+ */
+struct ldap_async_conn {
+	rlm_ldap_thread_t	*thread;		//!< Thread this connection belongs to.
+	ldap_handle_t		*conn;			//!< libldap handle.
+	int			fd;			//!< File descriptor registered with the event list.
+
+	rbtree_t		*ops;			//!< Operations waiting on results, ordered by msgid.
+	uint32_t		refs;			//!< Number of operations using this connection.
+
+	bool			bind;			//!< Connection is used for user binds.
+	bool			dead;			//!< Connection has failed, and should be freed once
+							//!< it's no longer referenced.
+
+	ldap_async_conn_t	*next;			//!< Next idle bind connection.
+};
+
+static void ldap_async_conn_close(ldap_async_conn_t *aconn);
+
+static int ldap_async_op_cmp(void const *one, void const *two)
+{
+	ldap_async_op_t const *a = one, *b = two;
+
+	return (a->msgid > b->msgid) - (a->msgid < b->msgid);
+}
+
+/** Mark an operation as complete, and resume the request that sent it
+ *
+ */
+static void ldap_async_op_complete(ldap_async_op_t *op, ldap_rcode_t status)
+{
+	rbtree_deletebydata(op->aconn->ops, op);
+	if (op->ev) fr_event_timer_delete(op->aconn->thread->el, &op->ev);
+
+	op->status = status;
+	op->complete = true;
+
+	/*
+	 *	A user bind has finished, the connection can
+	 *	be used for another.
+	 */
+	if (op->aconn->bind && !op->aconn->dead) {
+		op->aconn->next = op->aconn->thread->bind_idle;
+		op->aconn->thread->bind_idle = op->aconn;
+	}
+
+	unlang_resumable(op->request);
+}
+
+/** Process a result received on an asynchronous connection
+ *
+ */
+static void ldap_async_op_result(ldap_async_op_t *op, LDAPMessage *result)
+{
+	rlm_ldap_t const	*inst = op->aconn->thread->inst;
+	REQUEST			*request = op->request;
+	ldap_rcode_t		status;
+	char const		*error = NULL;
+	char			*extra = NULL;
+	int			count;
+
+	status = rlm_ldap_result_process(inst, op->conn, LDAP_SUCCESS, op->dn, &result,
+					 false, &error, &extra);
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	/*
+	 *	Invalid DN isn't a failure when searching,
+	 *	it's the same as notfound.
+	 */
+	case LDAP_PROC_BAD_DN:
+		if (op->search) {
+			RDEBUG("%s", error);
+			if (extra) RDEBUG("%s", extra);
+			break;
+		}
+		/* FALL-THROUGH */
+
+	default:
+		REDEBUG("%s failed: %s", op->search ? "Search" : "Bind", error);
+		if (extra) REDEBUG("%s", extra);
+		break;
+	}
+	talloc_free(extra);
+
+	if ((status == LDAP_PROC_SUCCESS) && op->search) {
+		count = ldap_count_entries(op->conn->handle, result);
+		if (count < 0) {
+			REDEBUG("Error counting results: %s", rlm_ldap_error_str(op->conn));
+			status = LDAP_PROC_ERROR;
+		} else if (count == 0) {
+			RDEBUG("Search returned no results");
+			status = LDAP_PROC_NO_RESULT;
+		} else {
+			op->result = result;
+			result = NULL;
+		}
+	}
+	if (result) ldap_msgfree(result);
+
+	ldap_async_op_complete(op, status);
+}
+
+/** Read all the results available on a connection, and match them to their operations
+ *
+ */
+static void _ldap_async_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	ldap_async_conn_t	*aconn = talloc_get_type_abort(ctx, ldap_async_conn_t);
+	struct timeval		poll = { 0, 0 };
+	LDAPMessage		*result;
+	ldap_async_op_t		find, *op;
+	int			ret;
+
+	for (;;) {
+		result = NULL;
+		ret = ldap_result(aconn->conn->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &poll, &result);
+		if (ret == 0) return;		/* Nothing more to read */
+		if (ret < 0) {
+			ERROR("Failed reading result from %s: %s", aconn->conn->pool_inst->server,
+			      rlm_ldap_error_str(aconn->conn));
+			ldap_async_conn_close(aconn);
+			return;
+		}
+
+		find.msgid = ldap_msgid(result);
+		op = rbtree_finddata(aconn->ops, &find);
+		if (!op) {
+			/*
+			 *	Operation was cancelled or timed out,
+			 *	and its result arrived anyway.
+			 */
+			DEBUG3("Discarding result for unknown msgid %i", find.msgid);
+			ldap_msgfree(result);
+			continue;
+		}
+
+		ldap_async_op_result(op, result);
+
+		/*
+		 *	If the connection was a bind connection, the
+		 *	result was the only one we were waiting for.
+		 */
+		if (aconn->bind) return;
+	}
+}
+
+static void _ldap_async_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	ldap_async_conn_t *aconn = talloc_get_type_abort(ctx, ldap_async_conn_t);
+
+	ERROR("Connection to %s failed", aconn->conn->pool_inst->server);
+	ldap_async_conn_close(aconn);
+}
+
+static int _ldap_async_conn_fail_op(UNUSED void *ctx, void *data)
+{
+	ldap_async_op_t *op = data;
+
+	op->status = LDAP_PROC_ERROR;
+	op->complete = true;
+	if (op->ev) fr_event_timer_delete(op->aconn->thread->el, &op->ev);
+
+	unlang_resumable(op->request);
+
+	return 0;
+}
+
+/** Fail all the operations on a connection, and stop using it
+ *
+ * The connection is freed once all the operations that were sent on it have been freed.
+ */
+static void ldap_async_conn_close(ldap_async_conn_t *aconn)
+{
+	rlm_ldap_thread_t	*t = aconn->thread;
+	ldap_async_conn_t	**last;
+	uint32_t		i;
+
+	if (aconn->dead) return;
+	aconn->dead = true;
+
+	fr_event_fd_delete(t->el, aconn->fd);
+	aconn->fd = -1;
+
+	if (aconn->bind) {
+		for (last = &t->bind_idle; *last; last = &(*last)->next) {
+			if (*last != aconn) continue;
+
+			*last = aconn->next;
+			break;
+		}
+	} else {
+		for (i = 0; i < t->inst->async_connections; i++) {
+			if (t->conn[i] == aconn) t->conn[i] = NULL;
+		}
+	}
+
+	/*
+	 *	The operations stay in the tree so we don't
+	 *	need to worry about modifying it whilst walking
+	 *	it.  The tree is freed with the connection.
+	 */
+	rbtree_walk(aconn->ops, RBTREE_IN_ORDER, _ldap_async_conn_fail_op, NULL);
+
+	if (aconn->refs == 0) talloc_free(aconn);
+}
+
+static int _ldap_async_conn_free(ldap_async_conn_t *aconn)
+{
+	if (aconn->fd >= 0) fr_event_fd_delete(aconn->thread->el, aconn->fd);
+
+	return 0;
+}
+
+/** Open a new connection for asynchronous operations
+ *
+ * The connection is established, and bound as the admin user, synchronously.
+ *
+ * @param[in] t		Thread the connection belongs to.
+ * @param[in] bind	Whether the connection will be used for user binds.
+ * @return
+ *	- New connection.
+ *	- NULL on error.
+ */
+static ldap_async_conn_t *ldap_async_conn_alloc(rlm_ldap_thread_t *t, bool bind)
+{
+	ldap_async_conn_t	*aconn;
+	struct timeval		timeout;
+
+	timeout = fr_connection_pool_timeout(t->inst->pool);
+
+	MEM(aconn = talloc_zero(t->ctx, ldap_async_conn_t));
+	aconn->thread = t;
+	aconn->bind = bind;
+	aconn->fd = -1;
+	MEM(aconn->ops = rbtree_create(aconn, ldap_async_op_cmp, NULL, 0));
+
+	aconn->conn = mod_conn_create(aconn, t->inst, &timeout);
+	if (!aconn->conn) {
+	error:
+		talloc_free(aconn);
+		return NULL;
+	}
+
+	if ((ldap_get_option(aconn->conn->handle, LDAP_OPT_DESC, &aconn->fd) != LDAP_OPT_SUCCESS) ||
+	    (aconn->fd < 0)) {
+		ERROR("Failed retrieving file descriptor from libldap handle");
+		aconn->fd = -1;
+		goto error;
+	}
+
+	if (fr_event_fd_insert(t->el, aconn->fd, _ldap_async_conn_readable, NULL,
+			       _ldap_async_conn_error, aconn) < 0) {
+		ERROR("Failed registering LDAP connection with event loop: %s", fr_strerror());
+		aconn->fd = -1;
+		goto error;
+	}
+	talloc_set_destructor(aconn, _ldap_async_conn_free);
+
+	return aconn;
+}
+
+/** Stop waiting for an operation's result
+ *
+ */
+static int _ldap_async_op_free(ldap_async_op_t *op)
+{
+	ldap_async_conn_t *aconn = op->aconn;
+
+	if (op->result) ldap_msgfree(op->result);
+	if (op->ev) fr_event_timer_delete(aconn->thread->el, &op->ev);
+
+	if (!op->complete) {
+		rbtree_deletebydata(aconn->ops, op);
+		(void) ldap_abandon_ext(aconn->conn->handle, op->msgid, NULL, NULL);
+
+		/*
+		 *	We don't know what state the bind was
+		 *	left in, so the connection can't be reused.
+		 */
+		if (aconn->bind) ldap_async_conn_close(aconn);
+	}
+
+	if ((--aconn->refs == 0) && aconn->dead) talloc_free(aconn);
+
+	return 0;
+}
+
+/** Give up waiting for a result
+ *
+ */
+static void _ldap_async_op_timeout(UNUSED struct timeval *now, void *ctx)
+{
+	ldap_async_op_t		*op = talloc_get_type_abort(ctx, ldap_async_op_t);
+	REQUEST			*request = op->request;
+	ldap_async_conn_t	*aconn = op->aconn;
+
+	op->ev = NULL;
+
+	REDEBUG("Timed out while waiting for server to respond");
+	trigger_exec(NULL, aconn->thread->inst->cs, "modules.ldap.timeout", true, NULL);
+
+	rbtree_deletebydata(aconn->ops, op);
+	(void) ldap_abandon_ext(aconn->conn->handle, op->msgid, NULL, NULL);
+
+	op->status = LDAP_PROC_ERROR;
+	op->complete = true;
+
+	if (aconn->bind) ldap_async_conn_close(aconn);
+
+	unlang_resumable(request);
+}
+
+/** Start tracking an operation that's been sent
+ *
+ */
+static ldap_async_op_t *ldap_async_op_alloc(TALLOC_CTX *ctx, ldap_async_conn_t *aconn, REQUEST *request,
+					    char const *dn, int msgid, bool search)
+{
+	ldap_async_op_t	*op;
+	struct timeval	when;
+
+	MEM(op = talloc_zero(ctx, ldap_async_op_t));
+	op->aconn = aconn;
+	op->conn = aconn->conn;
+	op->request = request;
+	op->msgid = msgid;
+	op->search = search;
+	op->status = LDAP_PROC_ERROR;
+	MEM(op->dn = talloc_typed_strdup(op, dn ? dn : ""));
+
+	gettimeofday(&when, NULL);
+	when.tv_sec += aconn->thread->inst->res_timeout;
+	if (fr_event_timer_insert(aconn->thread->el, _ldap_async_op_timeout, op, &when, &op->ev) < 0) {
+		REDEBUG("Failed inserting result timeout: %s", fr_strerror());
+		talloc_free(op);
+		return NULL;
+	}
+
+	if (!rbtree_insert(aconn->ops, op)) {
+		REDEBUG("Duplicate msgid %i", msgid);
+		fr_event_timer_delete(aconn->thread->el, &op->ev);
+		talloc_free(op);
+		return NULL;
+	}
+	aconn->refs++;
+	talloc_set_destructor(op, _ldap_async_op_free);
+
+	return op;
+}
+
+/** Send a search without waiting for the result
+ *
+ * When the operation completes the request is marked as resumable.  The caller should
+ * yield, and check op->status in its resume function.  If op->status is LDAP_PROC_SUCCESS,
+ * op->result contains at least one entry.  The result is freed with the operation.
+ *
+ * Freeing the operation before it completes abandons it.
+ *
+ * @param[in] ctx		to allocate the operation in.
+ * @param[in] t			Thread specific data.
+ * @param[in] request		Current request.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.
+ * @param[in] serverctrls	Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Search controls for ldap_search.  May be NULL.
+ * @return
+ *	- The operation.
+ *	- NULL if the search couldn't be sent.
+ */
+ldap_async_op_t *rlm_ldap_async_search(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				       char const *dn, int scope, char const *filter, char const * const *attrs,
+				       LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	ldap_async_conn_t	*aconn;
+	ldap_async_op_t		*op;
+	uint32_t		i;
+	int			msgid, ret;
+	struct timeval		tv;
+	char			**search_attrs;
+
+	LDAPControl		*our_serverctrls[LDAP_MAX_CONTROLS];
+	LDAPControl		*our_clientctrls[LDAP_MAX_CONTROLS];
+
+	/*
+	 *	Round robin over the thread's connections,
+	 *	replacing any which have failed.
+	 */
+	i = t->conn_next++ % inst->async_connections;
+	if (!t->conn[i]) {
+		t->conn[i] = ldap_async_conn_alloc(t, false);
+		if (!t->conn[i]) {
+			REDEBUG("Failed opening connection to %s", inst->pool_inst.server);
+			return NULL;
+		}
+	}
+	aconn = t->conn[i];
+
+	rlm_ldap_control_merge(our_serverctrls, our_clientctrls,
+			       sizeof(our_serverctrls) / sizeof(*our_serverctrls),
+			       sizeof(our_clientctrls) / sizeof(*our_clientctrls),
+			       aconn->conn, serverctrls, clientctrls);
+
+	/*
+	 *	OpenLDAP library doesn't declare attrs array as const, but
+	 *	it really should be *sigh*.
+	 */
+	memcpy(&search_attrs, &attrs, sizeof(attrs));
+
+	if (filter) {
+		RDEBUG("Sending search in \"%s\" with filter \"%s\", scope \"%s\"", dn, filter,
+		       fr_int2str(ldap_scope, scope, "<INVALID>"));
+	} else {
+		RDEBUG("Sending unfiltered search in \"%s\", scope \"%s\"", dn,
+		       fr_int2str(ldap_scope, scope, "<INVALID>"));
+	}
+
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = inst->res_timeout;
+
+	ret = ldap_search_ext(aconn->conn->handle, dn, scope, filter, search_attrs,
+			      0, our_serverctrls, our_clientctrls, &tv, 0, &msgid);
+	if (ret != LDAP_SUCCESS) {
+		REDEBUG("Failed sending search: %s", ldap_err2string(ret));
+		if ((ret == LDAP_SERVER_DOWN) || (ret == LDAP_UNAVAILABLE)) ldap_async_conn_close(aconn);
+		return NULL;
+	}
+
+	op = ldap_async_op_alloc(ctx, aconn, request, dn, msgid, true);
+	if (!op) {
+		(void) ldap_abandon_ext(aconn->conn->handle, msgid, NULL, NULL);
+		return NULL;
+	}
+
+	return op;
+}
+
+/** Send a simple bind without waiting for the result
+ *
+ * When the operation completes the request is marked as resumable.  The caller should
+ * yield, and check op->status in its resume function.
+ *
+ * Freeing the operation before it completes abandons it.
+ *
+ * @param[in] ctx		to allocate the operation in.
+ * @param[in] t			Thread specific data.
+ * @param[in] request		Current request.
+ * @param[in] dn		of the user.
+ * @param[in] password		of the user.
+ * @return
+ *	- The operation.
+ *	- NULL if the bind couldn't be sent.
+ */
+ldap_async_op_t *rlm_ldap_async_bind(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				     char const *dn, char const *password)
+{
+	ldap_async_conn_t	*aconn;
+	ldap_async_op_t		*op;
+	int			msgid, ret;
+	struct berval		cred;
+
+	LDAPControl		*our_serverctrls[LDAP_MAX_CONTROLS];
+	LDAPControl		*our_clientctrls[LDAP_MAX_CONTROLS];
+
+	aconn = t->bind_idle;
+	if (aconn) {
+		t->bind_idle = aconn->next;
+		aconn->next = NULL;
+	} else {
+		aconn = ldap_async_conn_alloc(t, true);
+		if (!aconn) {
+			REDEBUG("Failed opening connection to %s", t->inst->pool_inst.server);
+			return NULL;
+		}
+	}
+
+	rlm_ldap_control_merge(our_serverctrls, our_clientctrls,
+			       sizeof(our_serverctrls) / sizeof(*our_serverctrls),
+			       sizeof(our_clientctrls) / sizeof(*our_clientctrls),
+			       aconn->conn, NULL, NULL);
+
+	if (password) {
+		memcpy(&cred.bv_val, &password, sizeof(cred.bv_val));
+		cred.bv_len = talloc_array_length(password) - 1;
+	} else {
+		cred.bv_val = NULL;
+		cred.bv_len = 0;
+	}
+
+	RDEBUG("Sending bind as \"%s\"", dn);
+
+	/*
+	 *	The connection is now bound as something
+	 *	other than the admin user.
+	 */
+	aconn->conn->rebound = true;
+
+	ret = ldap_sasl_bind(aconn->conn->handle, dn, LDAP_SASL_SIMPLE, &cred,
+			     our_serverctrls, our_clientctrls, &msgid);
+	if (ret != LDAP_SUCCESS) {
+		REDEBUG("Failed sending bind: %s", ldap_err2string(ret));
+	error:
+		ldap_async_conn_close(aconn);
+		return NULL;
+	}
+
+	op = ldap_async_op_alloc(ctx, aconn, request, dn, msgid, false);
+	if (!op) goto error;
+
+	return op;
+}
+
+/** Free any connections opened by this thread
+ *
+ * @param[in] t		Thread specific data.
+ */
+void rlm_ldap_async_thread_free(rlm_ldap_thread_t *t)
+{
+	TALLOC_FREE(t->ctx);
+	t->conn = NULL;
+	t->bind_idle = NULL;
+}
+
+/** Initialise the thread specific data used for asynchronous operations
+ *
+ * Connections are opened when they're first needed.
+ *
+ * @param[in] t		Thread specific data to initialise.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] el	Event list to register connections with.
+ * @return 0
+ */
+int rlm_ldap_async_thread_init(rlm_ldap_thread_t *t, rlm_ldap_t *inst, fr_event_list_t *el)
+{
+	t->inst = inst;
+	t->el = el;
+	MEM(t->ctx = talloc_named_const(t, 0, "rlm_ldap_async"));
+	MEM(t->conn = talloc_zero_array(t->ctx, ldap_async_conn_t *, inst->async_connections));
+	t->conn_next = 0;
+	t->bind_idle = NULL;
+
+	return 0;
+}
@@ -25,6 +25,7 @@
  * @copyright 2013-2015 The FreeRADIUS Server Project.
  */
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/heap.h>
 #include <ctype.h>
 
 #define LOG_PREFIX "rlm_ldap (%s) - "
@@ -32,6 +33,333 @@
 
 #include "rlm_ldap.h"
 
+/** An entry in the group cache
+ *
+ */
+typedef struct ldap_group_cache_entry {
+	uint8_t			*key;		//!< Entry type, followed by the DNs or names it relates to.
+	size_t			key_len;	//!< Length of the key.
+
+	time_t			expires;	//!< When the entry should be discarded.
+	size_t			heap_id;	//!< Offset used for heap.
+
+	bool			found;		//!< Whether this is a positive or a negative entry.
+	char			*name;		//!< Group name for DN to name entries.
+} ldap_group_cache_entry_t;
+
+/** Membership and group DN to name mappings, shared between all threads
+ *
+ */
+struct ldap_group_cache {
+	rbtree_t		*tree;		//!< Entries indexed by key.
+	fr_heap_t		*heap;		//!< Entries ordered by expiry time.
+
+	char			*csn;		//!< Last contextCSN value retrieved from the directory.
+	time_t			csn_check;	//!< When we should next retrieve the contextCSN.
+	bool			csn_unavailable;	//!< Directory doesn't publish a contextCSN.
+
+	pthread_mutex_t		mutex;		//!< Protects all of the above.
+};
+
+#define GROUP_CACHE_MEMBER	'M'		//!< User DN and group name or DN to membership.
+#define GROUP_CACHE_DN2NAME	'N'		//!< Group DN to group name.
+
+static int group_cache_entry_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static int group_cache_heap_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+
+	return (a->expires > b->expires) - (a->expires < b->expires);
+}
+
+/** Build a cache key
+ *
+ * @return the length of the key, or 0 if the key wouldn't fit in the buffer.
+ */
+static size_t group_cache_key(uint8_t *out, size_t outlen, char type, char const *a, char const *b)
+{
+	size_t a_len = strlen(a), b_len = b ? strlen(b) : 0;
+
+	if ((2 + a_len + b_len) > outlen) return 0;
+
+	out[0] = type;
+	memcpy(out + 1, a, a_len + 1);
+	if (b) memcpy(out + 2 + a_len, b, b_len);
+
+	return 2 + a_len + b_len;
+}
+
+static void group_cache_entry_remove(ldap_group_cache_t *cache, ldap_group_cache_entry_t *c)
+{
+	fr_heap_extract(cache->heap, c);
+	rbtree_deletebydata(cache->tree, c);
+	talloc_free(c);
+}
+
+/** Find an unexpired entry, discarding any entries which have expired
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static ldap_group_cache_entry_t *group_cache_find(ldap_group_cache_t *cache, uint8_t const *key, size_t key_len,
+						  time_t now)
+{
+	ldap_group_cache_entry_t *c, find;
+
+	while ((c = fr_heap_peek(cache->heap)) && (c->expires <= now)) group_cache_entry_remove(cache, c);
+
+	memcpy(&find.key, &key, sizeof(find.key));
+	find.key_len = key_len;
+
+	return rbtree_finddata(cache->tree, &find);
+}
+
+/** Add or replace an entry, evicting the entry closest to expiry if the cache is full
+ *
+ */
+static void group_cache_insert(rlm_ldap_t const *inst, uint8_t const *key, size_t key_len,
+			       bool found, char const *name, time_t now)
+{
+	ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	*c;
+	uint32_t			ttl = found ? inst->group_cache_ttl : inst->group_cache_negative_ttl;
+
+	if (!ttl) return;
+
+	pthread_mutex_lock(&cache->mutex);
+	c = group_cache_find(cache, key, key_len, now);
+	if (c) group_cache_entry_remove(cache, c);
+
+	if (inst->group_cache_max_entries && (rbtree_num_elements(cache->tree) >= inst->group_cache_max_entries)) {
+		group_cache_entry_remove(cache, fr_heap_peek(cache->heap));
+	}
+
+	MEM(c = talloc_zero(cache, ldap_group_cache_entry_t));
+	MEM(c->key = talloc_memdup(c, key, key_len));
+	c->key_len = key_len;
+	c->expires = now + ttl;
+	c->found = found;
+	if (name) MEM(c->name = talloc_typed_strdup(c, name));
+
+	if (!rbtree_insert(cache->tree, c) || (fr_heap_insert(cache->heap, c) < 0)) {
+		rbtree_deletebydata(cache->tree, c);
+		talloc_free(c);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static int _group_cache_entry_free(void *ctx, void *data)
+{
+	ldap_group_cache_t *cache = ctx;
+
+	fr_heap_extract(cache->heap, data);
+	talloc_free(data);
+
+	return 2;
+}
+
+/** Discard all cached memberships and mappings
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void group_cache_flush(ldap_group_cache_t *cache)
+{
+	rbtree_walk(cache->tree, RBTREE_DELETE_ORDER, _group_cache_entry_free, cache);
+}
+
+/** Flush the cache if the directory has changed since we last checked
+ *
+ * Retrieves the contextCSN (the change sequence number syncrepl uses as its
+ * cookie) from group.membership_cache.sync_dn.  If it differs from the last
+ * value we saw, something in the directory changed and the cache is flushed.
+ *
+ * Only one thread performs the check each sync_interval.  If the directory
+ * doesn't publish a contextCSN, entries are only expired by their TTL.
+ */
+static void group_cache_sync(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn, time_t now)
+{
+	ldap_group_cache_t	*cache = inst->group_cache;
+	ldap_rcode_t		status;
+	char const		*attrs[] = { "contextCSN", NULL };
+	LDAPMessage		*result = NULL, *entry;
+	struct berval		**values = NULL;
+	char			*csn = NULL;
+	int			i, count;
+
+	if (!inst->group_cache_sync_dn) return;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (cache->csn_unavailable || (now < cache->csn_check)) {
+		pthread_mutex_unlock(&cache->mutex);
+		return;
+	}
+	cache->csn_check = now + inst->group_cache_sync_interval;
+	pthread_mutex_unlock(&cache->mutex);
+
+	RDEBUG2("Checking for directory changes");
+	RINDENT();
+	status = rlm_ldap_search(&result, inst, request, pconn, inst->group_cache_sync_dn, LDAP_SCOPE_BASE,
+				 NULL, attrs, NULL, NULL);
+	REXDENT();
+	if (status != LDAP_PROC_SUCCESS) goto finish;	/* Try again next interval */
+
+	entry = ldap_first_entry((*pconn)->handle, result);
+	if (entry) values = ldap_get_values_len((*pconn)->handle, entry, "contextCSN");
+	if (!values) {
+		RWDEBUG("No contextCSN found in \"%s\", group cache entries will only be expired by TTL",
+			inst->group_cache_sync_dn);
+
+		pthread_mutex_lock(&cache->mutex);
+		cache->csn_unavailable = true;
+		pthread_mutex_unlock(&cache->mutex);
+		goto finish;
+	}
+
+	/*
+	 *	There's one contextCSN per server in
+	 *	multi-master deployments.
+	 */
+	MEM(csn = talloc_zero_array(NULL, char, 1));
+	count = ldap_count_values_len(values);
+	for (i = 0; i < count; i++) {
+		MEM(csn = talloc_asprintf_append_buffer(csn, "%.*s;", (int)values[i]->bv_len, values[i]->bv_val));
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	if (cache->csn && (strcmp(cache->csn, csn) != 0)) {
+		RDEBUG("Directory has changed, flushing group cache");
+		group_cache_flush(cache);
+	}
+	talloc_free(cache->csn);
+	cache->csn = talloc_steal(cache, csn);
+	pthread_mutex_unlock(&cache->mutex);
+
+finish:
+	if (values) ldap_value_free_len(values);
+	if (result) ldap_msgfree(result);
+}
+
+/** Check whether we have a cached result for a group membership check
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] user_dn of the user.
+ * @param[in] check vp containing the group value (name or dn).
+ * @return
+ *	- RLM_MODULE_OK if the user is a member of the group.
+ *	- RLM_MODULE_NOTFOUND if the user is not a member of the group.
+ *	- RLM_MODULE_NOOP if there's no cached result.
+ *	- RLM_MODULE_FAIL if we lost the connection checking for directory changes.
+ */
+rlm_rcode_t rlm_ldap_group_cache_check(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+				       char const *user_dn, VALUE_PAIR const *check)
+{
+	ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	*c;
+	uint8_t				key[(LDAP_MAX_DN_STR_LEN * 2) + 2];
+	size_t				key_len;
+	time_t				now = request->packet->timestamp.tv_sec;
+	rlm_rcode_t			rcode = RLM_MODULE_NOOP;
+
+	if (!cache) return RLM_MODULE_NOOP;
+
+	group_cache_sync(inst, request, pconn, now);
+	if (!*pconn) return RLM_MODULE_FAIL;
+
+	key_len = group_cache_key(key, sizeof(key), GROUP_CACHE_MEMBER, user_dn, check->vp_strvalue);
+	if (!key_len) return RLM_MODULE_NOOP;
+
+	pthread_mutex_lock(&cache->mutex);
+	c = group_cache_find(cache, key, key_len, now);
+	if (c) rcode = c->found ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND;
+	pthread_mutex_unlock(&cache->mutex);
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		RDEBUG("User found in group \"%s\". Matched cached membership", check->vp_strvalue);
+		break;
+
+	case RLM_MODULE_NOTFOUND:
+		RDEBUG("User not found in group \"%s\". Matched cached non-membership", check->vp_strvalue);
+		break;
+
+	default:
+		break;
+	}
+
+	return rcode;
+}
+
+/** Record the result of a group membership check
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] user_dn of the user.
+ * @param[in] check vp containing the group value (name or dn).
+ * @param[in] found Whether the user is a member of the group.
+ */
+void rlm_ldap_group_cache_add(rlm_ldap_t const *inst, REQUEST *request, char const *user_dn,
+			      VALUE_PAIR const *check, bool found)
+{
+	uint8_t	key[(LDAP_MAX_DN_STR_LEN * 2) + 2];
+	size_t	key_len;
+
+	if (!inst->group_cache) return;
+
+	key_len = group_cache_key(key, sizeof(key), GROUP_CACHE_MEMBER, user_dn, check->vp_strvalue);
+	if (!key_len) return;
+
+	group_cache_insert(inst, key, key_len, found, NULL, request->packet->timestamp.tv_sec);
+}
+
+static int _group_cache_free(ldap_group_cache_t *cache)
+{
+	group_cache_flush(cache);
+	fr_heap_delete(cache->heap);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate the group cache, if it's enabled
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst)
+{
+	ldap_group_cache_t *cache;
+
+	if (!inst->group_cache_ttl) return 0;
+
+	MEM(cache = talloc_zero(inst, ldap_group_cache_t));
+	MEM(cache->tree = rbtree_create(cache, group_cache_entry_cmp, NULL, 0));
+	MEM(cache->heap = fr_heap_create(group_cache_heap_cmp, offsetof(ldap_group_cache_entry_t, heap_id)));
+
+	if (pthread_mutex_init(&cache->mutex, NULL) < 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		fr_heap_delete(cache->heap);
+		talloc_free(cache);
+		return -1;
+	}
+	talloc_set_destructor(cache, _group_cache_free);
+
+	inst->group_cache = cache;
+
+	return 0;
+}
+
 /** Convert multiple group names into a DNs
  *
  * Given an array of group names, builds a filter matching all names, then retrieves all group objects
@@ -203,6 +531,9 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 	LDAPMessage *result = NULL, *entry;
 
+	uint8_t key[LDAP_MAX_DN_STR_LEN + 2];
+	size_t key_len = 0;
+
 	*out = NULL;
 
 	if (!inst->groupobj_name_attr) {
@@ -211,6 +542,30 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 		return RLM_MODULE_INVALID;
 	}
 
+	if (inst->group_cache) {
+		ldap_group_cache_entry_t *c;
+
+		key_len = group_cache_key(key, sizeof(key), GROUP_CACHE_DN2NAME, dn, NULL);
+		if (key_len) {
+			pthread_mutex_lock(&inst->group_cache->mutex);
+			c = group_cache_find(inst->group_cache, key, key_len, request->packet->timestamp.tv_sec);
+			if (c) {
+				if (c->found) *out = talloc_typed_strdup(request, c->name);
+				rcode = c->found ? RLM_MODULE_OK : RLM_MODULE_INVALID;
+			}
+			pthread_mutex_unlock(&inst->group_cache->mutex);
+
+			if (c) {
+				if (*out) {
+					RDEBUG("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, *out);
+				} else {
+					REDEBUG("Group DN \"%s\" did not resolve to an object (cached)", dn);
+				}
+				return rcode;
+			}
+		}
+	}
+
 	RDEBUG("Resolving group DN \"%s\" to group name", dn);
 
 	status = rlm_ldap_search(&result, inst, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
@@ -220,6 +575,7 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 
 	case LDAP_PROC_NO_RESULT:
 		REDEBUG("Group DN \"%s\" did not resolve to an object", dn);
+		if (key_len) group_cache_insert(inst, key, key_len, false, NULL, request->packet->timestamp.tv_sec);
 		return RLM_MODULE_INVALID;
 
 	default:
@@ -246,6 +602,7 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 
 	*out = rlm_ldap_berval_to_string(request, values[0]);
 	RDEBUG("Group DN \"%s\" resolves to name \"%s\"", dn, *out);
+	if (key_len) group_cache_insert(inst, key, key_len, true, *out, request->packet->timestamp.tv_sec);
 
 finish:
 	if (result) ldap_msgfree(result);
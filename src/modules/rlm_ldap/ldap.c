@@ -35,11 +35,14 @@
 
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
+#include <freeradius-devel/escape.h>
 #include "rlm_ldap.h"
 
 static const char specials[] = ",+\"\\<>;*=()";
 static const char hextab[] = "0123456789abcdef";
 
+static fr_escape_t ldap_escape;		//!< Built from specials by rlm_ldap_escape_init().
+
 FR_NAME_NUMBER const ldap_supported_extensions[] = {
 	{ "bindname",	LDAP_DEREF_NEVER	},
 	{ "x-bindpw",	LDAP_DEREF_SEARCHING	},
@@ -130,43 +133,40 @@ void rlm_ldap_timeout_debug(rlm_ldap_t const *inst, REQUEST *request, ldap_handl
  */
 size_t rlm_ldap_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
 {
+	size_t len = 0;
 
-	size_t left = outlen;
-
-	if (*in && ((*in == ' ') || (*in == '#'))) goto encode;
+	if (!outlen) return 0;
 
-	while (*in) {
+	/*
+	 *	A leading space or hash has a special meaning in DNs,
+	 *	so is encoded, even though it's safe elsewhere.
+	 */
+	if ((*in == ' ') || (*in == '#')) {
 		/*
-		 *	Encode unsafe characters.
+		 *	Only 3 or less bytes available.
 		 */
-		if (memchr(specials, *in, sizeof(specials) - 1)) {
-		encode:
-			/*
-			 *	Only 3 or less bytes available.
-			 */
-			if (left <= 3) break;
-
-			*out++ = '\\';
-			*out++ = hextab[(*in >> 4) & 0x0f];
-			*out++ = hextab[*in & 0x0f];
-			in++;
-			left -= 3;
-
-			continue;
+		if (outlen <= 3) {
+			*out = '\0';
+			return 0;
 		}
 
-		if (left <= 1) break;
-
-		/*
-		 *	Doesn't need encoding
-		 */
-		*out++ = *in++;
-		left--;
+		out[0] = '\\';
+		out[1] = hextab[(*in >> 4) & 0x0f];
+		out[2] = hextab[*in & 0x0f];
+		in++;
+		len = 3;
 	}
 
-	*out = '\0';
+	return len + fr_escape(&ldap_escape, out + len, outlen - len, in, -1);
+}
 
-	return outlen - left;
+/** Build the table used by #rlm_ldap_escape_func
+ *
+ * Must be called before any strings are escaped.
+ */
+void rlm_ldap_escape_init(void)
+{
+	fr_escape_init(&ldap_escape, specials, '\\', FR_ESCAPE_FLAG_SPECIALS | FR_ESCAPE_FLAG_LOWER);
 }
 
 /** Converts escaped DNs and filter strings into normal
@@ -550,38 +550,39 @@ char const *rlm_ldap_error_str(ldap_handle_t const *conn)
 	return ldap_err2string(lib_errno);
 }
 
-/** Parse response from LDAP server dealing with any errors
+/** Process a result received from an LDAP server, or an error that occurred retrieving it
  *
- * Should be called after an LDAP operation. Will check result of operation
- * and if it was successful, then attempt to retrieve and parse the result.
+ * Maps the library and server error codes to one of the LDAP_PROC_* values, and
+ * produces extended error output including any messages the server sent, and
+ * information about partial DN matches.
  *
- * Will also produce extended error output including any messages the server
- * sent, and information about partial DN matches.
+ * This is used by #rlm_ldap_result, and by the asynchronous code, which receives
+ * results from the event loop instead of waiting for them.
  *
  * @param[in] inst	of LDAP module.
- * @param[in] conn	Current connection.
- * @param[in] msgid	returned from last operation. May be -1 if no result
- *			processing is required.
+ * @param[in] conn	the result was received on.
+ * @param[in] lib_errno	error that occurred sending the operation or receiving the result.
+ *			If this isn't LDAP_SUCCESS, *result is not parsed.
  * @param[in] dn	Last search or bind DN.
- * @param[in] timeout	Override the default result timeout.
- * @param[out] result	Where to write result, if NULL result will be freed.
+ * @param[in,out] result	to parse.  Will be freed and set to NULL if freeit is true,
+ *			or the operation failed.
+ * @param[in] freeit	Free the result after it has been parsed.
  * @param[out] error	Where to write the error string, may be NULL, must
  *			not be freed.
  * @param[out] extra	Where to write additional error string to, may be NULL
  *			(faster) or must be freed (with talloc_free).
  * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
  */
-ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst,
-			     ldap_handle_t const *conn,
-			     int msgid,
-			     char const *dn,
-			     struct timeval const *timeout,
-			     LDAPMessage **result,
-			     char const **error, char **extra)
+ldap_rcode_t rlm_ldap_result_process(rlm_ldap_t const *inst,
+				     ldap_handle_t const *conn,
+				     int lib_errno,
+				     char const *dn,
+				     LDAPMessage **result,
+				     bool freeit,
+				     char const **error, char **extra)
 {
 	ldap_rcode_t status = LDAP_PROC_SUCCESS;
 
-	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
 	int srv_errno = LDAP_SUCCESS;	// errno in the result message.
 
 	char *part_dn = NULL;		// Partial DN match.
@@ -589,59 +590,16 @@ ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst,
 	char *srv_err = NULL;		// Server's extended error message.
 	char *p, *a;
 
-	bool freeit = false;		// Whether the message should be freed after being processed.
 	int len;
 
-	struct timeval tv;		// Holds timeout values.
-
-	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
-
 	char const *tmp_err;		// Temporary error pointer storage if we weren't provided with one.
 
 	if (!error) error = &tmp_err;
 	*error = NULL;
 
 	if (extra) *extra = NULL;
-	if (result) *result = NULL;
-
-	/*
-	 *	We always need the result, but our caller may not
-	 */
-	if (!result) {
-		result = &tmp_msg;
-		freeit = true;
-	}
 
-	/*
-	 *	Check if there was an error sending the request
-	 */
-	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
 	if (lib_errno != LDAP_SUCCESS) goto process_error;
-	if (msgid < 0) return LDAP_SUCCESS;	/* No msgid and no error, return now */
-
-	if (!timeout) {
-		tv.tv_sec = inst->res_timeout;
-		tv.tv_usec = 0;
-	} else {
-		tv = *timeout;
-	}
-
-	/*
-	 *	Now retrieve the result and check for errors
-	 *	ldap_result returns -1 on failure, and 0 on timeout
-	 */
-	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
-	if (lib_errno == 0) {
-		lib_errno = LDAP_TIMEOUT;
-
-		goto process_error;
-	}
-
-	if (lib_errno == -1) {
-		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
-
-		goto process_error;
-	}
 
 	/*
 	 *	Parse the result and check for errors sent by the server
@@ -653,10 +611,7 @@ ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst,
 				      NULL, NULL, freeit);
 	if (freeit) *result = NULL;
 
-	if (lib_errno != LDAP_SUCCESS) {
-		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
-		goto process_error;
-	}
+	if (lib_errno != LDAP_SUCCESS) ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
 
 process_error:
 	if ((lib_errno == LDAP_SUCCESS) && (srv_errno != LDAP_SUCCESS)) {
@@ -798,6 +753,86 @@ process_error:
 	return status;
 }
 
+/** Parse response from LDAP server dealing with any errors
+ *
+ * Should be called after an LDAP operation. Will check result of operation
+ * and if it was successful, then attempt to retrieve and parse the result.
+ *
+ * Will also produce extended error output including any messages the server
+ * sent, and information about partial DN matches.
+ *
+ * @param[in] inst	of LDAP module.
+ * @param[in] conn	Current connection.
+ * @param[in] msgid	returned from last operation. May be -1 if no result
+ *			processing is required.
+ * @param[in] dn	Last search or bind DN.
+ * @param[in] timeout	Override the default result timeout.
+ * @param[out] result	Where to write result, if NULL result will be freed.
+ * @param[out] error	Where to write the error string, may be NULL, must
+ *			not be freed.
+ * @param[out] extra	Where to write additional error string to, may be NULL
+ *			(faster) or must be freed (with talloc_free).
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst,
+			     ldap_handle_t const *conn,
+			     int msgid,
+			     char const *dn,
+			     struct timeval const *timeout,
+			     LDAPMessage **result,
+			     char const **error, char **extra)
+{
+	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
+
+	bool freeit = false;		// Whether the message should be freed after being processed.
+
+	struct timeval tv;		// Holds timeout values.
+
+	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
+
+	if (error) *error = NULL;
+	if (extra) *extra = NULL;
+	if (result) *result = NULL;
+
+	/*
+	 *	We always need the result, but our caller may not
+	 */
+	if (!result) {
+		result = &tmp_msg;
+		freeit = true;
+	}
+
+	/*
+	 *	Check if there was an error sending the request
+	 */
+	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+	if (lib_errno != LDAP_SUCCESS) goto process_error;
+	if (msgid < 0) return LDAP_SUCCESS;	/* No msgid and no error, return now */
+
+	if (!timeout) {
+		tv.tv_sec = inst->res_timeout;
+		tv.tv_usec = 0;
+	} else {
+		tv = *timeout;
+	}
+
+	/*
+	 *	Now retrieve the result and check for errors
+	 *	ldap_result returns -1 on failure, and 0 on timeout
+	 */
+	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
+	if (lib_errno == 0) {
+		lib_errno = LDAP_TIMEOUT;
+	} else if (lib_errno == -1) {
+		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+	} else {
+		lib_errno = LDAP_SUCCESS;
+	}
+
+process_error:
+	return rlm_ldap_result_process(inst, conn, lib_errno, dn, result, freeit, error, extra);
+}
+
 /** Bind to the LDAP directory as a user
  *
  * Performs a simple bind to the LDAP directory, and handles any errors that occur.
@@ -1249,6 +1284,92 @@ finish:
 	return status;
 }
 
+/** Retrieve the DN of a user object from the result of a user object search
+ *
+ * Checks the result contains exactly one entry (unless the results were sorted), and adds
+ * the DN of that entry to the control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the result was received on.
+ * @param[in] result of the user object search.  Will not be freed.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_find_user_process(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t const *conn,
+				       LDAPMessage *result, rlm_rcode_t *rcode)
+{
+	VALUE_PAIR	*vp = NULL;
+	LDAPMessage	*entry = NULL;
+	int		ldap_errno;
+	int		cnt;
+	char		*dn = NULL;
+
+	*rcode = RLM_MODULE_FAIL;
+
+	/*
+	 *	Forbid the use of unsorted search results that
+	 *	contain multiple entries, as it's a potential
+	 *	security issue, and likely non deterministic.
+	 */
+	if (!inst->userobj_sort_ctrl) {
+		cnt = ldap_count_entries(conn->handle, result);
+		if (cnt > 1) {
+			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
+				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
+			REDEBUG("The following entries were returned:");
+			RINDENT();
+			for (entry = ldap_first_entry(conn->handle, result);
+			     entry;
+			     entry = ldap_next_entry(conn->handle, entry)) {
+				dn = ldap_get_dn(conn->handle, entry);
+				REDEBUG("%s", dn);
+				ldap_memfree(dn);
+			}
+			REXDENT();
+			*rcode = RLM_MODULE_INVALID;
+			goto finish;
+		}
+	}
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s",
+			ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+
+	dn = ldap_get_dn(conn->handle, entry);
+	if (!dn) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+	rlm_ldap_normalise_dn(dn, dn);
+
+	/*
+	 *	We can't use fr_pair_make here to copy the value into the
+	 *	attribute, as the dn must be copied into the attribute
+	 *	verbatim (without de-escaping).
+	 *
+	 *	Special chars are pre-escaped by libldap, and because
+	 *	we pass the string back to libldap we must not alter it.
+	 */
+	RDEBUG("User object found at DN \"%s\"", dn);
+	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
+	if (vp) {
+		fr_pair_value_strcpy(vp, dn);
+		*rcode = RLM_MODULE_OK;
+	}
+	ldap_memfree(dn);
+
+finish:
+	return vp ? vp->vp_strvalue : NULL;
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -1273,11 +1394,9 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 	static char const *tmp_attrs[] = { NULL };
 
 	ldap_rcode_t	status;
-	VALUE_PAIR	*vp = NULL;
-	LDAPMessage	*tmp_msg = NULL, *entry = NULL;
-	int		ldap_errno;
-	int		cnt;
-	char		*dn = NULL;
+	VALUE_PAIR	*vp;
+	LDAPMessage	*tmp_msg = NULL;
+	char const	*dn;
 	char const	*filter = NULL;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
@@ -1364,72 +1483,14 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 
 	rad_assert(*pconn);
 
-	/*
-	 *	Forbid the use of unsorted search results that
-	 *	contain multiple entries, as it's a potential
-	 *	security issue, and likely non deterministic.
-	 */
-	if (!inst->userobj_sort_ctrl) {
-		cnt = ldap_count_entries((*pconn)->handle, *result);
-		if (cnt > 1) {
-			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
-				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
-			REDEBUG("The following entries were returned:");
-			RINDENT();
-			for (entry = ldap_first_entry((*pconn)->handle, *result);
-			     entry;
-			     entry = ldap_next_entry((*pconn)->handle, entry)) {
-				dn = ldap_get_dn((*pconn)->handle, entry);
-				REDEBUG("%s", dn);
-				ldap_memfree(dn);
-			}
-			REXDENT();
-			*rcode = RLM_MODULE_INVALID;
-			goto finish;
-		}
-	}
-
-	entry = ldap_first_entry((*pconn)->handle, *result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s",
-			ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
-
-	dn = ldap_get_dn((*pconn)->handle, entry);
-	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+	dn = rlm_ldap_find_user_process(inst, request, *pconn, *result, rcode);
 
-		goto finish;
-	}
-	rlm_ldap_normalise_dn(dn, dn);
-
-	/*
-	 *	We can't use fr_pair_make here to copy the value into the
-	 *	attribute, as the dn must be copied into the attribute
-	 *	verbatim (without de-escaping).
-	 *
-	 *	Special chars are pre-escaped by libldap, and because
-	 *	we pass the string back to libldap we must not alter it.
-	 */
-	RDEBUG("User object found at DN \"%s\"", dn);
-	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
-	if (vp) {
-		fr_pair_value_strcpy(vp, dn);
-		*rcode = RLM_MODULE_OK;
-	}
-	ldap_memfree(dn);
-
-finish:
 	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
 		ldap_msgfree(*result);
 		*result = NULL;
 	}
 
-	return vp ? vp->vp_strvalue : NULL;
+	return dn;
 }
 
 /** Check for presence of access attribute in result
@@ -136,6 +136,18 @@ static CONF_PARSER user_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Group membership cache configuration
+ */
+static CONF_PARSER group_cache_config[] = {
+	{ FR_CONF_OFFSET("ttl", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_ttl), .dflt = "0" },
+	{ FR_CONF_OFFSET("negative_ttl", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_negative_ttl), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_max_entries), .dflt = "16384" },
+	{ FR_CONF_OFFSET("sync_dn", PW_TYPE_STRING, rlm_ldap_t, group_cache_sync_dn) },
+	{ FR_CONF_OFFSET("sync_interval", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_sync_interval), .dflt = "5" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	Group configuration
  */
@@ -151,6 +163,7 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cacheable_dn", PW_TYPE_BOOLEAN, rlm_ldap_t, cacheable_group_dn), .dflt = "no" },
 	{ FR_CONF_OFFSET("cache_attribute", PW_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", PW_TYPE_STRING, rlm_ldap_t, group_attribute) },
+	{ FR_CONF_POINTER("membership_cache", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) group_cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -214,6 +227,12 @@ static CONF_PARSER option_config[] = {
 	/* timeout for search results */
 	{ FR_CONF_OFFSET("res_timeout", PW_TYPE_INTEGER, rlm_ldap_t, res_timeout), .dflt = "20" },
 
+	/* authenticate without blocking the worker thread */
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_ldap_t, async), .dflt = "no" },
+
+	/* connections per thread for async searches */
+	{ FR_CONF_OFFSET("async_connections", PW_TYPE_INTEGER, rlm_ldap_t, async_connections), .dflt = "2" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -631,6 +650,23 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	rad_assert(conn);
 
+	/*
+	 *	Check the results of previous dynamic lookups
+	 */
+	switch (rlm_ldap_group_cache_check(inst, request, &conn, user_dn, check)) {
+	case RLM_MODULE_NOOP:
+		break;
+
+	case RLM_MODULE_OK:
+		found = true;
+		goto finish;
+
+	default:
+		goto finish;
+	}
+
+	rad_assert(conn);
+
 	/*
 	 *	Check groupobj user membership
 	 */
@@ -641,6 +677,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 		case RLM_MODULE_OK:
 			found = true;
+			goto cache;
 
 		default:
 			goto finish;
@@ -659,6 +696,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 		case RLM_MODULE_OK:
 			found = true;
+			goto cache;
 
 		default:
 			goto finish;
@@ -667,6 +705,9 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	rad_assert(conn);
 
+cache:
+	rlm_ldap_group_cache_add(inst, request, user_dn, check, found);
+
 finish:
 	if (conn) mod_conn_release(inst, request, conn);
 
@@ -679,8 +720,180 @@ finish:
 	return 0;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** Convert the result of a user bind to a module return code
+ *
+ */
+static rlm_rcode_t ldap_bind_rcode(REQUEST *request, ldap_rcode_t status, char const *dn)
+{
+	rlm_rcode_t rcode;
+
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		rcode = RLM_MODULE_OK;
+		RDEBUG("Bind as user \"%s\" was successful", dn);
+		break;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		rcode = RLM_MODULE_USERLOCK;
+		break;
+
+	case LDAP_PROC_REJECT:
+		rcode = RLM_MODULE_REJECT;
+		break;
+
+	case LDAP_PROC_BAD_DN:
+		rcode = RLM_MODULE_INVALID;
+		break;
+
+	case LDAP_PROC_NO_RESULT:
+		rcode = RLM_MODULE_NOTFOUND;
+		break;
+
+	default:
+		rcode = RLM_MODULE_FAIL;
+		break;
+	}
+
+	return rcode;
+}
+
+/** State for an asynchronous authentication
+ *
+ */
+typedef struct ldap_auth_ctx {
+	ldap_async_op_t		*op;		//!< Search or bind in progress.
+	char const		*dn;		//!< DN of the user, once found.
+} ldap_auth_ctx_t;
+
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, void *thread, void *ctx);
+static void mod_authenticate_action(REQUEST *request, void *instance, void *thread, void *ctx,
+				    fr_state_action_t action);
+
+/** Send the user bind, and yield until we get the result
+ *
+ */
+static rlm_rcode_t ldap_authenticate_bind(rlm_ldap_thread_t *t, REQUEST *request, ldap_auth_ctx_t *actx)
+{
+	actx->op = rlm_ldap_async_bind(actx, t, request, actx->dn, request->password->vp_strvalue);
+	if (!actx->op) {
+		talloc_free(actx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_yield(request, mod_authenticate_resume, mod_authenticate_action, actx);
+}
+
+/** Process the result of the user object search or the user bind
+ *
+ */
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	ldap_auth_ctx_t		*actx = talloc_get_type_abort(ctx, ldap_auth_ctx_t);
+	ldap_async_op_t		*op = actx->op;
+	rlm_rcode_t		rcode;
+
+	if (!op->search) {
+		rcode = ldap_bind_rcode(request, op->status, actx->dn);
+		goto finish;
+	}
+
+	switch (op->status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_BAD_DN:
+	case LDAP_PROC_NO_RESULT:
+		rcode = RLM_MODULE_NOTFOUND;
+		goto finish;
+
+	default:
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	actx->dn = rlm_ldap_find_user_process(inst, request, op->conn, op->result, &rcode);
+	if (!actx->dn) goto finish;
+
+	TALLOC_FREE(actx->op);
+
+	return ldap_authenticate_bind(thread, request, actx);
+
+finish:
+	talloc_free(actx);
+
+	return rcode;
+}
+
+/** Abandon the search or bind
+ *
+ */
+static void mod_authenticate_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				    fr_state_action_t action)
+{
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending LDAP operation");
+	talloc_free(ctx);
+}
+
+/** Authenticate a user without blocking the worker thread
+ *
+ * Finds the user's DN with a search multiplexed over one of the thread's
+ * connections, then binds as the user on a dedicated connection.
+ */
+static rlm_rcode_t ldap_authenticate_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request)
+{
+	ldap_auth_ctx_t	*actx;
+	VALUE_PAIR	*vp;
+	char const	*filter = NULL;
+	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const	*base_dn;
+	char	    	base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl	*serverctrls[] = { inst->userobj_sort_ctrl, NULL };
+
+	RDEBUG("Login attempt by \"%s\"", request->username->vp_strvalue);
+
+	MEM(actx = talloc_zero(request, ldap_auth_ctx_t));
+
+	vp = fr_pair_find_by_num(request->control, 0, PW_LDAP_USERDN, TAG_ANY);
+	if (vp) {
+		RDEBUG("Using user DN from request \"%s\"", vp->vp_strvalue);
+		actx->dn = vp->vp_strvalue;
+
+		return ldap_authenticate_bind(t, request, actx);
+	}
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
+				rlm_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			talloc_free(actx);
+
+			return RLM_MODULE_INVALID;
+		}
+	}
+
+	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
+			inst->userobj_base_dn, rlm_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		talloc_free(actx);
+
+		return RLM_MODULE_INVALID;
+	}
+
+	actx->op = rlm_ldap_async_search(actx, t, request, base_dn, inst->userobj_scope, filter, NULL,
+					 serverctrls, NULL);
+	if (!actx->op) {
+		talloc_free(actx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_yield(request, mod_authenticate_resume, mod_authenticate_action, actx);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rcode_t		rcode;
 	ldap_rcode_t		status;
@@ -723,6 +936,13 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		return RLM_MODULE_INVALID;
 	}
 
+	/*
+	 *	SASL binds are multi-step, and are always
+	 *	performed synchronously.  So are binds for
+	 *	requests with no event list to resume them.
+	 */
+	if (inst->async && !inst->user_sasl.mech && request->el) return ldap_authenticate_async(inst, thread, request);
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
 
@@ -772,32 +992,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 	conn->rebound = true;
 	status = rlm_ldap_bind(inst, request, &conn, dn, request->password->vp_strvalue,
 			       inst->user_sasl.mech ? &sasl : NULL, true, NULL, NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG("Bind as user \"%s\" was successful", dn);
-		break;
-
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_USERLOCK;
-		break;
-
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
-
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
-
-	default:
-		rcode = RLM_MODULE_FAIL;
-		break;
-	};
+	rcode = ldap_bind_rcode(request, status, dn);
 
 finish:
 	mod_conn_release(inst, request, conn);
@@ -1383,6 +1578,7 @@ static int mod_detach(void *instance)
 
 	fr_connection_pool_free(inst->pool);
 	talloc_free(inst->user_map);
+	TALLOC_FREE(inst->group_cache);
 
 	return 0;
 }
@@ -1547,6 +1743,17 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		}
 	}
 
+	if (inst->async) {
+		if (!inst->pool_inst.server_str) {
+			cf_log_err_cs(conf, "Configuration item 'options.async' requires 'server' to be set, "
+				      "connections can't be shared with another module");
+			goto error;
+		}
+
+		FR_INTEGER_BOUND_CHECK("options.async_connections", inst->async_connections, >=, 1);
+		FR_INTEGER_BOUND_CHECK("options.async_connections", inst->async_connections, <=, 64);
+	}
+
 #ifndef WITH_SASL
 	if (inst->user_sasl.mech) {
 		cf_log_err_cs(conf, "Configuration item 'user.sasl.mech' not supported.  "
@@ -1934,6 +2141,11 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	 */
 	if (rlm_ldap_global_init(inst) < 0) goto error;
 
+	/*
+	 *	Shared cache of dynamic group lookups.
+	 */
+	if (rlm_ldap_group_cache_init(inst) < 0) goto error;
+
 	/*
 	 *	Initialize the socket pool.
 	 */
@@ -1973,11 +2185,46 @@ error:
 	return -1;
 }
 
+/** Initialise the thread specific data used for asynchronous authentication
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_ldap_t		*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+
+	t->conn_cache = fr_connection_pool_thread_instantiate(inst->pool);
+
+	if (!inst->async) return 0;
+
+	return rlm_ldap_async_thread_init(t, inst, el);
+}
+
+/** Close any connections opened by this thread, and return its idle pool connections
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_ldap_thread_t	*t = thread;
+
+	fr_connection_pool_thread_detach(t->conn_cache);
+	t->conn_cache = NULL;
+
+	rlm_ldap_async_thread_free(t);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	static LDAPAPIInfo info = { .ldapai_info_version = LDAP_API_INFO_VERSION };	/* static to quiet valgrind about this being uninitialised */
 	int ldap_errno;
 
+	rlm_ldap_escape_init();
+
 	/*
 	 *	Only needs to be done once, prevents races in environment
 	 *	initialisation within libldap.
@@ -2042,16 +2289,19 @@ static void mod_unload(void)
 /* globally exported name */
 extern rad_module_t rlm_ldap;
 rad_module_t rlm_ldap = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "ldap",
-	.type		= 0,
-	.inst_size	= sizeof(rlm_ldap_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.unload		= mod_unload,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "ldap",
+	.type			= 0,
+	.inst_size		= sizeof(rlm_ldap_t),
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.unload			= mod_unload,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
@@ -275,6 +275,8 @@ typedef struct {
 							//!< (also bounded by value on the server).
 } ldap_pool_inst_t;
 
+typedef struct ldap_group_cache ldap_group_cache_t;
+
 struct rlm_ldap_s {
 	char const	*name;				//!< Instance name.
 
@@ -293,6 +295,13 @@ struct rlm_ldap_s {
 	 */
 	uint32_t	res_timeout;			//!< How long we wait for a result from the server.
 
+	/*
+	 *	Asynchronous operations
+	 */
+	bool		async;				//!< Perform authentication without blocking the worker.
+	uint32_t	async_connections;		//!< Number of connections each thread multiplexes
+							//!< searches over.
+
 	/*
 	 *	User object attributes and filters
 	 */
@@ -349,6 +358,15 @@ struct rlm_ldap_s {
 	fr_dict_attr_t const	*group_da;		//!< The DA associated with this specific instance of the
 							//!< rlm_ldap module.
 
+	uint32_t	group_cache_ttl;		//!< How long positive membership results and group DN
+							//!< to name mappings are cached for.  0 disables the cache.
+	uint32_t	group_cache_negative_ttl;	//!< How long negative results are cached for.
+	uint32_t	group_cache_max_entries;	//!< Maximum number of entries in the cache.
+	char const	*group_cache_sync_dn;		//!< Object to retrieve the contextCSN from.
+	uint32_t	group_cache_sync_interval;	//!< How often we check whether the contextCSN changed.
+
+	ldap_group_cache_t *group_cache;		//!< Membership cache shared by all threads.
+
 	/*
 	 *	Dynamic clients
 	 */
@@ -421,6 +439,25 @@ typedef struct ldap_handle {
 	rlm_ldap_t	 const *inst;			//!< rlm_ldap pool inst.
 } ldap_handle_t;
 
+typedef struct ldap_async_conn ldap_async_conn_t;
+
+/** Thread specific data used for asynchronous operations, and the connection pool
+ *
+ */
+typedef struct rlm_ldap_thread {
+	rlm_ldap_t	*inst;				//!< rlm_ldap configuration.
+	fr_event_list_t	*el;				//!< Event list connections are registered with.
+	TALLOC_CTX	*ctx;				//!< Context connections are allocated in.
+
+	ldap_async_conn_t **conn;			//!< Admin bound connections searches are
+							//!< multiplexed over.
+	uint32_t	conn_next;			//!< Counter used to pick the next search connection.
+
+	ldap_async_conn_t *bind_idle;			//!< Connections available for user binds.
+
+	fr_connection_thread_cache_t *conn_cache;	//!< This thread's cache of idle pool connections.
+} rlm_ldap_thread_t;
+
 /** Result of expanding the RHS of a set of maps
  *
  * Used to store the array of attributes we'll be querying for.
@@ -465,6 +502,26 @@ typedef enum {
 	LDAP_PROC_NO_RESULT = -6			//!< Got no results.
 } ldap_rcode_t;
 
+/** An asynchronous search or bind
+ *
+ */
+typedef struct ldap_async_op {
+	ldap_async_conn_t *aconn;			//!< Connection the operation was sent on.
+	ldap_handle_t const *conn;			//!< Handle to use when parsing the result.
+	REQUEST		*request;			//!< Request to resume when the operation completes.
+
+	int		msgid;				//!< libldap message ID.
+	bool		search;				//!< Whether the operation is a search or a bind.
+	char const	*dn;				//!< Search base or bind DN.
+
+	fr_event_timer_t *ev;				//!< Result timeout.
+
+	bool		complete;			//!< Whether the operation has completed.
+	ldap_rcode_t	status;				//!< One of the LDAP_PROC_* (#ldap_rcode_t) values.
+	LDAPMessage	*result;			//!< Result of a successful search.  Freed with the
+							//!< operation.
+} ldap_async_op_t;
+
 /*
  *	Some functions may be called with a NULL request structure, this
  *	simplifies switching certain messages from the request log to
@@ -483,6 +540,8 @@ void	rlm_ldap_timeout_debug(rlm_ldap_t const *inst, REQUEST *request, ldap_handl
 
 size_t rlm_ldap_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg);
 
+void rlm_ldap_escape_init(void);
+
 size_t rlm_ldap_unescape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg);
 
 bool rlm_ldap_is_dn(char const *in, size_t inlen);
@@ -506,6 +565,9 @@ ldap_rcode_t rlm_ldap_modify(rlm_ldap_t const *inst, REQUEST *request, ldap_hand
 			     char const *dn, LDAPMod *mods[],
 			     LDAPControl **serverctrls, LDAPControl **clientctrls);
 
+char const *rlm_ldap_find_user_process(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t const *conn,
+				       LDAPMessage *result, rlm_rcode_t *rcode);
+
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
@@ -517,6 +579,10 @@ void rlm_ldap_check_reply(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_
 /*
  *	ldap.c - Callbacks for the connection pool API.
  */
+ldap_rcode_t rlm_ldap_result_process(rlm_ldap_t const *inst, ldap_handle_t const *conn, int lib_errno,
+				     char const *dn, LDAPMessage **result, bool freeit,
+				     char const **error, char **extra);
+
 ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst, ldap_handle_t const *conn, int msgid, char const *dn,
 			     struct timeval const *timeout,
 			     LDAPMessage **result, char const **error, char **extra);
@@ -531,6 +597,20 @@ ldap_handle_t *mod_conn_get(rlm_ldap_t const *inst, REQUEST *request);
 
 void mod_conn_release(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t *conn);
 
+/*
+ *	async.c - Asynchronous searches and binds.
+ */
+ldap_async_op_t *rlm_ldap_async_search(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				       char const *dn, int scope, char const *filter, char const * const *attrs,
+				       LDAPControl **serverctrls, LDAPControl **clientctrls);
+
+ldap_async_op_t *rlm_ldap_async_bind(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				     char const *dn, char const *password);
+
+int rlm_ldap_async_thread_init(rlm_ldap_thread_t *t, rlm_ldap_t *inst, fr_event_list_t *el);
+
+void rlm_ldap_async_thread_free(rlm_ldap_thread_t *t);
+
 /*
  *	groups.c - Group membership functions.
  */
@@ -547,6 +627,14 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 
 rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALUE_PAIR *check);
 
+rlm_rcode_t rlm_ldap_group_cache_check(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+				       char const *user_dn, VALUE_PAIR const *check);
+
+void rlm_ldap_group_cache_add(rlm_ldap_t const *inst, REQUEST *request, char const *user_dn,
+			      VALUE_PAIR const *check, bool found);
+
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst);
+
 /*
  *	attrmap.c - Attribute mapping code.
  */
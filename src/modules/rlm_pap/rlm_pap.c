@@ -30,6 +30,7 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/base64.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/crypto_offload.h>
 
 #include <ctype.h>
 
@@ -48,13 +49,42 @@ USES_APPLE_DEPRECATED_API
  *      be used as the instance handle.
  */
 typedef struct rlm_pap_t {
-	char const	*name;
-	int		auth_type;
-	bool		normify;
+	char const			*name;
+	int				auth_type;
+	bool				normify;
+
+	fr_crypto_offload_config_t	offload;	//!< Crypto thread pool configuration.
+	fr_crypto_offload_t		*co;		//!< Runs crypt and salted SHA2 comparisons.
 } rlm_pap_t;
 
+typedef struct rlm_pap_thread_t {
+	fr_crypto_offload_thread_t	*cot;		//!< This worker's handle for the crypto thread pool.
+} rlm_pap_thread_t;
+
+/** Data for a comparison run by a crypto thread
+ *
+ * Copies of the passwords are made, as the request may be freed while
+ * the comparison is running.
+ */
+typedef struct pap_offload_t {
+	char const			*name;		//!< Of the "known good" password type.
+	unsigned int			attr;		//!< Of the "known good" password.
+	char				*password;	//!< User-Password.
+	size_t				password_len;	//!< Length of User-Password.
+	char				*known_good;	//!< "known good" password.
+	size_t				known_good_len;	//!< Length of the "known good" password.
+	fr_crypto_offload_job_t		*job;		//!< Job this data belongs to.
+} pap_offload_t;
+
+static CONF_PARSER offload_config[] = {
+	{ FR_CONF_OFFSET("threads", PW_TYPE_INTEGER, rlm_pap_t, offload.threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", PW_TYPE_INTEGER, rlm_pap_t, offload.max_queued), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("normalise", PW_TYPE_BOOLEAN, rlm_pap_t, normify), .dflt = "yes" },
+	{ FR_CONF_POINTER("offload", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) offload_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -115,6 +145,58 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		inst->auth_type = 0;
 	}
 
+	if (inst->offload.threads > 0) {
+		FR_INTEGER_BOUND_CHECK("offload.threads", inst->offload.threads, <=, 64);
+		FR_INTEGER_BOUND_CHECK("offload.max_queued", inst->offload.max_queued, >=, 1);
+		FR_INTEGER_BOUND_CHECK("offload.max_queued", inst->offload.max_queued, <=, 65536);
+
+		inst->co = fr_crypto_offload_create(inst, inst->name, &inst->offload);
+		if (!inst->co) return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_pap_t		*inst = instance;
+	rlm_pap_thread_t	*t = thread;
+
+	if (!inst->co) return 0;
+
+	t->cot = fr_crypto_offload_thread_create(NULL, inst->co, el);
+	if (!t->cot) return -1;
+
+	return 0;
+}
+
+/** Wait for any comparisons still running for this worker
+ *
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_pap_thread_t	*t = thread;
+
+	TALLOC_FREE(t->cot);
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_pap_t			*inst = instance;
+	fr_crypto_offload_stats_t	stats;
+
+	if (!inst->co) return 0;
+
+	fr_crypto_offload_stats(inst->co, &stats);
+	if (stats.completed) {
+		DEBUG("rlm_pap (%s): %" PRIu64 " comparisons offloaded, average %" PRIu64 "us queued, "
+		      "%" PRIu64 "us running", inst->name, stats.completed,
+		      stats.wait_usec / stats.completed, stats.run_usec / stats.completed);
+	}
+	TALLOC_FREE(inst->co);
+
 	return 0;
 }
 
@@ -735,42 +817,82 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_sha2(rlm_pap_t const *inst, REQUEST
 	return RLM_MODULE_OK;
 }
 
-static rlm_rcode_t CC_HINT(nonnull) pap_auth_ssha2(rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
+/** Get the digest, and digest length for a salted SHA2 password type
+ *
+ */
+static void pap_ssha2_params(unsigned int attr, char const **name, EVP_MD const **md, unsigned int *min_len)
 {
-	EVP_MD_CTX *ctx;
-	EVP_MD const *md = NULL;
-	char const *name = NULL;
-	uint8_t digest[EVP_MAX_MD_SIZE];
-	unsigned int digest_len, min_len = 0;
-
-	switch (vp->da->attr) {
+	switch (attr) {
 	case PW_SSHA2_224_PASSWORD:
-		name = "SSHA2-224";
-		md = EVP_sha224();
-		min_len = 28;
+		*name = "SSHA2-224";
+		*md = EVP_sha224();
+		*min_len = 28;
 		break;
 
 	case PW_SSHA2_256_PASSWORD:
-		name = "SSHA2-256";
-		md = EVP_sha256();
-		min_len = 32;
+		*name = "SSHA2-256";
+		*md = EVP_sha256();
+		*min_len = 32;
 		break;
 
 	case PW_SSHA2_384_PASSWORD:
-		name = "SSHA2-384";
-		md = EVP_sha384();
-		min_len = 48;
+		*name = "SSHA2-384";
+		*md = EVP_sha384();
+		*min_len = 48;
 		break;
 
 	case PW_SSHA2_512_PASSWORD:
-		name = "SSHA2-512";
-		min_len = 64;
-		md = EVP_sha512();
+		*name = "SSHA2-512";
+		*min_len = 64;
+		*md = EVP_sha512();
 		break;
 
 	default:
 		rad_assert(0);
 	}
+}
+
+/** Hash the password and salt, and compare the result with the "known good" digest
+ *
+ * @note Doesn't touch the request, so may be run by a crypto thread.
+ *
+ * @return
+ *	- 0 if the digests match.
+ *	- 1 if they don't.
+ */
+static int pap_ssha2_cmp(EVP_MD const *md, unsigned int min_len,
+			 uint8_t const *password, size_t password_len,
+			 uint8_t const *known_good, size_t known_good_len)
+{
+	EVP_MD_CTX *ctx;
+	uint8_t digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len;
+
+	ctx = EVP_MD_CTX_create();
+	EVP_DigestInit_ex(ctx, md, NULL);
+	EVP_DigestUpdate(ctx, password, password_len);
+	EVP_DigestUpdate(ctx, &known_good[min_len], known_good_len - min_len);
+	EVP_DigestFinal_ex(ctx, digest, &digest_len);
+	EVP_MD_CTX_destroy(ctx);
+
+	rad_assert((size_t) digest_len == min_len);	/* This would be an OpenSSL bug... */
+
+	/*
+	 *	Only compare digest_len bytes, the rest is salt.
+	 */
+	return (fr_radius_digest_cmp(digest, known_good, (size_t)digest_len) != 0);
+}
+
+/** Normalise and check the length of a salted SHA2 password
+ *
+ */
+static rlm_rcode_t CC_HINT(nonnull) pap_ssha2_prepare(rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
+{
+	EVP_MD const *md = NULL;
+	char const *name = NULL;
+	unsigned int min_len = 0;
+
+	pap_ssha2_params(vp->da->attr, &name, &md, &min_len);
 
 	RDEBUG("Comparing with \"known-good\" %s-Password", name);
 
@@ -787,19 +909,23 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_ssha2(rlm_pap_t const *inst, REQUES
 		return RLM_MODULE_INVALID;
 	}
 
-	ctx = EVP_MD_CTX_create();
-	EVP_DigestInit_ex(ctx, md, NULL);
-	EVP_DigestUpdate(ctx, request->password->vp_octets, request->password->vp_length);
-	EVP_DigestUpdate(ctx, &vp->vp_octets[min_len], vp->vp_length - min_len);
-	EVP_DigestFinal_ex(ctx, digest, &digest_len);
-	EVP_MD_CTX_destroy(ctx);
+	return RLM_MODULE_OK;
+}
 
-	rad_assert((size_t) digest_len == min_len);	/* This would be an OpenSSL bug... */
+static rlm_rcode_t CC_HINT(nonnull) pap_auth_ssha2(rlm_pap_t const *inst, REQUEST *request, VALUE_PAIR *vp)
+{
+	EVP_MD const *md = NULL;
+	char const *name = NULL;
+	unsigned int min_len = 0;
+	rlm_rcode_t rcode;
 
-	/*
-	 *	Only compare digest_len bytes, the rest is salt.
-	 */
-	if (fr_radius_digest_cmp(digest, vp->vp_octets, (size_t)digest_len) != 0) {
+	rcode = pap_ssha2_prepare(inst, request, vp);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	pap_ssha2_params(vp->da->attr, &name, &md, &min_len);
+
+	if (pap_ssha2_cmp(md, min_len, request->password->vp_octets, request->password->vp_length,
+			  vp->vp_octets, vp->vp_length) != 0) {
 		REDEBUG("%s digest does not match \"known good\" digest", name);
 		return RLM_MODULE_REJECT;
 	}
@@ -936,12 +1062,147 @@ static rlm_rcode_t CC_HINT(nonnull) pap_auth_ns_mta_md5(UNUSED rlm_pap_t const *
 }
 
 
+/*
+ *	Comparisons which may be run by a crypto thread
+ */
+static int pap_offload_crypt(void *uctx)
+{
+	pap_offload_t	*po = uctx;
+
+	return (fr_crypt_check(po->password, po->known_good) != 0);
+}
+
+#ifdef HAVE_OPENSSL_EVP_H
+static int pap_offload_ssha2(void *uctx)
+{
+	pap_offload_t	*po = uctx;
+	EVP_MD const	*md = NULL;
+	char const	*name = NULL;
+	unsigned int	min_len = 0;
+
+	pap_ssha2_params(po->attr, &name, &md, &min_len);
+
+	return pap_ssha2_cmp(md, min_len, (uint8_t const *)po->password, po->password_len,
+			     (uint8_t const *)po->known_good, po->known_good_len);
+}
+#endif
+
+/** Convert the result of an offloaded comparison to a module rcode
+ *
+ */
+static rlm_rcode_t pap_offload_rcode(REQUEST *request, pap_offload_t const *po, int result)
+{
+	switch (result) {
+	case 0:
+		RDEBUG("User authenticated successfully");
+		return RLM_MODULE_OK;
+
+	case 1:
+		REDEBUG("%s digest does not match \"known good\" digest", po->name);
+		RDEBUG("Passwords don't match");
+		return RLM_MODULE_REJECT;
+
+	default:
+		REDEBUG("Failed comparing with \"known good\" %s-Password", po->name);
+		return RLM_MODULE_FAIL;
+	}
+}
+
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx)
+{
+	pap_offload_t	*po = talloc_get_type_abort(ctx, pap_offload_t);
+	rlm_rcode_t	rcode;
+
+	rcode = pap_offload_rcode(request, po, fr_crypto_offload_job_result(po->job));
+	talloc_free(po->job);
+
+	return rcode;
+}
+
+static void mod_authenticate_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				    fr_state_action_t action)
+{
+	pap_offload_t	*po = talloc_get_type_abort(ctx, pap_offload_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling offloaded password comparison");
+
+	talloc_free(po->job);	/* Freed when the comparison completes, if it's running */
+}
+
+/** Run a comparison in the crypto thread pool, and yield
+ *
+ * If the pool's queue is full, the comparison is run inline instead.
+ */
+static rlm_rcode_t CC_HINT(nonnull) pap_offload(rlm_pap_t const *inst, rlm_pap_thread_t *t,
+						REQUEST *request, VALUE_PAIR *vp)
+{
+	fr_crypto_offload_func_t	func;
+	fr_crypto_offload_job_t		*job;
+	pap_offload_t			*po;
+	char const			*name;
+
+	switch (vp->da->attr) {
+	case PW_CRYPT_PASSWORD:
+		RDEBUG("Comparing with \"known-good\" Crypt-password");
+		name = "Crypt";
+		func = pap_offload_crypt;
+		break;
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case PW_SSHA2_224_PASSWORD:
+	case PW_SSHA2_256_PASSWORD:
+	case PW_SSHA2_384_PASSWORD:
+	case PW_SSHA2_512_PASSWORD:
+	{
+		EVP_MD const	*md = NULL;
+		unsigned int	min_len = 0;
+		rlm_rcode_t	rcode;
+
+		rcode = pap_ssha2_prepare(inst, request, vp);
+		if (rcode != RLM_MODULE_OK) return rcode;
+
+		pap_ssha2_params(vp->da->attr, &name, &md, &min_len);
+		func = pap_offload_ssha2;
+	}
+		break;
+#endif
+
+	default:
+		rad_assert(0);
+		return RLM_MODULE_FAIL;
+	}
+
+	MEM(job = fr_crypto_offload_job_alloc(t->cot, func));
+	MEM(po = talloc_zero(job, pap_offload_t));
+	po->name = name;
+	po->attr = vp->da->attr;
+	po->password = talloc_bstrndup(po, request->password->vp_strvalue, request->password->vp_length);
+	po->password_len = request->password->vp_length;
+	po->known_good = talloc_bstrndup(po, vp->vp_strvalue, vp->vp_length);
+	po->known_good_len = vp->vp_length;
+	po->job = job;
+
+	if (fr_crypto_offload_job_submit(job, request, po) < 0) {
+		rlm_rcode_t rcode;
+
+		rcode = pap_offload_rcode(request, po, func(po));
+		talloc_free(job);
+
+		return rcode;
+	}
+
+	return unlang_yield(request, mod_authenticate_resume, mod_authenticate_action, po);
+}
+
 /*
  *	Authenticate the user via one of any well-known password.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_pap_t const *inst = instance;
+	rlm_pap_thread_t *t = thread;
 	VALUE_PAIR	*vp;
 	rlm_rcode_t	rc = RLM_MODULE_INVALID;
 	vp_cursor_t	cursor;
@@ -1041,6 +1302,18 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		return RLM_MODULE_FAIL;
 	}
 
+	/*
+	 *	Slow hashes are run by the crypto thread pool,
+	 *	so they don't block the worker.  Requests with
+	 *	no event list can't be resumed, and are done
+	 *	inline.
+	 */
+	if (t->cot && request->el && ((auth_func == &pap_auth_crypt)
+#ifdef HAVE_OPENSSL_EVP_H
+		       || (auth_func == &pap_auth_ssha2)
+#endif
+		       )) return pap_offload(inst, t, request, vp);
+
 	/*
 	 *	Authenticate, and return.
 	 */
@@ -1069,11 +1342,15 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
  */
 extern rad_module_t rlm_pap;
 rad_module_t rlm_pap = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "pap",
-	.inst_size	= sizeof(rlm_pap_t),
-	.config		= module_config,
-	.instantiate	= mod_instantiate,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "pap",
+	.inst_size		= sizeof(rlm_pap_t),
+	.thread_inst_size	= sizeof(rlm_pap_thread_t),
+	.config			= module_config,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize
@@ -1,2 +1 @@
-TARGET		:= rlm_passwd.a
-SOURCES		:= rlm_passwd.c
+SUBMAKEFILES := rlm_passwd.mk rlm_passwd_index.mk
@@ -0,0 +1,490 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file passwd_index.c
+ * @brief On disk hash index for passwd style files.
+ *
+ * Reading a passwd file with tens of millions of lines into memory takes
+ * minutes, and gigabytes of memory per server.
+ *
+ * Instead, rlm_passwd_index builds an index file, which the module maps
+ * read only.  There's nothing to parse at startup, lookups touch one or
+ * two pages, and the page cache is shared between all the processes
+ * using the index.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "passwd_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** A mapped index file
+ *
+ */
+struct passwd_index {
+	void				*map;		//!< Start of the mapping.
+	size_t				len;		//!< Length of the mapping.
+
+	passwd_index_header_t const	*header;
+	passwd_index_slot_t const	*slots;
+	char const			*records;
+};
+
+/** A key found while reading the passwd file
+ *
+ */
+typedef struct {
+	uint64_t	record_offset;
+	uint32_t	record_len;
+	uint32_t	key_offset;
+	uint32_t	key_len;
+	uint32_t	hash;
+} index_key_t;
+
+/** Find the key field of a line
+ *
+ * Splits lines in the same way as string_to_entry() in rlm_passwd.c.  The last
+ * field contains the remainder of the line.
+ *
+ * @return
+ *	- The key field.
+ *	- NULL if the line has too few fields.
+ */
+static char const *index_key_field(size_t *len, char const *line, size_t line_len, passwd_index_format_t const *format)
+{
+	char const	*p = line, *end = line + line_len, *q;
+	uint32_t	i;
+
+	for (i = 0; i < format->keyfield; i++) {
+		q = memchr(p, format->delimiter, end - p);
+		if (!q) return NULL;
+		p = q + 1;
+	}
+
+	if (format->keyfield == (format->nfields - 1)) {
+		*len = end - p;
+		return p;
+	}
+
+	q = memchr(p, format->delimiter, end - p);
+	*len = q ? (size_t)(q - p) : (size_t)(end - p);
+
+	return p;
+}
+
+static int index_write(FILE *fp, void const *data, size_t len, char const *filename)
+{
+	/*
+	 *	fwrite() returns 0 for zero length writes, e.g. no
+	 *	padding after records which end on a boundary.
+	 */
+	if (!len) return 0;
+
+	if (fwrite(data, len, 1, fp) != 1) {
+		fr_strerror_printf("Failed writing %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Build an index file for a passwd file
+ *
+ * The index is written to a temporary file, which is renamed to out when
+ * it's complete, so servers using the old index (even if they re-open it)
+ * never see a partially written index.
+ *
+ * @param[in] out		index file to write.
+ * @param[in] in		passwd file to read.
+ * @param[in] format		of the passwd file.  Must match the module configuration.
+ * @param[out] num_records	lines in the index.
+ * @param[out] num_keys		keys in the index.
+ * @param[out] num_skipped	lines longer than #PASSWD_INDEX_MAX_LINE, which were
+ *				left out of the index.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int passwd_index_build(char const *out, char const *in, passwd_index_format_t const *format,
+		       uint64_t *num_records, uint64_t *num_keys, uint64_t *num_skipped)
+{
+	FILE			*in_fp = NULL, *out_fp = NULL;
+	char			*tmp;
+	char			buffer[PASSWD_INDEX_MAX_LINE];
+	struct stat		buf;
+	passwd_index_header_t	header;
+	passwd_index_slot_t	*slots = NULL;
+	index_key_t		*keys = NULL;
+	size_t			keys_max = 1024;
+	uint64_t		offset = 0, i;
+	int			ret = -1;
+	bool			truncated = false;
+	static uint8_t const	zero[8];
+
+	*num_records = *num_keys = *num_skipped = 0;
+
+	if ((format->nfields == 0) || (format->keyfield >= format->nfields)) {
+		fr_strerror_printf("Invalid key field %u", format->keyfield);
+		return -1;
+	}
+
+	tmp = talloc_typed_asprintf(NULL, "%s.tmp", out);
+	if (!tmp) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		goto finish;
+	}
+
+	in_fp = fopen(in, "r");
+	if (!in_fp || (fstat(fileno(in_fp), &buf) < 0)) {
+		fr_strerror_printf("Failed opening %s: %s", in, fr_syserror(errno));
+		goto finish;
+	}
+
+	out_fp = fopen(tmp, "w");
+	if (!out_fp) {
+		fr_strerror_printf("Failed opening %s: %s", tmp, fr_syserror(errno));
+		goto finish;
+	}
+
+	/*
+	 *	Written again when we know the sizes.
+	 */
+	memset(&header, 0, sizeof(header));
+	if (index_write(out_fp, &header, sizeof(header), tmp) < 0) goto finish;
+
+	keys = talloc_array(NULL, index_key_t, keys_max);
+	if (!keys) goto oom;
+
+	while (fgets(buffer, sizeof(buffer), in_fp)) {
+		size_t		len = strlen(buffer), key_len;
+		char const	*key, *list_end;
+
+		/*
+		 *	Skip the rest of lines which are too long
+		 */
+		if (truncated) {
+			truncated = (buffer[len - 1] != '\n');
+			continue;
+		}
+
+		if (buffer[len - 1] != '\n') {
+			if (!feof(in_fp)) {
+				(*num_skipped)++;
+				truncated = true;
+				continue;
+			}
+		} else {
+			buffer[--len] = '\0';
+		}
+		if (len && (buffer[len - 1] == '\r')) buffer[--len] = '\0';
+
+		if (!len) continue;
+		if (format->ignore_nislike && ((buffer[0] == '+') || (buffer[0] == '-'))) continue;
+
+		key = index_key_field(&key_len, buffer, len, format);
+		if (!key || !key_len) continue;
+
+		/*
+		 *	Each element of a list is a key.
+		 */
+		list_end = key + key_len;
+		do {
+			char const *p = key;
+
+			if (format->listable) {
+				p = memchr(key, ',', list_end - key);
+				key_len = p ? (size_t)(p - key) : (size_t)(list_end - key);
+			}
+
+			if (key_len) {
+				if (*num_keys == keys_max) {
+					index_key_t *tmp_keys;
+
+					keys_max *= 2;
+					tmp_keys = talloc_realloc(NULL, keys, index_key_t, keys_max);
+					if (!tmp_keys) goto oom;
+					keys = tmp_keys;
+				}
+
+				keys[*num_keys].record_offset = offset;
+				keys[*num_keys].record_len = len;
+				keys[*num_keys].key_offset = key - buffer;
+				keys[*num_keys].key_len = key_len;
+				keys[*num_keys].hash = fr_hash(key, key_len);
+				(*num_keys)++;
+			}
+
+			key = p ? p + 1 : list_end;
+		} while (format->listable && (key < list_end));
+
+		if (index_write(out_fp, buffer, len + 1, tmp) < 0) goto finish;
+		offset += len + 1;
+		(*num_records)++;
+	}
+	if (ferror(in_fp)) {
+		fr_strerror_printf("Failed reading %s: %s", in, fr_syserror(errno));
+		goto finish;
+	}
+
+	memcpy(header.magic, PASSWD_INDEX_MAGIC, sizeof(header.magic));
+	header.version = PASSWD_INDEX_VERSION;
+	header.byte_order = PASSWD_INDEX_BYTE_ORDER;
+	header.nfields = format->nfields;
+	header.keyfield = format->keyfield;
+	header.delimiter = format->delimiter;
+	header.listable = format->listable;
+	header.ignore_nislike = format->ignore_nislike;
+	header.source_mtime = buf.st_mtime;
+	header.source_size = buf.st_size;
+	header.num_records = *num_records;
+	header.num_keys = *num_keys;
+	header.records_offset = sizeof(header);
+	header.records_len = offset;
+	header.slots_offset = sizeof(header) + ((offset + 7) & ~(uint64_t)7);
+
+	/*
+	 *	Keep the table at most half full, so probe
+	 *	sequences are short.
+	 */
+	header.num_slots = 16;
+	while (header.num_slots < (*num_keys * 2)) header.num_slots <<= 1;
+
+	if (index_write(out_fp, zero, header.slots_offset - (sizeof(header) + offset), tmp) < 0) goto finish;
+
+	slots = talloc_zero_array(NULL, passwd_index_slot_t, header.num_slots);
+	if (!slots) goto oom;
+
+	/*
+	 *	Insert in reverse, so later lines are found first.
+	 */
+	for (i = *num_keys; i > 0; i--) {
+		index_key_t const	*k = &keys[i - 1];
+		uint64_t		slot = k->hash & (header.num_slots - 1);
+
+		while (slots[slot].key_len) slot = (slot + 1) & (header.num_slots - 1);
+
+		slots[slot].hash = k->hash;
+		slots[slot].key_len = k->key_len;
+		slots[slot].key_offset = k->key_offset;
+		slots[slot].record_len = k->record_len;
+		slots[slot].record_offset = k->record_offset;
+	}
+
+	if (index_write(out_fp, slots, sizeof(*slots) * header.num_slots, tmp) < 0) goto finish;
+
+	if ((fseek(out_fp, 0, SEEK_SET) < 0) ||
+	    (index_write(out_fp, &header, sizeof(header), tmp) < 0)) goto finish;
+
+	if ((fflush(out_fp) != 0) || (fsync(fileno(out_fp)) < 0)) {
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+		goto finish;
+	}
+
+	if (rename(tmp, out) < 0) {
+		fr_strerror_printf("Failed renaming %s to %s: %s", tmp, out, fr_syserror(errno));
+		goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	if (in_fp) fclose(in_fp);
+	if (out_fp) {
+		fclose(out_fp);
+		if (ret < 0) unlink(tmp);
+	}
+	talloc_free(slots);
+	talloc_free(keys);
+	talloc_free(tmp);
+
+	return ret;
+}
+
+static int _passwd_index_free(passwd_index_t *pi)
+{
+	munmap(pi->map, pi->len);
+
+	return 0;
+}
+
+/** Map an index file
+ *
+ * @param[in] ctx	to allocate the index in.  Freeing it unmaps the file.
+ * @param[in] filename	of the index.
+ * @param[in] format	the passwd file must have been indexed with.
+ * @return
+ *	- The index.
+ *	- NULL on error.
+ */
+passwd_index_t *passwd_index_open(TALLOC_CTX *ctx, char const *filename, passwd_index_format_t const *format)
+{
+	passwd_index_t			*pi;
+	passwd_index_header_t const	*header;
+	struct stat			buf;
+	void				*map;
+	int				fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &buf) < 0) {
+		fr_strerror_printf("Failed getting size of %s: %s", filename, fr_syserror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ((size_t)buf.st_size < sizeof(*header)) {
+		fr_strerror_printf("%s is too short to be an index", filename);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping %s: %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+#ifdef MADV_RANDOM
+	/*
+	 *	Lookups are random, readahead just wastes
+	 *	the page cache.
+	 */
+	(void) madvise(map, buf.st_size, MADV_RANDOM);
+#endif
+
+	pi = talloc_zero(ctx, passwd_index_t);
+	if (!pi) {
+		fr_strerror_printf("Out of memory");
+		munmap(map, buf.st_size);
+		return NULL;
+	}
+	pi->map = map;
+	pi->len = buf.st_size;
+	talloc_set_destructor(pi, _passwd_index_free);
+
+	header = pi->header = map;
+	if ((memcmp(header->magic, PASSWD_INDEX_MAGIC, sizeof(header->magic)) != 0) ||
+	    (header->version != PASSWD_INDEX_VERSION)) {
+		fr_strerror_printf("%s is not a version %u passwd index", filename, PASSWD_INDEX_VERSION);
+	error:
+		talloc_free(pi);
+		return NULL;
+	}
+
+	if (header->byte_order != PASSWD_INDEX_BYTE_ORDER) {
+		fr_strerror_printf("%s was built on a host with a different byte order", filename);
+		goto error;
+	}
+
+	if ((header->nfields != format->nfields) || (header->keyfield != format->keyfield) ||
+	    (header->delimiter != (uint8_t)format->delimiter) || (header->listable != format->listable) ||
+	    (header->ignore_nislike != format->ignore_nislike)) {
+		fr_strerror_printf("%s was built with a different format, delimiter, or ignore_nislike", filename);
+		goto error;
+	}
+
+	if ((header->num_slots == 0) || ((header->num_slots & (header->num_slots - 1)) != 0) ||
+	    (header->num_keys >= header->num_slots) ||
+	    (header->records_offset < sizeof(*header)) ||
+	    (header->records_offset + header->records_len > header->slots_offset) ||
+	    (header->slots_offset & 7) ||
+	    (header->slots_offset > pi->len) ||
+	    (header->num_slots > ((pi->len - header->slots_offset) / sizeof(passwd_index_slot_t)))) {
+		fr_strerror_printf("%s is truncated or corrupt", filename);
+		goto error;
+	}
+
+	pi->records = (char const *)map + header->records_offset;
+	pi->slots = (passwd_index_slot_t const *)((uint8_t const *)map + header->slots_offset);
+
+	return pi;
+}
+
+/** Return the header of a mapped index
+ *
+ */
+passwd_index_header_t const *passwd_index_header(passwd_index_t const *pi)
+{
+	return pi->header;
+}
+
+/** Return the next record with the key being looked up
+ *
+ * @param[in,out] iter	position of the lookup.
+ * @param[in] pi	to search.
+ * @param[out] len	of the record.
+ * @return
+ *	- The record, a '\0' terminated line from the passwd file.
+ *	- NULL if there are no more records with the key.
+ */
+char const *passwd_index_next(passwd_index_iter_t *iter, passwd_index_t const *pi, size_t *len)
+{
+	uint64_t mask = pi->header->num_slots - 1;
+
+	for (; pi->slots[iter->slot].key_len; iter->slot = (iter->slot + 1) & mask) {
+		passwd_index_slot_t const *s = &pi->slots[iter->slot];
+
+		if ((s->hash != iter->hash) || (s->key_len != iter->key_len)) continue;
+
+		/*
+		 *	Don't trust the index not to send us
+		 *	outside the records area.
+		 */
+		if ((s->record_offset + s->record_len >= pi->header->records_len) ||
+		    (s->key_offset + s->key_len > s->record_len)) continue;
+
+		if (memcmp(pi->records + s->record_offset + s->key_offset, iter->key, iter->key_len) != 0) continue;
+
+		iter->slot = (iter->slot + 1) & mask;
+		*len = s->record_len;
+
+		return pi->records + s->record_offset;
+	}
+
+	return NULL;
+}
+
+/** Return the first record with a key
+ *
+ * @param[out] iter	position of the lookup, for #passwd_index_next.
+ * @param[in] pi	to search.
+ * @param[in] key	to find.  Must remain valid until the lookup is complete.
+ * @param[out] len	of the record.
+ * @return
+ *	- The record, a '\0' terminated line from the passwd file.
+ *	- NULL if there are no records with the key.
+ */
+char const *passwd_index_first(passwd_index_iter_t *iter, passwd_index_t const *pi, char const *key, size_t *len)
+{
+	iter->key = key;
+	iter->key_len = strlen(key);
+	iter->hash = fr_hash(key, iter->key_len);
+	iter->slot = iter->hash & (pi->header->num_slots - 1);
+
+	return passwd_index_next(iter, pi, len);
+}
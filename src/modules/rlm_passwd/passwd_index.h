@@ -0,0 +1,120 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file passwd_index.h
+ * @brief On disk hash index for passwd style files.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#ifndef _RLM_PASSWD_INDEX_H
+#define _RLM_PASSWD_INDEX_H
+
+RCSIDH(passwd_index_h, "$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#define PASSWD_INDEX_MAGIC		"FRPWIDX"	//!< Including the terminating '\0'.
+#define PASSWD_INDEX_VERSION		1
+#define PASSWD_INDEX_BYTE_ORDER		0x01020304	//!< Written in the byte order of the host
+							//!< which built the index.
+#define PASSWD_INDEX_MAX_LINE		1024		//!< Same as when the file is read into memory.
+
+/** Index file header
+ *
+ * An index file consists of the header, the records area, and the slot table.
+ * All integers are in host byte order, so indexes can only be used on hosts with
+ * the same byte order as the host which built them.
+ *
+ * The records area contains the lines of the passwd file which have a key, in
+ * file order, without line endings, each terminated by a '\0'.
+ *
+ * The slot table is an open addressing hash table, with linear probing.  Each
+ * key (there may be more than one per line for listable key fields) has a slot
+ * pointing to the record it came from.  Keys which appear more than once are
+ * found in reverse file order, matching the in memory hash table.
+ */
+typedef struct passwd_index_header {
+	char		magic[8];		//!< #PASSWD_INDEX_MAGIC.
+	uint32_t	version;		//!< #PASSWD_INDEX_VERSION.
+	uint32_t	byte_order;		//!< #PASSWD_INDEX_BYTE_ORDER.
+
+	uint32_t	nfields;		//!< Fields per line.
+	uint32_t	keyfield;		//!< Field containing the key.
+	uint8_t		delimiter;		//!< Field delimiter.
+	uint8_t		listable;		//!< Key field is a comma separated list of keys.
+	uint8_t		ignore_nislike;		//!< Lines starting with '+' or '-' were skipped.
+	uint8_t		pad[5];
+
+	uint64_t	source_mtime;		//!< Modification time of the passwd file.
+	uint64_t	source_size;		//!< Size of the passwd file.
+
+	uint64_t	num_records;		//!< Lines in the records area.
+	uint64_t	num_keys;		//!< Used slots.
+
+	uint64_t	records_offset;		//!< Start of the records area.
+	uint64_t	records_len;		//!< Length of the records area.
+	uint64_t	slots_offset;		//!< Start of the slot table.
+	uint64_t	num_slots;		//!< Size of the slot table.  Always a power of 2.
+} passwd_index_header_t;
+
+/** A slot in the hash table
+ *
+ */
+typedef struct passwd_index_slot {
+	uint32_t	hash;			//!< fr_hash() of the key.
+	uint32_t	key_len;		//!< Length of the key.  0 if the slot is empty.
+	uint32_t	key_offset;		//!< Offset of the key from the start of the record.
+	uint32_t	record_len;		//!< Length of the record, excluding the '\0'.
+	uint64_t	record_offset;		//!< Offset of the record from the start of the records area.
+} passwd_index_slot_t;
+
+/** How the passwd file is split into fields
+ *
+ */
+typedef struct passwd_index_format {
+	uint32_t	nfields;		//!< Fields per line.
+	uint32_t	keyfield;		//!< Field containing the key.
+	char		delimiter;		//!< Field delimiter.
+	bool		listable;		//!< Key field is a comma separated list of keys.
+	bool		ignore_nislike;		//!< Skip lines starting with '+' or '-'.
+} passwd_index_format_t;
+
+typedef struct passwd_index passwd_index_t;
+
+/** Position of a lookup
+ *
+ */
+typedef struct passwd_index_iter {
+	char const	*key;
+	size_t		key_len;
+	uint32_t	hash;
+	uint64_t	slot;
+} passwd_index_iter_t;
+
+int			passwd_index_build(char const *out, char const *in, passwd_index_format_t const *format,
+					   uint64_t *num_records, uint64_t *num_keys, uint64_t *num_skipped);
+
+passwd_index_t		*passwd_index_open(TALLOC_CTX *ctx, char const *filename, passwd_index_format_t const *format);
+
+passwd_index_header_t const *passwd_index_header(passwd_index_t const *pi);
+
+char const		*passwd_index_first(passwd_index_iter_t *iter, passwd_index_t const *pi,
+					    char const *key, size_t *len);
+
+char const		*passwd_index_next(passwd_index_iter_t *iter, passwd_index_t const *pi, size_t *len);
+#endif /* _RLM_PASSWD_INDEX_H */
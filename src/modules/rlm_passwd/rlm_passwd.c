@@ -28,6 +28,11 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/reload.h>
+
+#include <sys/stat.h>
+
+#include "passwd_index.h"
 
 struct mypasswd {
 	struct mypasswd *next;
@@ -145,11 +150,13 @@ static void release_hash_table(struct hashtable * ht){
 	ht->tablesize = 0;
 }
 
+#ifdef TEST
 static void release_ht(struct hashtable * ht){
 	if (!ht) return;
 	release_hash_table(ht);
 	talloc_free(ht);
 }
+#endif
 
 static struct hashtable * build_hash_table (char const * file, int nfields,
 					    int keyfield, int islist, int tablesize, int ignorenis, char delimiter)
@@ -348,14 +355,18 @@ int main(void){
 
 #else  /* TEST */
 typedef struct rlm_passwd_t {
-	struct hashtable	*ht;
+	char const		*name;
+	fr_reload_t		*reload;		//!< The hash table, as currently loaded.
 	struct mypasswd		*pwdfmt;
 	char const		*filename;
+	char const		*index_file;		//!< Built by rlm_passwd_index, used instead of
+							//!< reading filename into memory.
 	char const		*format;
 	char const		*delimiter;
 	bool			allow_multiple;
 	bool			ignore_nislike;
 	uint32_t		hash_size;
+	uint32_t		check_interval;
 	uint32_t		nfields;
 	uint32_t		keyfield;
 	uint32_t		listable;
@@ -365,6 +376,7 @@ typedef struct rlm_passwd_t {
 
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_INPUT | PW_TYPE_REQUIRED, rlm_passwd_t, filename) },
+	{ FR_CONF_OFFSET("index_file", PW_TYPE_FILE_INPUT, rlm_passwd_t, index_file) },
 	{ FR_CONF_OFFSET("format", PW_TYPE_STRING | PW_TYPE_REQUIRED, rlm_passwd_t, format) },
 	{ FR_CONF_OFFSET("delimiter", PW_TYPE_STRING, rlm_passwd_t, delimiter), .dflt = ":" },
 
@@ -375,9 +387,92 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("allow_multiple_keys", PW_TYPE_BOOLEAN, rlm_passwd_t, allow_multiple), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("hash_size", PW_TYPE_INTEGER, rlm_passwd_t, hash_size), .dflt = "100" },
+
+	{ FR_CONF_OFFSET("check_interval", PW_TYPE_INTEGER, rlm_passwd_t, check_interval), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
+static int _ht_free(struct hashtable *ht)
+{
+	release_hash_table(ht);
+
+	return 0;
+}
+
+/** Build the hash table
+ *
+ * Called by the reload thread, as well as when we're instantiated.
+ */
+static int passwd_load(void **out, uint64_t *entries, void *uctx)
+{
+	rlm_passwd_t const	*inst = uctx;
+	struct hashtable	*ht;
+	struct mypasswd		*pw;
+	int			i;
+
+	if (inst->index_file) {
+		passwd_index_t			*pi;
+		passwd_index_header_t const	*header;
+		passwd_index_format_t		format = {
+							.nfields = inst->nfields,
+							.keyfield = inst->keyfield,
+							.delimiter = *inst->delimiter,
+							.listable = inst->listable,
+							.ignore_nislike = inst->ignore_nislike
+						};
+		struct stat			buf;
+
+		pi = passwd_index_open(NULL, inst->index_file, &format);
+		if (!pi) {
+			ERROR("%s", fr_strerror());
+			return -1;
+		}
+		header = passwd_index_header(pi);
+
+		/*
+		 *	Still usable, but the entries may be out of date.
+		 */
+		if ((stat(inst->filename, &buf) == 0) &&
+		    ((header->source_mtime != (uint64_t)buf.st_mtime) || (header->source_size != (uint64_t)buf.st_size))) {
+			WARN("%s has changed since %s was built, re-run rlm_passwd_index", inst->filename, inst->index_file);
+		}
+
+		*entries = header->num_records;
+		*out = pi;
+
+		return 0;
+	}
+
+	ht = build_hash_table(inst->filename, inst->nfields, inst->keyfield, inst->listable,
+			      inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+	if (!ht) {
+		ERROR("Can't build hashtable from passwd file");
+		return -1;
+	}
+	talloc_set_destructor(ht, _ht_free);
+
+	for (i = 0; i < ht->tablesize; i++) {
+		for (pw = ht->table[i]; pw; pw = pw->next) (*entries)++;
+	}
+
+	*out = ht;
+
+	return 0;
+}
+
+/** Reload the passwd file, or return statistics about it
+ *
+ * Example: "%{etc_passwd:reload}", "%{etc_passwd:stats entries}"
+ */
+static ssize_t passwd_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
+			   void const *mod_inst, UNUSED void const *xlat_inst,
+			   REQUEST *request, char const *fmt)
+{
+	rlm_passwd_t const *inst = mod_inst;
+
+	return fr_reload_xlat(out, inst->reload, request, fmt);
+}
+
 static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
 	int			nfields = 0, keyfield = -1, listable = 0;
@@ -431,20 +526,12 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 			      inst->format);
 		return -1;
 	}
-	if (! (inst->ht = build_hash_table (inst->filename, nfields, keyfield, listable, inst->hash_size, inst->ignore_nislike, *inst->delimiter)) ){
-		ERROR("Can't build hashtable from passwd file");
-		return -1;
-	}
 	if (! (inst->pwdfmt = mypasswd_alloc(inst->format, nfields, &len)) ){
 		ERROR("Memory allocation failed");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 	if (!string_to_entry(inst->format, nfields, ':', inst->pwdfmt , len)) {
 		ERROR("Unable to convert format entry");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -459,14 +546,10 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	}
 	if (!*inst->pwdfmt->field[keyfield]) {
 		cf_log_err_cs(conf, "key field is empty");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 	if (!(da = fr_dict_attr_by_name(NULL, inst->pwdfmt->field[keyfield]))) {
 		ERROR("Unable to resolve attribute: %s", inst->pwdfmt->field[keyfield]);
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -478,6 +561,23 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	DEBUG3("nfields: %d keyfield %d(%s) listable: %s", nfields, keyfield,
 	       inst->pwdfmt->field[keyfield], listable ? "yes" : "no");
 
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	/*
+	 *	Instance data is read only once we're instantiated,
+	 *	so the reloadable data can't be parented by it.
+	 *
+	 *	Indexes are replaced by renaming a new index over
+	 *	the old one, so that's the file to watch.
+	 */
+	inst->reload = fr_reload_create(NULL, inst->name, passwd_load, inst,
+					inst->index_file ? &inst->index_file : &inst->filename, 1,
+					inst->check_interval);
+	if (!inst->reload) return -1;
+
+	xlat_register(inst, inst->name, passwd_xlat, NULL, NULL, 0, 0);
+
 	return 0;
 
 #undef inst
@@ -485,10 +585,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 
 static int mod_detach (void *instance) {
 #define inst ((rlm_passwd_t *)instance)
-	if(inst->ht) {
-		release_ht(inst->ht);
-		inst->ht = NULL;
-	}
+	TALLOC_FREE(inst->reload);
 	talloc_free(inst->pwdfmt);
 	return 0;
 #undef inst
@@ -513,6 +610,34 @@ static void result_add(TALLOC_CTX *ctx, rlm_passwd_t const *inst, REQUEST *reque
 	}
 }
 
+/** Add the attributes from each line of the index with a key
+ *
+ * @return the number of lines found.
+ */
+static int index_map(rlm_passwd_t const *inst, REQUEST *request, passwd_index_t const *pi, char const *name)
+{
+	passwd_index_iter_t	iter;
+	char const		*line;
+	size_t			line_len, len;
+	struct mypasswd		*pw;
+	int			found = 0;
+
+	for (line = passwd_index_first(&iter, pi, name, &line_len);
+	     line;
+	     line = passwd_index_next(&iter, pi, &line_len)) {
+		pw = mypasswd_alloc(line, inst->nfields, &len);
+		if (string_to_entry(line, inst->nfields, *inst->delimiter, pw, len)) {
+			result_add(request, inst, request, &request->control, pw, 0, "config");
+			result_add(request->reply, inst, request, &request->reply->vps, pw, 1, "reply_items");
+			result_add(request->packet, inst, request, &request->packet->vps, pw, 2, "request_items");
+			found++;
+		}
+		talloc_free(pw);
+	}
+
+	return found;
+}
+
 static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	rlm_passwd_t const	*inst = instance;
@@ -520,14 +645,24 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, UNUSED void *
 	char			buffer[1024];
 	VALUE_PAIR		*key, *i;
 	struct mypasswd		*pw, *last_found;
+	struct hashtable	*ht;
+	void const		*data;
 	vp_cursor_t		cursor;
 	int			found = 0;
+	unsigned int		ref;
 
 	key = fr_pair_find_by_da(request->packet->vps, inst->keyattr, TAG_ANY);
 	if (!key) {
 		return RLM_MODULE_NOTFOUND;
 	}
 
+	/*
+	 *	Lookups don't modify the table, as long as it
+	 *	has a non-zero size.
+	 */
+	data = fr_reload_acquire(inst->reload, &ref);
+	memcpy(&ht, &data, sizeof(ht));
+
 	for (i = fr_pair_cursor_init(&cursor, &key);
 	     i;
 	     i = fr_pair_cursor_next_by_num(&cursor, inst->keyattr->vendor, inst->keyattr->attr, TAG_ANY)) {
@@ -535,14 +670,23 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, UNUSED void *
 		 *	Ensure we have the string form of the attribute
 		 */
 		fr_pair_value_snprint(buffer, sizeof(buffer), i, 0);
-		if (!(pw = get_pw_nam(buffer, inst->ht, &last_found)) ) {
+
+		if (inst->index_file) {
+			if (!*buffer || !index_map(inst, request, data, buffer)) continue;
+
+			found++;
+			if (!inst->allow_multiple) break;
+			continue;
+		}
+
+		if (!(pw = get_pw_nam(buffer, ht, &last_found)) ) {
 			continue;
 		}
 		do {
 			result_add(request, inst, request, &request->control, pw, 0, "config");
 			result_add(request->reply, inst, request, &request->reply->vps, pw, 1, "reply_items");
 			result_add(request->packet, inst, request, &request->packet->vps, pw, 2, "request_items");
-		} while ((pw = get_next(buffer, inst->ht, &last_found)));
+		} while ((pw = get_next(buffer, ht, &last_found)));
 
 		found++;
 
@@ -551,6 +695,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, UNUSED void *
 		}
 	}
 
+	fr_reload_release(inst->reload, ref);
+
 	if (!found) return RLM_MODULE_NOTFOUND;
 
 	return RLM_MODULE_OK;
@@ -0,0 +1,2 @@
+TARGET		:= rlm_passwd.a
+SOURCES		:= rlm_passwd.c passwd_index.c
@@ -0,0 +1,138 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_passwd_index.c
+ * @brief Build index files for rlm_passwd.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#include "passwd_index.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static char const *name;
+
+static void NEVER_RETURNS usage(int ret)
+{
+	fprintf(stderr, "Usage: %s -F format [-d delimiter] [-Ih] passwd_file index_file\n", name);
+	fprintf(stderr, "  -F format              Format of the passwd file, as in the passwd module's\n");
+	fprintf(stderr, "                         configuration, e.g. \"*User-Name:Crypt-Password:\".\n");
+	fprintf(stderr, "  -d delimiter           Field delimiter (default ':').\n");
+	fprintf(stderr, "  -I                     Index lines starting with '+' or '-'.  Use this if\n");
+	fprintf(stderr, "                         the module sets ignore_nislike = no.\n");
+	fprintf(stderr, "  -h                     Print this help message and exit.\n");
+	exit(ret);
+}
+
+/** Find the number of fields, and the key field, from an rlm_passwd format string
+ *
+ * Only the '*' and ',' markers matter for the index.  The '=' and '~' markers
+ * are applied by the module when it reads the records.
+ */
+static int format_parse(passwd_index_format_t *format, char const *str)
+{
+	char const	*p = str;
+	bool		found = false;
+
+	format->nfields = 0;
+	format->listable = false;
+
+	for (;;) {
+		if (*p == '*') {
+			format->keyfield = format->nfields;
+			found = true;
+			p++;
+		}
+		if (*p == ',') {
+			format->listable = true;
+			p++;
+		}
+		format->nfields++;
+
+		p = strchr(p, ':');
+		if (!p) break;
+		p++;
+	}
+
+	if (!found) {
+		fprintf(stderr, "%s: No field marked as key in format \"%s\"\n", name, str);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*format_str = NULL;
+	passwd_index_format_t	format = {
+					.delimiter = ':',
+					.ignore_nislike = true
+				};
+	uint64_t		num_records, num_keys, num_skipped;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "d:F:Ih")) != EOF) switch (c) {
+	case 'd':
+		if (strlen(optarg) != 1) usage(64);
+		format.delimiter = *optarg;
+		break;
+
+	case 'F':
+		format_str = optarg;
+		break;
+
+	case 'I':
+		format.ignore_nislike = false;
+		break;
+
+	case 'h':
+		usage(0);
+
+	default:
+		usage(64);
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (!format_str || (argc != 2)) usage(64);
+
+	if (format_parse(&format, format_str) < 0) exit(64);
+
+	if (passwd_index_build(argv[1], argv[0], &format, &num_records, &num_keys, &num_skipped) < 0) {
+		fprintf(stderr, "%s: %s\n", name, fr_strerror());
+		exit(1);
+	}
+
+	if (num_skipped) {
+		fprintf(stderr, "%s: Ignored %" PRIu64 " lines in %s which were too long\n",
+			name, num_skipped, argv[0]);
+	}
+
+	printf("Indexed %" PRIu64 " records, with %" PRIu64 " keys\n", num_records, num_keys);
+
+	return 0;
+}
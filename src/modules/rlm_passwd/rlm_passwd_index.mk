@@ -0,0 +1,7 @@
+TARGET		:= rlm_passwd_index
+SOURCES		:= rlm_passwd_index.c passwd_index.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	+= $(TALLOC_LIBS)
+
+MAN		:= rlm_passwd_index.8
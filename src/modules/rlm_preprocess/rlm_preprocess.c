@@ -29,14 +29,24 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/reload.h>
 
 #include <ctype.h>
 
+/** The huntgroups and hints files, replaced as a unit on reload
+ *
+ */
+typedef struct preprocess_data {
+	PAIR_LIST	*huntgroups;
+	PAIR_LIST	*hints;
+} preprocess_data_t;
+
 typedef struct rlm_preprocess_t {
+	char const	*name;
 	char const	*huntgroup_file;
 	char const	*hints_file;
-	PAIR_LIST	*huntgroups;
-	PAIR_LIST	*hints;
+	uint32_t	check_interval;
+	fr_reload_t	*reload;		//!< The files, as currently loaded.
 	bool		with_ascend_hack;
 	uint32_t	ascend_channels_per_line;
 	bool		with_ntdomain_hack;
@@ -48,6 +58,7 @@ typedef struct rlm_preprocess_t {
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("huntgroups", PW_TYPE_FILE_INPUT, rlm_preprocess_t, huntgroup_file) },
 	{ FR_CONF_OFFSET("hints", PW_TYPE_FILE_INPUT, rlm_preprocess_t, hints_file) },
+	{ FR_CONF_OFFSET("check_interval", PW_TYPE_INTEGER, rlm_preprocess_t, check_interval), .dflt = "0" },
 	{ FR_CONF_OFFSET("with_ascend_hack", PW_TYPE_BOOLEAN, rlm_preprocess_t, with_ascend_hack), .dflt = "no" },
 	{ FR_CONF_OFFSET("ascend_channels_per_line", PW_TYPE_INTEGER, rlm_preprocess_t, ascend_channels_per_line), .dflt = "23" },
 
@@ -487,22 +498,26 @@ static int add_nas_attr(REQUEST *request)
 }
 
 
-/*
- *	Initialize.
+/** Read the huntgroups and hints files
+ *
+ * Called by the reload thread, as well as when we're instantiated.
  */
-static int mod_instantiate(UNUSED CONF_SECTION *conf, void *instance)
+static int preprocess_load(void **out, uint64_t *entries, void *uctx)
 {
-	int ret;
-	rlm_preprocess_t *inst = instance;
+	rlm_preprocess_t const	*inst = uctx;
+	preprocess_data_t	*data;
+	PAIR_LIST		*pl;
+
+	MEM(data = talloc_zero(NULL, preprocess_data_t));
 
 	/*
 	 *	Read the huntgroups file.
 	 */
 	if (inst->huntgroup_file) {
-		ret = pairlist_read(inst, inst->huntgroup_file, &(inst->huntgroups), 0);
-		if (ret < 0) {
+		if (pairlist_read(data, inst->huntgroup_file, &data->huntgroups, 0) < 0) {
 			ERROR("Error reading %s", inst->huntgroup_file);
-
+		error:
+			talloc_free(data);
 			return -1;
 		}
 	}
@@ -511,14 +526,63 @@ static int mod_instantiate(UNUSED CONF_SECTION *conf, void *instance)
 	 *	Read the hints file.
 	 */
 	if (inst->hints_file) {
-		ret = pairlist_read(inst, inst->hints_file, &(inst->hints), 0);
-		if (ret < 0) {
+		if (pairlist_read(data, inst->hints_file, &data->hints, 0) < 0) {
 			ERROR("Error reading %s", inst->hints_file);
-
-			return -1;
+			goto error;
 		}
 	}
 
+	for (pl = data->huntgroups; pl; pl = pl->next) (*entries)++;
+	for (pl = data->hints; pl; pl = pl->next) (*entries)++;
+
+	*out = data;
+
+	return 0;
+}
+
+/** Reload the huntgroups and hints files, or return statistics about them
+ *
+ * Example: "%{preprocess:reload}", "%{preprocess:stats entries}"
+ */
+static ssize_t preprocess_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
+			       void const *mod_inst, UNUSED void const *xlat_inst,
+			       REQUEST *request, char const *fmt)
+{
+	rlm_preprocess_t const *inst = mod_inst;
+
+	return fr_reload_xlat(out, inst->reload, request, fmt);
+}
+
+/*
+ *	Initialize.
+ */
+static int mod_instantiate(CONF_SECTION *conf, void *instance)
+{
+	rlm_preprocess_t	*inst = instance;
+	char const		*files[] = { inst->huntgroup_file, inst->hints_file };
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	/*
+	 *	Instance data is read only once we're instantiated,
+	 *	so the reloadable data can't be parented by it.
+	 */
+	inst->reload = fr_reload_create(NULL, inst->name, preprocess_load, inst,
+					files, sizeof(files) / sizeof(*files), inst->check_interval);
+	if (!inst->reload) return -1;
+
+	xlat_register(inst, inst->name, preprocess_xlat, NULL, NULL, 0, 0);
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_preprocess_t *inst = instance;
+
+	TALLOC_FREE(inst->reload);
+
 	return 0;
 }
 
@@ -529,6 +593,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
 {
 	int r;
 	rlm_preprocess_t const *inst = instance;
+	preprocess_data_t const *data;
+	unsigned int ref;
 
 	VALUE_PAIR *vp;
 
@@ -584,7 +650,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
 		return RLM_MODULE_FAIL;
 	}
 
-	hints_setup(inst->hints, request);
+	data = fr_reload_acquire(inst->reload, &ref);
+	hints_setup(data->hints, request);
 
 	/*
 	 *      If there is a PW_CHAP_PASSWORD attribute but there
@@ -597,7 +664,10 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
 		fr_pair_value_memcpy(vp, request->packet->vector, AUTH_VECTOR_LEN);
 	}
 
-	if ((r = huntgroup_access(request, inst->huntgroups)) != RLM_MODULE_OK) {
+	r = huntgroup_access(request, data->huntgroups);
+	fr_reload_release(inst->reload, ref);
+
+	if (r != RLM_MODULE_OK) {
 		char buf[1024];
 		RIDEBUG("No huntgroup access: [%s] (%s)",
 			request->username ? request->username->vp_strvalue : "<NO User-Name>",
@@ -617,6 +687,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_preaccounting(void *instance, UNUSED voi
 	int r;
 	VALUE_PAIR *vp;
 	rlm_preprocess_t const *inst = instance;
+	preprocess_data_t const *data;
+	unsigned int ref;
 
 	/*
 	 *  Ensure that we have the SAME user name for both
@@ -647,7 +719,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_preaccounting(void *instance, UNUSED voi
 		return RLM_MODULE_FAIL;
 	}
 
-	hints_setup(inst->hints, request);
+	data = fr_reload_acquire(inst->reload, &ref);
+	hints_setup(data->hints, request);
 
 	/*
 	 *	Add an event timestamp.  This means that the rest of
@@ -671,7 +744,10 @@ static rlm_rcode_t CC_HINT(nonnull) mod_preaccounting(void *instance, UNUSED voi
 		}
 	}
 
-	if ((r = huntgroup_access(request, inst->huntgroups)) != RLM_MODULE_OK) {
+	r = huntgroup_access(request, data->huntgroups);
+	fr_reload_release(inst->reload, ref);
+
+	if (r != RLM_MODULE_OK) {
 		char buf[1024];
 		RIDEBUG("No huntgroup access: [%s] (%s)",
 			request->username ? request->username->vp_strvalue : "<NO User-Name>",
@@ -690,6 +766,7 @@ rad_module_t rlm_preprocess = {
 	.inst_size	= sizeof(rlm_preprocess_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_PREACCT]		= mod_preaccounting
@@ -150,7 +150,8 @@ static void mod_event_fd(UNUSED fr_event_list_t *el, int fd, void *ctx)
 	/*
 	 *	If the reply fails the signature validation, it's not a real reply.
 	 */
-	if (fr_radius_verify(reply, ccr->packet, ccr->inst->home_server->secret) < 0) {
+	if (fr_radius_verify_keyed(reply, ccr->packet, ccr->inst->home_server->secret,
+				   ccr->inst->home_server->secret_hmac) < 0) {
 		REDEBUG("Reply verification failed for home server %s", ccr->inst->home_server->name);
 		fr_radius_free(&reply);
 		return;
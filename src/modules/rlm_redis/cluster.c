@@ -69,6 +69,27 @@
  *
  * See #fr_redis_cluster_state_init for example code.
  *
+ * Using the asynchronous API
+ * --------------------------
+ *
+ * Modules running in the new async framework can avoid blocking a worker thread for the
+ * duration of a round trip, by using the asynchronous API.
+ *
+ *     1. In the module's thread_instantiate callback, allocate a per-thread client with
+ *        #fr_redis_cluster_thread_alloc.  The client holds a single non-blocking connection
+ *        to each node it communicates with.  Commands from all requests processed by the
+ *        thread are pipelined over that connection.
+ *     2. Allocate a command set with #fr_redis_cluster_async_alloc, add commands with
+ *        #fr_redis_cluster_async_append, and send it with #fr_redis_cluster_async_send.
+ *     3. Yield with unlang_yield().  -MOVED, -ASK and -TRYAGAIN are handled internally,
+ *        and the request is only resumed once a final result is available.
+ *     4. In the resume function, retrieve the replies with #fr_redis_cluster_async_result.
+ *
+ * Cluster remaps are non-blocking too.  'cluster slots' is queued on the thread's
+ * connection to the node, and the new map is applied when the reply arrives.
+ * Connections to nodes which are new to the cluster are still opened by the node's
+ * connection pool when the map is applied.
+ *
  * Structures
  * ----------
  *
@@ -85,9 +106,9 @@
  *   indexes in the fr_redis_cluster_t.node array.  We use 8bit unsigned integers instead of
  *   pointers to save space.  Using pointers, the node[] array would need 784K, using IDs
  *   it uses 112K.  Still not light on memory, but a bit more acceptable.
- *   Currently the key_slot array is shadowed by key_slot_pending, used to stage new key_slot
- *   mappings.  This doubles the memory used.  We may want to consider allocating key_slot_pending
- *   only during remappings and freeing it after.
+ *   The key_slot array is held in a #fr_redis_slot_table_t.  New mappings are staged in a
+ *   pending copy of the table, which is published with an atomic pointer swap.  Workers
+ *   routing commands never take the cluster mutex, and always see a complete mapping.
  *
  * Mapping/Remapping the cluster
  * -----------------------------
@@ -103,7 +124,7 @@
  *     4. Connecting to nodes that were in the result, but not in the tree.
  *        Note: If we can't connect to any of the masters, we count the map as invalid, roll
  *        back any newly connected nodes, and error out. Slave failure is OK.
- *     5. Mapping keyslot ranges to nodes in the key_slot_pending array.
+ *     5. Mapping keyslot ranges to nodes in the pending key slot table.
  *     6. Verifying there are no holes in the ranges (if there are, we roll back and error out).
  *     7. Applying the new keyslot ranges.
  *     8. Removing nodes no longer used by the key slots, and adding them back to the free
@@ -147,13 +168,10 @@
  */
 #include "redis.h"
 #include "cluster.h"
-#include "crc16.h"
+#include "slot_table.h"
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/modules.h>
 
-#define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
-
-#define MAX_SLAVES		5			//!< Maximum number of slaves associated
-							//!< with a keyslot.
 
 /*
  *	Periods and weights for live node selection
@@ -222,18 +240,6 @@ typedef struct fr_redis_cluster_node {
 							//!< we need to issue to every master in the cluster.
 } cluster_node_t;
 
-/** Indexes in the cluster_node_t array for a single key slot
- *
- * When dealing with 16K entries, space is a concern. It's significantly
- * more memory efficient to use 8bit indexes than 64bit pointers for each
- * of the key slot to node mappings.
- */
-typedef struct cluster_key_slot {
-	uint8_t			slave[MAX_SLAVES];	//!< R/O node (slave) for this key slot.
-	uint8_t			slave_num;		//!< Number of slaves associated with this key slot.
-	uint8_t			master;			//!< R/W node (master) for this key slot.
-} cluster_key_slot_t;
-
 /** A redis cluster
  *
  * Holds all the structures and collections of nodes, to represent a Redis cluster.
@@ -259,40 +265,12 @@ struct fr_redis_cluster {
 	fr_fifo_t		*free_nodes;		//!< Queue of free nodes (or nodes waiting to be reused).
 	rbtree_t		*used_nodes;		//!< Tree of used nodes.
 
-	cluster_key_slot_t	key_slot[KEY_SLOTS];		//!< Lookup table of slots to pools.
-	cluster_key_slot_t	key_slot_pending[KEY_SLOTS];	//!< Pending key slot table.
+	fr_redis_slot_table_t	*slot_table;		//!< Lookup table of slots to nodes.
 
 	pthread_mutex_t		mutex;			//!< Mutex to synchronise cluster operations.
 };
 
 
-/** Resolve key to key slot
- *
- * Identical to the example implementation, except it uses memchr which will
- * be faster, and isn't so needlessly complex.
- *
- * @param[in] key to resolve.
- * @param[in] key_len length of key.
- * @return key slot index for the key.
- */
-static uint16_t cluster_key_hash(uint8_t const *key, size_t key_len)
-{
-	uint8_t *p, *q;
-
-	p = memchr(key, '{', key_len);
-	if (!p) {
-	all:
-		return fr_crc16_xmodem(key, key_len) & (KEY_SLOTS - 1);
-	}
-
-	q = memchr(p, '}', key_len - (p - key)); /* look for } after { */
-	if (!q || (q == p + 1)) goto all; /* no } or {}, hash everything */
-
-	p++;	/* skip '{' */
-
-    	return fr_crc16_xmodem(p, q - p) & (KEY_SLOTS - 1);	/* hash stuff between { and } */
-}
-
 /** Compare two redis nodes to check equality
  *
  * @param[in] a first node.
@@ -526,6 +504,8 @@ static cluster_rcode_t cluster_map_apply(fr_redis_cluster_t *cluster, redisReply
 	uint8_t		rollback[UINT8_MAX];		// Set of nodes to re-add to the queue on failure.
 	bool		active[UINT8_MAX];		// Set of nodes active in the new cluster map.
 	bool		master[UINT8_MAX];		// Master nodes.
+
+	cluster_key_slot_t *key_slot_pending;		// Key slot table we're building.
 #ifndef NDEBUG
 #  define SET_ADDR(_addr, _map) \
 do { \
@@ -570,7 +550,8 @@ do { \
 	/*
 	 *	Must be cleared with the mutex held
 	 */
-	memset(&cluster->key_slot_pending, 0, sizeof(cluster->key_slot_pending));
+	key_slot_pending = fr_redis_slot_table_pending(cluster->slot_table);
+	memset(key_slot_pending, 0, sizeof(*key_slot_pending) * KEY_SLOTS);
 
 	/*
 	 *	Insert new nodes and markup the keyslot indexes
@@ -674,8 +655,7 @@ do { \
 		 *	specified by the range for this map.
 		 */
 		for (k = map->element[0]->integer; k <= map->element[1]->integer; k++) {
-			memcpy(&cluster->key_slot_pending[k], &tmpl_slot,
-			       sizeof(*(cluster->key_slot_pending)));
+			memcpy(&key_slot_pending[k], &tmpl_slot, sizeof(*key_slot_pending));
 		}
 	}
 
@@ -691,7 +671,7 @@ do { \
 	 *	error out.
 	 */
 	for (i = 0; i < KEY_SLOTS; i++) {
-		if (cluster->key_slot_pending[i].master == 0) {
+		if (key_slot_pending[i].master == 0) {
 			fr_strerror_printf("Cluster is misconfigured, no node assigned for key %zu", i);
 			rcode = CLUSTER_OP_BAD_INPUT;
 			goto error;
@@ -702,12 +682,13 @@ do { \
 	 *	We have connections/pools for all the nodes in
 	 *	the new map, apply it to the live cluster.
 	 *
-	 *	Other workers may be using the key slot table,
-	 *	but that's ok. Nodes and pools are never freed,
-	 *	so the worst that will happen, is they'll hit
-	 *	the wrong node for the key, and get redirected.
+	 *	Other workers may still be routing commands
+	 *	using the old mappings, but that's ok. Nodes
+	 *	and pools are never freed, so the worst that
+	 *	will happen, is they'll hit the wrong node for
+	 *	the key, and get redirected.
 	 */
-	memcpy(&cluster->key_slot, &cluster->key_slot_pending, sizeof(cluster->key_slot));
+	fr_redis_slot_table_publish(cluster->slot_table);
 
 	/*
 	 *	Anything not in the active set of nodes gets
@@ -814,50 +795,22 @@ static int cluster_map_node_validate(redisReply *node, int map_idx, int node_idx
 	return CLUSTER_OP_SUCCESS;
 }
 
-/** Learn a new cluster layout by querying the node that issued the -MOVE
+/** Validate the response to a 'cluster slots' command
  *
- * Also validates the response from the Redis cluster, so we can be sure that
- * it's well formed, before doing more expensive operations.
+ * Checks the response from the Redis cluster is well formed, before we do
+ * more expensive operations with it.
  *
  * @note Errors may be retrieved with fr_strerror().
  *
- * @param[out] out Where to write cluster map.
- * @param[in] conn to use for learning the new cluster map.
+ * @param[in] reply to 'cluster slots'.
  * @return
- *	- CLUSTER_OP_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
  *	- CLUSTER_OP_SUCCESS on success.
- *	- CLUSTER_OP_FAILED if issuing the command resulted in an error.
- *	- CLUSTER_OP_NO_CONNECTION connection failure.
  *	- CLUSTER_OP_BAD_INPUT on validation failure (bad data returned from Redis).
  */
-static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+static cluster_rcode_t cluster_map_validate(redisReply *reply)
 {
-	redisReply	*reply;
 	size_t		i = 0;
 
-	*out = NULL;
-
-	reply = redisCommand(conn->handle, "cluster slots");
-	switch (fr_redis_command_status(conn, reply)) {
-	case REDIS_RCODE_RECONNECT:
-		fr_redis_reply_free(reply);
-		fr_strerror_printf("No connections available");
-		return CLUSTER_OP_NO_CONNECTION;
-
-	case REDIS_RCODE_ERROR:
-	default:
-		if (reply && reply->type == REDIS_REPLY_ERROR) {
-			fr_redis_reply_free(reply);
-			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
-			return CLUSTER_OP_IGNORED;
-		}
-		fr_strerror_printf("Unknown client error");
-		return CLUSTER_OP_FAILED;
-
-	case REDIS_RCODE_SUCCESS:
-		break;
-	}
-
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		fr_strerror_printf("Bad response to \"cluster slots\" command, expected array got %s",
 				   fr_int2str(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -884,7 +837,6 @@ static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
 			fr_strerror_printf("Cluster map %zu is wrong type, expected array got %s",
 				   	   i, fr_int2str(redis_reply_types, map->type, "<UNKNOWN>"));
 		error:
-			fr_redis_reply_free(reply);
 			return CLUSTER_OP_BAD_INPUT;
 		}
 
@@ -955,11 +907,101 @@ static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
 			if (cluster_map_node_validate(map->element[j], i, j - 2) < 0) goto error;
 		}
 	}
+	return CLUSTER_OP_SUCCESS;
+}
+
+/** Learn a new cluster layout by querying the node that issued the -MOVE
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[out] out Where to write cluster map.
+ * @param[in] conn to use for learning the new cluster map.
+ * @return
+ *	- CLUSTER_OP_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
+ *	- CLUSTER_OP_SUCCESS on success.
+ *	- CLUSTER_OP_FAILED if issuing the command resulted in an error.
+ *	- CLUSTER_OP_NO_CONNECTION connection failure.
+ *	- CLUSTER_OP_BAD_INPUT on validation failure (bad data returned from Redis).
+ */
+static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+{
+	redisReply	*reply;
+	cluster_rcode_t	ret;
+
+	*out = NULL;
+
+	reply = redisCommand(conn->handle, "cluster slots");
+	switch (fr_redis_command_status(conn, reply)) {
+	case REDIS_RCODE_RECONNECT:
+		fr_redis_reply_free(reply);
+		fr_strerror_printf("No connections available");
+		return CLUSTER_OP_NO_CONNECTION;
+
+	case REDIS_RCODE_ERROR:
+	default:
+		if (reply && reply->type == REDIS_REPLY_ERROR) {
+			fr_redis_reply_free(reply);
+			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
+			return CLUSTER_OP_IGNORED;
+		}
+		fr_strerror_printf("Unknown client error");
+		return CLUSTER_OP_FAILED;
+
+	case REDIS_RCODE_SUCCESS:
+		break;
+	}
+
+	ret = cluster_map_validate(reply);
+	if (ret != CLUSTER_OP_SUCCESS) {
+		fr_redis_reply_free(reply);
+		return ret;
+	}
 	*out = reply;
 
 	return CLUSTER_OP_SUCCESS;
 }
 
+/** Apply a validated cluster map, unless the cluster was remapped by someone else
+ *
+ * Checks again that the cluster isn't being remapped, or was remapped too
+ * recently, now we hold the mutex and the state of those variables is
+ * synchronized.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ * @note Must be called with the cluster mutex free.
+ *
+ * @param[in,out] cluster to remap.
+ * @param[in] map validated reply to 'cluster slots'.
+ * @param[in] now when the remap was initiated.
+ * @return
+ *	- CLUSTER_OP_IGNORED if the cluster is being, or was very recently remapped.
+ *	- CLUSTER_OP_SUCCESS on success.
+ *	- CLUSTER_OP_FAILED if the map couldn't be applied.
+ */
+static cluster_rcode_t cluster_map_update(fr_redis_cluster_t *cluster, redisReply *map, time_t now)
+{
+	cluster_rcode_t ret;
+
+	pthread_mutex_lock(&cluster->mutex);
+	if (cluster->remapping) {
+		pthread_mutex_unlock(&cluster->mutex);
+		fr_strerror_printf("Cluster remapping in progress, ignoring remap request");
+		return CLUSTER_OP_IGNORED;
+	}
+	if (now == cluster->last_updated) {
+		pthread_mutex_unlock(&cluster->mutex);
+		fr_strerror_printf("Cluster was updated less than a second ago, ignoring remap request");
+		return CLUSTER_OP_IGNORED;
+	}
+	ret = cluster_map_apply(cluster, map);
+	if (ret == CLUSTER_OP_SUCCESS) cluster->remap_needed = false;	/* Change on successful remap */
+	pthread_mutex_unlock(&cluster->mutex);
+
+	if (ret < 0) return CLUSTER_OP_FAILED;
+
+	return CLUSTER_OP_SUCCESS;
+}
+
 /** Perform a runtime remap of the cluster
  *
  * @note Errors may be retrieved with fr_strerror().
@@ -987,14 +1029,12 @@ static cluster_rcode_t cluster_remap(REQUEST *request, fr_redis_cluster_t *clust
 	 *	remapped it's unlikely that it needs remapping again.
 	 */
 	if (cluster->remapping) {
-	in_progress:
 		RDEBUG("Cluster remapping in progress, ignoring remap request");
 		return CLUSTER_OP_IGNORED;
 	}
 
 	now = time(NULL);
 	if (now == cluster->last_updated) {
-	too_soon:
 		RDEBUG("Cluster was updated less than a second ago, ignoring remap request");
 		return CLUSTER_OP_IGNORED;
 	}
@@ -1042,31 +1082,11 @@ static cluster_rcode_t cluster_remap(REQUEST *request, fr_redis_cluster_t *clust
 		REXDENT();
 	}
 
-	/*
-	 *	Check again that the cluster isn't being
-	 *	remapped, or was remapped too recently,
-	 *	now we hold the mutex and the state of
-	 *	those variables is synchronized.
-	 */
-	pthread_mutex_lock(&cluster->mutex);
-	if (cluster->remapping) {
-		pthread_mutex_unlock(&cluster->mutex);
-		fr_redis_reply_free(map);	/* Free the map */
-		goto in_progress;
-	}
-	if (now == cluster->last_updated) {
-		pthread_mutex_unlock(&cluster->mutex);
-		fr_redis_reply_free(map);	/* Free the map */
-		goto too_soon;
-	}
-	ret = cluster_map_apply(cluster, map);
-	if (ret == CLUSTER_OP_SUCCESS) cluster->remap_needed = false;	/* Change on successful remap */
-	pthread_mutex_unlock(&cluster->mutex);
-
+	ret = cluster_map_update(cluster, map, now);
 	fr_redis_reply_free(map);	/* Free the map */
-	if (ret < 0) return CLUSTER_OP_FAILED;
+	if (ret == CLUSTER_OP_IGNORED) RDEBUG("%s", fr_strerror());
 
-	return CLUSTER_OP_SUCCESS;
+	return ret;
 }
 
 /** Retrieve or associate a node with the server indicated in the redirect
@@ -1550,22 +1570,27 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, struct timev
  * If there's only a single node in the cluster, then we avoid the CRC16
  * and just use key slot 0.
  *
+ * The node mappings are copied out of the live key slot table, so remain
+ * consistent even if the cluster is remapped while the caller is using them.
+ *
+ * @param out where to write the node mappings for the key slot.
  * @param cluster to determine key slot for.
  * @param request The current request.
  * @param key the key to resolve.
  * @param key_len the length of the key.
- * @return pointer to key slot key resolves to.
+ * @return the key slot the key resolves to.
  */
-static cluster_key_slot_t *cluster_slot_by_key(fr_redis_cluster_t *cluster, REQUEST *request,
-					       uint8_t const *key, size_t key_len)
+static uint16_t cluster_slot_by_key(cluster_key_slot_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				    uint8_t const *key, size_t key_len)
 {
-	cluster_key_slot_t *key_slot;
+	uint16_t slot;
 
 	if (!key || (key_len == 0)) {
-		key_slot = &cluster->key_slot[(uint16_t)(fr_rand() & (KEY_SLOTS - 1))];
-		RDEBUG2("Key rand() -> slot %zu", key_slot - cluster->key_slot);
+		slot = (uint16_t)(fr_rand() & (KEY_SLOTS - 1));
+		RDEBUG2("Key rand() -> slot %u", slot);
 
-		return key_slot;
+		fr_redis_slot_table_read(out, cluster->slot_table, slot);
+		return slot;
 	}
 
 	/*
@@ -1573,20 +1598,22 @@ static cluster_key_slot_t *cluster_slot_by_key(fr_redis_cluster_t *cluster, REQU
 	 *	without clustering.
 	 */
 	if (rbtree_num_elements(cluster->used_nodes) > 1) {
-		key_slot = &cluster->key_slot[cluster_key_hash(key, key_len)];
+		slot = fr_redis_key_slot(key, key_len);
 		if (RDEBUG_ENABLED2) {
 			char *p;
 
 			p = fr_asprint(request, (char const *)key, key_len, '"');
-			RDEBUG2("Key \"%s\" -> slot %zu", p, key_slot - cluster->key_slot);
+			RDEBUG2("Key \"%s\" -> slot %u", p, slot);
 			talloc_free(p);
 		}
 
-		return key_slot;
+		fr_redis_slot_table_read(out, cluster->slot_table, slot);
+		return slot;
 	}
 	RDEBUG3("Single node available, skipping key selection");
 
-	return &cluster->key_slot[0];
+	fr_redis_slot_table_read(out, cluster->slot_table, 0);
+	return 0;
 }
 
 /** Resolve a key to a pool, and reserve a connection in that pool
@@ -1637,7 +1664,8 @@ fr_redis_rcode_t fr_redis_cluster_state_init(fr_redis_cluster_state_t *state, fr
 					     uint8_t const *key, size_t key_len, bool read_only)
 {
 	cluster_node_t		*node;
-	cluster_key_slot_t	*key_slot;
+	cluster_key_slot_t	key_slot;
+	uint16_t		slot;
 	uint8_t			first, i;
 	int			used_nodes;
 
@@ -1654,23 +1682,23 @@ fr_redis_rcode_t fr_redis_cluster_state_init(fr_redis_cluster_state_t *state, fr
 	}
 
 again:
-	key_slot = cluster_slot_by_key(cluster, request, key, key_len);
+	slot = cluster_slot_by_key(&key_slot, cluster, request, key, key_len);
 
 	/*
 	 *	1. Try each of the slaves for the key slot
 	 *	2. Fall through to trying the master, and a single alternate node.
 	 */
 	if (read_only) {
-		first = fr_rand() & key_slot->slave_num;
-		for (i = 0; i < key_slot->slave_num; i++) {
+		first = fr_rand() & key_slot.slave_num;
+		for (i = 0; i < key_slot.slave_num; i++) {
 			uint8_t node_id;
 
-			node_id = key_slot->slave[(first + i) % key_slot->slave_num];
+			node_id = key_slot.slave[(first + i) % key_slot.slave_num];
 			node = &cluster->node[node_id];
 			*conn = fr_connection_get(node->pool, request);
 			if (!*conn) {
-				RDEBUG2("[%i] No connections available (key slot %zu slave %i)",
-					node->id, key_slot - cluster->key_slot, (first + i) % key_slot->slave_num);
+				RDEBUG2("[%i] No connections available (key slot %u slave %i)",
+					node->id, slot, (first + i) % key_slot.slave_num);
 				cluster->remap_needed = true;
 				continue;	/* Continue until we find a live pool */
 			}
@@ -1686,11 +1714,11 @@ again:
 	 *	3. If there are no pools, or we can't reserve a handle,
 	 *	   give up.
 	 */
-	node = &cluster->node[key_slot->master];
+	node = &cluster->node[key_slot.master];
 	*conn = fr_connection_get(node->pool, request);
 	if (!*conn) {
-		RDEBUG2("[%i] No connections available (key slot %zu master)",
-			node->id, key_slot - cluster->key_slot);
+		RDEBUG2("[%i] No connections available (key slot %u master)",
+			node->id, slot);
 		cluster->remap_needed = true;
 
 		if (cluster_node_find_live(&node, conn, request, cluster, node) < 0) return REDIS_RCODE_RECONNECT;
@@ -1839,7 +1867,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	 */
 	case REDIS_RCODE_RECONNECT:
 	{
-		cluster_key_slot_t *key_slot;
+		cluster_key_slot_t key_slot;
 
 		RERROR("[%i] Failed communicating with %s:%i: %s", state->node->id, state->node->name,
 		       state->node->addr.port, fr_strerror());
@@ -1855,8 +1883,8 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 		/*
 		 *	Refresh the key slot
 		 */
-		key_slot = cluster_slot_by_key(cluster, request, state->key, state->key_len);
-		state->node = &cluster->node[key_slot->master];
+		cluster_slot_by_key(&key_slot, cluster, request, state->key, state->key_len);
+		state->node = &cluster->node[key_slot.master];
 
 		*conn = fr_connection_get(state->node->pool, request);
 		if (!*conn) {
@@ -1942,125 +1970,1131 @@ try_again:
 	return REDIS_RCODE_TRY_AGAIN;
 }
 
-/** Get the pool associated with a node in the cluster
- *
- * @note This is used for testing only.  It's not ifdef'd out because
- *	tests need to run against production builds too.
- *
- * @param[out] pool associated with the node.
- * @param[in] cluster to search for node in.
- * @param[in] node_addr to retrieve pool for.  Specifies IP and port of node.
- * @param[in] create Establish a connection to the specified node if it
- *	was previously unknown to the cluster client.
- * @return
- *	- 0 on success.
- *	- -1 if no such node exists.
+/*
+ *	Asynchronous cluster client
  */
-int fr_redis_cluster_pool_by_node_addr(fr_connection_pool_t **pool, fr_redis_cluster_t *cluster,
-				       fr_socket_addr_t *node_addr, bool create)
-{
-	cluster_node_t	find, *found;
 
-	find.addr.ipaddr = node_addr->ipaddr;
-	find.addr.port = node_addr->port;
+/** Maximum number of times we'll reconnect to a node for a single set of commands
+ *
+ * Each thread only holds a single connection per node, so if a fresh connection
+ * fails as well, the node is very likely down and we should wait for a remap.
+ */
+#define ASYNC_MAX_RECONNECTS	1
 
-	pthread_mutex_lock(&cluster->mutex);
-	found = rbtree_finddata(cluster->used_nodes, &find);
-	if (!found) {
-		cluster_node_t *spare;
-		char buffer[INET6_ADDRSTRLEN];
-		char const *hostname;
+typedef struct cluster_async_pending cluster_async_pending_t;
 
-		if (!create) {
-			pthread_mutex_unlock(&cluster->mutex);
+/** A reply we're waiting for on a node connection
+ *
+ * One of these is queued for every command written to a connection.  Redis
+ * returns replies in the order commands were received, so the head of the
+ * queue always identifies the owner of the next reply.
+ */
+struct cluster_async_pending {
+	cluster_async_pending_t		*next;		//!< Next reply we're expecting.
+	fr_redis_cluster_async_t	*async;		//!< Command set this reply belongs to.  NULL if
+							//!< the command was issued internally, or the
+							//!< command set was freed before its replies arrived.
+	bool				must_succeed;	//!< Close the connection if this command fails.
+							//!< Set for AUTH and SELECT.
+	bool				remap;		//!< Reply is a cluster map, from 'cluster slots'.
+};
 
-			hostname = inet_ntop(node_addr->ipaddr.af, &node_addr->ipaddr.ipaddr, buffer, sizeof(buffer));
-			rad_assert(hostname);	/* addr.ipaddr is probably corrupt */;
-			fr_strerror_printf("No existing node found with address %s, port %i",
-					   hostname, node_addr->port);
-			return -1;
-		}
+/** A non-blocking connection to a cluster node, owned by a single thread
+ *
+ * hiredis is only used for its output buffer and reply parser.  All I/O is
+ * driven by the thread's event list.
+ */
+typedef struct cluster_async_conn {
+	fr_redis_cluster_thread_t	*thread;	//!< Thread this connection belongs to.
+	cluster_node_t			*node;		//!< Node we're connected to.
+	fr_socket_addr_t		addr;		//!< Address of the node when the connection was opened.
+	redisContext			*handle;	//!< Non-blocking hiredis context.
 
-		spare = fr_fifo_peek(cluster->free_nodes);
-		if (!spare) {
-			fr_strerror_printf("Reached maximum connected nodes");
-			pthread_mutex_unlock(&cluster->mutex);
-			return -1;
-		}
-		spare->pending_addr = find.addr;	/* Set the config to be applied */
-		if (cluster_node_connect(cluster, spare) < 0) {
-			pthread_mutex_unlock(&cluster->mutex);
-			return -1;
-		}
-		rbtree_insert(cluster->used_nodes, spare);
-		fr_fifo_pop(cluster->free_nodes);
-		found = spare;
-	}
-	/*
-	 *	Sanity checks
-	 */
-	rad_assert(((talloc_array_length(cluster->node) - 1) - rbtree_num_elements(cluster->used_nodes)) ==
-		   fr_fifo_num_elements(cluster->free_nodes));
-	pthread_mutex_unlock(&cluster->mutex);
+	bool				connected;	//!< Non-blocking connect has completed.
+	bool				want_write;	//!< We're registered for writable events.
 
-	*pool = found->pool;
+	bool				dispatching;	//!< We're processing replies.  Processing one may
+							//!< close the connection, so closing is deferred
+							//!< until we're done.
+	bool				close_pending;	//!< Close the connection once we're done dispatching.
+	bool				close_retry;	//!< Retry the command sets in flight when we do.
 
-	return 0;
-}
+	cluster_async_pending_t		*head;		//!< Oldest reply we're waiting on.
+	cluster_async_pending_t		*tail;		//!< Newest reply we're waiting on.
+	uint32_t			outstanding;	//!< How many replies we're waiting on.
+} cluster_async_conn_t;
 
-/** Private ctx structure to pass to _cluster_role_walk
+/** Per-thread asynchronous cluster client
  *
  */
-typedef struct addr_by_role_ctx {
-	bool			is_master;
-	bool			is_slave;
-	uint8_t			count;
-	fr_socket_addr_t	*found;
-} addr_by_role_ctx_t;
+struct fr_redis_cluster_thread {
+	fr_redis_cluster_t		*cluster;	//!< Cluster we're issuing commands against.
+	fr_event_list_t			*el;		//!< Event list servicing this thread.
+	cluster_async_conn_t		*conn[UINT8_MAX];	//!< Connections indexed by node ID.
+	bool				remapping;	//!< We're waiting on a cluster map.
+};
 
-/** Walk all used pools, recording the IP addresses of ones matching the filter
+/** A set of pipelined commands, and the state needed to follow redirects
  *
- * @param context Where to write the node we found.
- * @param data node to check.
- * @return
- *	- 0 continue walking.
- *	- -1 found suitable node.
  */
-static int _cluster_role_walk(void *context, void *data)
-{
-	addr_by_role_ctx_t	*ctx = context;
-	cluster_node_t		*node = data;
+struct fr_redis_cluster_async {
+	fr_redis_cluster_thread_t	*thread;	//!< Thread the commands are being issued from.
+	REQUEST				*request;	//!< to resume when the replies have been received.
 
-	if ((ctx->is_master && node->is_master) || (ctx->is_slave && !node->is_master)) {
-		ctx->found[ctx->count++] = node->addr;
-	}
-	return 0;
-}
+	uint8_t const			*key;		//!< Key used to select the node.
+	size_t				key_len;	//!< Length of the key.
+	bool				read_only;	//!< Prefer slaves.
 
-/** Return an array of IP addresses belonging to masters or slaves
- *
- * @note We return IP addresses as they're safe to use across cluster remaps.
- * @note Result array must be freed (talloc_free()) after use.
+	char				**cmd;		//!< Formatted commands, ready to be written.
+	size_t				*cmd_len;	//!< Length of each formatted command.
+	size_t				cmd_num;	//!< Number of commands in the set.
+
+	redisReply			**reply;	//!< Replies, one for each command.
+	size_t				reply_num;	//!< How many replies we've received.
+
+	cluster_node_t			*node;		//!< Node we're communicating with.
+	cluster_async_conn_t		*conn;		//!< Connection the commands are in flight on.
+	cluster_async_pending_t		*pending;	//!< First of our entries in the connection's queue.
+	bool				asking;		//!< Prefix the commands with ASKING (-ASK redirect).
+
+	uint32_t			redirects;	//!< How many redirects have we followed.
+	uint32_t			retries;	//!< How many times we've received TRYAGAIN.
+	uint32_t			reconnects;	//!< How many times we've reconnected.
+
+	fr_event_timer_t		*retry_ev;	//!< Delay before retrying after TRYAGAIN.
+
+	bool				complete;	//!< We have a final result.
+	fr_redis_rcode_t		status;		//!< Final status of the command set.
+};
+
+static int cluster_async_write(fr_redis_cluster_async_t *async);
+static void cluster_async_process(fr_redis_cluster_async_t *async);
+static void cluster_async_finish(fr_redis_cluster_async_t *async, fr_redis_rcode_t status);
+static cluster_node_t *cluster_async_node_by_key(fr_redis_cluster_async_t *async, bool read_only);
+static int cluster_async_conn_events(cluster_async_conn_t *conn, bool want_write);
+static void cluster_async_conn_close(cluster_async_conn_t *conn, bool retry);
+static void cluster_async_remap_apply(cluster_async_conn_t *conn, redisReply *reply);
+
+/** Connection is readable, parse and dispatch any complete replies
  *
- * @param[in] ctx to allocate array of IP addresses in.
- * @param[out] out		Where to write the addresses of the nodes.
- * @param[in] cluster		to search for nodes in.
- * @param[in] is_master		If true, include the addresses of all the master nodes.
- * @param[in] is_slave		If true, include the addresses of all the slaves nodes.
- * @return the number of ip addresses written to out.
  */
-ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *out[],
-					   fr_redis_cluster_t *cluster, bool is_master, bool is_slave)
+static void _cluster_async_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
 {
-	addr_by_role_ctx_t context;
-	size_t in_use = rbtree_num_elements(cluster->used_nodes);
+	cluster_async_conn_t		*conn = talloc_get_type_abort(ctx, cluster_async_conn_t);
+	fr_redis_cluster_async_t	*async;
+	cluster_async_pending_t		*pending;
+	redisReply			*reply;
 
-	if (in_use == 0) {
-		*out = NULL;
-		return 0;
+	if (redisBufferRead(conn->handle) != REDIS_OK) {
+		ERROR("%s [%i]: Failed reading from %s:%i: %s", conn->thread->cluster->log_prefix,
+		      conn->node->id, conn->node->name, conn->addr.port, conn->handle->errstr);
+		cluster_async_conn_close(conn, true);
+		return;
 	}
 
-	context.is_master = is_master;
+	/*
+	 *	Processing a set of replies may write commands,
+	 *	and getting a connection to write them on may
+	 *	close this one, so closing is deferred until
+	 *	we're done with it.
+	 */
+	conn->dispatching = true;
+	while (!conn->close_pending) {
+		reply = NULL;
+		if (redisGetReply(conn->handle, (void **)&reply) != REDIS_OK) {
+			ERROR("%s [%i]: Failed parsing reply from %s:%i: %s", conn->thread->cluster->log_prefix,
+			      conn->node->id, conn->node->name, conn->addr.port, conn->handle->errstr);
+			cluster_async_conn_close(conn, true);
+			break;
+		}
+		if (!reply) break;	/* Need more data */
+
+		pending = conn->head;
+		if (!pending) {
+			ERROR("%s [%i]: Received unsolicited reply from %s:%i", conn->thread->cluster->log_prefix,
+			      conn->node->id, conn->node->name, conn->addr.port);
+			fr_redis_reply_free(reply);
+			cluster_async_conn_close(conn, true);
+			break;
+		}
+		conn->head = pending->next;
+		if (!conn->head) conn->tail = NULL;
+		conn->outstanding--;
+
+		async = pending->async;
+
+		/*
+		 *	Internal command, or the command set
+		 *	was freed.  Discard the reply.
+		 */
+		if (!async) {
+			if (pending->remap) {
+				talloc_free(pending);
+				cluster_async_remap_apply(conn, reply);
+				continue;
+			}
+
+			if (pending->must_succeed && (reply->type == REDIS_REPLY_ERROR)) {
+				ERROR("%s [%i]: Connection setup failed on %s:%i: %s",
+				      conn->thread->cluster->log_prefix, conn->node->id,
+				      conn->node->name, conn->addr.port, reply->str);
+				talloc_free(pending);
+				fr_redis_reply_free(reply);
+				cluster_async_conn_close(conn, true);
+				break;
+			}
+			talloc_free(pending);
+			fr_redis_reply_free(reply);
+			continue;
+		}
+
+		if (async->pending == pending) async->pending = pending->next;
+		talloc_free(pending);
+
+		async->reply[async->reply_num++] = reply;
+		if (async->reply_num < async->cmd_num) continue;
+
+		/*
+		 *	All replies received, figure out what
+		 *	to do next.
+		 */
+		async->conn = NULL;
+		async->pending = NULL;
+		cluster_async_process(async);
+	}
+	conn->dispatching = false;
+
+	if (conn->close_pending) cluster_async_conn_close(conn, conn->close_retry);
+}
+
+/** Connection is writable, complete the connect, and flush the output buffer
+ *
+ */
+static void _cluster_async_conn_writable(UNUSED fr_event_list_t *el, int fd, void *ctx)
+{
+	cluster_async_conn_t	*conn = talloc_get_type_abort(ctx, cluster_async_conn_t);
+	int			done = 0;
+
+	if (!conn->connected) {
+		int		err = 0;
+		socklen_t	len = sizeof(err);
+
+		if ((getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || err) {
+			ERROR("%s [%i]: Connection to %s:%i failed: %s", conn->thread->cluster->log_prefix,
+			      conn->node->id, conn->node->name, conn->addr.port, fr_syserror(err ? err : errno));
+			cluster_async_conn_close(conn, true);
+			return;
+		}
+		DEBUG2("%s [%i]: Connected to %s:%i", conn->thread->cluster->log_prefix,
+		       conn->node->id, conn->node->name, conn->addr.port);
+		conn->connected = true;
+	}
+
+	if (redisBufferWrite(conn->handle, &done) != REDIS_OK) {
+		ERROR("%s [%i]: Failed writing to %s:%i: %s", conn->thread->cluster->log_prefix,
+		      conn->node->id, conn->node->name, conn->addr.port, conn->handle->errstr);
+		cluster_async_conn_close(conn, true);
+		return;
+	}
+
+	/*
+	 *	Output buffer drained, we only care about
+	 *	replies now.
+	 */
+	if (done && (cluster_async_conn_events(conn, false) < 0)) cluster_async_conn_close(conn, true);
+}
+
+/** Connection errored
+ *
+ */
+static void _cluster_async_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	cluster_async_conn_t *conn = talloc_get_type_abort(ctx, cluster_async_conn_t);
+
+	ERROR("%s [%i]: Connection to %s:%i errored", conn->thread->cluster->log_prefix,
+	      conn->node->id, conn->node->name, conn->addr.port);
+	cluster_async_conn_close(conn, true);
+}
+
+/** Register for the I/O events we're interested in
+ *
+ */
+static int cluster_async_conn_events(cluster_async_conn_t *conn, bool want_write)
+{
+	if (fr_event_fd_insert(conn->thread->el, conn->handle->fd,
+			       _cluster_async_conn_readable,
+			       want_write ? _cluster_async_conn_writable : NULL,
+			       _cluster_async_conn_error, conn) < 0) {
+		ERROR("%s [%i]: Failed registering events for %s:%i: %s", conn->thread->cluster->log_prefix,
+		      conn->node->id, conn->node->name, conn->addr.port, fr_strerror());
+		return -1;
+	}
+	conn->want_write = want_write;
+
+	return 0;
+}
+
+/** Free a node connection, detaching any command sets still waiting on it
+ *
+ */
+static int _cluster_async_conn_free(cluster_async_conn_t *conn)
+{
+	cluster_async_pending_t *pending;
+
+	if (conn->thread->conn[conn->node->id] == conn) conn->thread->conn[conn->node->id] = NULL;
+
+	for (pending = conn->head; pending; pending = pending->next) {
+		if (pending->remap) conn->thread->remapping = false;
+		if (!pending->async) continue;
+
+		pending->async->conn = NULL;
+		pending->async->pending = NULL;
+	}
+
+	if (conn->handle) {
+		fr_event_fd_delete(conn->thread->el, conn->handle->fd);
+		redisFree(conn->handle);
+	}
+
+	return 0;
+}
+
+/** Close a node connection, optionally retrying the command sets that were in flight on it
+ *
+ * @param[in] conn	to close.
+ * @param[in] retry	If true, command sets waiting on replies from this connection
+ *			are re-sent on a new connection, or failed.
+ */
+static void cluster_async_conn_close(cluster_async_conn_t *conn, bool retry)
+{
+	cluster_async_pending_t		*pending;
+	fr_redis_cluster_async_t	*async, **failed;
+	size_t				failed_num = 0, i;
+
+	/*
+	 *	Any node connection failure, is a good indication
+	 *	that our view of the cluster is stale.
+	 */
+	conn->thread->cluster->remap_needed = true;
+
+	/*
+	 *	We're in the middle of processing replies from
+	 *	this connection.  Stop it being used for new
+	 *	commands, and close it once we're done.
+	 */
+	if (conn->dispatching) {
+		if (conn->thread->conn[conn->node->id] == conn) conn->thread->conn[conn->node->id] = NULL;
+		conn->close_pending = true;
+		if (retry) conn->close_retry = true;
+		return;
+	}
+
+	if (!retry || !conn->outstanding) {
+		talloc_free(conn);
+		return;
+	}
+
+	/*
+	 *	Record the command sets we need to retry before
+	 *	freeing the connection, as the retries may
+	 *	establish a new connection to the same node.
+	 */
+	failed = talloc_array(NULL, fr_redis_cluster_async_t *, conn->outstanding);
+	for (pending = conn->head; pending; pending = pending->next) {
+		async = pending->async;
+		if (!async) continue;
+		if (failed_num && (failed[failed_num - 1] == async)) continue;	/* Command sets are contiguous */
+
+		failed[failed_num++] = async;
+	}
+	talloc_free(conn);
+
+	for (i = 0; i < failed_num; i++) {
+		REQUEST *request;
+
+		async = failed[i];
+		request = async->request;
+
+		/*
+		 *	Throw away any replies we got before the
+		 *	connection died.
+		 */
+		fr_redis_pipeline_free(async->reply, async->reply_num);
+		async->reply_num = 0;
+
+		if (async->reconnects++ >= ASYNC_MAX_RECONNECTS) {
+			REDEBUG("[%i] Hit maximum reconnect attempts", async->node->id);
+			cluster_async_finish(async, REDIS_RCODE_RECONNECT);
+			continue;
+		}
+
+		/*
+		 *	Go back to the master for the key slot
+		 */
+		async->node = cluster_async_node_by_key(async, false);
+		async->asking = false;
+		if (cluster_async_write(async) < 0) cluster_async_finish(async, REDIS_RCODE_RECONNECT);
+	}
+	talloc_free(failed);
+}
+
+/** Get this thread's connection to a node, opening one if required
+ *
+ * @param[in] thread	to retrieve the connection for.
+ * @param[in] node	to retrieve the connection for.
+ * @return
+ *	- A connection to the node.
+ *	- NULL on error.
+ */
+static cluster_async_conn_t *cluster_async_conn_get(fr_redis_cluster_thread_t *thread, cluster_node_t *node)
+{
+	cluster_async_conn_t	*conn = thread->conn[node->id];
+	fr_redis_conf_t		*conf = thread->cluster->conf;
+	char const		*log_prefix = thread->cluster->log_prefix;
+
+	/*
+	 *	Node may have been re-used for a different
+	 *	server after a remap.
+	 */
+	if (conn) {
+		if ((fr_ipaddr_cmp(&conn->addr.ipaddr, &node->addr.ipaddr) == 0) &&
+		    (conn->addr.port == node->addr.port)) return conn;
+
+		DEBUG2("%s [%i]: Node address changed, reconnecting", log_prefix, node->id);
+		cluster_async_conn_close(conn, true);
+	}
+
+	DEBUG2("%s [%i]: Opening async connection to %s:%i", log_prefix, node->id, node->name, node->addr.port);
+
+	conn = talloc_zero(thread, cluster_async_conn_t);
+	if (!conn) return NULL;
+	conn->thread = thread;
+	conn->node = node;
+	conn->addr = node->addr;
+	talloc_set_destructor(conn, _cluster_async_conn_free);
+
+	conn->handle = redisConnectNonBlock(node->name, node->addr.port);
+	if (!conn->handle || conn->handle->err) {
+		ERROR("%s [%i]: Connection failed: %s", log_prefix, node->id,
+		      conn->handle ? conn->handle->errstr : "Out of memory");
+		talloc_free(conn);
+		return NULL;
+	}
+
+	/*
+	 *	AUTH and SELECT are pipelined ahead of the
+	 *	first command, so we don't need to wait for
+	 *	the connection to be set up.
+	 */
+	if (conf->password) {
+		cluster_async_pending_t *pending;
+
+		redisAppendCommand(conn->handle, "AUTH %s", conf->password);
+		pending = talloc_zero(conn, cluster_async_pending_t);
+		pending->must_succeed = true;
+		conn->head = conn->tail = pending;
+		conn->outstanding++;
+	}
+
+	if (conf->database) {
+		cluster_async_pending_t *pending;
+
+		redisAppendCommand(conn->handle, "SELECT %i", conf->database);
+		pending = talloc_zero(conn, cluster_async_pending_t);
+		pending->must_succeed = true;
+		if (conn->tail) {
+			conn->tail->next = pending;
+		} else {
+			conn->head = pending;
+		}
+		conn->tail = pending;
+		conn->outstanding++;
+	}
+
+	if (cluster_async_conn_events(conn, true) < 0) {
+		talloc_free(conn);
+		return NULL;
+	}
+	thread->conn[node->id] = conn;
+
+	return conn;
+}
+
+/** Select the node to send a command set to, based on its key
+ *
+ * @param[in] async		command set to select the node for.
+ * @param[in] read_only		If true, try a slave first.
+ * @return the node to communicate with.
+ */
+static cluster_node_t *cluster_async_node_by_key(fr_redis_cluster_async_t *async, bool read_only)
+{
+	fr_redis_cluster_t	*cluster = async->thread->cluster;
+	REQUEST			*request = async->request;
+	cluster_key_slot_t	key_slot;
+
+	cluster_slot_by_key(&key_slot, cluster, request, async->key, async->key_len);
+	if (read_only && key_slot.slave_num) {
+		return &cluster->node[key_slot.slave[fr_rand() % key_slot.slave_num]];
+	}
+
+	return &cluster->node[key_slot.master];
+}
+
+/** Ask a node for the current cluster map, without blocking
+ *
+ * 'cluster slots' is queued on this thread's connection to the node, like any
+ * other command, and the map is applied when the reply arrives.  Each thread
+ * only waits on one map at a time, and remaps are still limited to one a second.
+ *
+ * @param[in] thread	to issue the command from.
+ * @param[in] node	to ask.  Usually the one that issued a -MOVED redirect.
+ */
+static void cluster_async_remap(fr_redis_cluster_thread_t *thread, cluster_node_t *node)
+{
+	fr_redis_cluster_t	*cluster = thread->cluster;
+	cluster_async_conn_t	*conn;
+	cluster_async_pending_t	*pending;
+
+	if (thread->remapping || cluster->remapping || (time(NULL) == cluster->last_updated)) return;
+
+	conn = cluster_async_conn_get(thread, node);
+	if (!conn) return;
+
+	DEBUG2("%s [%i]: Requesting cluster map from %s:%i", cluster->log_prefix, node->id,
+	       node->name, node->addr.port);
+
+	redisAppendCommand(conn->handle, "CLUSTER SLOTS");
+	pending = talloc_zero(conn, cluster_async_pending_t);
+	pending->remap = true;
+	if (conn->tail) {
+		conn->tail->next = pending;
+	} else {
+		conn->head = pending;
+	}
+	conn->tail = pending;
+	conn->outstanding++;
+	thread->remapping = true;
+
+	if (!conn->want_write && (cluster_async_conn_events(conn, true) < 0)) cluster_async_conn_close(conn, true);
+}
+
+/** Apply the cluster map a node sent us
+ *
+ * @param[in] conn	the map was received on.
+ * @param[in] reply	to 'cluster slots'.  Will be freed.
+ */
+static void cluster_async_remap_apply(cluster_async_conn_t *conn, redisReply *reply)
+{
+	fr_redis_cluster_t	*cluster = conn->thread->cluster;
+	cluster_rcode_t		ret;
+
+	conn->thread->remapping = false;
+
+	/*
+	 *	Clustering not enabled, or not supported
+	 */
+	if (reply->type == REDIS_REPLY_ERROR) {
+		DEBUG2("%s [%i]: Ignoring cluster map from %s:%i: %s", cluster->log_prefix, conn->node->id,
+		       conn->node->name, conn->addr.port, reply->str);
+		cluster->remap_needed = false;
+		fr_redis_reply_free(reply);
+		return;
+	}
+
+	ret = cluster_map_validate(reply);
+	if (ret == CLUSTER_OP_SUCCESS) ret = cluster_map_update(cluster, reply, time(NULL));
+	switch (ret) {
+	case CLUSTER_OP_SUCCESS:
+		INFO("%s: Cluster map updated, %zu key ranges", cluster->log_prefix, reply->elements);
+		break;
+
+	case CLUSTER_OP_IGNORED:
+		DEBUG2("%s: %s", cluster->log_prefix, fr_strerror());
+		break;
+
+	default:
+		ERROR("%s [%i]: Failed applying cluster map from %s:%i: %s", cluster->log_prefix, conn->node->id,
+		      conn->node->name, conn->addr.port, fr_strerror());
+		break;
+	}
+	fr_redis_reply_free(reply);
+}
+
+/** Record the final result of a command set, and mark the request as resumable
+ *
+ */
+static void cluster_async_finish(fr_redis_cluster_async_t *async, fr_redis_rcode_t status)
+{
+	async->status = status;
+	async->complete = true;
+
+	unlang_resumable(async->request);
+}
+
+/** Retry a command set after receiving -TRYAGAIN
+ *
+ */
+static void _cluster_async_retry(UNUSED struct timeval *now, void *ctx)
+{
+	fr_redis_cluster_async_t *async = talloc_get_type_abort(ctx, fr_redis_cluster_async_t);
+
+	if (cluster_async_write(async) < 0) cluster_async_finish(async, REDIS_RCODE_RECONNECT);
+}
+
+/** Examine the replies to a command set, and follow redirects, or retry as required
+ *
+ * Mirrors the logic in #fr_redis_cluster_state_next.
+ *
+ * @param[in] async	command set to process.
+ */
+static void cluster_async_process(fr_redis_cluster_async_t *async)
+{
+	fr_redis_cluster_t	*cluster = async->thread->cluster;
+	REQUEST			*request = async->request;
+	fr_redis_rcode_t	status = REDIS_RCODE_SUCCESS;
+	redisReply		*redirect = NULL;
+	size_t			i;
+
+	/*
+	 *	The lowest status code is the most important
+	 */
+	for (i = 0; i < async->reply_num; i++) {
+		fr_redis_rcode_t ret;
+
+		if (RDEBUG_ENABLED3) fr_redis_reply_print(L_DBG_LVL_3, async->reply[i], request, i);
+
+		ret = fr_redis_reply_status(async->reply[i]);
+		if (ret >= status) continue;
+
+		status = ret;
+		if ((ret == REDIS_RCODE_MOVE) || (ret == REDIS_RCODE_ASK)) redirect = async->reply[i];
+	}
+
+	RDEBUG2("[%i] <<< Returned: %s", async->node->id, fr_int2str(redis_rcodes, status, "<UNKNOWN>"));
+
+	switch (status) {
+	/*
+	 *	-MOVE is treated identically to -ASK, except it may
+	 *	trigger a cluster remap.
+	 */
+	case REDIS_RCODE_MOVE:
+		cluster->remap_needed = true;
+		cluster_async_remap(async->thread, async->node);
+		/* FALL-THROUGH */
+
+	case REDIS_RCODE_ASK:
+	{
+		cluster_node_t *new;
+
+		RDEBUG("[%i] Processing redirect \"%s\"", async->node->id, redirect->str);
+		if (async->redirects++ >= cluster->conf->max_redirects) {
+			REDEBUG("[%i] Reached max_redirects (%i)", async->node->id, async->redirects);
+			cluster_async_finish(async, REDIS_RCODE_ERROR);
+			return;
+		}
+
+		switch (cluster_redirect(&new, cluster, redirect)) {
+		case CLUSTER_OP_SUCCESS:
+			if (new == async->node) {
+				REDEBUG("[%i] %s:%i issued redirect to itself", async->node->id,
+					async->node->name, async->node->addr.port);
+				cluster_async_finish(async, REDIS_RCODE_ERROR);
+				return;
+			}
+			RDEBUG("[%i] Redirected from %s:%i to [%i] %s:%i", async->node->id, async->node->name,
+			       async->node->addr.port, new->id, new->name, new->addr.port);
+			async->node = new;
+			async->asking = (status == REDIS_RCODE_ASK);
+
+			/*
+			 *	Reset these counters, their scope is
+			 *	a single node in the cluster.
+			 */
+			async->reconnects = 0;
+			async->retries = 0;
+			break;
+
+		case CLUSTER_OP_NO_CONNECTION:
+			cluster->remap_needed = true;
+			cluster_async_finish(async, REDIS_RCODE_RECONNECT);
+			return;
+
+		default:
+			cluster_async_finish(async, REDIS_RCODE_ERROR);
+			return;
+		}
+	}
+		fr_redis_pipeline_free(async->reply, async->reply_num);
+		async->reply_num = 0;
+		if (cluster_async_write(async) < 0) cluster_async_finish(async, REDIS_RCODE_RECONNECT);
+		return;
+
+	/*
+	 *	Cluster's unstable, try again.
+	 */
+	case REDIS_RCODE_TRY_AGAIN:
+		if (async->retries++ >= cluster->conf->max_retries) {
+			REDEBUG("[%i] Hit maximum retry attempts", async->node->id);
+			cluster_async_finish(async, REDIS_RCODE_ERROR);
+			return;
+		}
+		fr_redis_pipeline_free(async->reply, async->reply_num);
+		async->reply_num = 0;
+
+		if (FR_TIMEVAL_TO_MS(&cluster->conf->retry_delay)) {
+			struct timeval now, when;
+
+			gettimeofday(&now, NULL);
+			fr_timeval_add(&when, &now, &cluster->conf->retry_delay);
+			if (fr_event_timer_insert(async->thread->el, _cluster_async_retry, async,
+						  &when, &async->retry_ev) < 0) {
+				REDEBUG("[%i] Failed inserting retry timer: %s", async->node->id, fr_strerror());
+				cluster_async_finish(async, REDIS_RCODE_ERROR);
+			}
+			return;
+		}
+		if (cluster_async_write(async) < 0) cluster_async_finish(async, REDIS_RCODE_RECONNECT);
+		return;
+
+	case REDIS_RCODE_SUCCESS:
+		break;
+
+	default:
+		REDEBUG("[%i] Command failed: %s", async->node->id, fr_strerror());
+		break;
+	}
+
+	cluster_async_finish(async, status);
+}
+
+/** Write a command set to the connection for its current node
+ *
+ * @param[in] async	command set to write.
+ * @return
+ *	- 0 on success.
+ *	- -1 if we couldn't get a connection to the node.
+ */
+static int cluster_async_write(fr_redis_cluster_async_t *async)
+{
+	REQUEST			*request = async->request;
+	cluster_async_conn_t	*conn;
+	size_t			i;
+
+	conn = cluster_async_conn_get(async->thread, async->node);
+	if (!conn) {
+		REDEBUG("[%i] No connection available to %s:%i", async->node->id,
+			async->node->name, async->node->addr.port);
+		async->thread->cluster->remap_needed = true;
+		return -1;
+	}
+
+	RDEBUG2("[%i] >>> Sending command(s) to %s:%i (%u already in flight)", async->node->id,
+		async->node->name, async->node->addr.port, conn->outstanding);
+
+	if (async->asking) {
+		cluster_async_pending_t *pending;
+
+		redisAppendCommand(conn->handle, "ASKING");
+		pending = talloc_zero(conn, cluster_async_pending_t);
+		if (conn->tail) {
+			conn->tail->next = pending;
+		} else {
+			conn->head = pending;
+		}
+		conn->tail = pending;
+		conn->outstanding++;
+	}
+
+	async->conn = conn;
+	async->pending = NULL;
+	for (i = 0; i < async->cmd_num; i++) {
+		cluster_async_pending_t *pending;
+
+		redisAppendFormattedCommand(conn->handle, async->cmd[i], async->cmd_len[i]);
+
+		pending = talloc_zero(conn, cluster_async_pending_t);
+		pending->async = async;
+		if (conn->tail) {
+			conn->tail->next = pending;
+		} else {
+			conn->head = pending;
+		}
+		conn->tail = pending;
+		conn->outstanding++;
+
+		if (!async->pending) async->pending = pending;
+	}
+
+	/*
+	 *	Writes are batched, and happen when the event
+	 *	loop next services the connection.  This means
+	 *	commands from multiple requests are written with
+	 *	a single syscall.
+	 */
+	if (!conn->want_write && (cluster_async_conn_events(conn, true) < 0)) {
+		cluster_async_conn_close(conn, false);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Free a command set, abandoning any replies still in flight
+ *
+ */
+static int _cluster_async_free(fr_redis_cluster_async_t *async)
+{
+	cluster_async_pending_t	*pending;
+	size_t			i;
+
+	if (async->retry_ev) fr_event_timer_delete(async->thread->el, &async->retry_ev);
+
+	/*
+	 *	Our entries in the connection's queue are
+	 *	contiguous.  Mark them as orphaned so the
+	 *	replies are discarded when they arrive.
+	 */
+	for (pending = async->pending, i = async->reply_num;
+	     pending && (i < async->cmd_num);
+	     pending = pending->next, i++) {
+		rad_assert(pending->async == async);
+		pending->async = NULL;
+	}
+
+	fr_redis_pipeline_free(async->reply, async->reply_num);
+
+	return 0;
+}
+
+/** Free a per-thread cluster client
+ *
+ */
+static int _cluster_thread_free(fr_redis_cluster_thread_t *thread)
+{
+	size_t i;
+
+	for (i = 0; i < UINT8_MAX; i++) {
+		if (thread->conn[i]) cluster_async_conn_close(thread->conn[i], false);
+	}
+
+	return 0;
+}
+
+/** Allocate a per-thread asynchronous cluster client
+ *
+ * Should be called from a module's thread_instantiate callback.  Connections to
+ * cluster nodes are opened lazily, the first time a command set is sent to the node.
+ *
+ * @param[in] ctx	to allocate the client in.  Usually the module's thread instance data.
+ * @param[in] cluster	to issue commands against.  Shared by all threads.
+ * @param[in] el	event list servicing the thread.
+ * @return
+ *	- New #fr_redis_cluster_thread_t on success.
+ *	- NULL on failure.
+ */
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_redis_cluster_t *cluster,
+							 fr_event_list_t *el)
+{
+	fr_redis_cluster_thread_t *thread;
+
+	thread = talloc_zero(ctx, fr_redis_cluster_thread_t);
+	if (!thread) return NULL;
+
+	thread->cluster = cluster;
+	thread->el = el;
+	talloc_set_destructor(thread, _cluster_thread_free);
+
+	return thread;
+}
+
+/** Allocate a new asynchronous command set
+ *
+ * Commands should be added with #fr_redis_cluster_async_append, and the set issued with
+ * #fr_redis_cluster_async_send.  Once all replies have been received the request is
+ * marked as resumable, and the result can be retrieved with #fr_redis_cluster_async_result.
+ *
+ * Freeing the command set (at any time) abandons any outstanding replies, so freeing it
+ * from a module's action callback is the correct way to handle cancellation.
+ *
+ @code{.c}
+    async = fr_redis_cluster_async_alloc(request, thread, request, key, key_len, false);
+    fr_redis_cluster_async_append(async, "SET %b %s", key, key_len, "bar");
+    if (fr_redis_cluster_async_send(async) < 0) {
+    	talloc_free(async);
+    	return RLM_MODULE_FAIL;
+    }
+    return unlang_yield(request, mod_resume, mod_action, async);
+ @endcode
+ *
+ * @param[in] ctx	to allocate the command set in.
+ * @param[in] thread	Client to issue the commands with.
+ * @param[in] request	to resume once the replies are received.
+ * @param[in] key	used to select the cluster node.  Will be copied.
+ * @param[in] key_len	Length of the key.
+ * @param[in] read_only	If true, a slave will be used in preference to the master.
+ * @return
+ *	- A new command set.
+ *	- NULL on error.
+ */
+fr_redis_cluster_async_t *fr_redis_cluster_async_alloc(TALLOC_CTX *ctx, fr_redis_cluster_thread_t *thread,
+						       REQUEST *request,
+						       uint8_t const *key, size_t key_len, bool read_only)
+{
+	fr_redis_cluster_async_t *async;
+
+	async = talloc_zero(ctx, fr_redis_cluster_async_t);
+	if (!async) return NULL;
+
+	async->thread = thread;
+	async->request = request;
+	async->read_only = read_only;
+	if (key && key_len) {
+		async->key = talloc_memdup(async, key, key_len);
+		async->key_len = key_len;
+	}
+	talloc_set_destructor(async, _cluster_async_free);
+
+	return async;
+}
+
+/** Add a command to an asynchronous command set
+ *
+ * @param[in] async	to add the command to.
+ * @param[in] fmt	hiredis format string.
+ * @param[in] ap	Arguments for the format string.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_redis_cluster_async_vappend(fr_redis_cluster_async_t *async, char const *fmt, va_list ap)
+{
+	char	*cmd;
+	int	len;
+
+	rad_assert(!async->conn);
+
+	len = redisvFormatCommand(&cmd, fmt, ap);
+	if (len < 0) {
+		fr_strerror_printf("Failed formatting command");
+		return -1;
+	}
+
+	async->cmd = talloc_realloc(async, async->cmd, char *, async->cmd_num + 1);
+	async->cmd_len = talloc_realloc(async, async->cmd_len, size_t, async->cmd_num + 1);
+	async->reply = talloc_realloc(async, async->reply, redisReply *, async->cmd_num + 1);
+
+	async->cmd[async->cmd_num] = talloc_memdup(async, cmd, (size_t)len);
+	async->cmd_len[async->cmd_num] = (size_t)len;
+	async->reply[async->cmd_num] = NULL;
+	async->cmd_num++;
+	free(cmd);
+
+	return 0;
+}
+
+/** Add a command to an asynchronous command set
+ *
+ * @param[in] async	to add the command to.
+ * @param[in] fmt	hiredis format string.
+ * @param[in] ...	Arguments for the format string.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_redis_cluster_async_append(fr_redis_cluster_async_t *async, char const *fmt, ...)
+{
+	va_list	ap;
+	int	ret;
+
+	va_start(ap, fmt);
+	ret = fr_redis_cluster_async_vappend(async, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/** Send an asynchronous command set to the node responsible for its key
+ *
+ * Commands are pipelined with those of other requests on the same node connection.
+ *
+ * @param[in] async	to send.
+ * @return
+ *	- 0 on success.  The caller should yield, and will be resumed when all replies
+ *	  have been received.
+ *	- -1 on failure.  The request will not be resumed.
+ */
+int fr_redis_cluster_async_send(fr_redis_cluster_async_t *async)
+{
+	fr_redis_cluster_t	*cluster = async->thread->cluster;
+	REQUEST			*request = async->request;
+
+	rad_assert(async->cmd_num > 0);
+
+	if (rbtree_num_elements(cluster->used_nodes) == 0) {
+		REDEBUG("No nodes in cluster");
+		return -1;
+	}
+
+	async->node = cluster_async_node_by_key(async, async->read_only);
+
+	/*
+	 *	Something set the remap_needed flag.  Ask the
+	 *	node for a new map, we'll be redirected if our
+	 *	current one is wrong.
+	 */
+	if (cluster->remap_needed) cluster_async_remap(async->thread, async->node);
+
+	return cluster_async_write(async);
+}
+
+/** Retrieve the result of an asynchronous command set
+ *
+ * @note The replies remain owned by the command set, and are freed with it.
+ *
+ * @param[out] out	Where to write the array of replies.  One per command.
+ * @param[out] out_len	Number of replies.
+ * @param[in] async	command set to retrieve the result of.
+ * @return
+ *	- REDIS_RCODE_SUCCESS if all commands succeeded.
+ *	- REDIS_RCODE_NO_SCRIPT if a script needs to be loaded.
+ *	- REDIS_RCODE_ERROR on command error, or if the result isn't available yet.
+ *	- REDIS_RCODE_RECONNECT if no connection to the node could be established.
+ */
+fr_redis_rcode_t fr_redis_cluster_async_result(redisReply **out[], size_t *out_len,
+					       fr_redis_cluster_async_t *async)
+{
+	if (!async->complete) {
+		fr_strerror_printf("Result not yet available");
+		*out = NULL;
+		*out_len = 0;
+		return REDIS_RCODE_ERROR;
+	}
+
+	*out = async->reply;
+	*out_len = async->reply_num;
+
+	return async->status;
+}
+
+/** Get the pool associated with a node in the cluster
+ *
+ * @note This is used for testing only.  It's not ifdef'd out because
+ *	tests need to run against production builds too.
+ *
+ * @param[out] pool associated with the node.
+ * @param[in] cluster to search for node in.
+ * @param[in] node_addr to retrieve pool for.  Specifies IP and port of node.
+ * @param[in] create Establish a connection to the specified node if it
+ *	was previously unknown to the cluster client.
+ * @return
+ *	- 0 on success.
+ *	- -1 if no such node exists.
+ */
+int fr_redis_cluster_pool_by_node_addr(fr_connection_pool_t **pool, fr_redis_cluster_t *cluster,
+				       fr_socket_addr_t *node_addr, bool create)
+{
+	cluster_node_t	find, *found;
+
+	find.addr.ipaddr = node_addr->ipaddr;
+	find.addr.port = node_addr->port;
+
+	pthread_mutex_lock(&cluster->mutex);
+	found = rbtree_finddata(cluster->used_nodes, &find);
+	if (!found) {
+		cluster_node_t *spare;
+		char buffer[INET6_ADDRSTRLEN];
+		char const *hostname;
+
+		if (!create) {
+			pthread_mutex_unlock(&cluster->mutex);
+
+			hostname = inet_ntop(node_addr->ipaddr.af, &node_addr->ipaddr.ipaddr, buffer, sizeof(buffer));
+			rad_assert(hostname);	/* addr.ipaddr is probably corrupt */;
+			fr_strerror_printf("No existing node found with address %s, port %i",
+					   hostname, node_addr->port);
+			return -1;
+		}
+
+		spare = fr_fifo_peek(cluster->free_nodes);
+		if (!spare) {
+			fr_strerror_printf("Reached maximum connected nodes");
+			pthread_mutex_unlock(&cluster->mutex);
+			return -1;
+		}
+		spare->pending_addr = find.addr;	/* Set the config to be applied */
+		if (cluster_node_connect(cluster, spare) < 0) {
+			pthread_mutex_unlock(&cluster->mutex);
+			return -1;
+		}
+		rbtree_insert(cluster->used_nodes, spare);
+		fr_fifo_pop(cluster->free_nodes);
+		found = spare;
+	}
+	/*
+	 *	Sanity checks
+	 */
+	rad_assert(((talloc_array_length(cluster->node) - 1) - rbtree_num_elements(cluster->used_nodes)) ==
+		   fr_fifo_num_elements(cluster->free_nodes));
+	pthread_mutex_unlock(&cluster->mutex);
+
+	*pool = found->pool;
+
+	return 0;
+}
+
+/** Private ctx structure to pass to _cluster_role_walk
+ *
+ */
+typedef struct addr_by_role_ctx {
+	bool			is_master;
+	bool			is_slave;
+	uint8_t			count;
+	fr_socket_addr_t	*found;
+} addr_by_role_ctx_t;
+
+/** Walk all used pools, recording the IP addresses of ones matching the filter
+ *
+ * @param context Where to write the node we found.
+ * @param data node to check.
+ * @return
+ *	- 0 continue walking.
+ *	- -1 found suitable node.
+ */
+static int _cluster_role_walk(void *context, void *data)
+{
+	addr_by_role_ctx_t	*ctx = context;
+	cluster_node_t		*node = data;
+
+	if ((ctx->is_master && node->is_master) || (ctx->is_slave && !node->is_master)) {
+		ctx->found[ctx->count++] = node->addr;
+	}
+	return 0;
+}
+
+/** Return an array of IP addresses belonging to masters or slaves
+ *
+ * @note We return IP addresses as they're safe to use across cluster remaps.
+ * @note Result array must be freed (talloc_free()) after use.
+ *
+ * @param[in] ctx to allocate array of IP addresses in.
+ * @param[out] out		Where to write the addresses of the nodes.
+ * @param[in] cluster		to search for nodes in.
+ * @param[in] is_master		If true, include the addresses of all the master nodes.
+ * @param[in] is_slave		If true, include the addresses of all the slaves nodes.
+ * @return the number of ip addresses written to out.
+ */
+ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *out[],
+					   fr_redis_cluster_t *cluster, bool is_master, bool is_slave)
+{
+	addr_by_role_ctx_t context;
+	size_t in_use = rbtree_num_elements(cluster->used_nodes);
+
+	if (in_use == 0) {
+		*out = NULL;
+		return 0;
+	}
+
+	context.is_master = is_master;
 	context.is_slave = is_slave;
 	context.count = 0;
 	context.found = talloc_zero_array(ctx, fr_socket_addr_t, in_use);
@@ -2188,6 +3222,7 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 {
 	uint8_t			i;
 	uint16_t		s;
+	cluster_key_slot_t	*key_slot_pending;
 
 	CONF_SECTION		*mycs;
 	char const		*cs_name1, *cs_name2;
@@ -2293,6 +3328,9 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 	cluster->free_nodes = fr_fifo_create(cluster, conf->max_nodes, NULL);
 	if (!cluster->free_nodes) goto oom;
 
+	cluster->slot_table = fr_redis_slot_table_alloc(cluster);
+	if (!cluster->slot_table) goto oom;
+
 	cluster->conf = conf;
 
 	pthread_mutex_init(&cluster->mutex, NULL);
@@ -2451,7 +3489,9 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 	 *	hopefully we'll get one when we start processing
 	 *	requests.
 	 */
-	for (s = 0; s < KEY_SLOTS; s++) cluster->key_slot[s].master = (s % (uint16_t) num_nodes) + 1;
+	key_slot_pending = fr_redis_slot_table_pending(cluster->slot_table);
+	for (s = 0; s < KEY_SLOTS; s++) key_slot_pending[s].master = (s % (uint16_t) num_nodes) + 1;
+	fr_redis_slot_table_publish(cluster->slot_table);
 
 	return cluster;
 }
@@ -35,6 +35,16 @@ RCSIDH(cluster_h, "$Id$")
 
 typedef struct fr_redis_cluster fr_redis_cluster_t;
 
+/** Per-thread asynchronous cluster client
+ *
+ * Holds one non-blocking connection per cluster node, serviced by the thread's event list.
+ */
+typedef struct fr_redis_cluster_thread fr_redis_cluster_thread_t;
+
+/** A set of pipelined commands, issued asynchronously against the node responsible for a key
+ */
+typedef struct fr_redis_cluster_async fr_redis_cluster_async_t;
+
 /** Redis connection sequence state
  *
  * Tracks how many operations we've performed attempting to execute a single command.
@@ -84,6 +94,26 @@ int fr_redis_cluster_pool_by_node_addr(fr_connection_pool_t **pool, fr_redis_clu
 ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *out[],
 					   fr_redis_cluster_t *cluster, bool is_master, bool is_slave);
 
+/*
+ *	Asynchronous cluster client.  Commands are pipelined over per-thread
+ *	node connections, and the request is resumed when all replies arrive.
+ */
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_redis_cluster_t *cluster,
+							 fr_event_list_t *el);
+
+fr_redis_cluster_async_t *fr_redis_cluster_async_alloc(TALLOC_CTX *ctx, fr_redis_cluster_thread_t *thread,
+						       REQUEST *request,
+						       uint8_t const *key, size_t key_len, bool read_only);
+
+int fr_redis_cluster_async_append(fr_redis_cluster_async_t *async, char const *fmt, ...);
+
+int fr_redis_cluster_async_vappend(fr_redis_cluster_async_t *async, char const *fmt, va_list ap);
+
+int fr_redis_cluster_async_send(fr_redis_cluster_async_t *async);
+
+fr_redis_rcode_t fr_redis_cluster_async_result(redisReply **out[], size_t *out_len,
+					       fr_redis_cluster_async_t *async);
+
 /*
  *	Initialise a new cluster connection, and perform initial mapping.
  */
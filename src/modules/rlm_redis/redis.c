@@ -54,10 +54,13 @@ void fr_redis_version_print(void)
 	INFO("libfreeradius-redis: libhiredis version: %i.%i.%i", HIREDIS_MAJOR, HIREDIS_MINOR, HIREDIS_PATCH);
 }
 
-/** Check the reply for errors
+/** Check a reply for errors
  *
- * @param conn used to issue the command.
- * @param reply to process.
+ * Unlike #fr_redis_command_status, this doesn't need the connection the command
+ * was issued on, so can be used where replies are read from a connection we don't
+ * hold, i.e. by the asynchronous cluster client.
+ *
+ * @param reply to process.  Must not be NULL.
  * @return
  *	- REDIS_RCODE_TRY_AGAIN - If the operation should be retries.
  *	- REDIS_RCODE_MOVED  	- If the key has been permanently moved.
@@ -65,29 +68,12 @@ void fr_redis_version_print(void)
  *	- REDIS_RCODE_SUCCESS   - if no errors.
  *	- REDIS_RCODE_ERROR     - on command/server error.
  *	- REDIS_RCODE_NO_SCRIPT - script specified by evalsha doesn't exist.
- *	- REDIS_RCODE_RECONNECT - on connection error (probably needs reconnecting).
  */
-fr_redis_rcode_t fr_redis_command_status(fr_redis_conn_t *conn, redisReply *reply)
+fr_redis_rcode_t fr_redis_reply_status(redisReply *reply)
 {
 	size_t i = 0;
 
-	if (!reply) switch (conn->handle->err) {
-	case REDIS_OK:
-		break;
-
-	case REDIS_ERR_IO:
-	case REDIS_ERR_EOF:
-	case REDIS_ERR_OTHER:
-		fr_strerror_printf("Connection error: %s", conn->handle->errstr);
-		return REDIS_RCODE_RECONNECT;
-
-	default:
-	case REDIS_ERR_PROTOCOL:
-		fr_strerror_printf("Command error: %s", conn->handle->errstr);
-		return REDIS_RCODE_ERROR;
-	}
-
-	if (reply) switch (reply->type) {
+	switch (reply->type) {
 	case REDIS_REPLY_STATUS:
 		return REDIS_RCODE_SUCCESS;
 
@@ -114,7 +100,9 @@ fr_redis_rcode_t fr_redis_command_status(fr_redis_conn_t *conn, redisReply *repl
 		for (i = 0; i < reply->elements; i++) {
 			int ret;
 
-			ret = fr_redis_command_status(conn, reply->element[i]);
+			if (!reply->element[i]) continue;
+
+			ret = fr_redis_reply_status(reply->element[i]);
 			if (ret < 0) return ret;
 		}
 	default:
@@ -123,6 +111,40 @@ fr_redis_rcode_t fr_redis_command_status(fr_redis_conn_t *conn, redisReply *repl
 	return REDIS_RCODE_SUCCESS;
 }
 
+/** Check the reply for errors
+ *
+ * @param conn used to issue the command.
+ * @param reply to process.
+ * @return
+ *	- REDIS_RCODE_TRY_AGAIN - If the operation should be retries.
+ *	- REDIS_RCODE_MOVED  	- If the key has been permanently moved.
+ *	- REDIS_RCODE_ASK	- If the key has been temporarily moved.
+ *	- REDIS_RCODE_SUCCESS   - if no errors.
+ *	- REDIS_RCODE_ERROR     - on command/server error.
+ *	- REDIS_RCODE_NO_SCRIPT - script specified by evalsha doesn't exist.
+ *	- REDIS_RCODE_RECONNECT - on connection error (probably needs reconnecting).
+ */
+fr_redis_rcode_t fr_redis_command_status(fr_redis_conn_t *conn, redisReply *reply)
+{
+	if (!reply) switch (conn->handle->err) {
+	case REDIS_OK:
+		return REDIS_RCODE_SUCCESS;
+
+	case REDIS_ERR_IO:
+	case REDIS_ERR_EOF:
+	case REDIS_ERR_OTHER:
+		fr_strerror_printf("Connection error: %s", conn->handle->errstr);
+		return REDIS_RCODE_RECONNECT;
+
+	default:
+	case REDIS_ERR_PROTOCOL:
+		fr_strerror_printf("Command error: %s", conn->handle->errstr);
+		return REDIS_RCODE_ERROR;
+	}
+
+	return fr_redis_reply_status(reply);
+}
+
 /** Print the response data in a useful treelike form
  *
  * @param lvl to print data at.
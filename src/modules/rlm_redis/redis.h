@@ -115,6 +115,8 @@ void		fr_redis_version_print(void);
 /*
  *	Command and resulting parsing
  */
+fr_redis_rcode_t	fr_redis_reply_status(redisReply *reply) CC_HINT(nonnull);
+
 fr_redis_rcode_t	fr_redis_command_status(fr_redis_conn_t *conn, redisReply *reply);
 
 void			fr_redis_reply_print(log_lvl_t lvl, redisReply *reply, REQUEST *request, int idx);
@@ -0,0 +1,182 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file slot_table.c
+ * @brief Lock-free key slot to node lookup table for Redis cluster.
+ *
+ * The key slot table maps each of the 16384 key slots to a master and slave nodes.
+ * It's read for every command issued against the cluster, and written only when
+ * the cluster is remapped.
+ *
+ * Writers build a complete new table in a private 'pending' buffer, and publish it
+ * with an atomic pointer swap, so readers always see a consistent mapping, and never
+ * need to take the cluster mutex.
+ *
+ * The table that was replaced becomes the next pending buffer.  Before it can be
+ * written to, the writer waits for a grace period (see lib/epoch.c).
+ *
+ * Read side critical sections only copy a single #cluster_key_slot_t out of the table,
+ * so the wait is measured in nanoseconds.  Writers must be serialised by the caller
+ * (the cluster mutex).
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/epoch.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#include "crc16.h"
+#include "slot_table.h"
+
+/** A complete, immutable once published, mapping of key slots to nodes
+ *
+ */
+typedef struct slot_table_snapshot {
+	cluster_key_slot_t	key_slot[KEY_SLOTS];	//!< Lookup table of slots to nodes.
+} slot_table_snapshot_t;
+
+/** Key slot table, with lock-free reads
+ *
+ */
+struct fr_redis_slot_table {
+	_Atomic(slot_table_snapshot_t *) live;		//!< Table used by readers.
+	slot_table_snapshot_t	*pending;		//!< Table being built by the writer.
+
+	fr_epoch_t		*epoch;			//!< Tracks readers of the live table.
+};
+
+/** Allocate a new key slot table
+ *
+ * All key slots are initially mapped to node 0 (the reserved, invalid, node).
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @return
+ *	- A new slot table.
+ *	- NULL on error.
+ */
+fr_redis_slot_table_t *fr_redis_slot_table_alloc(TALLOC_CTX *ctx)
+{
+	fr_redis_slot_table_t	*st;
+	slot_table_snapshot_t	*live;
+
+	st = talloc_zero(ctx, fr_redis_slot_table_t);
+	if (!st) return NULL;
+
+	live = talloc_zero(st, slot_table_snapshot_t);
+	if (!live) {
+	error:
+		talloc_free(st);
+		return NULL;
+	}
+	st->pending = talloc_zero(st, slot_table_snapshot_t);
+	if (!st->pending) goto error;
+	st->epoch = fr_epoch_alloc(st);
+	if (!st->epoch) goto error;
+
+	atomic_init(&st->live, live);
+
+	return st;
+}
+
+/** Return the pending table so it can be modified
+ *
+ * The pending table contains the mappings from the live table before the last
+ * publish.  Callers should either reset, or completely overwrite, it.
+ *
+ * @note Must be called with the cluster mutex held.
+ *
+ * @param[in] st	to return the pending table for.
+ * @return array of #KEY_SLOTS key slots.
+ */
+cluster_key_slot_t *fr_redis_slot_table_pending(fr_redis_slot_table_t *st)
+{
+	return st->pending->key_slot;
+}
+
+/** Atomically replace the live table with the pending table
+ *
+ * Returns once no readers can be accessing the previous live table, which then
+ * becomes the pending table.
+ *
+ * @note Must be called with the cluster mutex held.
+ *
+ * @param[in] st	to publish the pending table for.
+ */
+void fr_redis_slot_table_publish(fr_redis_slot_table_t *st)
+{
+	slot_table_snapshot_t	*old;
+
+	old = atomic_exchange(&st->live, st->pending);
+	fr_epoch_synchronize(st->epoch);
+
+	/*
+	 *	Start from the current mappings, so partial
+	 *	updates are possible.
+	 */
+	memcpy(old, st->pending, sizeof(*old));
+	st->pending = old;
+}
+
+/** Copy the node mappings for a key slot out of the live table
+ *
+ * @param[out] out	Where to write the key slot.
+ * @param[in] st	to read from.
+ * @param[in] slot	to read.  Must be < #KEY_SLOTS.
+ */
+void fr_redis_slot_table_read(cluster_key_slot_t *out, fr_redis_slot_table_t *st, uint16_t slot)
+{
+	unsigned int		ref;
+
+	ref = fr_epoch_enter(st->epoch);
+	memcpy(out, &atomic_load(&st->live)->key_slot[slot & (KEY_SLOTS - 1)], sizeof(*out));
+	fr_epoch_exit(st->epoch, ref);
+}
+
+/** Resolve key to key slot
+ *
+ * Identical to the example implementation, except it uses memchr which will
+ * be faster, and isn't so needlessly complex.
+ *
+ * @param[in] key to resolve.
+ * @param[in] key_len length of key.
+ * @return key slot index for the key.
+ */
+uint16_t fr_redis_key_slot(uint8_t const *key, size_t key_len)
+{
+	uint8_t *p, *q;
+
+	p = memchr(key, '{', key_len);
+	if (!p) {
+	all:
+		return fr_crc16_xmodem(key, key_len) & (KEY_SLOTS - 1);
+	}
+
+	q = memchr(p, '}', key_len - (p - key)); /* look for } after { */
+	if (!q || (q == p + 1)) goto all; /* no } or {}, hash everything */
+
+	p++;	/* skip '{' */
+
+	return fr_crc16_xmodem(p, q - p) & (KEY_SLOTS - 1);	/* hash stuff between { and } */
+}
@@ -0,0 +1,61 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file slot_table.h
+ * @brief Lock-free key slot to node lookup table for Redis cluster.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+
+#ifndef LIBFREERADIUS_REDIS_SLOT_TABLE_H
+#define	LIBFREERADIUS_REDIS_SLOT_TABLE_H
+
+RCSIDH(slot_table_h, "$Id$")
+
+#include <stdint.h>
+#include <talloc.h>
+
+#define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
+
+#define MAX_SLAVES		5			//!< Maximum number of slaves associated
+							//!< with a keyslot.
+
+/** Indexes in the cluster_node_t array for a single key slot
+ *
+ * When dealing with 16K entries, space is a concern. It's significantly
+ * more memory efficient to use 8bit indexes than 64bit pointers for each
+ * of the key slot to node mappings.
+ */
+typedef struct cluster_key_slot {
+	uint8_t			slave[MAX_SLAVES];	//!< R/O node (slave) for this key slot.
+	uint8_t			slave_num;		//!< Number of slaves associated with this key slot.
+	uint8_t			master;			//!< R/W node (master) for this key slot.
+} cluster_key_slot_t;
+
+typedef struct fr_redis_slot_table fr_redis_slot_table_t;
+
+fr_redis_slot_table_t	*fr_redis_slot_table_alloc(TALLOC_CTX *ctx);
+
+cluster_key_slot_t	*fr_redis_slot_table_pending(fr_redis_slot_table_t *st);
+
+void			fr_redis_slot_table_publish(fr_redis_slot_table_t *st);
+
+void			fr_redis_slot_table_read(cluster_key_slot_t *out, fr_redis_slot_table_t *st, uint16_t slot);
+
+uint16_t		fr_redis_key_slot(uint8_t const *key, size_t key_len);
+#endif /* LIBFREERADIUS_REDIS_SLOT_TABLE_H */
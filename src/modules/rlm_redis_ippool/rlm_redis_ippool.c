@@ -93,9 +93,39 @@ typedef struct rlm_redis_ippool {
 	bool			copy_on_update; //!< Copy the address provided by ip_address to the
 						//!< allocated_address_attr if updates are successful.
 
+	bool			async;		//!< Allocate leases without blocking the worker thread.
+
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread specific data
+ *
+ */
+typedef struct rlm_redis_ippool_thread {
+	fr_redis_cluster_thread_t	*cluster;	//!< Asynchronous client for this thread.
+} rlm_redis_ippool_thread_t;
+
+/** State for an asynchronous allocation
+ *
+ * Holds copies of the expanded arguments, as we may need to resend the
+ * EVALSHA with the script if the node doesn't have it cached.
+ */
+typedef struct ippool_alloc_ctx {
+	fr_redis_cluster_async_t	*async;		//!< Commands in flight.
+
+	uint8_t const			*key_prefix;	//!< Pool name.
+	size_t				key_prefix_len;	//!< Length of the pool name.
+	uint8_t const			*device_id;	//!< Device identifier.
+	size_t				device_id_len;	//!< Length of the device identifier.
+	uint8_t const			*gateway_id;	//!< Gateway identifier.
+	size_t				gateway_id_len;	//!< Length of the gateway identifier.
+
+	unsigned int			now;		//!< Wall time when the allocation started.
+	uint32_t			expires;	//!< Lease time.
+
+	bool				load_script;	//!< Whether we sent the Lua script.
+} ippool_alloc_ctx_t;
+
 static CONF_PARSER redis_config[] = {
 	REDIS_COMMON_CONFIG,
 	CONF_PARSER_TERMINATOR
@@ -125,6 +155,8 @@ static CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("ipv4_integer", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, ipv4_integer) },
 	{ FR_CONF_OFFSET("copy_on_update", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, copy_on_update), .dflt = "yes", .quote = T_BARE_WORD },
 
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, async), .dflt = "no" },
+
 	/*
 	 *	Split out to allow conversion to universal ippool module with
 	 *	minimum of config changes.
@@ -346,6 +378,38 @@ static inline int ippool_wait_check(REQUEST *request, uint32_t wait_num, redisRe
 	return 0;
 }
 
+/** Check the result of the MULTI/SCRIPT LOAD/EVALSHA/EXEC transaction
+ *
+ * @param request The current request.
+ * @param digest of the script we loaded.
+ * @param reply to EXEC.
+ * @return
+ *	- 0 if the script was loaded, and the EXEC reply contains the result of EVALSHA.
+ *	- -1 on error.
+ */
+static int ippool_exec_check(REQUEST *request, char const digest[], redisReply *reply)
+{
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		REDEBUG("Bad response to EXEC, expected array got %s",
+			fr_int2str(redis_reply_types, reply->type, "<UNKNOWN>"));
+		return -1;
+	}
+	if (reply->elements != 2) {
+		REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu", reply->elements);
+		return -1;
+	}
+	if (reply->element[0]->type != REDIS_REPLY_STRING) {
+		REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
+			fr_int2str(redis_reply_types, reply->element[0]->type, "<UNKNOWN>"));
+		return -1;
+	}
+	if (strcmp(reply->element[0]->str, digest) != 0) {
+		RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s", digest, reply->element[0]->str);
+		return -1;
+	}
+	return 0;
+}
+
 static void ippool_action_print(REQUEST *request, ippool_action_t action,
 				log_lvl_t lvl,
 				uint8_t const *key_prefix, size_t key_prefix_len,
@@ -487,29 +551,12 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 				fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
 			}
 
-			if (replies[3]->type != REDIS_REPLY_ARRAY) {
-				REDEBUG("Bad response to EXEC, expected array got %s",
-					fr_int2str(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
+			if (ippool_exec_check(request, digest, replies[3]) < 0) {
 			error:
 				fr_redis_pipeline_free(replies, reply_cnt);
 				status = REDIS_RCODE_ERROR;
 				goto finish;
 			}
-			if (replies[3]->elements != 2) {
-				REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu",
-					replies[3]->elements);
-				goto error;
-			}
-			if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
-				REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
-					fr_int2str(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
-				goto error;
-			}
-			if (strcmp(replies[3]->element[0]->str, digest) != 0) {
-				RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
-					digest, replies[3]->element[0]->str);
-				goto error;
-			}
 		}
 	}
 	if (s_ret != REDIS_RCODE_SUCCESS) goto error;
@@ -547,47 +594,19 @@ finish:
 	return s_ret;
 }
 
-/** Allocate a new IP address from a pool
+/** Process the result of the allocation script
+ *
+ * Writes the allocated IP address, range, and expiry time to the request.
  *
+ * @param[in] inst	This instance of the rlm_redis_ippool module.
+ * @param[in] request	The current request.
+ * @param[in] reply	from the allocation script.  Not freed.
+ * @return the rcode from the script, or IPPOOL_RCODE_FAIL on error.
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request,
-					    uint8_t const *key_prefix, size_t key_prefix_len,
-					    uint8_t const *device_id, size_t device_id_len,
-					    uint8_t const *gateway_id, size_t gateway_id_len,
-					    uint32_t expires)
+static ippool_rcode_t ippool_allocate_reply(rlm_redis_ippool_t const *inst, REQUEST *request, redisReply *reply)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
-	rad_assert(key_prefix);
-	rad_assert(device_id);
-
-	gettimeofday(&now, NULL);
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!gateway_id) gateway_id = (uint8_t const *)"";
-
-	status = ippool_script(&reply, request, inst->cluster,
-			       key_prefix, key_prefix_len,
-			       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       key_prefix, key_prefix_len,
-			       (unsigned int)now.tv_sec, expires,
-			       device_id, device_id_len,
-			       gateway_id, gateway_id_len);
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
-	rad_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_int2str(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -754,10 +773,234 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQU
 		}
 	}
 finish:
+	return ret;
+}
+
+/** Allocate a new IP address from a pool
+ *
+ */
+static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request,
+					    uint8_t const *key_prefix, size_t key_prefix_len,
+					    uint8_t const *device_id, size_t device_id_len,
+					    uint8_t const *gateway_id, size_t gateway_id_len,
+					    uint32_t expires)
+{
+	struct			timeval now;
+	redisReply		*reply = NULL;
+
+	fr_redis_rcode_t	status;
+	ippool_rcode_t		ret;
+
+	rad_assert(key_prefix);
+	rad_assert(device_id);
+
+	gettimeofday(&now, NULL);
+
+	/*
+	 *	hiredis doesn't deal well with NULL string pointers
+	 */
+	if (!gateway_id) gateway_id = (uint8_t const *)"";
+
+	status = ippool_script(&reply, request, inst->cluster,
+			       key_prefix, key_prefix_len,
+			       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
+			       lua_alloc_digest, lua_alloc_cmd,
+	 		       "EVALSHA %s 1 %b %u %u %b %b",
+	 		       lua_alloc_digest,
+			       key_prefix, key_prefix_len,
+			       (unsigned int)now.tv_sec, expires,
+			       device_id, device_id_len,
+			       gateway_id, gateway_id_len);
+	if (status != REDIS_RCODE_SUCCESS) return IPPOOL_RCODE_FAIL;
+
+	rad_assert(reply);
+	ret = ippool_allocate_reply(inst, request, reply);
 	fr_redis_reply_free(reply);
+
 	return ret;
 }
 
+
+/** Convert the result of an allocation into a module rcode
+ *
+ */
+static rlm_rcode_t ippool_allocate_rcode(REQUEST *request, ippool_rcode_t ret)
+{
+	switch (ret) {
+	case IPPOOL_RCODE_SUCCESS:
+		RDEBUG2("IP address lease allocated");
+		return RLM_MODULE_UPDATED;
+
+	case IPPOOL_RCODE_POOL_EMPTY:
+		RWDEBUG("Pool contains no free addresses");
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+}
+
+static rlm_rcode_t mod_allocate_resume(REQUEST *request, void *instance, void *thread, void *ctx);
+static void mod_allocate_action(REQUEST *request, void *instance, void *thread, void *ctx,
+				fr_state_action_t action);
+
+/** Send the allocation script to the cluster without blocking
+ *
+ * If the node previously told us it didn't have the script cached, the script
+ * is loaded and called in a single transaction, as with #ippool_script.
+ *
+ * @param[in] inst	This instance of the rlm_redis_ippool module.
+ * @param[in] t		Thread specific data.
+ * @param[in] request	The current request.
+ * @param[in] actx	Allocation state.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ippool_allocate_async_send(rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *t,
+				      REQUEST *request, ippool_alloc_ctx_t *actx)
+{
+	TALLOC_FREE(actx->async);	/* Free the replies from any previous attempt */
+
+	actx->async = fr_redis_cluster_async_alloc(actx, t->cluster, request,
+						   actx->key_prefix, actx->key_prefix_len, false);
+	if (!actx->async) return -1;
+
+	if (actx->load_script) {
+		RDEBUG3("Loading script 0x%s", lua_alloc_digest);
+		if (fr_redis_cluster_async_append(actx->async, "MULTI") < 0) return -1;
+		if (fr_redis_cluster_async_append(actx->async, "SCRIPT LOAD %s", lua_alloc_cmd) < 0) return -1;
+	}
+
+	RDEBUG3("Calling script 0x%s", lua_alloc_digest);
+	if (fr_redis_cluster_async_append(actx->async, "EVALSHA %s 1 %b %u %u %b %b",
+					  lua_alloc_digest,
+					  actx->key_prefix, actx->key_prefix_len,
+					  actx->now, actx->expires,
+					  actx->device_id, actx->device_id_len,
+					  actx->gateway_id, actx->gateway_id_len) < 0) return -1;
+
+	if (actx->load_script && (fr_redis_cluster_async_append(actx->async, "EXEC") < 0)) return -1;
+
+	if (inst->wait_num && (fr_redis_cluster_async_append(actx->async, "WAIT %i %i", inst->wait_num,
+							      FR_TIMEVAL_TO_MS(&inst->wait_timeout)) < 0)) return -1;
+
+	return fr_redis_cluster_async_send(actx->async);
+}
+
+/** Process the replies to an asynchronous allocation
+ *
+ */
+static rlm_rcode_t mod_allocate_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_redis_ippool_t const	*inst = instance;
+	ippool_alloc_ctx_t		*actx = talloc_get_type_abort(ctx, ippool_alloc_ctx_t);
+	redisReply			**replies, *reply;
+	size_t				reply_cnt;
+	fr_redis_rcode_t		status;
+	ippool_rcode_t			ret = IPPOOL_RCODE_FAIL;
+
+	status = fr_redis_cluster_async_result(&replies, &reply_cnt, actx->async);
+
+	/*
+	 *	Node doesn't have the script cached, send it
+	 *	up with the EVALSHA and yield again.
+	 */
+	if ((status == REDIS_RCODE_NO_SCRIPT) && !actx->load_script) {
+		actx->load_script = true;
+		if (ippool_allocate_async_send(inst, thread, request, actx) < 0) goto finish;
+
+		return unlang_yield(request, mod_allocate_resume, mod_allocate_action, actx);
+	}
+	if (status != REDIS_RCODE_SUCCESS) goto finish;
+
+	switch (reply_cnt) {
+	case 2:	/* EVALSHA with wait */
+		if (ippool_wait_check(request, inst->wait_num, replies[1]) < 0) goto finish;
+		/* FALL-THROUGH */
+
+	case 1:	/* EVALSHA */
+		reply = replies[0];
+		break;
+
+	case 5: /* LOADSCRIPT + EVALSHA + WAIT */
+		if (ippool_wait_check(request, inst->wait_num, replies[4]) < 0) goto finish;
+		/* FALL-THROUGH */
+
+	case 4: /* LOADSCRIPT + EVALSHA */
+		if (ippool_exec_check(request, lua_alloc_digest, replies[3]) < 0) goto finish;
+		reply = replies[3]->element[1];
+		break;
+
+	default:
+		goto finish;
+	}
+
+	ret = ippool_allocate_reply(inst, request, reply);
+
+finish:
+	talloc_free(actx);	/* Frees the replies too */
+
+	return ippool_allocate_rcode(request, ret);
+}
+
+/** Abandon an asynchronous allocation
+ *
+ * Any replies still in flight are discarded when they arrive.
+ */
+static void mod_allocate_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				fr_state_action_t action)
+{
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending lease allocation");
+	talloc_free(ctx);
+}
+
+/** Allocate a new IP address from a pool, without blocking the worker thread
+ *
+ */
+static rlm_rcode_t redis_ippool_allocate_async(rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *t,
+					       REQUEST *request,
+					       uint8_t const *key_prefix, size_t key_prefix_len,
+					       uint8_t const *device_id, size_t device_id_len,
+					       uint8_t const *gateway_id, size_t gateway_id_len,
+					       uint32_t expires)
+{
+	ippool_alloc_ctx_t	*actx;
+	struct timeval		now;
+
+	rad_assert(key_prefix);
+	rad_assert(device_id);
+
+	gettimeofday(&now, NULL);
+
+	/*
+	 *	The arguments are usually expanded into buffers
+	 *	on the stack, so they need to be copied.
+	 */
+	MEM(actx = talloc_zero(request, ippool_alloc_ctx_t));
+	MEM(actx->key_prefix = talloc_memdup(actx, key_prefix, key_prefix_len));
+	actx->key_prefix_len = key_prefix_len;
+	MEM(actx->device_id = talloc_memdup(actx, device_id, device_id_len));
+	actx->device_id_len = device_id_len;
+	if (gateway_id) {
+		MEM(actx->gateway_id = talloc_memdup(actx, gateway_id, gateway_id_len));
+		actx->gateway_id_len = gateway_id_len;
+	} else {
+		actx->gateway_id = (uint8_t const *)"";	/* hiredis doesn't deal well with NULL string pointers */
+	}
+	actx->now = (unsigned int)now.tv_sec;
+	actx->expires = expires;
+
+	if (ippool_allocate_async_send(inst, t, request, actx) < 0) {
+		talloc_free(actx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_yield(request, mod_allocate_resume, mod_allocate_action, actx);
+}
+
 /** Update an existing IP address in a pool
  *
  */
@@ -1025,7 +1268,8 @@ static inline ssize_t ippool_pool_name(uint8_t const **out, uint8_t buff[], size
 	return slen;
 }
 
-static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request, ippool_action_t action)
+static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *t,
+			      REQUEST *request, ippool_action_t action)
 {
 	uint8_t		key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], device_id_buff[256], gateway_id_buff[256];
 	uint8_t const	*key_prefix, *device_id = NULL, *gateway_id = NULL;
@@ -1081,21 +1325,17 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, NULL,
 				    device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_allocate(inst, request, key_prefix, key_prefix_len,
-					      device_id, device_id_len,
-					      gateway_id, gateway_id_len, (uint32_t)expires)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("IP address lease allocated");
-			return RLM_MODULE_UPDATED;
-
-		case IPPOOL_RCODE_POOL_EMPTY:
-			RWDEBUG("Pool contains no free addresses");
-			return RLM_MODULE_NOTFOUND;
-
-		default:
-			return RLM_MODULE_FAIL;
+		if (inst->async) {
+			return redis_ippool_allocate_async(inst, t, request, key_prefix, key_prefix_len,
+							   device_id, device_id_len,
+							   gateway_id, gateway_id_len, (uint32_t)expires);
 		}
 
+		return ippool_allocate_rcode(request,
+					     redis_ippool_allocate(inst, request, key_prefix, key_prefix_len,
+								   device_id, device_id_len,
+								   gateway_id, gateway_id_len, (uint32_t)expires));
+
 	case POOL_ACTION_UPDATE:
 	{
 		char		ip_buff[INET6_ADDRSTRLEN + 4];
@@ -1227,8 +1467,8 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 	}
 }
 
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1237,7 +1477,7 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	 *	Pool-Action override
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, PW_POOL_ACTION, TAG_ANY);
-	if (vp) return mod_action(inst, request, vp->vp_integer);
+	if (vp) return mod_action(inst, thread, request, vp->vp_integer);
 
 	/*
 	 *	Otherwise, guess the action by Acct-Status-Type
@@ -1251,22 +1491,22 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	switch (vp->vp_integer) {
 	case PW_STATUS_START:
 	case PW_STATUS_ALIVE:
-		return mod_action(inst, request, POOL_ACTION_UPDATE);
+		return mod_action(inst, thread, request, POOL_ACTION_UPDATE);
 
 	case PW_STATUS_STOP:
-		return mod_action(inst, request, POOL_ACTION_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_RELEASE);
 
 	case PW_STATUS_ACCOUNTING_OFF:
 	case PW_STATUS_ACCOUNTING_ON:
-		return mod_action(inst, request, POOL_ACTION_BULK_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_BULK_RELEASE);
 
 	default:
 		return RLM_MODULE_NOOP;
 	}
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1276,11 +1516,11 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, PW_POOL_ACTION, TAG_ANY);
-	return mod_action(inst, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
+	return mod_action(inst, thread, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
 }
 
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1290,7 +1530,7 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, PW_POOL_ACTION, TAG_ANY);
-	return mod_action(inst, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
+	return mod_action(inst, thread, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
 }
 
 static int mod_instantiate(CONF_SECTION *conf, void *instance)
@@ -1343,6 +1583,44 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/** Allocate the per-thread asynchronous cluster client
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_redis_ippool_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_redis_ippool_t		*inst = instance;
+	rlm_redis_ippool_thread_t	*t = thread;
+
+	if (!inst->async) return 0;
+
+	t->cluster = fr_redis_cluster_thread_alloc(t, inst->cluster, el);
+	if (!t->cluster) return -1;
+
+	return 0;
+}
+
+/** Close any connections opened by this thread
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_redis_ippool_thread_t	*t = thread;
+
+	TALLOC_FREE(t->cluster);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -1352,13 +1630,16 @@ static int mod_load(void)
 
 extern rad_module_t rlm_redis_ippool;
 rad_module_t rlm_redis_ippool = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "redis",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_redis_ippool_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.instantiate	= mod_instantiate,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "redis",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_redis_ippool_t),
+	.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_AUTHORIZE]		= mod_authorize,
@@ -24,6 +24,7 @@
 #include "rest.h"
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/modules.h>
+#include <freeradius-devel/latency.h>
 
 /*
  *  CURL headers do:
@@ -40,6 +41,95 @@ do {\
 	}\
 } while (0)
 
+/** Compare two endpoints by name
+ *
+ */
+static int _rest_io_endpoint_cmp(void const *a, void const *b)
+{
+	rlm_rest_endpoint_t const *my_a = a, *my_b = b;
+
+	return strcmp(my_a->name, my_b->name);
+}
+
+/** Find or create the stats structure for the endpoint a URI refers to
+ *
+ * The endpoint is the scheme and host (and port) portion of the URI.
+ * Any userinfo is omitted, as the endpoint name is logged.
+ *
+ * @param[in] t		Thread the transfer is being made from.
+ * @param[in] uri	the transfer is for.
+ * @return
+ *	- The endpoint.
+ *	- NULL if the URI was too long.
+ */
+static rlm_rest_endpoint_t *rest_io_endpoint_find(rlm_rest_thread_t *t, char const *uri)
+{
+	rlm_rest_endpoint_t	find, *endpoint;
+	char			buffer[256];
+	char const		*host, *end, *at;
+	size_t			scheme_len = 0, host_len;
+
+	host = strstr(uri, "://");
+	if (host) {
+		host += 3;
+		scheme_len = host - uri;
+	} else {
+		host = uri;
+	}
+
+	end = host + strcspn(host, "/?#");
+	at = memchr(host, '@', end - host);
+	if (at) host = at + 1;
+	host_len = end - host;
+
+	if ((scheme_len + host_len) >= sizeof(buffer)) return NULL;
+
+	memcpy(buffer, uri, scheme_len);
+	memcpy(buffer + scheme_len, host, host_len);
+	buffer[scheme_len + host_len] = '\0';
+
+	find.name = buffer;
+	endpoint = rbtree_finddata(t->endpoints, &find);
+	if (endpoint) return endpoint;
+
+	endpoint = talloc_zero(t->endpoints, rlm_rest_endpoint_t);
+	endpoint->name = talloc_strdup(endpoint, buffer);
+
+	/*
+	 *	Every thread talking to this endpoint gets the
+	 *	same histograms.
+	 */
+	endpoint->latency_id = fr_latency_register("rest.%s.%s", t->inst->xlat_name, buffer);
+	endpoint->failed_id = fr_latency_register("rest.%s.%s.failed", t->inst->xlat_name, buffer);
+
+	if (!rbtree_insert(t->endpoints, endpoint)) {
+		talloc_free(endpoint);
+		return NULL;
+	}
+
+	return endpoint;
+}
+
+/** Record how long a transfer took against its endpoint
+ *
+ * @param[in] randle	whose transfer finished.
+ * @param[in] success	Whether the transfer completed at the transport layer.
+ */
+static void rest_io_endpoint_done(rlm_rest_handle_t *randle, bool success)
+{
+	rlm_rest_endpoint_t	*endpoint = randle->endpoint;
+	REQUEST			*request = randle->request;
+	uint64_t		elapsed;
+
+	if (!endpoint) return;
+	randle->endpoint = NULL;
+
+	elapsed = fr_latency_now() - randle->start;
+	fr_latency_record(success ? endpoint->latency_id : endpoint->failed_id, elapsed);
+
+	RDEBUG3("%s - %s after %" PRIu64 "us", endpoint->name, success ? "completed" : "failed", elapsed / 1000);
+}
+
 /** De-queue curl requests and wake up the requests that initiated them
  *
  * @param[in] thread	holding the requests to re-enliven.
@@ -54,9 +144,10 @@ static inline void _rest_io_demux(rlm_rest_thread_t *thread, CURLM *mandle)
 		switch (m->msg) {
 		case CURLMSG_DONE:
 		{
-			REQUEST		*request = NULL;
-			CURL		*candle = m->easy_handle;
-			CURLcode	ret;
+			REQUEST			*request;
+			rlm_rest_handle_t	*randle = NULL;
+			CURL			*candle = m->easy_handle;
+			CURLcode		ret;
 
 			rad_assert(candle);
 
@@ -64,9 +155,10 @@ static inline void _rest_io_demux(rlm_rest_thread_t *thread, CURLM *mandle)
 
 			thread->transfers--;
 
-			ret = curl_easy_getinfo(candle, CURLINFO_PRIVATE, &request);
+			ret = curl_easy_getinfo(candle, CURLINFO_PRIVATE, &randle);
 			if (!fr_cond_assert(ret == CURLE_OK)) return;
 
+			request = randle->request;
 			VERIFY_REQUEST(request);
 
 			/*
@@ -76,8 +168,11 @@ static inline void _rest_io_demux(rlm_rest_thread_t *thread, CURLM *mandle)
 				REDEBUG("%s (%i)", curl_easy_strerror(m->data.result), m->data.result);
 			}
 
+			rest_io_endpoint_done(randle, (m->data.result == CURLE_OK));
+
 			unlang_resumable(request);
 		}
+			break;
 
 		default:
 #if 0
@@ -328,7 +423,7 @@ static int _rest_io_event_modify(UNUSED CURL *easy, curl_socket_t fd, int what,
 /** Handle asynchronous cancellation of a request
  *
  * If we're signalled that the request has been cancelled (FR_ACTION_DONE).
- * Cleanup any pending state and release the connection handle back into the pool.
+ * Cleanup any pending state and release the handle back to the thread's free list.
  *
  * @param[in] request	being cancelled.
  * @param[in] instance	of rlm_rest.
@@ -353,8 +448,10 @@ void rest_io_action(REQUEST *request, void *instance, void *thread, void *ctx, f
 	}
 	t->transfers--;
 
+	rest_io_endpoint_done(randle, false);
+
 	rest_request_cleanup(instance, randle);
-	fr_connection_release(t->pool, request, randle);
+	rest_io_handle_release(t, randle);
 }
 
 /** Sends a REST (HTTP) request.
@@ -365,36 +462,100 @@ void rest_io_action(REQUEST *request, void *instance, void *thread, void *ctx, f
  * @param[in] t		Servicing this request.
  * @param[in] request	Current request.
  * @param[in] handle	to use.
+ * @param[in] uri	the handle was configured with.  Used to determine
+ *			which endpoint's stats to update.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-int rest_io_request_enqueue(rlm_rest_thread_t *t, REQUEST *request, void *handle)
+int rest_io_request_enqueue(rlm_rest_thread_t *t, REQUEST *request, void *handle, char const *uri)
 {
 	rlm_rest_handle_t	*randle = handle;
 	CURL			*candle = randle->candle;
-	CURLcode		ret;
+	CURLMcode		ret;
 
 	VERIFY_REQUEST(request);
 
 	/*
-	 *	Stick the current request in the curl handle's
-	 *	private data.  This makes it simple to resume
-	 *	the request in the demux function later...
+	 *	Stick the handle in the curl handle's private
+	 *	data.  This makes it simple to find the request
+	 *	and resume it in the demux function later...
 	 */
-	curl_easy_setopt(candle, CURLOPT_PRIVATE, request);
+	randle->request = request;
+	curl_easy_setopt(candle, CURLOPT_PRIVATE, randle);
 
 	ret = curl_multi_add_handle(t->mandle, candle);
-	if (ret != CURLE_OK) {
-		REDEBUG("Request failed: %i - %s", ret, curl_easy_strerror(ret));
+	if (ret != CURLM_OK) {
+		REDEBUG("Request failed: %i - %s", ret, curl_multi_strerror(ret));
 
 		return -1;
 	}
 	t->transfers++;
 
+	randle->start = fr_latency_now();
+	randle->endpoint = rest_io_endpoint_find(t, uri);
+
 	return 0;
 }
 
+/** Get an easy handle from the thread's free list, or allocate a new one
+ *
+ * Handles are only used by a single request at a time, but unlike
+ * connections from a connection pool, they're cheap.  Connections are
+ * owned by the multi-handle (and share handle) and are picked by libcurl
+ * when the transfer starts, so many handles may multiplex over a single
+ * HTTP/2 connection.
+ *
+ * @param[in] t		Thread to get the handle for.
+ * @param[in] request	Current request.
+ * @return
+ *	- A handle.
+ *	- NULL if no handle could be allocated.
+ */
+rlm_rest_handle_t *rest_io_handle_get(rlm_rest_thread_t *t, REQUEST *request)
+{
+	rlm_rest_handle_t	*randle;
+
+	randle = t->free_handles;
+	if (randle) {
+		t->free_handles = randle->next;
+		t->num_free--;
+		randle->next = NULL;
+
+		return randle;
+	}
+
+	randle = rest_handle_alloc(t, t->inst);
+	if (!randle) {
+		REDEBUG("Failed allocating curl handle");
+		return NULL;
+	}
+
+	return randle;
+}
+
+/** Return an easy handle to the thread's free list
+ *
+ * rest_request_cleanup must have been called on the handle first.
+ * If the free list is full, the handle is freed instead.
+ *
+ * @param[in] t		Thread the handle belongs to.
+ * @param[in] randle	to release.
+ */
+void rest_io_handle_release(rlm_rest_thread_t *t, rlm_rest_handle_t *randle)
+{
+	randle->request = NULL;
+
+	if (t->num_free >= t->inst->max_idle_handles) {
+		talloc_free(randle);
+		return;
+	}
+
+	randle->next = t->free_handles;
+	t->free_handles = randle;
+	t->num_free++;
+}
+
 /** Performs the libcurl initialisation of the thread
  *
  * @param[in] thread to initialise.
@@ -405,9 +566,36 @@ int rest_io_request_enqueue(rlm_rest_thread_t *t, REQUEST *request, void *handle
 int rest_io_init(rlm_rest_thread_t *thread)
 {
 	CURLMcode	ret;
+	CURLSHcode	sret;
 	CURLM		*mandle;
 	char const	*option = "unknown";
 
+	thread->endpoints = rbtree_create(thread, _rest_io_endpoint_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!thread->endpoints) {
+		ERROR("Failed creating endpoint tree");
+		return -1;
+	}
+
+	/*
+	 *	The share handle is only ever used by this
+	 *	thread, so no lock functions are required.
+	 */
+	thread->share = curl_share_init();
+	if (!thread->share) {
+		ERROR("Curl share-handle instantiation failed");
+		return -1;
+	}
+
+	sret = curl_share_setopt(thread->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	if (sret == CURLSHE_OK) sret = curl_share_setopt(thread->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	if (sret == CURLSHE_OK) sret = curl_share_setopt(thread->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	if (sret != CURLSHE_OK) {
+		ERROR("Failed configuring curl share-handle: %s (%i)", curl_share_strerror(sret), sret);
+		return -1;
+	}
+
 	mandle = thread->mandle = curl_multi_init();
 	if (!thread->mandle) {
 		ERROR("Curl multi-handle instantiation failed");
@@ -420,6 +608,16 @@ int rest_io_init(rlm_rest_thread_t *thread)
 	SET_OPTION(CURLMOPT_SOCKETFUNCTION, _rest_io_event_modify);
 	SET_OPTION(CURLMOPT_SOCKETDATA, thread);
 
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	if (thread->inst->multiplex) SET_OPTION(CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	if (thread->inst->max_host_connections) {
+		SET_OPTION(CURLMOPT_MAX_HOST_CONNECTIONS, (long)thread->inst->max_host_connections);
+	}
+#endif
+
 	return 0;
 
 error:
@@ -427,3 +625,31 @@ error:
 
 	return -1;
 }
+
+/** Free the libcurl resources held by a thread
+ *
+ * @param[in] thread to free resources for.
+ */
+void rest_io_free(rlm_rest_thread_t *thread)
+{
+	rlm_rest_handle_t	*randle, *next;
+
+	for (randle = thread->free_handles; randle; randle = next) {
+		next = randle->next;
+		talloc_free(randle);
+	}
+	thread->free_handles = NULL;
+	thread->num_free = 0;
+
+	if (thread->mandle) {
+		curl_multi_cleanup(thread->mandle);
+		thread->mandle = NULL;
+	}
+
+	if (thread->share) {
+		curl_share_cleanup(thread->share);
+		thread->share = NULL;
+	}
+
+	TALLOC_FREE(thread->endpoints);
+}
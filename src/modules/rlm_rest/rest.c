@@ -36,9 +36,12 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/connection.h>
+#include <freeradius-devel/escape.h>
 
 #include "rest.h"
 
+static fr_escape_t rest_uri_escaper;	//!< Unreserved characters from RFC 3986 section 2.3.
+
 /** Table of encoder/decoder support.
  *
  * Indexes in this table match the http_body_type_t enum, and should be
@@ -246,36 +249,33 @@ typedef struct json_flags {
  * @param[in] randle rlm_rest_handle_t to close and free.
  * @return returns true.
  */
-static int _mod_conn_free(rlm_rest_handle_t *randle)
+static int _rest_handle_free(rlm_rest_handle_t *randle)
 {
 	curl_easy_cleanup(randle->candle);
 
 	return 0;
 }
 
-/** Creates a new connection handle for use by the FR connection API.
+/** Creates a new easy handle
  *
- * Matches the fr_connection_create_t function prototype, is passed to
- * fr_connection_pool_init, and called when a new connection is required by the
- * connection pool API.
+ * Called by #rest_io_handle_get when the thread's free list is empty.
  *
  * Creates an instances of rlm_rest_handle_t, and rlm_rest_curl_context_t
  * which hold the context data required for generating requests and parsing
  * responses.
  *
- * If instance->connect_uri is not NULL libcurl will attempt to open a
- * TCP socket to the server specified in the URI. This is done so that when the
- * socket is first used, there will already be a cached TCP connection to the
- * REST server associated with the curl handle.
+ * Easy handles are no longer bound to a connection, libcurl picks one
+ * from the multi-handle's connection cache (or the thread's share handle)
+ * each time a transfer is started.
  *
- * @see fr_connection_pool_init
- * @see fr_connection_create_t
- * @see connection.c
+ * @param[in] ctx	to allocate the handle in.
+ * @param[in] inst	of rlm_rest.
+ * @return
+ *	- A new handle.
+ *	- NULL on error.
  */
-void *mod_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED struct timeval const *timeout)
+rlm_rest_handle_t *rest_handle_alloc(TALLOC_CTX *ctx, rlm_rest_t const *inst)
 {
-	rlm_rest_t const	*inst = instance;
-
 	rlm_rest_handle_t	*randle = NULL;
 	rlm_rest_curl_context_t	*curl_ctx = NULL;
 
@@ -298,7 +298,7 @@ void *mod_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED struct timeval con
 
 	randle->ctx = curl_ctx;
 	randle->candle = candle;
-	talloc_set_destructor(randle, _mod_conn_free);
+	talloc_set_destructor(randle, _rest_handle_free);
 
 	return randle;
 }
@@ -1703,7 +1703,6 @@ int rest_request_config(rlm_rest_t const *inst, rlm_rest_thread_t *t, rlm_rest_s
 	rlm_rest_handle_t	*randle	= handle;
 	rlm_rest_curl_context_t	*ctx = randle->ctx;
 	CURL			*candle = randle->candle;
-	struct timeval		timeout;
 
 	http_auth_type_t	auth = section->auth;
 
@@ -1740,12 +1739,28 @@ int rest_request_config(rlm_rest_t const *inst, rlm_rest_thread_t *t, rlm_rest_s
 		if (!ctx->headers) goto error_header;
 	}
 
-	timeout = fr_connection_pool_timeout(t->pool);
-	ERROR("CONNECT TIMEOUT IS %" PRIu64", REQUEST TIMEOUT IS %" PRIu64,
-	      FR_TIMEVAL_TO_MS(&timeout), FR_TIMEVAL_TO_MS(&section->timeout_tv));
-	SET_OPTION(CURLOPT_CONNECTTIMEOUT_MS, FR_TIMEVAL_TO_MS(&timeout));
+	SET_OPTION(CURLOPT_CONNECTTIMEOUT_MS, FR_TIMEVAL_TO_MS(&inst->connect_timeout));
 	SET_OPTION(CURLOPT_TIMEOUT_MS, FR_TIMEVAL_TO_MS(&section->timeout_tv));
 
+	/*
+	 *	curl_easy_reset() clears the share handle, so it
+	 *	needs to be set again for every transfer.
+	 */
+	if (t->share) SET_OPTION(CURLOPT_SHARE, t->share);
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	/*
+	 *	Use HTTP/2 for https:// URIs if the server supports
+	 *	it (negotiated with ALPN), and wait for pending
+	 *	connections to complete negotiation instead of
+	 *	opening new ones, so we get to multiplex over them.
+	 */
+	if (inst->multiplex) {
+		SET_OPTION(CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		SET_OPTION(CURLOPT_PIPEWAIT, 1L);
+	}
+#endif
+
 #ifdef CURLOPT_PROTOCOLS
 	SET_OPTION(CURLOPT_PROTOCOLS, (CURLPROTO_HTTP | CURLPROTO_HTTPS));
 #endif
@@ -2238,6 +2253,15 @@ void rest_request_cleanup(UNUSED rlm_rest_t const *instance, void *handle)
 	TALLOC_FREE(ctx->response.decoder);
 }
 
+/** Build the table used by #rest_uri_escape
+ *
+ * Must be called before any strings are escaped.
+ */
+void rest_uri_escape_init(void)
+{
+	fr_escape_init(&rest_uri_escaper, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~", '%', 0);
+}
+
 /** URL encodes a string.
  *
  * Encode special chars as per RFC 3986 section 4.
@@ -2251,13 +2275,7 @@ void rest_request_cleanup(UNUSED rlm_rest_t const *instance, void *handle)
  */
 size_t rest_uri_escape(UNUSED REQUEST *request, char *out, size_t outlen, char const *raw, UNUSED void *arg)
 {
-	char *escaped;
-
-	escaped = curl_escape(raw, strlen(raw));
-	strlcpy(out, escaped, outlen);
-	curl_free(escaped);
-
-	return strlen(out);
+	return fr_escape(&rest_uri_escaper, out, outlen, raw, -1);
 }
 
 /** Builds URI; performs XLAT expansions and encoding.
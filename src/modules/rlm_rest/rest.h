@@ -147,7 +147,14 @@ typedef struct {
 
 	char const		*connect_proxy;	//!< Send request via this proxy.
 
-	fr_connection_pool_t	*pool;		//!< Pointer to the connection pool.
+	struct timeval		connect_timeout;	//!< How long to wait for a new connection
+							//!< to be established.
+	bool			multiplex;	//!< Negotiate HTTP/2 and multiplex requests
+						//!< over existing connections.
+	uint32_t		max_host_connections;	//!< Maximum number of connections each
+							//!< thread may open to a single host.
+	uint32_t		max_idle_handles;	//!< Maximum number of idle easy handles
+							//!< each thread keeps around for reuse.
 
 	rlm_rest_section_t	xlat;		//!< Configuration specific to xlat.
 	rlm_rest_section_t	authorize;	//!< Configuration specific to authorisation.
@@ -158,14 +165,39 @@ typedef struct {
 	rlm_rest_section_t	post_auth;	//!< Configuration specific to Post-auth
 } rlm_rest_t;
 
+/** Per-endpoint statistics
+ *
+ * An endpoint is the scheme and authority portion of a URI, i.e. everything
+ * which determines which connections libcurl may use for the transfer.
+ *
+ * Transfer times are recorded in the server's latency histograms, so they
+ * can be read with radmin "stats latency rest." or a Status-Server request.
+ */
+typedef struct {
+	char const		*name;		//!< scheme://host[:port] of the endpoint.
+
+	uint32_t		latency_id;	//!< Histogram for transfers which completed.
+	uint32_t		failed_id;	//!< Histogram for transfers which failed at
+						//!< the transport layer.
+} rlm_rest_endpoint_t;
+
+typedef struct rlm_rest_handle rlm_rest_handle_t;
+
 /** Thread specific rlm_rest instance data
  *
  */
 typedef struct {
 	rlm_rest_t const	*inst;		//!< Instance of rlm_rest.
-	fr_connection_pool_t	*pool;		//!< Thread specific connection pool.
 	CURLM			*mandle;	//!< Thread specific multi handle.  Serves as the dispatch
 						//!< and coralling structure for REST requests.
+	CURLSH			*share;		//!< Shares DNS, TLS session and connection caches
+						//!< between all easy handles owned by this thread.
+
+	rlm_rest_handle_t	*free_handles;	//!< Idle easy handles, ready for reuse.
+	uint32_t		num_free;	//!< How many handles are on the free list.
+
+	rbtree_t		*endpoints;	//!< Per-endpoint statistics (rlm_rest_endpoint_t).
+
 	fr_event_list_t		*el;		//!< This thread's event list.
 	fr_event_timer_t	*ev;		//!< Used to manage IO timers for libcurl.
 	unsigned int		transfers;	//!< Keep track of how many outstanding transfers
@@ -242,12 +274,18 @@ typedef struct {
 } rlm_rest_curl_context_t;
 
 /*
- *	Connection API handle
+ *	Easy handle wrapper
  */
-typedef struct {
+struct rlm_rest_handle {
 	CURL			*candle;	//!< Libcurl easy handle
 	rlm_rest_curl_context_t	*ctx;		//!< Context, re-initialised after each request.
-} rlm_rest_handle_t;
+
+	REQUEST			*request;	//!< Request the current transfer is for.
+	rlm_rest_endpoint_t	*endpoint;	//!< Endpoint the current transfer is for.
+	uint64_t		start;		//!< When the current transfer was enqueued.
+
+	rlm_rest_handle_t	*next;		//!< Next handle in the thread's free list.
+};
 
 /*
  *	Function prototype for rest_read_wrapper. Matches CURL's
@@ -257,7 +295,7 @@ typedef size_t (*rest_read_t)(void *ptr, size_t size, size_t nmemb,
 			      void *userdata);
 
 
-void *mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *timeout);
+rlm_rest_handle_t *rest_handle_alloc(TALLOC_CTX *ctx, rlm_rest_t const *instance);
 
 /*
  *	Request processing API
@@ -288,6 +326,7 @@ size_t rest_get_handle_data(char const **out, rlm_rest_handle_t *handle);
 /*
  *	Helper functions
  */
+void rest_uri_escape_init(void);
 size_t rest_uri_escape(UNUSED REQUEST *request, char *out, size_t outlen, char const *raw, UNUSED void *arg);
 ssize_t rest_uri_build(char **out, rlm_rest_t const *instance, REQUEST *request, char const *uri);
 ssize_t rest_uri_host_unescape(char **out, UNUSED rlm_rest_t const *mod_inst, REQUEST *request,
@@ -297,6 +336,9 @@ ssize_t rest_uri_host_unescape(char **out, UNUSED rlm_rest_t const *mod_inst, RE
  *	Async IO helpers
  */
 void rest_io_action(REQUEST *request, void *instance, void *thread, void *ctx, fr_state_action_t action);
-int rest_io_request_enqueue(rlm_rest_thread_t *thread, REQUEST *request, void *handle);
+int rest_io_request_enqueue(rlm_rest_thread_t *thread, REQUEST *request, void *handle, char const *uri);
+rlm_rest_handle_t *rest_io_handle_get(rlm_rest_thread_t *thread, REQUEST *request);
+void rest_io_handle_release(rlm_rest_thread_t *thread, rlm_rest_handle_t *randle);
 int rest_io_init(rlm_rest_thread_t *thread);
+void rest_io_free(rlm_rest_thread_t *thread);
 
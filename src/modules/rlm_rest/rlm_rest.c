@@ -88,9 +88,25 @@ static const CONF_PARSER xlat_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	The module used to have a connection pool.  Items from the old
+ *	"pool" section which still mean something are mapped to their
+ *	replacements.  They're parsed after the module's own items, so
+ *	existing configurations behave as before.
+ */
+static const CONF_PARSER pool_config[] = {
+	{ FR_CONF_OFFSET("connect_timeout", PW_TYPE_TIMEVAL, rlm_rest_t, connect_timeout) },
+	{ FR_CONF_OFFSET("spare", PW_TYPE_INTEGER, rlm_rest_t, max_idle_handles) },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
-	{ FR_CONF_DEPRECATED("connect_timeout", PW_TYPE_TIMEVAL, rlm_rest_t, connect_timeout) },
+	{ FR_CONF_OFFSET("connect_timeout", PW_TYPE_TIMEVAL, rlm_rest_t, connect_timeout), .dflt = "3.0" },
 	{ FR_CONF_OFFSET("connect_proxy", PW_TYPE_STRING, rlm_rest_t, connect_proxy) },
+	{ FR_CONF_OFFSET("multiplex", PW_TYPE_BOOLEAN, rlm_rest_t, multiplex), .dflt = "yes" },
+	{ FR_CONF_OFFSET("max_host_connections", PW_TYPE_INTEGER, rlm_rest_t, max_host_connections), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_idle_handles", PW_TYPE_INTEGER, rlm_rest_t, max_idle_handles), .dflt = "64" },
+	{ FR_CONF_POINTER("pool", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) pool_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -156,14 +172,17 @@ static int rlm_rest_perform(rlm_rest_t const *instance, rlm_rest_thread_t *threa
 	 */
 	ret = rest_request_config(instance, thread, section, request, handle, section->method, section->body,
 				  uri, username, password);
-	talloc_free(uri);
-	if (ret < 0) return -1;
+	if (ret < 0) {
+		talloc_free(uri);
+		return -1;
+	}
 
 	/*
 	 *  Send the CURL request, pre-parse headers, aggregate incoming
 	 *  HTTP body data into a single contiguous buffer.
 	 */
-	ret = rest_io_request_enqueue(thread, request, handle);
+	ret = rest_io_request_enqueue(thread, request, handle, uri);
+	talloc_free(uri);
 	if (ret < 0) return -1;
 
 	return 0;
@@ -233,7 +252,7 @@ static ssize_t rest_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t outle
 	while (isspace(*p) && p++);
 
 #if 0
-	handle = fr_connection_get(t->pool, request);
+	handle = rest_io_handle_get(t, request);
 
 	if (!handle) return -1;
 #endif
@@ -345,7 +364,7 @@ error:
 finish:
 	rest_request_cleanup(mod_inst, handle);
 
-	fr_connection_release(t->pool, request, handle);
+	rest_io_handle_release(t, handle);
 
 	talloc_free(section);
 
@@ -430,7 +449,7 @@ static rlm_rcode_t mod_authorize_result(REQUEST *request, void *instance, void *
 finish:
 	rest_request_cleanup(instance, handle);
 
-	fr_connection_release(t->pool, request, handle);
+	rest_io_handle_release(t, handle);
 
 	return rcode;
 }
@@ -452,13 +471,13 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, void *thread,
 
 	if (!section->name) return RLM_MODULE_NOOP;
 
-	handle = fr_connection_get(t->pool, request);
+	handle = rest_io_handle_get(t, request);
 	if (!handle) return RLM_MODULE_FAIL;
 
 	ret = rlm_rest_perform(instance, thread, section, handle, request, NULL, NULL);
 	if (ret < 0) {
 		rest_request_cleanup(instance, handle);
-		fr_connection_release(t->pool, request, handle);
+		rest_io_handle_release(t, handle);
 
 		return RLM_MODULE_FAIL;
 	}
@@ -543,7 +562,7 @@ static rlm_rcode_t mod_authenticate_result(REQUEST *request, void *instance, voi
 finish:
 	rest_request_cleanup(instance, handle);
 
-	fr_connection_release(t->pool, request, handle);
+	rest_io_handle_release(t, handle);
 
 	return rcode;
 }
@@ -579,14 +598,14 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *threa
 		return RLM_MODULE_INVALID;
 	}
 
-	handle = fr_connection_get(t->pool, request);
+	handle = rest_io_handle_get(t, request);
 	if (!handle) return RLM_MODULE_FAIL;
 
 	ret = rlm_rest_perform(instance, thread, section,
 			       handle, request, username->vp_strvalue, password->vp_strvalue);
 	if (ret < 0) {
 		rest_request_cleanup(instance, handle);
-		fr_connection_release(t->pool, request, handle);
+		rest_io_handle_release(t, handle);
 
 		return RLM_MODULE_FAIL;
 	}
@@ -639,7 +658,7 @@ static rlm_rcode_t mod_accounting_result(REQUEST *request, void *instance, void
 finish:
 	rest_request_cleanup(instance, handle);
 
-	fr_connection_release(t->pool, request, handle);
+	rest_io_handle_release(t, handle);
 
 	return rcode;
 }
@@ -658,13 +677,13 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread,
 
 	if (!section->name) return RLM_MODULE_NOOP;
 
-	handle = fr_connection_get(t->pool, request);
+	handle = rest_io_handle_get(t, request);
 	if (!handle) return RLM_MODULE_FAIL;
 
 	ret = rlm_rest_perform(inst, thread, section, handle, request, NULL, NULL);
 	if (ret < 0) {
 		rest_request_cleanup(instance, handle);
-		fr_connection_release(t->pool, request, handle);
+		rest_io_handle_release(t, handle);
 
 		return RLM_MODULE_FAIL;
 	}
@@ -717,7 +736,7 @@ static rlm_rcode_t mod_post_auth_result(REQUEST *request, void *instance, void *
 finish:
 	rest_request_cleanup(inst, handle);
 
-	fr_connection_release(t->pool, request, handle);
+	rest_io_handle_release(t, handle);
 
 	return rcode;
 }
@@ -736,14 +755,14 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, void *thread,
 
 	if (!section->name) return RLM_MODULE_NOOP;
 
-	handle = fr_connection_get(t->pool, request);
+	handle = rest_io_handle_get(t, request);
 	if (!handle) return RLM_MODULE_FAIL;
 
 	ret = rlm_rest_perform(inst, thread, section, handle, request, NULL, NULL);
 	if (ret < 0) {
 		rest_request_cleanup(instance, handle);
 
-		fr_connection_release(t->pool, request, handle);
+		rest_io_handle_release(t, handle);
 
 		return RLM_MODULE_FAIL;
 	}
@@ -894,45 +913,27 @@ static int parse_sub_section(CONF_SECTION *parent, CONF_PARSER const *config_ite
  *	- 0 on success.
  *	- -1 on failure.
  */
-static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
 {
-	rlm_rest_t		*inst = instance;
 	rlm_rest_thread_t	*t = thread;
-	CONF_SECTION		*my_conf;
 
 	t->el = el;
 	t->inst = instance;
 
-	/*
-	 *	Temporary hack to make config parsing
-	 *	thread safe.
-	 */
-	my_conf = cf_section_dup(NULL, conf, cf_section_name1(conf), cf_section_name2(conf), true);
-	t->pool = fr_connection_pool_init(NULL, my_conf, instance, mod_conn_create, NULL, inst->xlat_name);
-	talloc_free(my_conf);
-
-	if (!t->pool) {
-		ERROR("Pool instantiation failed");
-		return -1;
-	}
-
 	return rest_io_init(t);
 }
 
 /** Cleanup all outstanding requests associated with this thread
  *
- * Destroys all curl easy handles, and then the multihandle associated
- * with this thread.
+ * Destroys all curl easy handles, and then the multihandle and
+ * share handle associated with this thread.
  *
  * @param[in] thread	specific data to destroy.
  * @return 0
  */
 static int mod_thread_detach(void *thread)
 {
-	rlm_rest_thread_t	*t = thread;
-
-	curl_multi_cleanup(t->mandle);
-	fr_connection_pool_free(t->pool);
+	rest_io_free(thread);
 
 	return 0;
 }
@@ -982,11 +983,23 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 
 static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 {
-	rlm_rest_t *inst = instance;
+	rlm_rest_t	*inst = instance;
+	CONF_SECTION	*pool;
 
 	inst->xlat_name = cf_section_name2(conf);
 	if (!inst->xlat_name) inst->xlat_name = cf_section_name1(conf);
 
+	/*
+	 *	The parser adds an empty "pool" section if there
+	 *	wasn't one, so only warn if it has contents.
+	 */
+	pool = cf_section_sub_find(conf, "pool");
+	if (pool && cf_item_find_next(pool, NULL)) {
+		cf_log_warn(pool, "The \"pool\" section is deprecated.  \"connect_timeout\" and \"spare\" "
+			    "from it are used as \"connect_timeout\" and \"max_idle_handles\", the other "
+			    "items are ignored.  See \"multiplex\" and \"max_host_connections\"");
+	}
+
 #if 0
 	/*
 	 *	Register the rest xlat function
@@ -1019,6 +1032,8 @@ static int mod_load(void)
 	/* developer sanity */
 	rad_assert((sizeof(http_body_type_supported) / sizeof(*http_body_type_supported)) == HTTP_BODY_NUM_ENTRIES);
 
+	rest_uri_escape_init();
+
 	ret = curl_global_init(CURL_GLOBAL_ALL);
 	if (ret != CURLE_OK) {
 		ERROR("rlm_curl - CURL init returned error: %i - %s", ret, curl_easy_strerror(ret));
@@ -42,6 +42,10 @@ RCSID("$Id$")
 
 #include "rlm_sql.h"
 
+typedef struct rlm_sql_thread {
+	fr_connection_thread_cache_t	*conn_cache;	//!< This worker's cache of idle connections.
+} rlm_sql_thread_t;
+
 /*
  *	So we can do pass2 xlat checks on the queries.
  */
@@ -547,111 +551,14 @@ static int generate_sql_clients(rlm_sql_t *inst)
 
 /** xlat escape function for drivers which do not provide their own
  *
+ * Multi-byte UTF-8 characters and safe_characters are copied, newlines, carriage
+ * returns and tabs are backslash escaped, and everything else is mime-encoded.
  */
 static size_t sql_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, void *arg)
 {
 	rlm_sql_handle_t	*handle = arg;
-	rlm_sql_t const		*inst = handle->inst;
-	size_t			len = 0;
-
-	while (in[0]) {
-		size_t utf8_len;
-
-		/*
-		 *	Allow all multi-byte UTF8 characters.
-		 */
-		utf8_len = fr_utf8_char((uint8_t const *) in, -1);
-		if (utf8_len > 1) {
-			if (outlen <= utf8_len) break;
-
-			memcpy(out, in, utf8_len);
-			in += utf8_len;
-			out += utf8_len;
-
-			outlen -= utf8_len;
-			len += utf8_len;
-			continue;
-		}
-
-		/*
-		 *	Because we register our own escape function
-		 *	we're now responsible for escaping all special
-		 *	chars in an xlat expansion or attribute value.
-		 */
-		switch (in[0]) {
-		case '\n':
-			if (outlen <= 2) break;
-			out[0] = '\\';
-			out[1] = 'n';
-
-			in++;
-			out += 2;
-			outlen -= 2;
-			len += 2;
-			break;
-
-		case '\r':
-			if (outlen <= 2) break;
-			out[0] = '\\';
-			out[1] = 'r';
-
-			in++;
-			out += 2;
-			outlen -= 2;
-			len += 2;
-			break;
-
-		case '\t':
-			if (outlen <= 2) break;
-			out[0] = '\\';
-			out[1] = 't';
-
-			in++;
-			out += 2;
-			outlen -= 2;
-			len += 2;
-			break;
-		}
-
-		/*
-		 *	Non-printable characters get replaced with their
-		 *	mime-encoded equivalents.
-		 */
-		if ((in[0] < 32) ||
-		    strchr(inst->config->allowed_chars, *in) == NULL) {
-			/*
-			 *	Only 3 or less bytes available.
-			 */
-			if (outlen <= 3) {
-				break;
-			}
-
-			snprintf(out, outlen, "=%02X", (unsigned char) in[0]);
-			in++;
-			out += 3;
-			outlen -= 3;
-			len += 3;
-			continue;
-		}
 
-		/*
-		 *	Only one byte left.
-		 */
-		if (outlen <= 1) {
-			break;
-		}
-
-		/*
-		 *	Allowed character.
-		 */
-		*out = *in;
-		out++;
-		in++;
-		outlen--;
-		len++;
-	}
-	*out = '\0';
-	return len;
+	return fr_escape(handle->inst->escape, out, outlen, in, -1);
 }
 
 /** Passed as the escape function to map_proc and sql xlat methods
@@ -1232,6 +1139,24 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 				inst->driver->sql_escape_func :
 				sql_escape_func;
 
+	if (!inst->driver->sql_escape_func) {
+		unsigned int i;
+
+		inst->escape = fr_escape_alloc(inst, inst->config->allowed_chars, '=', FR_ESCAPE_FLAG_UTF8);
+		if (!inst->escape) return -1;
+
+		/*
+		 *	Non-printable characters are always escaped,
+		 *	even if they're listed in safe_characters.
+		 */
+		for (i = 1; i < 32; i++) fr_escape_set(inst->escape, i, FR_ESCAPE_HEX);
+		for (i = 0x80; i < 256; i++) fr_escape_set(inst->escape, i, FR_ESCAPE_UTF8);
+
+		fr_escape_set(inst->escape, '\n', 'n');
+		fr_escape_set(inst->escape, '\r', 'r');
+		fr_escape_set(inst->escape, '\t', 't');
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, true, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err_cs(conf, "Failed creating log file context");
@@ -1256,6 +1181,30 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return RLM_MODULE_OK;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_sql_t		*inst = instance;
+	rlm_sql_thread_t	*t = thread;
+
+	t->conn_cache = fr_connection_pool_thread_instantiate(inst->pool);
+
+	return 0;
+}
+
+/** Return this worker's idle connections to the pool
+ *
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_sql_thread_t	*t = thread;
+
+	fr_connection_pool_thread_detach(t->conn_cache);
+	t->conn_cache = NULL;
+
+	return 0;
+}
+
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
 {
@@ -1919,14 +1868,17 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 /* globally exported name */
 extern rad_module_t rlm_sql;
 rad_module_t rlm_sql = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "sql",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_sql_t),
-	.config		= module_config,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "sql",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_sql_t),
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.config			= module_config,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
@@ -38,6 +38,7 @@ RCSIDH(rlm_sql_h, "$Id$")
 #include <freeradius-devel/connection.h>
 #include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/exfile.h>
+#include <freeradius-devel/escape.h>
 
 #define PW_ITEM_CHECK 0
 #define PW_ITEM_REPLY 1
@@ -236,6 +237,7 @@ struct sql_inst {
 
 	int (*sql_set_user)(rlm_sql_t const *inst, REQUEST *request, char const *username);
 	xlat_escape_t sql_escape_func;
+	fr_escape_t		*escape;		//!< Used by the default escape function.
 	sql_rcode_t (*sql_query)(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_select_query)(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_fetch_row)(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
@@ -1,3 +1,17 @@
 #
 #  Test the "files" module
 #
+
+#
+#  The reload test rewrites the users file of the "files_reload"
+#  instance, so the tests read a copy of it.
+#
+FILES_RELOAD_USERS := $(BUILD_DIR)/tests/modules/files/reload_users
+FILES_TESTS := $(patsubst src/%.unlang,$(BUILD_DIR)/%,$(wildcard src/tests/modules/files/*.unlang))
+
+$(FILES_RELOAD_USERS): src/tests/modules/files/reload_users
+	${Q}mkdir -p $(@D)
+	${Q}cp $< $@
+
+$(FILES_TESTS): $(FILES_RELOAD_USERS)
+$(FILES_TESTS): export FILES_RELOAD_USERS := $(FILES_RELOAD_USERS)
@@ -0,0 +1 @@
+pap.test:
@@ -0,0 +1,18 @@
+#
+#  Test the "passwd" module
+#
+
+#
+#  The module reads an index of the passwd file, which is built
+#  before the tests run.  The reload test rebuilds it.
+#
+PASSWD_INDEX_FILE := $(BUILD_DIR)/tests/modules/passwd/passwd.idx
+PASSWD_TESTS := $(patsubst src/%.unlang,$(BUILD_DIR)/%,$(wildcard src/tests/modules/passwd/*.unlang))
+
+$(PASSWD_INDEX_FILE): src/tests/modules/passwd/passwd $(TESTBINDIR)/rlm_passwd_index
+	${Q}mkdir -p $(@D)
+	${Q}$(TESTBIN)/rlm_passwd_index -F "*User-Name:Cleartext-Password:=Reply-Message" $< $@ > /dev/null
+
+$(PASSWD_TESTS): $(PASSWD_INDEX_FILE)
+$(PASSWD_TESTS): export PASSWD_INDEX_FILE := $(PASSWD_INDEX_FILE)
+$(PASSWD_TESTS): export PASSWD_INDEX_BUILD := $(TESTBIN)/rlm_passwd_index
@@ -1,8 +1,8 @@
-SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk 
+SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk hmac_md5_test.mk md5_mb_test.mk escape_test.mk value_print_test.mk cache_serialize_test.mk
 
 #
 #  These require pthread.
 #
 ifneq "$(findstring thread,${CFLAGS})" ""
-SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk
+SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk redis_slot_test.mk cache_driver_test.mk latency_test.mk reload_test.mk cache_coalesce_test.mk connection_cache_test.mk
 endif
@@ -0,0 +1,445 @@
+/*
+ * cache_coalesce_test.c	Tests for coalescing rlm_cache misses
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+
+#include "coalesce.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_THREADS		16
+#define MAX_WAITERS		64
+#define MAX_TEST_REQUESTS	(MAX_THREADS * MAX_WAITERS)
+
+static int			debug_lvl = 0;
+static int			num_threads = 4;
+static int			num_waiters = 16;
+
+static uint8_t const		key[] = "User-Name=bob";
+
+/*
+ *	Indexed by request number.  Each entry is only written by the
+ *	thread which owns the request.
+ */
+static pthread_t		owner_thread[MAX_TEST_REQUESTS];
+static int			resumed[MAX_TEST_REQUESTS];
+static int			wrong_thread = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: cache_coalesce_test [OPTS]\n");
+	fprintf(stderr, "  -t <threads>           Number of workers with waiting requests.\n");
+	fprintf(stderr, "  -w <waiters>           Number of waiting requests per worker.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Record a request being resumed
+ *
+ * Replaces the interpreter's version, which isn't linked in.
+ */
+void unlang_resumable(REQUEST *request)
+{
+	if (!pthread_equal(pthread_self(), owner_thread[request->number])) wrong_thread++;
+
+	resumed[request->number]++;
+}
+
+static REQUEST *request_alloc_test(TALLOC_CTX *ctx, unsigned int number)
+{
+	REQUEST *request;
+
+	request = talloc_zero(ctx, REQUEST);
+	request->number = number;
+
+	owner_thread[number] = pthread_self();
+	resumed[number] = 0;
+
+	return request;
+}
+
+/** Service the event list until a number of requests have been resumed
+ *
+ */
+static int run_until(fr_event_list_t *el, unsigned int first, unsigned int num)
+{
+	unsigned int	i;
+	int		loops;
+
+	for (loops = 0; loops < 5000; loops++) {
+		for (i = first; i < first + num; i++) if (!resumed[i]) break;
+		if (i == first + num) return 0;
+
+		if (fr_event_corral(el, false) > 0) fr_event_service(el);
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+/** Run the event list for a while, to see if anything is resumed
+ *
+ */
+static void run_for(fr_event_list_t *el, int loops)
+{
+	while (loops-- > 0) {
+		if (fr_event_corral(el, false) > 0) fr_event_service(el);
+		usleep(1000);
+	}
+}
+
+static int check_status(cache_load_status_t got, cache_load_status_t expected, char const *what)
+{
+	if (got == expected) return 0;
+
+	fprintf(stderr, "FAIL: %s, expected status %i, got %i\n", what, expected, got);
+
+	return 1;
+}
+
+/** Check claiming, waiting, and waking on one worker
+ *
+ */
+static int check_claim(TALLOC_CTX *ctx, cache_coalesce_t *cc, cache_coalesce_thread_t *cct, fr_event_list_t *el)
+{
+	REQUEST			*owner, *waiting, *other;
+	cache_coalesce_waiter_t	*waiter;
+	int			errors = 0;
+
+	owner = request_alloc_test(ctx, 0);
+	waiting = request_alloc_test(ctx, 1);
+	other = request_alloc_test(ctx, 2);
+
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, owner, key, sizeof(key), false),
+			       CACHE_LOAD_NONE, "Checking an unclaimed key");
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, owner, key, sizeof(key), true),
+			       CACHE_LOAD_OWNER, "Claiming a key");
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, owner, key, sizeof(key), true),
+			       CACHE_LOAD_OWNER, "Claiming a key twice");
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, other, key, sizeof(key), true),
+			       CACHE_LOAD_WAIT, "Claiming a key without waiting");
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, other, key, sizeof(key) - 1, false),
+			       CACHE_LOAD_NONE, "Checking a different key");
+
+	errors += check_status(cache_coalesce_claim(waiting, &waiter, cct, waiting, key, sizeof(key), true),
+			       CACHE_LOAD_WAIT, "Waiting for a key");
+	if (!waiter) {
+		fprintf(stderr, "FAIL: No waiter returned\n");
+		return errors + 1;
+	}
+
+	/*
+	 *	Nothing happens until the key is loaded.
+	 */
+	run_for(el, 10);
+	if (resumed[1]) {
+		fprintf(stderr, "FAIL: Waiter resumed before the key was loaded\n");
+		errors++;
+	}
+
+	cache_coalesce_done(cc, key, sizeof(key));
+	if (run_until(el, 1, 1) < 0) {
+		fprintf(stderr, "FAIL: Waiter not resumed after the key was loaded\n");
+		errors++;
+	}
+
+	/*
+	 *	Woken waiters can't be cancelled.
+	 */
+	if (cache_coalesce_waiter_cancel(waiter)) {
+		fprintf(stderr, "FAIL: Cancelled a waiter which had been woken\n");
+		errors++;
+	}
+	talloc_free(waiter);
+
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, other, key, sizeof(key), false),
+			       CACHE_LOAD_NONE, "Checking a loaded key");
+
+	talloc_free(owner);
+	talloc_free(waiting);
+	talloc_free(other);
+
+	return errors;
+}
+
+/** Check waiters are woken if the request loading the key is freed
+ *
+ */
+static int check_owner_free(TALLOC_CTX *ctx, cache_coalesce_thread_t *cct, fr_event_list_t *el)
+{
+	REQUEST			*owner, *waiting;
+	cache_coalesce_waiter_t	*waiter;
+	int			errors = 0;
+
+	owner = request_alloc_test(ctx, 0);
+	waiting = request_alloc_test(ctx, 1);
+
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, owner, key, sizeof(key), true),
+			       CACHE_LOAD_OWNER, "Claiming a key");
+	errors += check_status(cache_coalesce_claim(waiting, &waiter, cct, waiting, key, sizeof(key), true),
+			       CACHE_LOAD_WAIT, "Waiting for a key");
+
+	talloc_free(owner);
+	if (run_until(el, 1, 1) < 0) {
+		fprintf(stderr, "FAIL: Waiter not resumed after the owner was freed\n");
+		errors++;
+	}
+
+	/*
+	 *	The key is free to be claimed again.
+	 */
+	errors += check_status(cache_coalesce_claim(ctx, NULL, cct, waiting, key, sizeof(key), true),
+			       CACHE_LOAD_OWNER, "Claiming a key after the owner was freed");
+
+	talloc_free(waiting);
+
+	return errors;
+}
+
+/** Check cancelled and freed waiters aren't resumed
+ *
+ */
+static int check_cancel(TALLOC_CTX *ctx, cache_coalesce_t *cc, cache_coalesce_thread_t *cct, fr_event_list_t *el)
+{
+	REQUEST			*owner, *cancelled, *freed, *woken;
+	cache_coalesce_waiter_t	*waiter;
+	int			errors = 0;
+
+	owner = request_alloc_test(ctx, 0);
+	cancelled = request_alloc_test(ctx, 1);
+	freed = request_alloc_test(ctx, 2);
+	woken = request_alloc_test(ctx, 3);
+
+	(void) cache_coalesce_claim(ctx, NULL, cct, owner, key, sizeof(key), true);
+
+	/*
+	 *	Cancelling a waiter which is still waiting tells the
+	 *	caller to resume the request itself.
+	 */
+	(void) cache_coalesce_claim(cancelled, &waiter, cct, cancelled, key, sizeof(key), true);
+	if (!cache_coalesce_waiter_cancel(waiter)) {
+		fprintf(stderr, "FAIL: Couldn't cancel a waiting waiter\n");
+		errors++;
+	}
+
+	/*
+	 *	Freeing the request's waiter before it's collected by
+	 *	the worker stops it being resumed.
+	 */
+	(void) cache_coalesce_claim(freed, &waiter, cct, freed, key, sizeof(key), true);
+	(void) cache_coalesce_claim(woken, &waiter, cct, woken, key, sizeof(key), true);
+	talloc_free(freed);
+
+	cache_coalesce_done(cc, key, sizeof(key));
+	if (run_until(el, 3, 1) < 0) {
+		fprintf(stderr, "FAIL: Waiter not resumed after the key was loaded\n");
+		errors++;
+	}
+	run_for(el, 10);
+
+	if (resumed[1] || resumed[2]) {
+		fprintf(stderr, "FAIL: Cancelled waiters were resumed\n");
+		errors++;
+	}
+
+	talloc_free(owner);
+	talloc_free(cancelled);
+	talloc_free(woken);
+
+	return errors;
+}
+
+typedef struct {
+	int			id;
+	cache_coalesce_t	*cc;
+	pthread_barrier_t	*waiting;	//!< All the requests are waiting.
+	pthread_barrier_t	*done;		//!< The key has been loaded.
+	int			errors;
+} worker_t;
+
+/** Start requests which wait on the key, then wait for them to be resumed
+ *
+ */
+static void *worker_thread(void *arg)
+{
+	worker_t		*worker = arg;
+	TALLOC_CTX		*ctx = talloc_init("worker");
+	fr_event_list_t		*el;
+	cache_coalesce_thread_t	*cct;
+	unsigned int		first = MAX_WAITERS * (worker->id + 1);
+	int			i;
+
+	el = fr_event_list_create(ctx, NULL, NULL);
+	cct = cache_coalesce_thread_alloc(ctx, worker->cc, el);
+	if (!el || !cct) {
+		fprintf(stderr, "FAIL: Worker %i failed initialising\n", worker->id);
+		worker->errors++;
+		pthread_barrier_wait(worker->waiting);
+		pthread_barrier_wait(worker->done);
+		goto finish;
+	}
+
+	for (i = 0; i < num_waiters; i++) {
+		REQUEST			*request;
+		cache_coalesce_waiter_t	*waiter;
+
+		request = request_alloc_test(ctx, first + i);
+		if (cache_coalesce_claim(request, &waiter, cct, request, key, sizeof(key), true) != CACHE_LOAD_WAIT) {
+			fprintf(stderr, "FAIL: Worker %i request %i didn't wait\n", worker->id, i);
+			worker->errors++;
+		}
+	}
+
+	pthread_barrier_wait(worker->waiting);
+	pthread_barrier_wait(worker->done);
+
+	if (run_until(el, first, num_waiters) < 0) {
+		fprintf(stderr, "FAIL: Worker %i requests weren't all resumed\n", worker->id);
+		worker->errors++;
+	}
+
+	/*
+	 *	And only once.
+	 */
+	run_for(el, 10);
+	for (i = 0; i < num_waiters; i++) {
+		if (resumed[first + i] != 1) {
+			fprintf(stderr, "FAIL: Worker %i request %i resumed %i times\n",
+				worker->id, i, resumed[first + i]);
+			worker->errors++;
+		}
+	}
+
+finish:
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+/** Check waiters on other workers are resumed by their own workers
+ *
+ */
+static int check_workers(TALLOC_CTX *ctx, cache_coalesce_t *cc, cache_coalesce_thread_t *cct)
+{
+	worker_t		workers[MAX_THREADS];
+	pthread_t		threads[MAX_THREADS];
+	pthread_barrier_t	waiting, done;
+	REQUEST			*owner;
+	int			i, errors = 0;
+
+	owner = request_alloc_test(ctx, 0);
+	(void) cache_coalesce_claim(ctx, NULL, cct, owner, key, sizeof(key), true);
+
+	pthread_barrier_init(&waiting, NULL, num_threads + 1);
+	pthread_barrier_init(&done, NULL, num_threads + 1);
+
+	for (i = 0; i < num_threads; i++) {
+		workers[i].id = i;
+		workers[i].cc = cc;
+		workers[i].waiting = &waiting;
+		workers[i].done = &done;
+		workers[i].errors = 0;
+		pthread_create(&threads[i], NULL, worker_thread, &workers[i]);
+	}
+
+	pthread_barrier_wait(&waiting);
+	cache_coalesce_done(cc, key, sizeof(key));
+	pthread_barrier_wait(&done);
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+		errors += workers[i].errors;
+	}
+
+	if (wrong_thread) {
+		fprintf(stderr, "FAIL: %i requests were resumed by the wrong worker\n", wrong_thread);
+		errors++;
+	}
+
+	if (debug_lvl) printf("%i workers, %i waiters each, all resumed\n", num_threads, num_waiters);
+
+	pthread_barrier_destroy(&waiting);
+	pthread_barrier_destroy(&done);
+	talloc_free(owner);
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, rcode = 0;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_event_list_t		*el;
+	cache_coalesce_t	*cc;
+	cache_coalesce_thread_t	*cct;
+
+	while ((c = getopt(argc, argv, "t:w:hx")) != EOF) switch (c) {
+		case 't':
+			num_threads = atoi(optarg);
+			if ((num_threads <= 0) || (num_threads >= MAX_THREADS)) usage();
+			break;
+
+		case 'w':
+			num_waiters = atoi(optarg);
+			if ((num_waiters <= 0) || (num_waiters > MAX_WAITERS)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	el = fr_event_list_create(autofree, NULL, NULL);
+	cc = cache_coalesce_alloc("cache_coalesce_test");
+	cct = el && cc ? cache_coalesce_thread_alloc(autofree, cc, el) : NULL;
+	if (!cct) {
+		fprintf(stderr, "FAIL: Initialising: %s\n", fr_strerror());
+		return 1;
+	}
+
+	rcode |= check_claim(autofree, cc, cct, el);
+	rcode |= check_owner_free(autofree, cct, el);
+	rcode |= check_cancel(autofree, cc, cct, el);
+	rcode |= check_workers(autofree, cc, cct);
+
+	if (!rcode) printf("cache_coalesce_test: OK\n");
+
+	talloc_free(cct);
+	talloc_free(cc);
+	talloc_free(autofree);
+
+	return rcode;
+}
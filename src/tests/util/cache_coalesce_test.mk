@@ -0,0 +1,10 @@
+TARGET := cache_coalesce_test
+
+SOURCES		:= cache_coalesce_test.c \
+		   ../../main/worker_wake.c \
+		   ../../modules/rlm_cache/coalesce.c
+
+SRC_INCDIRS	:= ${top_srcdir}/src/modules/rlm_cache
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,306 @@
+/*
+ * cache_driver_test.c	Multithreaded benchmark for the in memory rlm_cache drivers
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_THREADS	64
+
+extern cache_driver_t rlm_cache_rbtree;
+extern cache_driver_t rlm_cache_htable;
+
+typedef struct {
+	pthread_t		id;
+	int			num;
+	cache_driver_t const	*driver;
+	void			*driver_inst;
+	uint64_t		hits;
+	uint64_t		misses;
+	uint64_t		errors;
+} worker_t;
+
+static int			debug_lvl = 0;
+static int			num_threads = 4;
+static uint64_t			lookups = 1000 * 1000;
+static uint32_t			num_keys = 100 * 1000;
+static uint32_t			max_entries = 0;
+static char const		*shards = "16";
+
+static rlm_cache_config_t	config;
+static char			(*keys)[32];
+static size_t			*keys_len;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: cache_driver_test [OPTS]\n");
+	fprintf(stderr, "  -k <keys>              Number of distinct keys (default 100000).\n");
+	fprintf(stderr, "  -m <max_entries>       Maximum number of cache entries (default 0, no limit).\n");
+	fprintf(stderr, "  -n <lookups>           Number of lookups each thread should perform.\n");
+	fprintf(stderr, "  -s <shards>            Number of rlm_cache_htable shards (default 16).\n");
+	fprintf(stderr, "  -t <threads>           Number of threads.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Look up random keys, inserting an entry on each miss
+ *
+ * This is what rlm_cache does for a request with the default control
+ * attributes.
+ */
+static void *worker_thread(void *arg)
+{
+	worker_t		*w = arg;
+	cache_driver_t const	*driver = w->driver;
+	TALLOC_CTX		*ctx = talloc_init("worker");
+	REQUEST			*request;
+	rlm_cache_handle_t	*handle = NULL;
+	rlm_cache_entry_t	*c;
+	uint32_t		seed = w->num + 1;
+	uint32_t		k;
+	uint64_t		i;
+
+	request = talloc_zero(ctx, REQUEST);
+	request->packet = talloc_zero(request, RADIUS_PACKET);
+	gettimeofday(&request->packet->timestamp, NULL);
+
+	for (i = 0; i < lookups; i++) {
+		/*
+		 *	xorshift32, cheaper than fr_rand() and doesn't
+		 *	need locking.
+		 */
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		k = seed % num_keys;
+
+		if (driver->acquire && (driver->acquire(&handle, &config, w->driver_inst, request) < 0)) {
+			w->errors++;
+			continue;
+		}
+
+		switch (driver->find(&c, &config, w->driver_inst, request, handle,
+				     (uint8_t const *)keys[k], keys_len[k])) {
+		case CACHE_OK:
+			if ((c->key_len != keys_len[k]) || (memcmp(c->key, keys[k], keys_len[k]) != 0)) {
+				fprintf(stderr, "FAIL: Found entry for wrong key\n");
+				w->errors++;
+			}
+			w->hits++;
+			if (driver->free) driver->free(c);
+			break;
+
+		case CACHE_MISS:
+			w->misses++;
+
+			c = driver->alloc(&config, w->driver_inst, request);
+			c->key = talloc_memdup(c, keys[k], keys_len[k]);
+			c->key_len = keys_len[k];
+			c->created = request->packet->timestamp.tv_sec;
+			c->expires = c->created + config.ttl;
+
+			if (driver->insert(&config, w->driver_inst, request, handle, c) != CACHE_OK) {
+				talloc_free(c);
+				w->errors++;
+				break;
+			}
+			if (driver->free) driver->free(c);
+			break;
+
+		default:
+			w->errors++;
+			break;
+		}
+
+		if (driver->release) driver->release(&config, w->driver_inst, request, handle);
+	}
+
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+static double usec_since(struct timeval *start)
+{
+	struct timeval end, elapsed;
+
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, start);
+
+	return (elapsed.tv_sec * 1000000.0) + elapsed.tv_usec;
+}
+
+/** Run the benchmark against one driver
+ *
+ */
+static int driver_bench(TALLOC_CTX *ctx, cache_driver_t const *driver, double *usec)
+{
+	CONF_SECTION		*cs;
+	void			*driver_inst;
+	worker_t		workers[MAX_THREADS];
+	uint64_t		hits = 0, misses = 0, errors = 0;
+	struct timeval		start;
+	int			i;
+
+	cs = cf_section_alloc(NULL, driver->name, NULL);
+	if (driver == &rlm_cache_htable) cf_pair_add(cs, cf_pair_alloc(cs, "shards", shards,
+								       T_OP_EQ, T_BARE_WORD, T_BARE_WORD));
+
+	driver_inst = talloc_zero_array(ctx, uint8_t, driver->inst_size);
+	if (driver->config && (cf_section_parse(cs, driver_inst, driver->config) < 0)) {
+		fprintf(stderr, "FAIL: Parsing %s config: %s\n", driver->name, fr_strerror());
+		return -1;
+	}
+	if (driver->instantiate(&config, driver_inst, cs) < 0) {
+		fprintf(stderr, "FAIL: Instantiating %s: %s\n", driver->name, fr_strerror());
+		return -1;
+	}
+
+	memset(workers, 0, sizeof(workers));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_threads; i++) {
+		workers[i].num = i;
+		workers[i].driver = driver;
+		workers[i].driver_inst = driver_inst;
+		pthread_create(&workers[i].id, NULL, worker_thread, &workers[i]);
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].id, NULL);
+		hits += workers[i].hits;
+		misses += workers[i].misses;
+		errors += workers[i].errors;
+	}
+	*usec = usec_since(&start);
+
+	printf("%-18s %.2f Mops/s, %" PRIu64 " hits, %" PRIu64 " misses\n", driver->name,
+	       (num_threads * lookups) / *usec, hits, misses);
+
+	if (driver->stats) {
+		rlm_cache_stats_t stats;
+
+		driver->stats(&stats, &config, driver_inst);
+		if (debug_lvl) {
+			printf("%-18s %" PRIu64 " entries, %" PRIu64 " bytes, %" PRIu64 " evictions\n",
+			       "", stats.entries, stats.size, stats.evictions);
+		}
+
+		if ((stats.hits != hits) || (stats.misses != misses)) {
+			fprintf(stderr, "FAIL: %s counted %" PRIu64 " hits, %" PRIu64 " misses\n",
+				driver->name, stats.hits, stats.misses);
+			errors++;
+		}
+
+		/*
+		 *	Each shard may round its share of max_entries up.
+		 */
+		if (max_entries && (stats.entries > (max_entries + atoi(shards)))) {
+			fprintf(stderr, "FAIL: %s holds %" PRIu64 " entries, max_entries is %u\n",
+				driver->name, stats.entries, max_entries);
+			errors++;
+		}
+	}
+
+	if (driver->detach) driver->detach(driver_inst);
+	talloc_free(driver_inst);
+	talloc_free(cs);
+
+	return errors ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, rcode = 0;
+	uint32_t		i;
+	double			rbtree_usec, htable_usec;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hk:m:n:s:t:x")) != EOF) switch (c) {
+		case 'k':
+			num_keys = atoi(optarg);
+			if (!num_keys) usage();
+			break;
+
+		case 'm':
+			max_entries = atoi(optarg);
+			break;
+
+		case 'n':
+			lookups = strtoull(optarg, NULL, 10);
+			break;
+
+		case 's':
+			shards = optarg;
+			break;
+
+		case 't':
+			num_threads = atoi(optarg);
+			if ((num_threads <= 0) || (num_threads > MAX_THREADS)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	config.name = "cache";
+	config.ttl = 3600;
+	config.max_entries = max_entries;
+
+	keys = (void *)talloc_array(autofree, char, num_keys * sizeof(*keys));
+	keys_len = talloc_array(autofree, size_t, num_keys);
+	for (i = 0; i < num_keys; i++) keys_len[i] = snprintf(keys[i], sizeof(keys[i]), "user-%u@example.org", i);
+
+	if (driver_bench(autofree, &rlm_cache_rbtree, &rbtree_usec) < 0) {
+		rcode = 1;
+		goto finish;
+	}
+
+	if (driver_bench(autofree, &rlm_cache_htable, &htable_usec) < 0) {
+		rcode = 1;
+		goto finish;
+	}
+
+	printf("%d threads: rlm_cache_htable is %.2fx rlm_cache_rbtree\n", num_threads, rbtree_usec / htable_usec);
+
+finish:
+	talloc_free(autofree);
+
+	return rcode;
+}
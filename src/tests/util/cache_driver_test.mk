@@ -0,0 +1,10 @@
+TARGET := cache_driver_test
+
+SOURCES		:= cache_driver_test.c \
+		   ../../modules/rlm_cache/drivers/rlm_cache_rbtree/rlm_cache_rbtree.c \
+		   ../../modules/rlm_cache/drivers/rlm_cache_htable/rlm_cache_htable.c
+
+SRC_INCDIRS	:= ${top_srcdir}/src/modules/rlm_cache
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
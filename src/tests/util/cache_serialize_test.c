@@ -0,0 +1,346 @@
+/*
+ * cache_serialize_test.c	Round trip tests for the rlm_cache serialization formats
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_cache.h"
+#include "serialize.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Offsets of the qualifier and operator bytes of the first map
+ *	in a binary serialized entry.
+ */
+#define BINARY_HDR_LEN		(1 + 1 + 8 + 8)
+#define BINARY_REQUEST		(BINARY_HDR_LEN)
+#define BINARY_LIST		(BINARY_HDR_LEN + 1)
+#define BINARY_OP		(BINARY_HDR_LEN + 2)
+
+static int			debug_lvl = 0;
+
+/*
+ *	Entries in the text format, as cache_serialize() writes them.
+ */
+static char const *entries[] = {
+	"&Cache-Expires = 1500000060\n"
+	"&Cache-Created = 1500000000\n",
+
+	"&Cache-Expires = 1500000060\n"
+	"&Cache-Created = 1500000000\n"
+	"&reply:Reply-Message := 'hello world'\n"
+	"&reply:Session-Timeout := 3600\n"
+	"&control:Tmp-Integer-0 += 42\n"
+	"&Framed-IP-Address = 192.0.2.1\n"
+	"&control:Tmp-Octets-0 := 0x0102ff00\n"
+	"&session-state:Tmp-String-0 += ''\n"
+	"&reply:Tmp-Integer64-0 := 18446744073709551615\n",
+
+	"&Cache-Expires = 1500000060\n"
+	"&Cache-Created = 1500000000\n"
+	"&parent.reply:Reply-Message := 'it\\'s \"quoted\"'\n"
+	"&outer.control:Tmp-String-1 := 'caf\xc3\xa9'\n",
+};
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: cache_serialize_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Parse a text format entry
+ *
+ */
+static rlm_cache_entry_t *entry_from_text(TALLOC_CTX *ctx, char const *text)
+{
+	rlm_cache_entry_t	*c;
+	char			*in;
+
+	c = talloc_zero(ctx, rlm_cache_entry_t);
+	in = talloc_typed_strdup(c, text);
+
+	if (cache_deserialize(c, in, -1) < 0) {
+		fprintf(stderr, "FAIL: Parsing entry: %s\n", fr_strerror());
+		talloc_free(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+/** Check an entry comes back the same from the text and binary formats
+ *
+ * Entries are compared by their text serialization, which includes
+ * every field of each map.
+ */
+static int check_round_trip(TALLOC_CTX *ctx, char const *text)
+{
+	rlm_cache_entry_t	*c, *text_c, *bin_c;
+	char			*expected, *out;
+	uint8_t			*bin;
+	size_t			bin_len;
+	int			errors = 0;
+
+	c = entry_from_text(ctx, text);
+	if (!c) return 1;
+
+	if (cache_serialize(c, &expected, c) < 0) {
+		fprintf(stderr, "FAIL: Serializing entry: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+
+	/*
+	 *	The text format should be stable.
+	 */
+	if (strcmp(expected, text) != 0) {
+		fprintf(stderr, "FAIL: Text round trip\nexpected:\n%sgot:\n%s", text, expected);
+		errors++;
+	}
+
+	text_c = entry_from_text(c, expected);
+	if (!text_c) {
+		talloc_free(c);
+		return 1;
+	}
+
+	if ((cache_serialize(c, &out, text_c) < 0) || (strcmp(out, expected) != 0)) {
+		fprintf(stderr, "FAIL: Text reserialization\n");
+		errors++;
+	}
+
+	/*
+	 *	Binary, and back again.
+	 */
+	if (cache_serialize_binary(c, &bin, &bin_len, c) < 0) {
+		fprintf(stderr, "FAIL: Binary serializing entry: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+
+	bin_c = talloc_zero(c, rlm_cache_entry_t);
+	if (cache_deserialize(bin_c, (char *)bin, bin_len) < 0) {
+		fprintf(stderr, "FAIL: Binary deserializing entry: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+
+	if ((bin_c->created != c->created) || (bin_c->expires != c->expires)) {
+		fprintf(stderr, "FAIL: Binary round trip of created/expires\n");
+		errors++;
+	}
+
+	if (cache_serialize(c, &out, bin_c) < 0) {
+		fprintf(stderr, "FAIL: Serializing binary round tripped entry: %s\n", fr_strerror());
+		errors++;
+	} else if (strcmp(out, expected) != 0) {
+		fprintf(stderr, "FAIL: Binary round trip\nexpected:\n%sgot:\n%s", expected, out);
+		errors++;
+	}
+
+	/*
+	 *	Every truncation must be rejected, apart from
+	 *	ones which end exactly on a map boundary.
+	 */
+	{
+		size_t		i, ok = 0, maps = 0;
+		vp_map_t	*map;
+
+		for (map = c->maps; map; map = map->next) maps++;
+
+		for (i = 0; i < bin_len; i++) {
+			rlm_cache_entry_t *t;
+
+			t = talloc_zero(c, rlm_cache_entry_t);
+			if (cache_deserialize_binary(t, bin, i) == 0) ok++;
+			talloc_free(t);
+		}
+
+		if (debug_lvl) printf("%zu byte entry, %zu truncations accepted\n", bin_len, ok);
+
+		if (ok > maps) {
+			fprintf(stderr, "FAIL: %zu truncations of a %zu byte entry accepted\n", ok, bin_len);
+			errors++;
+		}
+	}
+
+	if (debug_lvl) printf("%s", expected);
+
+	talloc_free(c);
+
+	return errors;
+}
+
+/** Check string values the text format can't represent survive the binary format
+ *
+ */
+static int check_binary_string(TALLOC_CTX *ctx)
+{
+	static char const	value[] = "back\\slash\nnew\0line";
+	rlm_cache_entry_t	*c, *out;
+	value_box_t		box;
+	uint8_t			*bin;
+	size_t			bin_len;
+	int			errors = 0;
+
+	c = entry_from_text(ctx, entries[0]);
+	if (!c) return 1;
+
+	if (map_afrom_attr_str(c, &c->maps, "&reply:Reply-Message := ''",
+			       REQUEST_CURRENT, PAIR_LIST_REQUEST, REQUEST_CURRENT, PAIR_LIST_REQUEST) < 0) {
+		fprintf(stderr, "FAIL: Creating map: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+	if (tmpl_cast_in_place(c->maps->rhs, PW_TYPE_STRING, c->maps->lhs->tmpl_da) < 0) {
+		fprintf(stderr, "FAIL: Casting map value: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+
+	memset(&box, 0, sizeof(box));
+	box.type = PW_TYPE_STRING;
+	box.datum.strvalue = value;
+	box.length = sizeof(value) - 1;
+
+	value_box_clear(&c->maps->rhs->tmpl_value_box);
+	if (value_box_copy(c->maps->rhs, &c->maps->rhs->tmpl_value_box, &box) < 0) {
+		fprintf(stderr, "FAIL: Copying map value: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+
+	if (cache_serialize_binary(c, &bin, &bin_len, c) < 0) {
+		fprintf(stderr, "FAIL: Binary serializing entry: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+
+	out = talloc_zero(c, rlm_cache_entry_t);
+	if (cache_deserialize_binary(out, bin, bin_len) < 0) {
+		fprintf(stderr, "FAIL: Binary deserializing entry: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+
+	if (!out->maps || (out->maps->rhs->type != TMPL_TYPE_DATA) ||
+	    (value_box_cmp(&out->maps->rhs->tmpl_value_box, &box) != 0)) {
+		fprintf(stderr, "FAIL: Binary round trip of string with embedded specials\n");
+		errors++;
+	}
+
+	talloc_free(c);
+
+	return errors;
+}
+
+/** Check a binary entry with a corrupt byte is rejected
+ *
+ */
+static int check_corrupt(TALLOC_CTX *ctx, size_t offset, uint8_t value, char const *what)
+{
+	rlm_cache_entry_t	*c, *out;
+	uint8_t			*bin;
+	size_t			bin_len;
+	int			errors = 0;
+
+	c = entry_from_text(ctx, entries[1]);
+	if (!c) return 1;
+
+	if (cache_serialize_binary(c, &bin, &bin_len, c) < 0) {
+		fprintf(stderr, "FAIL: Binary serializing entry: %s\n", fr_strerror());
+		talloc_free(c);
+		return 1;
+	}
+	rad_assert(offset < bin_len);
+	bin[offset] = value;
+
+	out = talloc_zero(c, rlm_cache_entry_t);
+	if (cache_deserialize_binary(out, bin, bin_len) == 0) {
+		fprintf(stderr, "FAIL: Entry with %s %u accepted\n", what, value);
+		errors++;
+	} else if (debug_lvl) {
+		printf("%s %u rejected: %s\n", what, value, fr_strerror());
+	}
+
+	talloc_free(c);
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, rcode = 0;
+	size_t			i;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_dict_t		*dict = NULL;
+	char const		*dict_dir = DICTDIR;
+
+	while ((c = getopt(argc, argv, "D:hx")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(NULL, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("cache_serialize_test");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(entries) / sizeof(*entries); i++) rcode |= check_round_trip(autofree, entries[i]);
+
+	rcode |= check_binary_string(autofree);
+
+	rcode |= check_corrupt(autofree, BINARY_REQUEST, REQUEST_UNKNOWN, "request qualifier");
+	rcode |= check_corrupt(autofree, BINARY_REQUEST, 0xff, "request qualifier");
+	rcode |= check_corrupt(autofree, BINARY_LIST, PAIR_LIST_UNKNOWN, "list qualifier");
+	rcode |= check_corrupt(autofree, BINARY_LIST, 0xff, "list qualifier");
+	rcode |= check_corrupt(autofree, BINARY_OP, T_INVALID, "operator");
+	rcode |= check_corrupt(autofree, BINARY_OP, T_BARE_WORD, "operator");
+	rcode |= check_corrupt(autofree, 1, CACHE_SERIALIZE_VERSION + 1, "version");
+
+	if (!rcode) printf("cache_serialize_test: OK\n");
+
+	talloc_free(dict);
+	talloc_free(autofree);
+
+	return rcode;
+}
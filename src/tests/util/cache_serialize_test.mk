@@ -0,0 +1,9 @@
+TARGET := cache_serialize_test
+
+SOURCES		:= cache_serialize_test.c \
+		   ../../modules/rlm_cache/serialize.c
+
+SRC_INCDIRS	:= ${top_srcdir}/src/modules/rlm_cache
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
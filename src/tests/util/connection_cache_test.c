@@ -0,0 +1,344 @@
+/*
+ * connection_cache_test.c	Tests for connection pool thread caches
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/connection.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_THREADS	64
+
+typedef struct {
+	pthread_t		id;
+	int			num;		//!< Index of the thread.
+	uint64_t		gets;		//!< Successful reservations.
+	uint64_t		failed;		//!< Reservations which gave up.
+} worker_t;
+
+static int			debug_lvl = 0;
+static int			max_conns = 2;
+static int			num_threads = 0;
+static int			num_loops = 10000;
+
+static fr_connection_pool_t	*pool;
+
+/*
+ *	Workers take turns in the first phases, so which connections
+ *	are cached, and which are reserved, is deterministic.
+ */
+static pthread_mutex_t		turn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		turn_cond = PTHREAD_COND_INITIALIZER;
+static int			turn = 0;
+
+static pthread_barrier_t	barrier;
+
+static int			fail = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: connection_cache_test [OPTS]\n");
+	fprintf(stderr, "  -m <max>               Maximum connections in the pool (default 2).\n");
+	fprintf(stderr, "  -n <loops>             Reservations per thread in the concurrent phase.\n");
+	fprintf(stderr, "  -t <threads>           Number of threads (default twice max).\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static void *conn_create(TALLOC_CTX *ctx, UNUSED void *opaque, UNUSED struct timeval const *timeout)
+{
+	return talloc_zero(ctx, uint8_t);
+}
+
+static int conn_alive(UNUSED void *opaque, UNUSED void *conn)
+{
+	return 0;
+}
+
+static void turn_wait(int num)
+{
+	pthread_mutex_lock(&turn_mutex);
+	while (turn != num) pthread_cond_wait(&turn_cond, &turn_mutex);
+	pthread_mutex_unlock(&turn_mutex);
+}
+
+static void turn_next(void)
+{
+	pthread_mutex_lock(&turn_mutex);
+	turn++;
+	pthread_cond_broadcast(&turn_cond);
+	pthread_mutex_unlock(&turn_mutex);
+}
+
+/** Reserve a connection, giving up after a second
+ *
+ * In the concurrent phase all the connections may legitimately be
+ * reserved by other threads for a while.
+ */
+static void *conn_get_retry(void)
+{
+	int	i;
+	void	*conn;
+
+	for (i = 0; i < 1000; i++) {
+		conn = fr_connection_get(pool, NULL);
+		if (conn) return conn;
+
+		usleep(1000);
+	}
+
+	return NULL;
+}
+
+static void *worker_thread(void *arg)
+{
+	worker_t			*w = arg;
+	fr_connection_thread_cache_t	*cache;
+	void				*conn = NULL;
+	int				i;
+
+	cache = fr_connection_pool_thread_instantiate(pool);
+	if (!cache) {
+		fprintf(stderr, "FAIL: Thread %i didn't get a cache\n", w->num);
+		fail = 1;
+	}
+
+	/*
+	 *	The first max threads each leave a connection
+	 *	idle in their cache.  This fills the pool.
+	 *
+	 *	The next max threads then each reserve a connection,
+	 *	and hold it.  They can only get one by reclaiming it
+	 *	from the cache of one of the first threads, none of
+	 *	which touch the pool again until the end.
+	 */
+	turn_wait(w->num);
+	if (w->num < (max_conns * 2)) {
+		conn = fr_connection_get(pool, NULL);
+		if (!conn) {
+			fprintf(stderr, "FAIL: Thread %i got no connection with the pool at max\n", w->num);
+			fail = 1;
+		} else {
+			w->gets++;
+		}
+	}
+	if (conn && (w->num < max_conns)) {
+		fr_connection_release(pool, NULL, conn);
+		conn = NULL;
+	}
+	turn_next();
+
+	pthread_barrier_wait(&barrier);
+	if (conn) fr_connection_release(pool, NULL, conn);
+	pthread_barrier_wait(&barrier);
+
+	/*
+	 *	Thread 0 goes quiet, leaving whatever it's got
+	 *	cached.  Everyone else hammers the pool.
+	 *
+	 *	If reclaiming is broken each reservation may
+	 *	take a second, so don't bother.
+	 */
+	if ((w->num != 0) && !fail) for (i = 0; i < num_loops; i++) {
+		conn = conn_get_retry();
+		if (!conn) {
+			w->failed++;
+			break;
+		}
+		w->gets++;
+		fr_connection_release(pool, NULL, conn);
+	}
+	pthread_barrier_wait(&barrier);
+
+	/*
+	 *	And the quiet thread must still be able to get
+	 *	a connection, from its cache or anyone else's.
+	 */
+	if (w->num == 0) {
+		conn = fr_connection_get(pool, NULL);
+		if (!conn) {
+			fprintf(stderr, "FAIL: Quiet thread got no connection after other threads finished\n");
+			fail = 1;
+		} else {
+			w->gets++;
+			fr_connection_release(pool, NULL, conn);
+		}
+	}
+	pthread_barrier_wait(&barrier);
+
+	fr_connection_pool_thread_detach(cache);
+
+	return NULL;
+}
+
+static CONF_SECTION *pool_conf_alloc(void)
+{
+	CONF_SECTION	*cs;
+	char		buffer[32];
+	size_t		i;
+	struct {
+		char const	*attr;
+		char const	*value;
+	} conf[] = {
+		{ "start",		"0" },
+		{ "min",		"0" },
+		{ "max",		buffer },
+		{ "spare",		"0" },
+		{ "thread_cache",	"1" },
+		{ "retry_delay",	"0" }
+	};
+
+	snprintf(buffer, sizeof(buffer), "%i", max_conns);
+
+	cs = cf_section_alloc(NULL, "pool", NULL);
+	if (!cs) return NULL;
+
+	for (i = 0; i < (sizeof(conf) / sizeof(*conf)); i++) {
+		CONF_PAIR *cp;
+
+		cp = cf_pair_alloc(cs, conf[i].attr, conf[i].value, T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+		if (!cp) {
+			talloc_free(cs);
+			return NULL;
+		}
+		cf_pair_add(cs, cp);
+	}
+
+	return cs;
+}
+
+int main(int argc, char *argv[])
+{
+	int					c, i, rcode = 0;
+	worker_t				workers[MAX_THREADS];
+	CONF_SECTION				*cs;
+	fr_connection_pool_state_t const	*state;
+	uint64_t				gets = 0, failed = 0;
+	int					dummy;
+
+	fr_log_init(&default_log, false);
+
+	while ((c = getopt(argc, argv, "hm:n:t:x")) != EOF) switch (c) {
+		case 'm':
+			max_conns = atoi(optarg);
+			if ((max_conns <= 0) || (max_conns > (MAX_THREADS / 2))) usage();
+			break;
+
+		case 'n':
+			num_loops = atoi(optarg);
+			if (num_loops <= 0) usage();
+			break;
+
+		case 't':
+			num_threads = atoi(optarg);
+			if ((num_threads <= 0) || (num_threads > MAX_THREADS)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			rad_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Need more threads than connections.
+	 */
+	if (!num_threads) num_threads = max_conns * 2;
+	if (num_threads <= max_conns) usage();
+
+	cs = pool_conf_alloc();
+	if (!cs) {
+		fprintf(stderr, "Failed allocating pool configuration\n");
+		exit(1);
+	}
+
+	pool = fr_connection_pool_init(cs, cs, &dummy, conn_create, conn_alive, "connection_cache_test");
+	if (!pool) {
+		fprintf(stderr, "Failed creating connection pool\n");
+		exit(1);
+	}
+
+	pthread_barrier_init(&barrier, NULL, num_threads);
+
+	for (i = 0; i < num_threads; i++) {
+		memset(&workers[i], 0, sizeof(workers[i]));
+		workers[i].num = i;
+		if (pthread_create(&workers[i].id, NULL, worker_thread, &workers[i]) != 0) {
+			fprintf(stderr, "Failed creating worker thread: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].id, NULL);
+		gets += workers[i].gets;
+		failed += workers[i].failed;
+	}
+	pthread_barrier_destroy(&barrier);
+
+	state = fr_connection_pool_state(pool);
+	if (debug_lvl) {
+		printf("%i threads, %i connections max, %" PRIu64 " reservations, %" PRIu64 " spawned, "
+		       "%" PRIu64 " cache hits, %" PRIu64 " cache misses\n",
+		       num_threads, max_conns, gets, state->count, state->cache_hits, state->cache_misses);
+	}
+
+	if (failed) {
+		fprintf(stderr, "FAIL: %" PRIu64 " reservations got no connection within a second\n", failed);
+		rcode = 1;
+	}
+
+	if (state->num > (uint32_t)max_conns) {
+		fprintf(stderr, "FAIL: Pool has %u connections, max is %i\n", state->num, max_conns);
+		rcode = 1;
+	}
+
+	/*
+	 *	All caches have been detached, so nothing should
+	 *	still be reserved.
+	 */
+	if (state->active != 0) {
+		fprintf(stderr, "FAIL: %u connections still reserved after all threads detached\n", state->active);
+		rcode = 1;
+	}
+
+	if (fail) rcode = 1;
+
+	fr_connection_pool_free(pool);
+	talloc_free(cs);
+
+	if (!rcode) printf("connection_cache_test: OK\n");
+
+	return rcode;
+}
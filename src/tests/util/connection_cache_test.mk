@@ -0,0 +1,6 @@
+TARGET := connection_cache_test
+
+SOURCES		:= connection_cache_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,288 @@
+/*
+ * escape_test.c	Tests and benchmark for table driven escaping
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/escape.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_IN		512
+#define MAX_OUT		((MAX_IN * 3) + 1)
+
+static int			debug_lvl = 0;
+static uint64_t			iterations = 1000 * 1000;
+
+static char const		sql_safe[] = "@abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-_: /";
+static char const		ldap_specials[] = ",+\"\\<>;*=()";
+static char const		uri_safe[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~";
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: escape_test [OPTS]\n");
+	fprintf(stderr, "  -n <iterations>        Number of strings to escape for each length.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Escape one byte at a time, as the modules used to
+ *
+ */
+static size_t escape_ref(fr_escape_t const *esc, char *out, size_t outlen, char const *in, size_t inlen)
+{
+	uint8_t const	*p = (uint8_t const *) in, *end = p + inlen;
+	char		*o = out;
+	size_t		left = outlen;
+
+	while (p < end) {
+		int	len;
+
+		switch (esc->action[*p]) {
+		case FR_ESCAPE_COPY:
+			if (left <= 1) goto done;
+			*o++ = *p++;
+			left--;
+			continue;
+
+		case FR_ESCAPE_UTF8:
+			len = fr_utf8_char(p, end - p);
+			if (len > 1) {
+				if ((size_t) len >= left) goto done;
+				memcpy(o, p, len);
+				o += len;
+				p += len;
+				left -= len;
+				continue;
+			}
+			/* FALL-THROUGH */
+
+		case FR_ESCAPE_HEX:
+			if (left <= 3) goto done;
+			o += snprintf(o, left, "%c%c%c", esc->prefix, esc->hextab[*p >> 4], esc->hextab[*p & 0x0f]);
+			p++;
+			left -= 3;
+			continue;
+
+		default:
+			if (left <= 2) goto done;
+			*o++ = '\\';
+			*o++ = esc->action[*p++];
+			left -= 2;
+			continue;
+		}
+	}
+
+done:
+	*o = '\0';
+	return o - out;
+}
+
+/** The way rlm_sql used to check for allowed characters
+ *
+ */
+static size_t escape_strchr(char *out, size_t outlen, char const *in)
+{
+	size_t left = outlen;
+
+	while (*in) {
+		if ((*in < 32) || !strchr(sql_safe, *in)) {
+			if (left <= 3) break;
+			snprintf(out, left, "=%02X", (uint8_t) *in);
+			in++;
+			out += 3;
+			left -= 3;
+			continue;
+		}
+
+		if (left <= 1) break;
+		*out++ = *in++;
+		left--;
+	}
+	*out = '\0';
+
+	return outlen - left;
+}
+
+/** Fill a buffer with mostly safe characters, and a few which need escaping
+ *
+ */
+static void random_string(char *out, size_t len)
+{
+	static char const	utf8[] = "\xc3\xa9\xe2\x82\xac";	/* e-acute, euro */
+	size_t			i = 0;
+
+	while (i < len) {
+		switch (fr_rand() % 16) {
+		case 0:
+			out[i++] = (fr_rand() % 255) + 1;
+			break;
+
+		case 1:
+			if ((len - i) < 5) goto ascii;
+			memcpy(out + i, utf8, 5);
+			i += 5;
+			break;
+
+		case 2:
+			out[i++] = "\n\r\t'\"\\=%()*"[fr_rand() % 12];
+			break;
+
+		default:
+		ascii:
+			out[i++] = sql_safe[fr_rand() % (sizeof(sql_safe) - 1)];
+			break;
+		}
+	}
+	out[len] = '\0';
+}
+
+static int escape_check_one(char const *name, fr_escape_t const *esc)
+{
+	static char	in[MAX_IN + 1];
+	char		out[MAX_OUT], expected[MAX_OUT];
+	size_t		inlen, outlen, len, expected_len;
+	int		rounds, errors = 0;
+
+	for (rounds = 0; rounds < 10000; rounds++) {
+		inlen = fr_rand() % MAX_IN;
+		random_string(in, inlen);
+		outlen = (rounds & 1) ? MAX_OUT : (fr_rand() % MAX_OUT) + 1;
+
+		len = fr_escape(esc, out, outlen, in, -1);
+		expected_len = escape_ref(esc, expected, outlen, in, strlen(in));
+
+		if ((len != expected_len) || (strcmp(out, expected) != 0)) {
+			fprintf(stderr, "FAIL: %s escaping mismatch for %zu byte string, %zu byte buffer\n",
+				name, inlen, outlen);
+			if (debug_lvl) fprintf(stderr, "got      %s\nexpected %s\n", out, expected);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+static int escape_check_vector(fr_escape_t const *esc, char const *in, char const *expected)
+{
+	char out[MAX_OUT];
+
+	fr_escape(esc, out, sizeof(out), in, -1);
+	if (strcmp(out, expected) == 0) return 0;
+
+	fprintf(stderr, "FAIL: escaping \"%s\" gave \"%s\", expected \"%s\"\n", in, out, expected);
+
+	return 1;
+}
+
+static double usec_since(struct timeval *start)
+{
+	struct timeval end, elapsed;
+
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, start);
+
+	return (elapsed.tv_sec * 1000000.0) + elapsed.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, rcode = 0;
+	uint64_t		i;
+	size_t			j;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_escape_t		*sql, *ldap, *uri;
+	static size_t const	lengths[] = { 8, 16, 32, 64, 128, 253 };
+	char			in[MAX_IN + 1], out[MAX_OUT];
+	struct timeval		start;
+	double			old_usec, new_usec;
+	size_t			total = 0;
+
+	while ((c = getopt(argc, argv, "hn:x")) != EOF) switch (c) {
+		case 'n':
+			iterations = strtoull(optarg, NULL, 10);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	The same escapers the modules use.
+	 */
+	sql = fr_escape_alloc(autofree, sql_safe, '=', FR_ESCAPE_FLAG_UTF8);
+	fr_escape_set(sql, '\n', 'n');
+	fr_escape_set(sql, '\r', 'r');
+	fr_escape_set(sql, '\t', 't');
+	ldap = fr_escape_alloc(autofree, ldap_specials, '\\', FR_ESCAPE_FLAG_SPECIALS | FR_ESCAPE_FLAG_LOWER);
+	uri = fr_escape_alloc(autofree, uri_safe, '%', 0);
+
+	rcode |= escape_check_vector(sql, "bob@example.com", "bob@example.com");
+	rcode |= escape_check_vector(sql, "it's\n\xc3\xa9\xff", "it=27s\\n\xc3\xa9=FF");
+	rcode |= escape_check_vector(ldap, "a(b)*\\c\xc3\xa9", "a\\28b\\29\\2a\\5cc\xc3\xa9");
+	rcode |= escape_check_vector(uri, "a b/c~d", "a%20b%2Fc~d");
+
+	rcode |= escape_check_one("sql", sql);
+	rcode |= escape_check_one("ldap", ldap);
+	rcode |= escape_check_one("uri", uri);
+	if (rcode) goto finish;
+
+	for (j = 0; j < sizeof(lengths) / sizeof(*lengths); j++) {
+		size_t k;
+
+		/*
+		 *	A typical attribute value.  All safe, apart
+		 *	from a single quote near the end.
+		 */
+		for (k = 0; k < lengths[j]; k++) in[k] = sql_safe[k % (sizeof(sql_safe) - 1)];
+		in[lengths[j] - 2] = '\'';
+		in[lengths[j]] = '\0';
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < iterations; i++) total += escape_strchr(out, sizeof(out), in);
+		old_usec = usec_since(&start);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < iterations; i++) total += fr_escape(sql, out, sizeof(out), in, -1);
+		new_usec = usec_since(&start);
+
+		printf("escape %3zu bytes: %.1f ns -> %.1f ns (%.2fx)\n", lengths[j],
+		       (old_usec * 1000.0) / iterations, (new_usec * 1000.0) / iterations, old_usec / new_usec);
+	}
+	if (debug_lvl) printf("total %zu\n", total);
+
+finish:
+	talloc_free(autofree);
+
+	return rcode;
+}
@@ -0,0 +1,6 @@
+TARGET := escape_test
+
+SOURCES		:= escape_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,284 @@
+/*
+ * hmac_md5_test.c	Benchmark for Message-Authenticator signing and verification
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/net.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define NUM_PACKETS	256
+
+static int			debug_lvl = 0;
+static uint64_t			iterations = 1000 * 1000;
+static char const		*secret_str = "testing123";
+
+/*
+ *	RFC 2202 test vectors.
+ */
+static struct {
+	char const	*key;
+	size_t		key_len;
+	char const	*data;
+	size_t		data_len;
+	uint8_t		digest[MD5_DIGEST_LENGTH];
+} vectors[] = {
+	{ "Jefe", 4, "what do ya want for nothing?", 28,
+	  { 0x75, 0x0c, 0x78, 0x3e, 0x6a, 0xb0, 0xb5, 0x03, 0xea, 0xa8, 0x6e, 0x31, 0x0a, 0x5d, 0xb7, 0x38 } },
+	{ "\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b", 16, "Hi There", 8,
+	  { 0x92, 0x94, 0x72, 0x7a, 0x36, 0x38, 0xbb, 0x1c, 0x13, 0xf4, 0x8e, 0xf8, 0x15, 0x8b, 0xfc, 0x9d } },
+	{ "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+	  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+	  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+	  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+	  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa", 80,
+	  "Test Using Larger Than Block-Size Key - Hash Key First", 54,
+	  { 0x6b, 0x1a, 0xb7, 0xfe, 0x4b, 0xd7, 0xbf, 0x8f, 0x0b, 0x62, 0xe6, 0xce, 0x61, 0xb9, 0xd0, 0xcd } }
+};
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: hmac_md5_test [OPTS]\n");
+	fprintf(stderr, "  -n <iterations>        Number of packets to sign and verify.\n");
+	fprintf(stderr, "  -s <secret>            Shared secret (default testing123).\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Build an Access-Request containing a zeroed Message-Authenticator
+ *
+ */
+static RADIUS_PACKET *packet_alloc(TALLOC_CTX *ctx, int id)
+{
+	RADIUS_PACKET	*packet;
+	uint8_t		*p;
+	int		len;
+
+	packet = fr_radius_alloc(ctx, true);
+	rad_assert(packet != NULL);
+
+	packet->code = PW_CODE_ACCESS_REQUEST;
+	packet->id = id & 0xff;
+	packet->data = p = talloc_zero_array(packet, uint8_t, 4096);
+
+	p[0] = packet->code;
+	p[1] = packet->id;
+	memcpy(p + 4, packet->vector, sizeof(packet->vector));
+	p += RADIUS_HDR_LEN;
+
+	len = snprintf((char *)p + 2, 64, "user-%i@example.org", id);
+	p[0] = PW_USER_NAME;
+	p[1] = len + 2;
+	p += p[1];
+
+	p[0] = PW_NAS_IP_ADDRESS;
+	p[1] = 6;
+	p[2] = 192;
+	p[3] = 0;
+	p[4] = 2;
+	p[5] = 1;
+	p += p[1];
+
+	packet->offset = p - packet->data;
+	p[0] = PW_MESSAGE_AUTHENTICATOR;
+	p[1] = 2 + AUTH_VECTOR_LEN;
+	p += p[1];
+
+	packet->data_len = p - packet->data;
+	packet->data[2] = (packet->data_len >> 8) & 0xff;
+	packet->data[3] = packet->data_len & 0xff;
+
+	return packet;
+}
+
+/** Zero the Message-Authenticator value, as fr_radius_encode() leaves it
+ *
+ * Otherwise the HMAC is calculated over the previous one.
+ */
+static void packet_reset(RADIUS_PACKET *packet)
+{
+	memset(packet->data + packet->offset + 2, 0, AUTH_VECTOR_LEN);
+}
+
+static double usec_since(struct timeval *start)
+{
+	struct timeval end, elapsed;
+
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, start);
+
+	return (elapsed.tv_sec * 1000000.0) + elapsed.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, rcode = 0;
+	uint64_t		i;
+	size_t			j;
+	char			*secret;
+	fr_hmac_md5_key_t	hkey;
+	RADIUS_PACKET		*packets[NUM_PACKETS];
+	uint8_t			digest[MD5_DIGEST_LENGTH];
+	uint8_t			sig[NUM_PACKETS][AUTH_VECTOR_LEN];
+	struct timeval		start;
+	double			sign_usec, sign_keyed_usec, verify_usec, verify_keyed_usec;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hn:s:x")) != EOF) switch (c) {
+		case 'n':
+			iterations = strtoull(optarg, NULL, 10);
+			if (!iterations) usage();
+			break;
+
+		case 's':
+			secret_str = optarg;
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Check the keyed and unkeyed APIs against the
+	 *	RFC 2202 test vectors.
+	 */
+	for (j = 0; j < sizeof(vectors) / sizeof(*vectors); j++) {
+		fr_hmac_md5(digest, (uint8_t const *)vectors[j].data, vectors[j].data_len,
+			    (uint8_t const *)vectors[j].key, vectors[j].key_len);
+		if (memcmp(digest, vectors[j].digest, sizeof(digest)) != 0) {
+			fprintf(stderr, "FAIL: fr_hmac_md5() test vector %zu\n", j);
+			rcode = 1;
+		}
+
+		fr_hmac_md5_key_init(&hkey, (uint8_t const *)vectors[j].key, vectors[j].key_len);
+		fr_hmac_md5_keyed(digest, (uint8_t const *)vectors[j].data, vectors[j].data_len, &hkey);
+		if (memcmp(digest, vectors[j].digest, sizeof(digest)) != 0) {
+			fprintf(stderr, "FAIL: fr_hmac_md5_keyed() test vector %zu\n", j);
+			rcode = 1;
+		}
+	}
+	if (rcode) goto finish;
+
+	secret = talloc_typed_strdup(autofree, secret_str);
+	fr_hmac_md5_key_init(&hkey, (uint8_t const *)secret, strlen(secret));
+
+	for (j = 0; j < NUM_PACKETS; j++) packets[j] = packet_alloc(autofree, j);
+
+	/*
+	 *	Before - the key pads are hashed for every packet
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		packet_reset(packets[i % NUM_PACKETS]);
+		if (fr_radius_sign(packets[i % NUM_PACKETS], NULL, secret) < 0) {
+			fprintf(stderr, "FAIL: fr_radius_sign(): %s\n", fr_strerror());
+			rcode = 1;
+			goto finish;
+		}
+	}
+	sign_usec = usec_since(&start);
+
+	for (j = 0; j < NUM_PACKETS; j++) {
+		memcpy(sig[j], packets[j]->data + packets[j]->offset + 2, AUTH_VECTOR_LEN);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if (fr_radius_verify(packets[i % NUM_PACKETS], NULL, secret) < 0) {
+			fprintf(stderr, "FAIL: fr_radius_verify(): %s\n", fr_strerror());
+			rcode = 1;
+			goto finish;
+		}
+	}
+	verify_usec = usec_since(&start);
+
+	/*
+	 *	After - the key pads were hashed once, above
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		packet_reset(packets[i % NUM_PACKETS]);
+		if (fr_radius_sign_keyed(packets[i % NUM_PACKETS], NULL, secret, &hkey) < 0) {
+			fprintf(stderr, "FAIL: fr_radius_sign_keyed(): %s\n", fr_strerror());
+			rcode = 1;
+			goto finish;
+		}
+	}
+	sign_keyed_usec = usec_since(&start);
+
+	for (j = 0; j < NUM_PACKETS; j++) {
+		if (memcmp(sig[j], packets[j]->data + packets[j]->offset + 2, AUTH_VECTOR_LEN) != 0) {
+			fprintf(stderr, "FAIL: Keyed and unkeyed Message-Authenticators differ for packet %zu\n", j);
+			rcode = 1;
+			goto finish;
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if (fr_radius_verify_keyed(packets[i % NUM_PACKETS], NULL, secret, &hkey) < 0) {
+			fprintf(stderr, "FAIL: fr_radius_verify_keyed(): %s\n", fr_strerror());
+			rcode = 1;
+			goto finish;
+		}
+	}
+	verify_keyed_usec = usec_since(&start);
+
+	/*
+	 *	Both should reject a bad Message-Authenticator.
+	 */
+	packets[0]->data[packets[0]->offset + 2] ^= 0xff;
+	if ((fr_radius_verify(packets[0], NULL, secret) == 0) ||
+	    (fr_radius_verify_keyed(packets[0], NULL, secret, &hkey) == 0)) {
+		fprintf(stderr, "FAIL: Invalid Message-Authenticator accepted\n");
+		rcode = 1;
+		goto finish;
+	}
+
+	if (debug_lvl) printf("%zu byte packets, %zu byte secret\n", packets[0]->data_len, strlen(secret));
+
+	printf("sign:   %.2f Kpps -> %.2f Kpps keyed (%.2fx)\n",
+	       (iterations * 1000.0) / sign_usec, (iterations * 1000.0) / sign_keyed_usec,
+	       sign_usec / sign_keyed_usec);
+	printf("verify: %.2f Kpps -> %.2f Kpps keyed (%.2fx)\n",
+	       (iterations * 1000.0) / verify_usec, (iterations * 1000.0) / verify_keyed_usec,
+	       verify_usec / verify_keyed_usec);
+
+finish:
+	talloc_free(autofree);
+
+	return rcode;
+}
@@ -0,0 +1,257 @@
+/*
+ * latency_test.c	Tests for the latency histogram buckets and percentiles
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/latency.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static int			debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: latency_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Check every bucket starts where the previous one ends, and is no wider than 25%
+ *
+ */
+static int check_buckets(void)
+{
+	unsigned int	i;
+	int		errors = 0;
+
+	for (i = 0; i < FR_LATENCY_BUCKETS; i++) {
+		uint64_t min = fr_latency_bucket_min(i);
+
+		if (fr_latency_bucket(min) != i) {
+			fprintf(stderr, "FAIL: Bucket %u starts at %" PRIu64 ", which is counted in bucket %u\n",
+				i, min, fr_latency_bucket(min));
+			errors++;
+		}
+
+		if (i == 0) continue;
+
+		if (fr_latency_bucket(min - 1) != (i - 1)) {
+			fprintf(stderr, "FAIL: %" PRIu64 " should be the end of bucket %u, but is counted in bucket %u\n",
+				min - 1, i - 1, fr_latency_bucket(min - 1));
+			errors++;
+		}
+
+		/*
+		 *	The first buckets hold a single value each.
+		 */
+		if (i <= FR_LATENCY_SUB) continue;
+
+		if (((fr_latency_bucket_min(i) - fr_latency_bucket_min(i - 1)) * FR_LATENCY_SUB) >
+		    fr_latency_bucket_min(i - 1)) {
+			fprintf(stderr, "FAIL: Bucket %u is wider than 1/%u of its start\n", i - 1, FR_LATENCY_SUB);
+			errors++;
+		}
+	}
+
+	if (debug_lvl) printf("%u buckets, the last starts at %" PRIu64 "ns\n",
+			      FR_LATENCY_BUCKETS, fr_latency_bucket_min(FR_LATENCY_BUCKETS - 1));
+
+	/*
+	 *	Anything too big for the table goes in the last bucket.
+	 */
+	if ((fr_latency_bucket((uint64_t) 1 << FR_LATENCY_MAX_BITS) != (FR_LATENCY_BUCKETS - 1)) ||
+	    (fr_latency_bucket(UINT64_MAX) != (FR_LATENCY_BUCKETS - 1))) {
+		fprintf(stderr, "FAIL: Large values aren't counted in the last bucket\n");
+		errors++;
+	}
+
+	return errors;
+}
+
+static void hist_add(fr_latency_t *hist, uint64_t elapsed, uint64_t count)
+{
+	hist->count += count;
+	hist->total += elapsed * count;
+	if (elapsed > hist->max) hist->max = elapsed;
+	hist->bucket[fr_latency_bucket(elapsed)] += count;
+}
+
+static int check_percentile(fr_latency_t const *hist, unsigned int permille, uint64_t expected)
+{
+	uint64_t got;
+
+	got = fr_latency_percentile(hist, permille);
+	if (got == expected) return 0;
+
+	fprintf(stderr, "FAIL: Permille %u, expected %" PRIu64 ", got %" PRIu64 "\n", permille, expected, got);
+
+	return 1;
+}
+
+static int check_percentiles(void)
+{
+	fr_latency_t	hist;
+	int		errors = 0;
+
+	/*
+	 *	No samples.
+	 */
+	memset(&hist, 0, sizeof(hist));
+	errors += check_percentile(&hist, 500, 0);
+	errors += check_percentile(&hist, 1000, 0);
+
+	/*
+	 *	A single sample is every percentile, and is never
+	 *	rounded up past the largest sample.
+	 */
+	hist_add(&hist, 1000, 1);
+	errors += check_percentile(&hist, 0, 1000);
+	errors += check_percentile(&hist, 500, 1000);
+	errors += check_percentile(&hist, 1000, 1000);
+
+	/*
+	 *	999 fast samples and one slow one.  Everything up to
+	 *	p99.9 is in the fast bucket, which is reported as the
+	 *	largest value it can hold.
+	 */
+	memset(&hist, 0, sizeof(hist));
+	hist_add(&hist, 1000, 999);
+	hist_add(&hist, 1000000000, 1);
+	errors += check_percentile(&hist, 500, fr_latency_bucket_min(fr_latency_bucket(1000) + 1) - 1);
+	errors += check_percentile(&hist, 999, fr_latency_bucket_min(fr_latency_bucket(1000) + 1) - 1);
+	errors += check_percentile(&hist, 1000, 1000000000);
+
+	/*
+	 *	The target rounds up, so with 1001 samples p99.9
+	 *	needs 1000 of them.
+	 */
+	hist_add(&hist, 2000, 1);
+	errors += check_percentile(&hist, 999, fr_latency_bucket_min(fr_latency_bucket(2000) + 1) - 1);
+
+	/*
+	 *	Samples in the last bucket are reported as the
+	 *	largest sample.
+	 */
+	memset(&hist, 0, sizeof(hist));
+	hist_add(&hist, UINT64_MAX, 2);
+	errors += check_percentile(&hist, 500, UINT64_MAX);
+
+	/*
+	 *	Small values are counted exactly.
+	 */
+	memset(&hist, 0, sizeof(hist));
+	hist_add(&hist, 0, 1);
+	hist_add(&hist, 1, 1);
+	hist_add(&hist, 2, 1);
+	hist_add(&hist, 3, 1);
+	errors += check_percentile(&hist, 250, 0);
+	errors += check_percentile(&hist, 500, 1);
+	errors += check_percentile(&hist, 750, 2);
+	errors += check_percentile(&hist, 1000, 3);
+
+	return errors;
+}
+
+static int check_walk_one(void *ctx, char const *name, fr_latency_t const *hist)
+{
+	int *found = ctx;
+
+	if (strcmp(name, "test.walk") != 0) return 0;
+
+	if ((hist->count != 3) || (hist->total != 6000) || (hist->max != 3000)) {
+		fprintf(stderr, "FAIL: Walk found count %" PRIu64 ", total %" PRIu64 ", max %" PRIu64 "\n",
+			hist->count, hist->total, hist->max);
+		*found = -1;
+		return -1;
+	}
+
+	*found = 1;
+
+	return 0;
+}
+
+/** Check samples recorded with fr_latency_record() come back from fr_latency_walk()
+ *
+ */
+static int check_walk(void)
+{
+	uint32_t	id;
+	int		found = 0;
+
+	id = fr_latency_register("test.%s", "walk");
+	if (!id) {
+		fprintf(stderr, "FAIL: Registering histogram\n");
+		return 1;
+	}
+
+	/*
+	 *	Registering the same name again gets the same
+	 *	histogram.
+	 */
+	if (fr_latency_register("test.walk") != id) {
+		fprintf(stderr, "FAIL: Registering a duplicate name allocated a new histogram\n");
+		return 1;
+	}
+
+	fr_latency_record(id, 1000);
+	fr_latency_record(id, 2000);
+	fr_latency_record(id, 3000);
+	fr_latency_record(0, 4000);	/* Ignored */
+
+	(void) fr_latency_walk(check_walk_one, &found);
+	if (found != 1) {
+		if (!found) fprintf(stderr, "FAIL: Walk didn't find the histogram\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int c, rcode = 0;
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	rcode |= check_buckets();
+	rcode |= check_percentiles();
+	rcode |= check_walk();
+
+	if (!rcode) printf("latency_test: OK\n");
+
+	return rcode;
+}
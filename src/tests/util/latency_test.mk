@@ -0,0 +1,7 @@
+TARGET := latency_test
+
+SOURCES		:= latency_test.c \
+		   ../../main/latency.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,276 @@
+/*
+ * md5_mb_test.c	Tests and benchmark for multi-buffer MD5 and batch authenticator verification
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/net.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_MSGS	64
+#define MAX_DATA	512
+#define MAX_SUFFIX	128
+
+static int			debug_lvl = 0;
+static uint64_t			iterations = 100 * 1000;
+static int			batch_size = 32;
+static char const		*secret_str = "testing123";
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: md5_mb_test [OPTS]\n");
+	fprintf(stderr, "  -b <size>              Packets per batch (default 32).\n");
+	fprintf(stderr, "  -n <iterations>        Number of batches to hash and verify.\n");
+	fprintf(stderr, "  -s <secret>            Shared secret (default testing123).\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Compare fr_md5_mb_calc against the scalar code for random messages
+ *
+ */
+static int md5_mb_check(void)
+{
+	static uint8_t		data[MAX_MSGS][MAX_DATA];
+	static uint8_t		suffix[MAX_MSGS][MAX_SUFFIX];
+	uint8_t			digest[MAX_MSGS][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_DIGEST_LENGTH];
+	fr_md5_mb_msg_t		msgs[MAX_MSGS];
+	FR_MD5_CTX		ctx;
+	unsigned int		i, j, num;
+	int			rounds, errors = 0;
+
+	for (rounds = 0; rounds < 1000; rounds++) {
+		num = fr_rand() % (MAX_MSGS + 1);
+
+		for (i = 0; i < num; i++) {
+			msgs[i].data = data[i];
+			msgs[i].data_len = fr_rand() % MAX_DATA;
+			msgs[i].suffix = suffix[i];
+			msgs[i].suffix_len = fr_rand() % MAX_SUFFIX;
+			msgs[i].digest = digest[i];
+
+			for (j = 0; j < msgs[i].data_len; j++) data[i][j] = fr_rand();
+			for (j = 0; j < msgs[i].suffix_len; j++) suffix[i][j] = fr_rand();
+		}
+
+		fr_md5_mb_calc(msgs, num);
+
+		for (i = 0; i < num; i++) {
+			fr_md5_init(&ctx);
+			fr_md5_update(&ctx, msgs[i].data, msgs[i].data_len);
+			fr_md5_update(&ctx, msgs[i].suffix, msgs[i].suffix_len);
+			fr_md5_final(expected, &ctx);
+
+			if (memcmp(expected, digest[i], sizeof(expected)) != 0) {
+				fprintf(stderr, "FAIL: Digest mismatch for %zu byte message, %zu byte suffix\n",
+					msgs[i].data_len, msgs[i].suffix_len);
+				errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
+/** Build a signed Accounting-Request
+ *
+ */
+static RADIUS_PACKET *packet_alloc(TALLOC_CTX *ctx, int id, char const *secret)
+{
+	RADIUS_PACKET	*packet;
+	uint8_t		*p;
+	int		len;
+
+	packet = fr_radius_alloc(ctx, false);
+	rad_assert(packet != NULL);
+
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	packet->id = id & 0xff;
+	packet->data = p = talloc_zero_array(packet, uint8_t, 4096);
+
+	/*
+	 *	As fr_radius_encode() leaves it.  Accounting-Request
+	 *	vectors start off as all zero, and there's no
+	 *	Message-Authenticator.
+	 */
+	memset(packet->vector, 0, sizeof(packet->vector));
+	packet->offset = 0;
+
+	p[0] = packet->code;
+	p[1] = packet->id;
+	memcpy(p + 4, packet->vector, sizeof(packet->vector));
+	p += RADIUS_HDR_LEN;
+
+	len = snprintf((char *)p + 2, 64, "user-%i@example.org", id);
+	p[0] = PW_USER_NAME;
+	p[1] = len + 2;
+	p += p[1];
+
+	len = snprintf((char *)p + 2, 64, "%08x", id);
+	p[0] = PW_ACCT_SESSION_ID;
+	p[1] = len + 2;
+	p += p[1];
+
+	p[0] = PW_ACCT_STATUS_TYPE;
+	p[1] = 6;
+	p[5] = 3;	/* Interim-Update */
+	p += p[1];
+
+	p[0] = PW_NAS_IP_ADDRESS;
+	p[1] = 6;
+	p[2] = 192;
+	p[3] = 0;
+	p[4] = 2;
+	p[5] = 1;
+	p += p[1];
+
+	packet->data_len = p - packet->data;
+	packet->data[2] = (packet->data_len >> 8) & 0xff;
+	packet->data[3] = packet->data_len & 0xff;
+
+	if (fr_radius_sign(packet, NULL, secret) < 0) {
+		fprintf(stderr, "FAIL: fr_radius_sign(): %s\n", fr_strerror());
+		exit(1);
+	}
+
+	return packet;
+}
+
+static double usec_since(struct timeval *start)
+{
+	struct timeval end, elapsed;
+
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, start);
+
+	return (elapsed.tv_sec * 1000000.0) + elapsed.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, j, rcode = 0;
+	uint64_t		i;
+	char			*secret;
+	char const		*secrets[MAX_MSGS];
+	RADIUS_PACKET		*packets[MAX_MSGS];
+	int			results[MAX_MSGS];
+	struct timeval		start;
+	double			single_usec, batch_usec;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "b:hn:s:x")) != EOF) switch (c) {
+		case 'b':
+			batch_size = atoi(optarg);
+			if ((batch_size <= 0) || (batch_size > MAX_MSGS)) usage();
+			break;
+
+		case 'n':
+			iterations = strtoull(optarg, NULL, 10);
+			break;
+
+		case 's':
+			secret_str = optarg;
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	printf("md5_mb: %u lanes\n", fr_md5_mb_lanes());
+
+	if (md5_mb_check() != 0) {
+		rcode = 1;
+		goto finish;
+	}
+
+	secret = talloc_typed_strdup(autofree, secret_str);
+	for (j = 0; j < batch_size; j++) {
+		packets[j] = packet_alloc(autofree, j, secret);
+		secrets[j] = secret;
+	}
+
+	/*
+	 *	One packet at a time
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < batch_size; j++) {
+			if (fr_radius_verify(packets[j], NULL, secret) < 0) {
+				fprintf(stderr, "FAIL: fr_radius_verify(): %s\n", fr_strerror());
+				rcode = 1;
+				goto finish;
+			}
+		}
+	}
+	single_usec = usec_since(&start);
+
+	/*
+	 *	Whole batch in one call
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if (fr_radius_verify_batch(results, packets, NULL, secrets, batch_size) != 0) {
+			fprintf(stderr, "FAIL: fr_radius_verify_batch(): %s\n", fr_strerror());
+			rcode = 1;
+			goto finish;
+		}
+	}
+	batch_usec = usec_since(&start);
+
+	/*
+	 *	Corrupt one packet, and check it's the only one
+	 *	which fails.
+	 */
+	packets[batch_size / 2]->vector[0] ^= 0xff;
+	if ((fr_radius_verify_batch(results, packets, NULL, secrets, batch_size) != 1) ||
+	    (results[batch_size / 2] != -1)) {
+		fprintf(stderr, "FAIL: fr_radius_verify_batch() didn't detect invalid Request-Authenticator\n");
+		rcode = 1;
+		goto finish;
+	}
+	if (debug_lvl) printf("corrupt packet: %s\n", fr_strerror());
+
+	printf("verify: %.2f Kpps -> %.2f Kpps batched (%.2fx)\n",
+	       (iterations * batch_size * 1000.0) / single_usec,
+	       (iterations * batch_size * 1000.0) / batch_usec,
+	       single_usec / batch_usec);
+
+finish:
+	talloc_free(autofree);
+
+	return rcode;
+}
@@ -0,0 +1,6 @@
+TARGET := md5_mb_test
+
+SOURCES		:= md5_mb_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,323 @@
+/*
+ * redis_slot_test.c	Benchmark for the Redis cluster key slot table
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "slot_table.h"
+#include "crc16.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_THREADS	64
+#define NUM_KEYS	1024
+
+typedef struct {
+	pthread_t		id;
+	int			num;
+	uint64_t		lookups;
+	uint64_t		torn;
+} reader_t;
+
+/** How readers are kept consistent with the writer
+ *
+ * The lock based modes are baselines for comparison, they copy the
+ * key slot out of a single table, which the writer modifies in place.
+ */
+typedef enum {
+	SLOT_TABLE_EPOCH = 0,			//!< fr_redis_slot_table_t.
+	SLOT_TABLE_MUTEX,			//!< Table protected by a mutex.
+	SLOT_TABLE_RWLOCK			//!< Table protected by a read/write lock.
+} slot_table_mode_t;
+
+static const FR_NAME_NUMBER slot_table_modes[] = {
+	{ "epoch",	SLOT_TABLE_EPOCH },
+	{ "mutex",	SLOT_TABLE_MUTEX },
+	{ "rwlock",	SLOT_TABLE_RWLOCK },
+	{ NULL, -1 }
+};
+
+static int			debug_lvl = 0;
+static slot_table_mode_t	mode = SLOT_TABLE_EPOCH;
+static int			num_readers = 4;
+static uint64_t			lookups = 10 * 1000 * 1000;
+static int			remap_delay = 0;
+
+static fr_redis_slot_table_t	*slot_table;
+static cluster_key_slot_t	locked_table[KEY_SLOTS];
+static pthread_mutex_t		table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t		table_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static char			keys[NUM_KEYS][32];
+static size_t			keys_len[NUM_KEYS];
+
+static volatile bool		done = false;
+static uint64_t			remaps = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: redis_slot_test [OPTS]\n");
+	fprintf(stderr, "  -l <mode>              How lookups are synchronised with remaps, one of\n");
+	fprintf(stderr, "                         epoch (default), or the mutex and rwlock baselines.\n");
+	fprintf(stderr, "  -n <lookups>           Number of lookups each reader should perform.\n");
+	fprintf(stderr, "  -r <usec>              Delay between remaps (default 0, remap continuously).\n");
+	fprintf(stderr, "  -t <threads>           Number of reader threads.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Copy the node mappings for a key slot out of the table being benchmarked
+ *
+ */
+static inline void slot_read(cluster_key_slot_t *out, uint16_t slot)
+{
+	switch (mode) {
+	case SLOT_TABLE_EPOCH:
+		fr_redis_slot_table_read(out, slot_table, slot);
+		break;
+
+	case SLOT_TABLE_MUTEX:
+		pthread_mutex_lock(&table_mutex);
+		memcpy(out, &locked_table[slot], sizeof(*out));
+		pthread_mutex_unlock(&table_mutex);
+		break;
+
+	case SLOT_TABLE_RWLOCK:
+		pthread_rwlock_rdlock(&table_rwlock);
+		memcpy(out, &locked_table[slot], sizeof(*out));
+		pthread_rwlock_unlock(&table_rwlock);
+		break;
+	}
+}
+
+/** Map every key slot to a single node, in the table being benchmarked
+ *
+ */
+static void slot_map(uint8_t node_id)
+{
+	cluster_key_slot_t	*table;
+	int			i;
+
+	switch (mode) {
+	case SLOT_TABLE_EPOCH:
+		table = fr_redis_slot_table_pending(slot_table);
+		break;
+
+	case SLOT_TABLE_MUTEX:
+		pthread_mutex_lock(&table_mutex);
+		table = locked_table;
+		break;
+
+	case SLOT_TABLE_RWLOCK:
+		pthread_rwlock_wrlock(&table_rwlock);
+		table = locked_table;
+		break;
+
+	default:
+		rad_assert(0);
+		return;
+	}
+
+	for (i = 0; i < KEY_SLOTS; i++) {
+		memset(table[i].slave, node_id, sizeof(table[i].slave));
+		table[i].slave_num = MAX_SLAVES;
+		table[i].master = node_id;
+	}
+
+	switch (mode) {
+	case SLOT_TABLE_EPOCH:
+		fr_redis_slot_table_publish(slot_table);
+		break;
+
+	case SLOT_TABLE_MUTEX:
+		pthread_mutex_unlock(&table_mutex);
+		break;
+
+	case SLOT_TABLE_RWLOCK:
+		pthread_rwlock_unlock(&table_rwlock);
+		break;
+	}
+}
+
+/** Lookup keys, checking we never see a partially applied map
+ *
+ */
+static void *reader_thread(void *arg)
+{
+	reader_t		*r = arg;
+	cluster_key_slot_t	key_slot;
+	uint64_t		i;
+	int			j;
+
+	for (i = 0; i < lookups; i++) {
+		size_t k = (i + r->num) & (NUM_KEYS - 1);
+
+		slot_read(&key_slot, fr_redis_key_slot((uint8_t const *)keys[k], keys_len[k]));
+
+		/*
+		 *	The writer sets every node ID in a map to the
+		 *	same value, so any mismatch means the table
+		 *	was modified while we were reading it.
+		 */
+		for (j = 0; j < MAX_SLAVES; j++) if (key_slot.slave[j] != key_slot.master) r->torn++;
+		if ((key_slot.master == 0) || (key_slot.slave_num != MAX_SLAVES)) r->torn++;
+	}
+	r->lookups = i;
+
+	return NULL;
+}
+
+/** Remap the cluster continuously until all the readers are done
+ *
+ */
+static void *writer_thread(UNUSED void *arg)
+{
+	uint8_t			node_id = 1;
+
+	while (!done) {
+		if (++node_id == 0) node_id = 1;	/* Node 0 is reserved */
+
+		slot_map(node_id);
+		remaps++;
+
+		if (remap_delay) usleep(remap_delay);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, rcode = 0;
+	reader_t		readers[MAX_THREADS];
+	pthread_t		writer;
+	struct timeval		start, end, elapsed;
+	uint64_t		total = 0, torn = 0;
+	double			usec;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hl:n:r:t:x")) != EOF) switch (c) {
+		case 'l':
+			c = fr_str2int(slot_table_modes, optarg, -1);
+			if (c < 0) usage();
+			mode = c;
+			break;
+
+		case 'n':
+			lookups = strtoull(optarg, NULL, 10);
+			break;
+
+		case 'r':
+			remap_delay = atoi(optarg);
+			break;
+
+		case 't':
+			num_readers = atoi(optarg);
+			if ((num_readers <= 0) || (num_readers > MAX_THREADS)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	slot_table = fr_redis_slot_table_alloc(autofree);
+	rad_assert(slot_table != NULL);
+
+	slot_map(1);
+
+	/*
+	 *	Keys look like the ones produced by
+	 *	rlm_redis_ippool.
+	 */
+	for (i = 0; i < NUM_KEYS; i++) {
+		keys_len[i] = snprintf(keys[i], sizeof(keys[i]), "{pool-%i}:device:%i", i & 0x0f, i);
+	}
+
+	/*
+	 *	CRC16 throughput on its own
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < 10 * 1000 * 1000; i++) {
+		total += fr_crc16_xmodem((uint8_t const *)keys[i & (NUM_KEYS - 1)], keys_len[i & (NUM_KEYS - 1)]);
+	}
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, &start);
+	usec = (elapsed.tv_sec * 1000000.0) + elapsed.tv_usec;
+	printf("crc16: %.2f ns/key (checksum %" PRIu64 ")\n", (usec * 1000.0) / (10 * 1000 * 1000), total);
+
+	if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+		fprintf(stderr, "Failed creating writer thread: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_readers; i++) {
+		memset(&readers[i], 0, sizeof(readers[i]));
+		readers[i].num = i;
+		if (pthread_create(&readers[i].id, NULL, reader_thread, &readers[i]) != 0) {
+			fprintf(stderr, "Failed creating reader thread: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+	}
+
+	total = 0;
+	for (i = 0; i < num_readers; i++) {
+		pthread_join(readers[i].id, NULL);
+		total += readers[i].lookups;
+		torn += readers[i].torn;
+		if (debug_lvl) printf("reader %i: %" PRIu64 " lookups\n", i, readers[i].lookups);
+	}
+	gettimeofday(&end, NULL);
+
+	done = true;
+	pthread_join(writer, NULL);
+
+	fr_timeval_subtract(&elapsed, &end, &start);
+	usec = (elapsed.tv_sec * 1000000.0) + elapsed.tv_usec;
+
+	printf("%s: %i readers, %" PRIu64 " lookups, %" PRIu64 " remaps in %.3fs\n",
+	       fr_int2str(slot_table_modes, mode, "<INVALID>"), num_readers, total, remaps, usec / 1000000.0);
+	printf("%.2f Mlookups/s, %.2f ns/lookup/thread\n",
+	       total / usec, (usec * 1000.0 * num_readers) / total);
+
+	if (torn) {
+		fprintf(stderr, "FAIL: %" PRIu64 " inconsistent lookups\n", torn);
+		rcode = 1;
+	}
+
+	talloc_free(autofree);
+
+	return rcode;
+}
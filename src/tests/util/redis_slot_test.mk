@@ -0,0 +1,8 @@
+TARGET := redis_slot_test
+
+SOURCES		:= redis_slot_test.c ../../modules/rlm_redis/slot_table.c ../../modules/rlm_redis/crc16.c
+
+SRC_INCDIRS	:= ${top_srcdir}/src/modules/rlm_redis
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,367 @@
+/*
+ * reload_test.c	Tests for reloading data sets in the background
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/reload.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_THREADS	64
+#define DATA_MAGIC	0x72656c6f6164ULL
+
+/** What the load callback builds from the data file
+ *
+ */
+typedef struct {
+	uint64_t		magic;		//!< Cleared when the data is freed.
+	uint64_t		value;		//!< Read from the file.
+	uint64_t		check;		//!< ~value.
+} reload_data_t;
+
+typedef struct {
+	pthread_t		id;
+	uint64_t		reads;
+	uint64_t		errors;
+} reader_t;
+
+static int			debug_lvl = 0;
+static int			num_readers = 4;
+static int			num_reloads = 100;
+static int			load_delay = 1000;
+
+static char			filename[] = "/tmp/reload_test.XXXXXX";
+static fr_reload_t		*reload;
+static volatile bool		done = false;
+static uint64_t			loads = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: reload_test [OPTS]\n");
+	fprintf(stderr, "  -d <usec>              How long each load takes (default 1000).\n");
+	fprintf(stderr, "  -n <reloads>           Number of reloads to trigger.\n");
+	fprintf(stderr, "  -t <threads>           Number of reader threads.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static int _data_free(reload_data_t *data)
+{
+	data->magic = 0;
+
+	return 0;
+}
+
+/** Read the number in the data file
+ *
+ */
+static int data_load(void **out, uint64_t *entries, UNUSED void *uctx)
+{
+	FILE		*fp;
+	reload_data_t	*data;
+	unsigned long long value;
+
+	fp = fopen(filename, "r");
+	if (!fp) return -1;
+	if (fscanf(fp, "%llu", &value) != 1) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	if (load_delay) usleep(load_delay);
+
+	data = talloc_zero(NULL, reload_data_t);
+	data->magic = DATA_MAGIC;
+	data->value = value;
+	data->check = ~data->value;
+	talloc_set_destructor(data, _data_free);
+
+	loads++;	/* Only written by the reload thread */
+
+	*out = data;
+	*entries = 1;
+
+	return 0;
+}
+
+static void data_write(uint64_t value)
+{
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed opening %s: %s\n", filename, fr_syserror(errno));
+		exit(1);
+	}
+	fprintf(fp, "%" PRIu64 "\n", value);
+	fclose(fp);
+}
+
+/** Wait for the current data to have a particular value
+ *
+ */
+static int data_wait(uint64_t value)
+{
+	int i;
+
+	for (i = 0; i < 5000; i++) {
+		reload_data_t const	*data;
+		unsigned int		ref;
+		uint64_t		current;
+
+		data = fr_reload_acquire(reload, &ref);
+		current = data->value;
+		fr_reload_release(reload, ref);
+
+		if (current == value) return 0;
+
+		usleep(1000);
+	}
+
+	fprintf(stderr, "FAIL: Timed out waiting for value %" PRIu64 "\n", value);
+
+	return -1;
+}
+
+/** Wait for the reload thread to count a number of reloads
+ *
+ * The data is published before the counters are updated.
+ */
+static void stats_wait(fr_reload_stats_t *stats, uint64_t reloads)
+{
+	int i;
+
+	for (i = 0; i < 5000; i++) {
+		fr_reload_stats(reload, stats);
+		if (stats->reloads >= reloads) return;
+
+		usleep(1000);
+	}
+}
+
+/** Read the data continuously, checking it's never freed, or goes backwards
+ *
+ */
+static void *reader_thread(void *arg)
+{
+	reader_t	*r = arg;
+	uint64_t	last = 0;
+
+	while (!done) {
+		reload_data_t const	*data;
+		unsigned int		ref;
+
+		data = fr_reload_acquire(reload, &ref);
+		if ((data->magic != DATA_MAGIC) || (data->check != ~data->value) || (data->value < last)) {
+			r->errors++;
+		}
+		last = data->value;
+		fr_reload_release(reload, ref);
+
+		r->reads++;
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, fd, rcode = 0;
+	reader_t		readers[MAX_THREADS];
+	fr_reload_stats_t	stats;
+	char const		*files[1] = { filename };
+	uint64_t		reads = 0, errors = 0, before;
+
+	fr_log_init(&default_log, false);
+
+	while ((c = getopt(argc, argv, "d:hn:t:x")) != EOF) switch (c) {
+		case 'd':
+			load_delay = atoi(optarg);
+			break;
+
+		case 'n':
+			num_reloads = atoi(optarg);
+			if (num_reloads <= 0) usage();
+			break;
+
+		case 't':
+			num_readers = atoi(optarg);
+			if ((num_readers <= 0) || (num_readers > MAX_THREADS)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			rad_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fd = mkstemp(filename);
+	if (fd < 0) {
+		fprintf(stderr, "Failed creating data file: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+	close(fd);
+	data_write(0);
+
+	/*
+	 *	Not checking the file, so there should be
+	 *	no reloads until we ask for one.
+	 */
+	reload = fr_reload_create(NULL, "reload_test", data_load, NULL, files, 1, 0);
+	if (!reload) {
+		fprintf(stderr, "Failed creating data set\n");
+		unlink(filename);
+		exit(1);
+	}
+
+	for (i = 0; i < num_readers; i++) {
+		memset(&readers[i], 0, sizeof(readers[i]));
+		if (pthread_create(&readers[i].id, NULL, reader_thread, &readers[i]) != 0) {
+			fprintf(stderr, "Failed creating reader thread: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+	}
+
+	data_write(1);
+	usleep(100 * 1000);
+	fr_reload_stats(reload, &stats);
+	if (stats.reloads != 0) {
+		fprintf(stderr, "FAIL: Data reloaded without being triggered\n");
+		rcode = 1;
+	}
+
+	/*
+	 *	Each trigger is waited for, so should
+	 *	result in exactly one reload.
+	 */
+	for (i = 1; i <= num_reloads; i++) {
+		data_write(i);
+		fr_reload_trigger(reload);
+		if (data_wait(i) < 0) {
+			rcode = 1;
+			break;
+		}
+	}
+
+	stats_wait(&stats, num_reloads);
+	if (stats.reloads != (uint64_t)num_reloads) {
+		fprintf(stderr, "FAIL: Expected %i reloads, got %" PRIu64 "\n", num_reloads, stats.reloads);
+		rcode = 1;
+	}
+
+	/*
+	 *	Triggers which arrive while a reload is in
+	 *	progress should be coalesced.
+	 */
+	before = stats.reloads;
+	data_write(num_reloads + 1);
+	for (i = 0; i < num_reloads; i++) fr_reload_trigger(reload);
+	if (data_wait(num_reloads + 1) < 0) rcode = 1;
+	usleep((load_delay * 4) + (100 * 1000));	/* Let the last coalesced reload finish */
+
+	fr_reload_stats(reload, &stats);
+	if (debug_lvl) printf("%i triggers, %" PRIu64 " reloads\n", num_reloads, stats.reloads - before);
+	if ((stats.reloads - before) >= (uint64_t)num_reloads) {
+		fprintf(stderr, "FAIL: %i triggers weren't coalesced, got %" PRIu64 " reloads\n",
+			num_reloads, stats.reloads - before);
+		rcode = 1;
+	}
+
+	/*
+	 *	A file which doesn't parse leaves the current
+	 *	data in place.
+	 */
+	before = stats.failed;
+	{
+		FILE *fp;
+
+		fp = fopen(filename, "w");
+		if (fp) fclose(fp);
+	}
+	fr_reload_trigger(reload);
+	for (i = 0; i < 5000; i++) {
+		fr_reload_stats(reload, &stats);
+		if (stats.failed > before) break;
+		usleep(1000);
+	}
+	if (stats.failed == before) {
+		fprintf(stderr, "FAIL: Reload of an empty file didn't fail\n");
+		rcode = 1;
+	}
+	if (data_wait(num_reloads + 1) < 0) rcode = 1;
+
+	done = true;
+	for (i = 0; i < num_readers; i++) {
+		pthread_join(readers[i].id, NULL);
+		reads += readers[i].reads;
+		errors += readers[i].errors;
+	}
+	talloc_free(reload);
+
+	/*
+	 *	Files changes are picked up when they're
+	 *	checked.
+	 */
+	data_write(1000);
+	reload = fr_reload_create(NULL, "reload_test", data_load, NULL, files, 1, 1);
+	if (!reload) {
+		fprintf(stderr, "Failed creating data set\n");
+		unlink(filename);
+		exit(1);
+	}
+	sleep(1);	/* mtime has a resolution of one second */
+	data_write(10000);
+	if (data_wait(10000) < 0) {
+		sleep(2);
+		if (data_wait(10000) < 0) {
+			fprintf(stderr, "FAIL: Changed file wasn't reloaded\n");
+			rcode = 1;
+		}
+	}
+	talloc_free(reload);
+
+	unlink(filename);
+
+	if (debug_lvl) printf("%i readers, %" PRIu64 " reads, %" PRIu64 " loads\n", num_readers, reads, loads);
+
+	if (errors) {
+		fprintf(stderr, "FAIL: %" PRIu64 " reads of freed or stale data\n", errors);
+		rcode = 1;
+	}
+
+	if (!rcode) printf("reload_test: OK\n");
+
+	return rcode;
+}
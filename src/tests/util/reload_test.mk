@@ -0,0 +1,7 @@
+TARGET := reload_test
+
+SOURCES		:= reload_test.c \
+		   ../../main/reload.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
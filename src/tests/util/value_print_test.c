@@ -0,0 +1,379 @@
+/*
+ * value_print_test.c	Tests and benchmark for printing and parsing values
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_OCTETS	256
+
+static int			debug_lvl = 0;
+static uint64_t			iterations = 1000 * 1000;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: value_print_test [OPTS]\n");
+	fprintf(stderr, "  -n <iterations>        Number of values to print and parse for each test.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static uint64_t random_uint64(void)
+{
+	uint64_t num = ((uint64_t) fr_rand() << 32) | fr_rand();
+
+	/*
+	 *	Otherwise nearly everything is 19 or 20 digits.
+	 */
+	return num >> (fr_rand() % 64);
+}
+
+/** The way fr_bin2hex used to convert octets
+ *
+ */
+static void bin2hex_scalar(char *hex, uint8_t const *bin, size_t inlen)
+{
+	static char const hextab[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < inlen; i++) {
+		hex[0] = hextab[((*bin) >> 4) & 0x0f];
+		hex[1] = hextab[*bin & 0x0f];
+		hex += 2;
+		bin++;
+	}
+	*hex = '\0';
+}
+
+/** The way fr_hex2bin used to convert hex digits
+ *
+ */
+static size_t hex2bin_memchr(uint8_t *bin, size_t outlen, char const *hex, size_t inlen)
+{
+	static char const hextab[] = "0123456789abcdef";
+	size_t i, len;
+	char *c1, *c2;
+
+	len = inlen >> 1;
+	if (len > outlen) len = outlen;
+
+	for (i = 0; i < len; i++) {
+		if (!(c1 = memchr(hextab, tolower((int) hex[i << 1]), sizeof(hextab))) ||
+		    !(c2 = memchr(hextab, tolower((int) hex[(i << 1) + 1]), sizeof(hextab)))) break;
+		bin[i] = ((c1 - hextab) << 4) + (c2 - hextab);
+	}
+
+	return i;
+}
+
+static int check_str(char const *what, char const *got, char const *expected)
+{
+	if (strcmp(got, expected) == 0) return 0;
+
+	fprintf(stderr, "FAIL: %s gave \"%s\", expected \"%s\"\n", what, got, expected);
+
+	return 1;
+}
+
+/** Compare the fast formatters and parsers against libc
+ *
+ */
+static int check_all(void)
+{
+	static uint64_t const	edges[] = { 0, 1, 9, 10, 99, 100, 999, 1000, 4294967295ULL, 4294967296ULL,
+					    9999999999999999999ULL, 10000000000000000000ULL, UINT64_MAX };
+	char			got[MAX_OCTETS * 2 + 1], expected[MAX_OCTETS * 2 + 1];
+	uint8_t			bin[MAX_OCTETS], bin2[MAX_OCTETS];
+	value_box_t		box;
+	int			errors = 0;
+	size_t			i, j;
+
+	for (i = 0; i < sizeof(edges) / sizeof(*edges); i++) {
+		fr_uint2dec(got, edges[i]);
+		snprintf(expected, sizeof(expected), "%" PRIu64, edges[i]);
+		errors += check_str("fr_uint2dec", got, expected);
+	}
+
+	for (i = 0; i < 100000; i++) {
+		uint64_t	num = random_uint64();
+		int32_t		snum = (int32_t) fr_rand();
+		struct in_addr	addr;
+		char		*end;
+
+		if (fr_uint2dec(got, num) != strlen(got)) errors++;
+		snprintf(expected, sizeof(expected), "%" PRIu64, num);
+		errors += check_str("fr_uint2dec", got, expected);
+
+		fr_sint2dec(got, snum);
+		snprintf(expected, sizeof(expected), "%d", snum);
+		errors += check_str("fr_sint2dec", got, expected);
+
+		snprintf(expected, sizeof(expected), "%u%s", (uint32_t) num, (i & 1) ? "" : " trailing");
+		if ((fr_strtoul(expected, &end) != (uint32_t) num) || (end != expected + strlen(expected) - ((i & 1) ? 0 : 9))) {
+			fprintf(stderr, "FAIL: fr_strtoul(\"%s\")\n", expected);
+			errors++;
+		}
+
+		addr.s_addr = fr_rand();
+		fr_inet_ntop4(got, &addr);
+		inet_ntop(AF_INET, &addr, expected, sizeof(expected));
+		errors += check_str("fr_inet_ntop4", got, expected);
+
+		memset(&box, 0, sizeof(box));
+		box.type = PW_TYPE_TIMEVAL;
+		box.datum.timeval.tv_sec = fr_rand();
+		box.datum.timeval.tv_usec = fr_rand() % 1000000;
+		value_box_snprint(got, sizeof(got), &box, '\0');
+		snprintf(expected, sizeof(expected), "%" PRIu64 ".%06" PRIu64,
+			 (uint64_t) box.datum.timeval.tv_sec, (uint64_t) box.datum.timeval.tv_usec);
+		errors += check_str("value_box_snprint(timeval)", got, expected);
+
+		/*
+		 *	Truncation must behave like snprintf.
+		 */
+		memset(&box, 0, sizeof(box));
+		box.type = PW_TYPE_INTEGER64;
+		box.datum.integer64 = num;
+		j = (fr_rand() % 22) + 1;
+		if (value_box_snprint(got, j, &box, '\0') != (size_t) snprintf(expected, j, "%" PRIu64, num)) {
+			fprintf(stderr, "FAIL: value_box_snprint(%" PRIu64 ") returned the wrong length\n", num);
+			errors++;
+		}
+		errors += check_str("value_box_snprint(integer64)", got, expected);
+	}
+
+	/*
+	 *	Twice, the second time comes from the cache.
+	 */
+	for (i = 0; i < 4; i++) {
+		struct tm	s_tm;
+		time_t		date = 1500000000 + (i / 2);
+
+		memset(&box, 0, sizeof(box));
+		box.type = PW_TYPE_DATE;
+		box.datum.date = date;
+		value_box_snprint(got, sizeof(got), &box, (i & 1) ? '"' : '\0');
+		j = strftime(expected + 1, sizeof(expected) - 2, "%b %e %Y %H:%M:%S %Z", localtime_r(&date, &s_tm));
+		if (i & 1) {
+			expected[0] = '"';
+			expected[j + 1] = '"';
+			expected[j + 2] = '\0';
+			errors += check_str("value_box_snprint(date)", got, expected);
+		} else {
+			errors += check_str("value_box_snprint(date)", got, expected + 1);
+		}
+	}
+
+	memset(&box, 0, sizeof(box));
+	box.type = PW_TYPE_ETHERNET;
+	memcpy(box.datum.ether, "\x00\x1a\x2b\xfc\xde\x0f", 6);
+	value_box_snprint(got, sizeof(got), &box, '\0');
+	errors += check_str("value_box_snprint(ethernet)", got, "00:1a:2b:fc:de:0f");
+
+	memset(&box, 0, sizeof(box));
+	box.type = PW_TYPE_IPV4_PREFIX;
+	box.datum.ipv4prefix[1] = 24;
+	memcpy(&box.datum.ipv4prefix[2], "\xc0\xa8\x64\x00", 4);
+	value_box_snprint(got, sizeof(got), &box, '\0');
+	errors += check_str("value_box_snprint(ipv4prefix)", got, "192.168.100.0/24");
+
+	for (i = 0; i < 10000; i++) {
+		size_t len = fr_rand() % MAX_OCTETS;
+
+		for (j = 0; j < len; j++) bin[j] = fr_rand();
+
+		fr_bin2hex(got, bin, len);
+		for (j = 0; j < len; j++) snprintf(expected + (j * 2), 3, "%02x", bin[j]);
+		expected[len * 2] = '\0';
+		errors += check_str("fr_bin2hex", got, expected);
+
+		/*
+		 *	Upper case decodes too.
+		 */
+		if (i & 1) for (j = 0; j < len * 2; j++) got[j] = toupper((int) got[j]);
+
+		if ((fr_hex2bin(bin2, sizeof(bin2), got, len * 2) != len) || (memcmp(bin, bin2, len) != 0)) {
+			fprintf(stderr, "FAIL: fr_hex2bin(\"%s\")\n", got);
+			errors++;
+		}
+
+		/*
+		 *	Decoding stops at the first bad digit.
+		 */
+		if (len) {
+			j = fr_rand() % (len * 2);
+			got[j] = "gG: \x80"[fr_rand() % 5];
+			if (fr_hex2bin(bin2, sizeof(bin2), got, len * 2) != (j / 2)) {
+				fprintf(stderr, "FAIL: fr_hex2bin didn't stop at bad digit %zu in \"%s\"\n", j, got);
+				errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
+static double usec_since(struct timeval *start)
+{
+	struct timeval end, elapsed;
+
+	gettimeofday(&end, NULL);
+	fr_timeval_subtract(&elapsed, &end, start);
+
+	return (elapsed.tv_sec * 1000000.0) + elapsed.tv_usec;
+}
+
+static void report(char const *name, double old_usec, double new_usec)
+{
+	printf("%-24s %7.1f ns -> %7.1f ns (%.2fx)\n", name,
+	       (old_usec * 1000.0) / iterations, (new_usec * 1000.0) / iterations, old_usec / new_usec);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	uint64_t		i;
+	char			out[MAX_OCTETS * 2 + 1];
+	uint8_t			octets[MAX_OCTETS];
+	struct in_addr		addr;
+	struct timeval		start;
+	double			old_usec, new_usec;
+	size_t			total = 0;
+	fr_ipaddr_t		ipaddr;
+	char			*end;
+
+	while ((c = getopt(argc, argv, "hn:x")) != EOF) switch (c) {
+		case 'n':
+			iterations = strtoull(optarg, NULL, 10);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (check_all() != 0) return 1;
+
+	/*
+	 *	Printing
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += snprintf(out, sizeof(out), "%u", (uint32_t) (i * 2654435761U));
+	old_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += fr_uint2dec(out, (uint32_t) (i * 2654435761U));
+	new_usec = usec_since(&start);
+	report("print integer", old_usec, new_usec);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += snprintf(out, sizeof(out), "%" PRIu64, (uint64_t) (i * 11400714819323198485ULL));
+	old_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += fr_uint2dec(out, (uint64_t) (i * 11400714819323198485ULL));
+	new_usec = usec_since(&start);
+	report("print integer64", old_usec, new_usec);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		addr.s_addr = i * 2654435761U;
+		inet_ntop(AF_INET, &addr, out, sizeof(out));
+		total += out[0];
+	}
+	old_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		addr.s_addr = i * 2654435761U;
+		total += fr_inet_ntop4(out, &addr);
+	}
+	new_usec = usec_since(&start);
+	report("print ipv4addr", old_usec, new_usec);
+
+	for (i = 0; i < sizeof(octets); i++) octets[i] = fr_rand();
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		bin2hex_scalar(out, octets, 64);
+		total += out[0];
+	}
+	old_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += fr_bin2hex(out, octets, 64);
+	new_usec = usec_since(&start);
+	report("print 64 octets", old_usec, new_usec);
+
+	/*
+	 *	Parsing
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += strtoul("3735928559", &end, 10);
+	old_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += fr_strtoul("3735928559", &end);
+	new_usec = usec_since(&start);
+	report("parse integer", old_usec, new_usec);
+
+	/*
+	 *	With hostname lookups on (the default), every address
+	 *	used to go through the resolver.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += fr_inet_hton(&ipaddr, AF_INET, "192.168.100.254", false);
+	old_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += fr_inet_pton4(&ipaddr, "192.168.100.254", -1, true, false, false);
+	new_usec = usec_since(&start);
+	report("parse ipv4addr", old_usec, new_usec);
+
+	fr_bin2hex(out, octets, 64);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += hex2bin_memchr(octets, sizeof(octets), out, 128);
+	old_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) total += fr_hex2bin(octets, sizeof(octets), out, 128);
+	new_usec = usec_since(&start);
+	report("parse 64 octets", old_usec, new_usec);
+
+	if (debug_lvl) printf("total %zu\n", total);
+
+	return 0;
+}
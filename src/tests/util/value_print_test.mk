@@ -0,0 +1,6 @@
+TARGET := value_print_test
+
+SOURCES		:= value_print_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)